@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../mfapi/file.h"
+#include "../mfapi/folder.h"
+#include "../mfapi/mfconn.h"
+#include "crawler.h"
+#include "hashtbl.h"
+
+/*
+ * The crawler retrieves the content of all folders in the tree whose content
+ * is not known yet so that later lookups do not have to wait for the remote.
+ *
+ * A number of worker threads, each with its own connection, take folder keys
+ * from a queue and retrieve their content. A single coordinator thread takes
+ * the results, applies them to the tree while holding the lock for writing
+ * and puts the subfolders that have to be retrieved next into the queue. The
+ * number of requests that are sent to the remote at the same time is thus
+ * bounded by the number of workers while the tree only ever has a single
+ * writer.
+ *
+ * The queue is a stack, so the tree is traversed depth first and the queue
+ * does not grow with the width of the tree as much as a breadth first
+ * traversal would.
+ *
+ * Folders whose content was retrieved before the revision of the tree
+ * changed are retrieved again. Once the queue is empty, the changes made
+ * remotely while the crawl ran are applied with a single device/get_changes
+ * so that the folders that were retrieved early are up to date as well.
+ */
+
+struct crawler_item {
+    char           *key;
+    /* the revision of the tree when the key was put into the queue */
+    uint64_t        revision;
+    mffolder      **folder_result;
+    mffile        **file_result;
+    int             retval;
+    struct crawler_item *next;
+};
+
+struct crawler {
+    folder_tree    *tree;
+    pthread_rwlock_t *lock;
+    mfconn         *conn;
+
+    /* protects all members below and is used together with cond to wake up
+     * the workers and the coordinator */
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+
+    struct crawler_item *queue;
+    struct crawler_item *results;
+    int             num_busy;
+    int             num_alive;
+    bool            stop;
+
+    pthread_t       coordinator;
+    pthread_t      *workers;
+    int             num_workers;
+};
+
+static void    *crawler_coordinator(void *user_ptr);
+static void    *crawler_worker(void *user_ptr);
+static void     crawler_enqueue(crawler * crawler, char **keys,
+                                uint64_t revision);
+static void     crawler_item_free(struct crawler_item *item);
+
+crawler        *crawler_start(folder_tree * tree, pthread_rwlock_t * lock,
+                              mfconn * conn, int num_workers)
+{
+    crawler        *crawler;
+    int             retval;
+
+    if (num_workers < 1)
+        return NULL;
+
+    crawler = (struct crawler *)calloc(1, sizeof(struct crawler));
+    if (crawler == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+
+    crawler->tree = tree;
+    crawler->lock = lock;
+    crawler->conn = conn;
+    crawler->num_workers = num_workers;
+    crawler->workers = (pthread_t *) calloc(num_workers, sizeof(pthread_t));
+    if (crawler->workers == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        free(crawler);
+        return NULL;
+    }
+    pthread_mutex_init(&(crawler->mutex), NULL);
+    pthread_cond_init(&(crawler->cond), NULL);
+
+    retval = pthread_create(&(crawler->coordinator), NULL,
+                            crawler_coordinator, crawler);
+    if (retval != 0) {
+        fprintf(stderr, "cannot start crawler thread\n");
+        pthread_cond_destroy(&(crawler->cond));
+        pthread_mutex_destroy(&(crawler->mutex));
+        free(crawler->workers);
+        free(crawler);
+        return NULL;
+    }
+
+    return crawler;
+}
+
+/*
+ * stop the crawler if it is still running and free it
+ *
+ * requests which are in flight are finished first but their results are
+ * discarded
+ */
+void crawler_stop(crawler * crawler)
+{
+    if (crawler == NULL)
+        return;
+
+    pthread_mutex_lock(&(crawler->mutex));
+    crawler->stop = true;
+    pthread_cond_broadcast(&(crawler->cond));
+    pthread_mutex_unlock(&(crawler->mutex));
+
+    pthread_join(crawler->coordinator, NULL);
+
+    pthread_cond_destroy(&(crawler->cond));
+    pthread_mutex_destroy(&(crawler->mutex));
+    free(crawler->workers);
+    free(crawler);
+}
+
+static void    *crawler_coordinator(void *user_ptr)
+{
+    crawler        *crawler;
+    struct crawler_item *results;
+    struct crawler_item *item;
+    char          **keys;
+    uint64_t        revision;
+    uint64_t        num_folders;
+    int             num_started;
+    int             i;
+    bool            drained;
+
+    crawler = (struct crawler *)user_ptr;
+
+    pthread_rwlock_rdlock(crawler->lock);
+    keys = folder_tree_get_outdated_folders(crawler->tree, NULL);
+    revision = folder_tree_get_revision(crawler->tree);
+    pthread_rwlock_unlock(crawler->lock);
+
+    if (keys == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&(crawler->mutex));
+    crawler_enqueue(crawler, keys, revision);
+    pthread_mutex_unlock(&(crawler->mutex));
+
+    num_started = 0;
+    for (i = 0; i < crawler->num_workers; i++) {
+        pthread_mutex_lock(&(crawler->mutex));
+        crawler->num_alive++;
+        pthread_mutex_unlock(&(crawler->mutex));
+        if (pthread_create(&(crawler->workers[num_started]), NULL,
+                           crawler_worker, crawler) != 0) {
+            fprintf(stderr, "cannot start crawler worker\n");
+            pthread_mutex_lock(&(crawler->mutex));
+            crawler->num_alive--;
+            pthread_mutex_unlock(&(crawler->mutex));
+            continue;
+        }
+        num_started++;
+    }
+
+    num_folders = 0;
+
+    pthread_mutex_lock(&(crawler->mutex));
+
+    for (;;) {
+        while (!crawler->stop && crawler->results == NULL
+               && crawler->num_alive > 0
+               && (crawler->queue != NULL || crawler->num_busy > 0)) {
+            pthread_cond_wait(&(crawler->cond), &(crawler->mutex));
+        }
+        if (crawler->stop || crawler->results == NULL)
+            break;
+
+        results = crawler->results;
+        crawler->results = NULL;
+        pthread_mutex_unlock(&(crawler->mutex));
+
+        pthread_rwlock_wrlock(crawler->lock);
+        revision = folder_tree_get_revision(crawler->tree);
+        for (item = results; item != NULL; item = item->next) {
+            if (item->retval != 0)
+                continue;
+            if (item->revision != revision) {
+                /* the content might have changed remotely after it was
+                 * retrieved, so retrieve it again if it is still needed */
+                folder_tree_free_content(item->folder_result,
+                                         item->file_result);
+                keys = (char **)calloc(2, sizeof(char *));
+                if (keys != NULL) {
+                    keys[0] = item->key;
+                    item->key = NULL;
+                }
+            } else {
+                folder_tree_set_content(crawler->tree, item->key,
+                                        item->folder_result,
+                                        item->file_result);
+                num_folders++;
+                keys = folder_tree_get_outdated_folders(crawler->tree,
+                                                        item->key);
+            }
+            item->folder_result = NULL;
+            item->file_result = NULL;
+            if (keys != NULL) {
+                pthread_mutex_lock(&(crawler->mutex));
+                crawler_enqueue(crawler, keys, revision);
+                pthread_mutex_unlock(&(crawler->mutex));
+            }
+        }
+        /* the crawled folders must not push the tree over its limit */
+        folder_tree_trim(crawler->tree);
+        pthread_rwlock_unlock(crawler->lock);
+
+        while (results != NULL) {
+            item = results;
+            results = item->next;
+            crawler_item_free(item);
+        }
+
+        pthread_mutex_lock(&(crawler->mutex));
+    }
+
+    if (!crawler->stop && crawler->num_alive == 0 && crawler->queue != NULL) {
+        fprintf(stderr, "crawler has no workers left\n");
+    }
+    drained = !crawler->stop && crawler->queue == NULL;
+
+    crawler->stop = true;
+    pthread_cond_broadcast(&(crawler->cond));
+    pthread_mutex_unlock(&(crawler->mutex));
+
+    for (i = 0; i < num_started; i++) {
+        pthread_join(crawler->workers[i], NULL);
+    }
+
+    /* now no other thread accesses the queue or the results anymore */
+    while (crawler->queue != NULL) {
+        item = crawler->queue;
+        crawler->queue = item->next;
+        crawler_item_free(item);
+    }
+    while (crawler->results != NULL) {
+        item = crawler->results;
+        crawler->results = item->next;
+        crawler_item_free(item);
+    }
+
+    fprintf(stderr, "crawler retrieved %" PRIu64 " folders\n", num_folders);
+
+    /* crawler_stop does not hold the lock, so it only waits for this */
+    if (drained) {
+        pthread_rwlock_wrlock(crawler->lock);
+        folder_tree_update(crawler->tree, crawler->conn, false);
+        pthread_rwlock_unlock(crawler->lock);
+    }
+
+    return NULL;
+}
+
+static void    *crawler_worker(void *user_ptr)
+{
+    crawler        *crawler;
+    struct crawler_item *item;
+    mfconn         *conn;
+
+    crawler = (struct crawler *)user_ptr;
+
+    /* the credentials of the connection never change, so they can be read
+     * without holding the lock on the tree */
+    conn = mfconn_clone(crawler->conn);
+    if (conn == NULL) {
+        fprintf(stderr, "crawler worker cannot connect\n");
+    }
+
+    pthread_mutex_lock(&(crawler->mutex));
+
+    while (conn != NULL && !crawler->stop) {
+        if (crawler->queue == NULL) {
+            pthread_cond_wait(&(crawler->cond), &(crawler->mutex));
+            continue;
+        }
+
+        item = crawler->queue;
+        crawler->queue = item->next;
+        crawler->num_busy++;
+        pthread_mutex_unlock(&(crawler->mutex));
+
+        item->retval = folder_tree_fetch_content(conn, item->key,
+                                                 &(item->folder_result),
+                                                 &(item->file_result));
+
+        pthread_mutex_lock(&(crawler->mutex));
+        item->next = crawler->results;
+        crawler->results = item;
+        crawler->num_busy--;
+        pthread_cond_broadcast(&(crawler->cond));
+    }
+
+    crawler->num_alive--;
+    pthread_cond_broadcast(&(crawler->cond));
+    pthread_mutex_unlock(&(crawler->mutex));
+
+    if (conn != NULL)
+        mfconn_destroy(conn);
+
+    return NULL;
+}
+
+/*
+ * put the keys of a NULL terminated array on top of the queue and free the
+ * array but not its elements
+ *
+ * the caller must hold the mutex
+ */
+static void crawler_enqueue(crawler * crawler, char **keys, uint64_t revision)
+{
+    struct crawler_item *item;
+    int             i;
+
+    for (i = 0; keys[i] != NULL; i++) {
+        item = (struct crawler_item *)calloc(1, sizeof(struct crawler_item));
+        if (item == NULL) {
+            fprintf(stderr, "calloc failed\n");
+            free(keys[i]);
+            continue;
+        }
+        item->key = keys[i];
+        item->revision = revision;
+        item->next = crawler->queue;
+        crawler->queue = item;
+    }
+    free(keys);
+
+    pthread_cond_broadcast(&(crawler->cond));
+}
+
+static void crawler_item_free(struct crawler_item *item)
+{
+    folder_tree_free_content(item->folder_result, item->file_result);
+    free(item->key);
+    free(item);
+}
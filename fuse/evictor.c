@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hashtbl.h"
+#include "evictor.h"
+
+/*
+ * The evictor keeps the file cache below a size limit while the filesystem
+ * is mounted.
+ *
+ * The tree counts the bytes that the cached files take on disk as they are
+ * retrieved, patched, truncated and removed and as partial files are closed.
+ * Whenever a file was opened, the evictor is notified and compares that
+ * count against the high watermark. Once it is exceeded, the least recently
+ * used files that are not open are removed until the cache is below the low
+ * watermark again, so that this does not happen on every open. In addition,
+ * the size of the cache is measured every interval seconds, which removes
+ * files as well if necessary and corrects the count if files were changed
+ * behind the back of the tree.
+ */
+
+struct evictor {
+    folder_tree    *tree;
+    /* the lock of the context which protects the tree */
+    pthread_rwlock_t *lock;
+    uint64_t        high;
+    uint64_t        low;
+    time_t          interval;
+
+    pthread_t       thread;
+    /* protects the members below and is used with cond to wake the thread */
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            notified;
+    bool            stop;
+};
+
+static void    *evictor_main(void *user_ptr);
+
+evictor        *evictor_start(folder_tree * tree, pthread_rwlock_t * lock,
+                              uint64_t high, uint64_t low, time_t interval)
+{
+    evictor        *evictor;
+    int             retval;
+
+    evictor = (struct evictor *)calloc(1, sizeof(struct evictor));
+    if (evictor == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+
+    evictor->tree = tree;
+    evictor->lock = lock;
+    evictor->high = high;
+    evictor->low = low;
+    evictor->interval = interval;
+    pthread_mutex_init(&(evictor->mutex), NULL);
+    pthread_cond_init(&(evictor->cond), NULL);
+
+    retval = pthread_create(&(evictor->thread), NULL, evictor_main, evictor);
+    if (retval != 0) {
+        fprintf(stderr, "cannot start evictor thread\n");
+        pthread_cond_destroy(&(evictor->cond));
+        pthread_mutex_destroy(&(evictor->mutex));
+        free(evictor);
+        return NULL;
+    }
+
+    return evictor;
+}
+
+/*
+ * make the evictor check the size of the cache because it might have grown
+ *
+ * this is cheap, so it can be called with the lock of the context held
+ */
+void evictor_notify(evictor * evictor)
+{
+    if (evictor == NULL)
+        return;
+
+    pthread_mutex_lock(&(evictor->mutex));
+    evictor->notified = true;
+    pthread_cond_signal(&(evictor->cond));
+    pthread_mutex_unlock(&(evictor->mutex));
+}
+
+/*
+ * stop the evictor and free it
+ *
+ * a removal which is in progress is finished first
+ */
+void evictor_stop(evictor * evictor)
+{
+    if (evictor == NULL)
+        return;
+
+    pthread_mutex_lock(&(evictor->mutex));
+    evictor->stop = true;
+    pthread_cond_signal(&(evictor->cond));
+    pthread_mutex_unlock(&(evictor->mutex));
+
+    pthread_join(evictor->thread, NULL);
+
+    pthread_cond_destroy(&(evictor->cond));
+    pthread_mutex_destroy(&(evictor->mutex));
+    free(evictor);
+}
+
+static void    *evictor_main(void *user_ptr)
+{
+    evictor        *evictor;
+    struct timespec deadline;
+    uint64_t        cache_size;
+    uint64_t        removed;
+    bool            measure;
+    int             retval;
+
+    evictor = (struct evictor *)user_ptr;
+
+    /* the cache is measured right away because files might have been added
+     * while the filesystem was not mounted */
+    measure = true;
+
+    pthread_mutex_lock(&(evictor->mutex));
+
+    while (!evictor->stop) {
+        if (!measure) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += evictor->interval;
+
+            retval = 0;
+            while (!evictor->stop && !evictor->notified
+                   && retval != ETIMEDOUT) {
+                retval = pthread_cond_timedwait(&(evictor->cond),
+                                                &(evictor->mutex),
+                                                &deadline);
+            }
+            if (evictor->stop)
+                break;
+            measure = retval == ETIMEDOUT;
+        }
+        evictor->notified = false;
+
+        pthread_mutex_unlock(&(evictor->mutex));
+
+        /* a notification only leads to a removal if the count exceeds the
+         * high watermark, which only needs the lock for reading */
+        if (!measure) {
+            pthread_rwlock_rdlock(evictor->lock);
+            cache_size = folder_tree_get_cache_size(evictor->tree);
+            pthread_rwlock_unlock(evictor->lock);
+            measure = cache_size > evictor->high;
+        }
+
+        if (measure) {
+            pthread_rwlock_wrlock(evictor->lock);
+            removed = folder_tree_evict_filecache(evictor->tree,
+                                                  evictor->high,
+                                                  evictor->low);
+            cache_size = folder_tree_get_cache_size(evictor->tree);
+            pthread_rwlock_unlock(evictor->lock);
+            if (removed > 0) {
+                fprintf(stderr, "removed %" PRIu64 " bytes from the file "
+                        "cache, %" PRIu64 " bytes left\n", removed,
+                        cache_size);
+            }
+            measure = false;
+        }
+
+        pthread_mutex_lock(&(evictor->mutex));
+    }
+
+    pthread_mutex_unlock(&(evictor->mutex));
+
+    return NULL;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __FUSE_EVICTOR_H__
+#define __FUSE_EVICTOR_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "hashtbl.h"
+
+typedef struct evictor evictor;
+
+evictor        *evictor_start(folder_tree * tree, pthread_rwlock_t * lock,
+                              uint64_t high, uint64_t low, time_t interval);
+
+void            evictor_notify(evictor * evictor);
+
+void            evictor_stop(evictor * evictor);
+
+#endif
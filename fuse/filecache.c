@@ -16,6 +16,8 @@
  *
  */
 
+#define _POSIX_C_SOURCE 200809L // for strdup, pread, pwrite and ftruncate
+
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -25,6 +27,9 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
 //#include <sys/types.h>
 #include <sys/stat.h>
 
@@ -41,11 +46,55 @@
 #include "../utils/http.h"
 #include "../utils/strings.h"
 #include "../utils/fsio.h"
+#include "filecache.h"
 
 #ifndef TRUE
 #define TRUE true
 #endif
 
+/* the size of the blocks in which partial cache files are retrieved */
+#define FILECACHE_BLOCK_SIZE 1048576
+
+struct filecache_part {
+    char           *partfile;
+    char           *blocksfile;
+    char           *cachefile;
+    uint64_t        fsize;
+    unsigned char   fhash[SHA256_DIGEST_LENGTH];
+    /* the partial file and the file with the bitmap, both opened for reading
+     * and writing */
+    int             fd;
+    int             blocks_fd;
+    /* one bit for every block that is set once the block was written */
+    unsigned char  *blocks;
+    uint64_t        num_blocks;
+    uint64_t        num_present;
+    /* marks the blocks which are being retrieved */
+    unsigned char  *fetching;
+    /* set once the file was verified and moved to cachefile and while its
+     * hash is calculated */
+    bool            complete;
+    bool            verifying;
+    /* the direct download link retrieved when the file was opened */
+    char           *url;
+    unsigned int    http_flags;
+    /*
+     * if the server ignores range requests, the whole file is streamed by a
+     * detached thread instead. While streaming is set, readers wait on cond
+     * for their blocks. stream_blocks is the number of blocks from the start
+     * that the stream has written and stream_stop aborts it */
+    bool            streaming;
+    bool            stream_stop;
+    uint64_t        stream_blocks;
+    /* the opener, every pending prefetch and the stream hold a reference.
+     * Once the opener gave up its reference, closed is set */
+    int             num_refs;
+    bool            closed;
+    /* protects the bitmaps and the state above */
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+};
+
 static int      get_file_size(const char *filepath)
 {
     struct stat st;
@@ -77,6 +126,16 @@ static int      filecache_patch_file(const char *filecache_path,
                                      const char *quickkey,
                                      uint64_t source_revision,
                                      uint64_t target_revision);
+static int      filecache_part_load(filecache_part * part, uint64_t first,
+                                    uint64_t last, bool wait);
+static int      filecache_part_fetch(filecache_part * part, uint64_t first,
+                                     uint64_t last);
+static void     filecache_part_mark(filecache_part * part, uint64_t first,
+                                    uint64_t end);
+static int      filecache_part_finish(filecache_part * part);
+static int      filecache_part_stream(filecache_part * part);
+static void    *filecache_part_stream_main(void *user_ptr);
+static int      filecache_part_streamed(void *user_ptr, uint64_t num_written);
 
 int filecache_upload_patch(const char *quickkey, uint64_t local_revision,
                            const char *filecache_path, mfconn * conn,
@@ -720,3 +779,548 @@ static int filecache_patch_file(const char *filecache_path,
 
     return 0;
 }
+
+/*
+ * Partial cache files
+ *
+ * A file which is only read does not have to be downloaded completely before
+ * it can be opened. Instead, its content is written to <key>_<revision>_part,
+ * which is created with the size of the file but without any data. The
+ * blocks that a read needs are retrieved with HTTP range requests against the
+ * direct download link when they are read for the first time. Which blocks
+ * are present is recorded in a bitmap in <key>_<revision>_blocks, so that
+ * they are kept across mounts.
+ *
+ * Blocks are retrieved without holding the mutex, so that reads of present
+ * blocks are not held up by the network. A second bitmap marks the blocks
+ * which are being retrieved and readers which need them wait on cond. Besides
+ * readers, blocks are retrieved ahead of time by filecache_part_prefetch.
+ *
+ * If the server does not support range requests, the whole file is streamed
+ * into the partial file by a thread of its own instead. Reads are answered
+ * as soon as the stream has written the blocks they need.
+ *
+ * Once all blocks are present, the hash of the whole file is checked and it
+ * is renamed to <key>_<revision>, where it is found like a file that was
+ * downloaded in one piece. If the hash does not match, all blocks are
+ * retrieved anew.
+ */
+
+static bool filecache_part_has_block(filecache_part * part, uint64_t block)
+{
+    return (part->blocks[block / 8] & (1U << (block % 8))) != 0;
+}
+
+static bool filecache_part_is_fetching(filecache_part * part, uint64_t block)
+{
+    return (part->fetching[block / 8] & (1U << (block % 8))) != 0;
+}
+
+filecache_part *filecache_part_open(const char *quickkey, uint64_t revision,
+                                    uint64_t fsize,
+                                    const unsigned char *fhash,
+                                    const char *filecache_path, mfconn * conn)
+{
+    filecache_part *part;
+    mffile         *file;
+    const char     *url;
+    struct stat     st;
+    size_t          blocks_size;
+    uint64_t        i;
+    int             retval;
+
+    /* the link is needed even if all blocks are present because their hash
+     * might not match */
+    file = file_alloc();
+    retval = mfconn_api_file_get_links(conn, file, (char *)quickkey,
+                                       MFCONN_FILE_LINK_TYPE_DIRECT_DOWNLOAD);
+    if (retval != 0) {
+        fprintf(stderr, "mfconn_api_file_get_links failed\n");
+        file_free(file);
+        return NULL;
+    }
+
+    url = file_get_direct_link(file);
+    if (url == NULL) {
+        fprintf(stderr, "file_get_direct_link failed\n");
+        file_free(file);
+        return NULL;
+    }
+
+    part = (filecache_part *) calloc(1, sizeof(filecache_part));
+    if (part == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        file_free(file);
+        return NULL;
+    }
+    pthread_mutex_init(&(part->mutex), NULL);
+    pthread_cond_init(&(part->cond), NULL);
+    part->num_refs = 1;
+    part->fd = -1;
+    part->blocks_fd = -1;
+    part->url = strdup(url);
+    file_free(file);
+
+    part->partfile = strdup_printf("%s/%s_%" PRIu64 "_part", filecache_path,
+                                   quickkey, revision);
+    part->blocksfile = strdup_printf("%s/%s_%" PRIu64 "_blocks",
+                                     filecache_path, quickkey, revision);
+    part->cachefile = strdup_printf("%s/%s_%" PRIu64, filecache_path,
+                                    quickkey, revision);
+    part->fsize = fsize;
+    memcpy(part->fhash, fhash, SHA256_DIGEST_LENGTH);
+    part->http_flags = mfconn_get_http_flags(conn);
+    part->num_blocks = (fsize + FILECACHE_BLOCK_SIZE - 1)
+        / FILECACHE_BLOCK_SIZE;
+    blocks_size = (part->num_blocks + 7) / 8;
+    /* one more byte so that empty files do not need special treatment */
+    part->blocks = (unsigned char *)calloc(blocks_size + 1, 1);
+    part->fetching = (unsigned char *)calloc(blocks_size + 1, 1);
+    if (part->blocks == NULL || part->fetching == NULL) {
+        fprintf(stderr, "cannot allocate partial file\n");
+        filecache_part_unref(part);
+        return NULL;
+    }
+
+    part->fd = open(part->partfile, O_RDWR | O_CREAT, 0644);
+    part->blocks_fd = open(part->blocksfile, O_RDWR | O_CREAT, 0644);
+    if (part->fd < 0 || part->blocks_fd < 0) {
+        fprintf(stderr, "cannot open %s\n", part->partfile);
+        filecache_part_unref(part);
+        return NULL;
+    }
+
+    /* the blocks of an earlier mount are only used if the partial file
+     * still has the right size */
+    if (fstat(part->fd, &st) != 0 || (uint64_t) st.st_size != fsize
+        || pread(part->blocks_fd, part->blocks, blocks_size, 0)
+        != (ssize_t) blocks_size) {
+        memset(part->blocks, 0, blocks_size);
+    }
+
+    if (ftruncate(part->fd, fsize) != 0
+        || ftruncate(part->blocks_fd, blocks_size) != 0
+        || pwrite(part->blocks_fd, part->blocks, blocks_size, 0)
+        != (ssize_t) blocks_size) {
+        fprintf(stderr, "cannot prepare %s\n", part->partfile);
+        filecache_part_unref(part);
+        return NULL;
+    }
+
+    for (i = 0; i < part->num_blocks; i++) {
+        if (filecache_part_has_block(part, i))
+            part->num_present++;
+    }
+
+    /* the hash of a file whose blocks are all present is checked by the
+     * first read instead of here, where the caller might hold locks while
+     * the whole file is read. Only empty files are never read */
+    if (part->num_blocks == 0) {
+        pthread_mutex_lock(&(part->mutex));
+        filecache_part_finish(part);
+        pthread_mutex_unlock(&(part->mutex));
+    }
+
+    return part;
+}
+
+/*
+ * read from the partial file like pread, retrieving the missing blocks
+ * first
+ *
+ * returns the number of bytes read or a negative error number
+ */
+int filecache_part_read(filecache_part * part, char *buf, size_t size,
+                        off_t offset)
+{
+    ssize_t         retval;
+
+    if (offset < 0)
+        return -EINVAL;
+    if ((uint64_t) offset >= part->fsize || size == 0)
+        return 0;
+    if (size > part->fsize - offset)
+        size = part->fsize - offset;
+
+    pthread_mutex_lock(&(part->mutex));
+    retval = filecache_part_load(part, offset / FILECACHE_BLOCK_SIZE,
+                                 (offset + size - 1) / FILECACHE_BLOCK_SIZE,
+                                 true);
+    pthread_mutex_unlock(&(part->mutex));
+    if (retval != 0)
+        return -EIO;
+
+    /* present blocks do not change, so they are read without the mutex */
+    retval = pread(part->fd, buf, size, offset);
+    if (retval < 0)
+        return -errno;
+
+    return retval;
+}
+
+/*
+ * retrieve the missing blocks of the given range of bytes ahead of a read
+ *
+ * blocks which are already being retrieved are skipped. Nothing is done
+ * once the partial file was closed or while it is streamed.
+ */
+int filecache_part_prefetch(filecache_part * part, uint64_t offset,
+                            uint64_t length)
+{
+    int             retval;
+
+    if (offset >= part->fsize || length == 0)
+        return 0;
+    if (length > part->fsize - offset)
+        length = part->fsize - offset;
+
+    pthread_mutex_lock(&(part->mutex));
+    retval = 0;
+    if (!part->closed && !part->streaming) {
+        retval = filecache_part_load(part, offset / FILECACHE_BLOCK_SIZE,
+                                     (offset + length - 1)
+                                     / FILECACHE_BLOCK_SIZE, false);
+    }
+    pthread_mutex_unlock(&(part->mutex));
+
+    return retval;
+}
+
+/*
+ * give up the reference of the opener. A stream is stopped and prefetching
+ * ends, but the partial file is only freed once the last reference is
+ * dropped. Its blocks stay on disk until all of them are present or the
+ * cache is cleaned up
+ */
+void filecache_part_close(filecache_part * part)
+{
+    if (part == NULL)
+        return;
+
+    pthread_mutex_lock(&(part->mutex));
+    part->closed = true;
+    part->stream_stop = true;
+    pthread_mutex_unlock(&(part->mutex));
+
+    filecache_part_unref(part);
+}
+
+void filecache_part_ref(filecache_part * part)
+{
+    pthread_mutex_lock(&(part->mutex));
+    part->num_refs++;
+    pthread_mutex_unlock(&(part->mutex));
+}
+
+void filecache_part_unref(filecache_part * part)
+{
+    int             num_refs;
+
+    pthread_mutex_lock(&(part->mutex));
+    part->num_refs--;
+    num_refs = part->num_refs;
+    pthread_mutex_unlock(&(part->mutex));
+
+    if (num_refs > 0)
+        return;
+
+    if (part->fd >= 0)
+        close(part->fd);
+    if (part->blocks_fd >= 0)
+        close(part->blocks_fd);
+    pthread_mutex_destroy(&(part->mutex));
+    pthread_cond_destroy(&(part->cond));
+    free(part->blocks);
+    free(part->fetching);
+    free(part->url);
+    free(part->partfile);
+    free(part->blocksfile);
+    free(part->cachefile);
+    free(part);
+}
+
+/*
+ * make the blocks from first to last present. A reader waits for blocks that
+ * are being retrieved or streamed, a prefetch skips them
+ *
+ * the mutex must be held. It is released while blocks are retrieved
+ */
+static int filecache_part_load(filecache_part * part, uint64_t first,
+                               uint64_t last, bool wait)
+{
+    uint64_t        block;
+    uint64_t        run_first;
+    uint64_t        i;
+    bool            waited_stream;
+    int             retval;
+
+    waited_stream = false;
+    block = first;
+    while (!part->complete && block <= last) {
+        if (filecache_part_has_block(part, block)) {
+            block++;
+            continue;
+        }
+        if (part->streaming || filecache_part_is_fetching(part, block)) {
+            /* a prefetch has nothing to do while the file is streamed but
+             * goes on behind a block that is being retrieved */
+            if (!wait && part->streaming)
+                return 0;
+            if (!wait) {
+                block++;
+                continue;
+            }
+            waited_stream = part->streaming;
+            pthread_cond_wait(&(part->cond), &(part->mutex));
+            continue;
+        }
+        /* the stream ended without writing the block */
+        if (waited_stream)
+            return -1;
+
+        /* every run of missing blocks is retrieved with a single request */
+        run_first = block;
+        while (block < last && !filecache_part_has_block(part, block + 1)
+               && !filecache_part_is_fetching(part, block + 1))
+            block++;
+        for (i = run_first; i <= block; i++)
+            part->fetching[i / 8] |= 1U << (i % 8);
+
+        pthread_mutex_unlock(&(part->mutex));
+        retval = filecache_part_fetch(part, run_first, block);
+        pthread_mutex_lock(&(part->mutex));
+
+        for (i = run_first; i <= block; i++)
+            part->fetching[i / 8] &= ~(1U << (i % 8));
+        if (retval == 0)
+            filecache_part_mark(part, run_first, block + 1);
+        pthread_cond_broadcast(&(part->cond));
+
+        if (retval == 1 && (part->streaming
+                            || filecache_part_stream(part) == 0)) {
+            if (!wait)
+                return 0;
+            block = run_first;
+            continue;
+        }
+        if (retval != 0)
+            return -1;
+        block++;
+    }
+
+    /* the blocks just read do not belong to the file if its hash does not
+     * match */
+    if (!part->complete && part->num_present == part->num_blocks)
+        return filecache_part_finish(part);
+
+    return 0;
+}
+
+/*
+ * retrieve the blocks from first to last. Returns 1 if the server does not
+ * support range requests
+ *
+ * the mutex must not be held and the blocks must be marked as being
+ * retrieved, so that nobody else writes them
+ */
+static int filecache_part_fetch(filecache_part * part, uint64_t first,
+                                uint64_t last)
+{
+    mfhttp         *http;
+    uint64_t        offset;
+    uint64_t        end;
+    int             retval;
+
+    offset = first * FILECACHE_BLOCK_SIZE;
+    end = (last + 1) * FILECACHE_BLOCK_SIZE;
+    if (end > part->fsize)
+        end = part->fsize;
+
+    /* mediafire does not support keep-alive, so handles are not reused */
+    http = http_create();
+    if (http == NULL) {
+        fprintf(stderr, "http_create failed\n");
+        return -1;
+    }
+    http_set_connect_flags(http, part->http_flags);
+    retval = http_get_range(http, part->url, part->fd, offset, end - offset);
+    http_destroy(http);
+
+    if (retval == 1)
+        return 1;
+    if (retval != 0) {
+        fprintf(stderr, "retrieving blocks %" PRIu64 " to %" PRIu64
+                " of %s failed\n", first, last, part->partfile);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * mark the blocks from first up to but not including end as present and
+ * write the changed part of the bitmap
+ *
+ * the data is not synced before the bitmap is written because the hash of
+ * the whole file is checked anyways. The mutex must be held
+ */
+static void filecache_part_mark(filecache_part * part, uint64_t first,
+                                uint64_t end)
+{
+    uint64_t        block;
+    size_t          len;
+
+    if (first >= end)
+        return;
+
+    for (block = first; block < end; block++) {
+        if (!filecache_part_has_block(part, block)) {
+            part->blocks[block / 8] |= 1U << (block % 8);
+            part->num_present++;
+        }
+    }
+
+    len = (end - 1) / 8 - first / 8 + 1;
+    if (pwrite(part->blocks_fd, part->blocks + first / 8, len, first / 8)
+        != (ssize_t) len) {
+        fprintf(stderr, "cannot write %s\n", part->blocksfile);
+    }
+}
+
+/*
+ * check the hash of the complete file and move it to where complete cache
+ * files are found. If the hash does not match, all blocks are retrieved
+ * anew
+ *
+ * the mutex must be held. It is released while the hash is calculated, so
+ * that the present blocks can still be read
+ */
+static int filecache_part_finish(filecache_part * part)
+{
+    size_t          blocks_size;
+    int             retval;
+
+    /* another thread is at it already */
+    if (part->verifying)
+        return 0;
+
+    part->verifying = true;
+    pthread_mutex_unlock(&(part->mutex));
+    retval = file_check_integrity(part->partfile, part->fsize, part->fhash);
+    pthread_mutex_lock(&(part->mutex));
+    part->verifying = false;
+
+    if (retval != 0) {
+        fprintf(stderr, "%s has the wrong hash\n", part->partfile);
+        blocks_size = (part->num_blocks + 7) / 8;
+        memset(part->blocks, 0, blocks_size);
+        part->num_present = 0;
+        if (pwrite(part->blocks_fd, part->blocks, blocks_size, 0)
+            != (ssize_t) blocks_size) {
+            fprintf(stderr, "cannot write %s\n", part->blocksfile);
+        }
+        return -1;
+    }
+
+    if (rename(part->partfile, part->cachefile) != 0) {
+        perror("rename");
+        return -1;
+    }
+    unlink(part->blocksfile);
+    part->complete = true;
+
+    return 0;
+}
+
+/*
+ * start streaming the whole file
+ *
+ * the thread is never joined, so that whoever drops the last other
+ * reference does not wait for the network or for the hash of the file.
+ * Instead, the thread holds a reference of its own. The mutex must be held
+ */
+static int filecache_part_stream(filecache_part * part)
+{
+    pthread_t       thread;
+
+    part->streaming = true;
+    part->stream_blocks = 0;
+    part->num_refs++;
+    if (pthread_create(&thread, NULL, filecache_part_stream_main, part) != 0) {
+        fprintf(stderr, "cannot start streaming %s\n", part->partfile);
+        part->streaming = false;
+        part->num_refs--;
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+static void    *filecache_part_stream_main(void *user_ptr)
+{
+    filecache_part *part;
+    mfhttp         *http;
+    int             retval;
+
+    part = (filecache_part *) user_ptr;
+
+    http = http_create();
+    if (http == NULL) {
+        retval = -1;
+    } else {
+        http_set_connect_flags(http, part->http_flags);
+        retval = http_get_fd(http, part->url, part->fd,
+                             filecache_part_streamed, part);
+        http_destroy(http);
+    }
+
+    pthread_mutex_lock(&(part->mutex));
+    if (retval != 0) {
+        fprintf(stderr, "streaming %s failed\n", part->partfile);
+    } else if (!part->complete && part->num_present == part->num_blocks) {
+        filecache_part_finish(part);
+    }
+    part->streaming = false;
+    pthread_cond_broadcast(&(part->cond));
+    pthread_mutex_unlock(&(part->mutex));
+
+    filecache_part_unref(part);
+
+    return NULL;
+}
+
+/*
+ * mark the blocks that the stream has written completely and wake up the
+ * readers waiting for them
+ *
+ * this is also called while the stream waits for data, so that closing the
+ * file aborts a stalled stream
+ */
+static int filecache_part_streamed(void *user_ptr, uint64_t num_written)
+{
+    filecache_part *part;
+    uint64_t        end;
+    int             retval;
+
+    part = (filecache_part *) user_ptr;
+
+    pthread_mutex_lock(&(part->mutex));
+
+    if (num_written >= part->fsize)
+        end = part->num_blocks;
+    else
+        end = num_written / FILECACHE_BLOCK_SIZE;
+
+    if (end > part->stream_blocks) {
+        filecache_part_mark(part, part->stream_blocks, end);
+        part->stream_blocks = end;
+        pthread_cond_broadcast(&(part->cond));
+    }
+
+    retval = part->stream_stop ? -1 : 0;
+
+    pthread_mutex_unlock(&(part->mutex));
+
+    return retval;
+}
@@ -19,6 +19,8 @@
 #ifndef __FUSE_FILECACHE_H__
 #define __FUSE_FILECACHE_H__
 
+typedef struct filecache_part filecache_part;
+
 int             filecache_open_file(const char *quickkey,
                                     uint64_t local_revision,
                                     uint64_t remote_revision, uint64_t fsize,
@@ -37,4 +39,22 @@ int             filecache_upload_patch(const char *quickkey,
 				       const char *filename,
 				       const char *folder_key);
 
+filecache_part *filecache_part_open(const char *quickkey, uint64_t revision,
+                                    uint64_t fsize,
+                                    const unsigned char *fhash,
+                                    const char *filecache_path,
+                                    mfconn * conn);
+
+int             filecache_part_read(filecache_part * part, char *buf,
+                                    size_t size, off_t offset);
+
+int             filecache_part_prefetch(filecache_part * part,
+                                        uint64_t offset, uint64_t length);
+
+void            filecache_part_close(filecache_part * part);
+
+void            filecache_part_ref(filecache_part * part);
+
+void            filecache_part_unref(filecache_part * part);
+
 #endif
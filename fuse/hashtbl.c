@@ -38,8 +38,11 @@
 #include <openssl/sha.h>
 #include <dirent.h>
 #include <ctype.h>
+#include <fnmatch.h>
 #include <time.h>
 #include <libgen.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include "hashtbl.h"
 #include "filecache.h"
@@ -49,13 +52,61 @@
 #include "../mfapi/apicalls.h"
 #include "../utils/strings.h"
 #include "../utils/hash.h"
+#include "../utils/slab.h"
+#include "../utils/strpool.h"
+#include "../utils/trigram.h"
+#include "../utils/manifest.h"
 
 /*
- * we build a hashtable using the first three characters of the file or folder
- * key. Since the folder key is encoded in base 36 (10 digits and 26 letters),
- * this means that the resulting hashtable has to have 36^3=46656 buckets.
+ * the table of keys is grown once more than KEYS_MAX_LOAD_NUM /
+ * KEYS_MAX_LOAD_DEN of its slots would be used
  */
-#define NUM_BUCKETS 46656
+#define KEYS_MAX_LOAD_NUM 7
+#define KEYS_MAX_LOAD_DEN 8
+
+/*
+ * number of slots of the cache of resolved paths. This must be a power of two
+ * so that the slot of a path can be found by masking its hash
+ */
+#define DCACHE_SIZE 4096
+
+/*
+ * number of slots of the cache of paths that were found not to exist and
+ * the longest name that is stored in them (including the terminating zero)
+ */
+#define NCACHE_SIZE 1024
+#define NCACHE_NAME_SIZE 40
+
+/*
+ * number of h_entry structs allocated at once by the slab allocator
+ */
+#define ENTRIES_PER_CHUNK 1024
+
+/*
+ * when applying remote changes, the content of a folder is retrieved with
+ * two requests instead of asking for the information of each changed file
+ * in it once more files than this changed
+ */
+#define FOLDER_TREE_REFETCH_THRESHOLD 2
+
+/*
+ * The information that is needed for every file and folder during path
+ * lookups and updates is kept in struct h_entry. The information which is
+ * only needed for files and only when they are accessed is kept in struct
+ * h_file which is referenced from the h_entry struct of the file. This way,
+ * folders do not carry the members that are only relevant for files and the
+ * members that are used in lookups are close together in memory.
+ */
+struct h_file {
+    /* SHA256 is 256 bits = 32 bytes */
+    unsigned char   hash[SHA256_DIGEST_LENGTH];
+    /*
+     * last access time to remove old locally cached files
+     * a file that has never been accessed has an atime of 1 */
+    uint64_t        atime;
+    /* file size */
+    uint64_t        fsize;
+};
 
 struct h_entry {
     /*
@@ -63,10 +114,20 @@ struct h_entry {
      * members are most likely 8-byte aligned anyways, it does not make sense
      * to differentiate between them */
     char            key[MFAPI_MAX_LEN_KEY + 1];
-    /* a filename is maximum 255 characters long */
-    char            name[MFAPI_MAX_LEN_NAME + 1];
-    /* we do not add the parent here because it is not used anywhere */
-    /* char parent[20]; */
+    /*
+     * the name is interned in the string pool of the folder_tree, so entries
+     * with the same name share the same memory. Entries loaded from a mapped
+     * dircache point into the mapping instead. It must only be changed
+     * through folder_tree_allocate_entry */
+    const char     *name;
+    /* the containing folder */
+    union {
+        /* during runtime this is a pointer to the containing h_entry struct */
+        struct h_entry *entry;
+        /* when storing on disk, this is the offset of the stored h_entry
+         * struct */
+        uint64_t        offs;
+    } parent;
     /* local revision */
     uint64_t        remote_revision;
     /* the revision of the local version. For folders, this is the last
@@ -76,239 +137,681 @@ struct h_entry {
     uint64_t        local_revision;
     /* creation time */
     uint64_t        ctime;
-    /* the containing folder */
-    union {
-        /* during runtime this is a pointer to the containing h_entry struct */
-        struct h_entry *entry;
-        /* when storing on disk, this is the offset of the stored h_entry
-         * struct */
-        uint64_t        offs;
-    } parent;
 
     /********************
      * only for folders *
      ********************/
-    /* number of children (number of files plus number of folders). Set to
-     * zero when storing on disk */
-    uint64_t        num_children;
     /*
-     * Array of pointers to its children. Set to zero when storing on disk.
+     * Array of pointers to its children.
      *
      * This member could also be an array of keys which would not require
      * lookups on updating but we expect more reads than writes so we
-     * sacrifice slower updates for faster lookups */
+     * sacrifice slower updates for faster lookups
+     *
+     * The array is kept ordered by the name of the children (in strcmp
+     * order) so that a child of a given name can be found using bisection.
+     * Because of this, the name of an entry must not be changed while it is
+     * referenced by the children array of its parent.
+     *
+     * The array is NULL while the children are paged out (see
+     * folder_tree_trim) but num_children keeps their number. */
     struct h_entry **children;
+    /* number of children (number of files plus number of folders) */
+    uint32_t        num_children;
+
+    /*
+     * position of this entry in the entries_by_index array of the
+     * folder_tree (for files and folders). The root has the index zero and
+     * the indices of all entries are dense. This member is placed here
+     * because it fills the space that num_children leaves until the next
+     * eight byte boundary. */
+    uint32_t        index;
 
     /******************
      * only for files *
      ******************/
-    /* SHA256 is 256 bits = 32 bytes */
+    /* NULL for folders, so this also tells whether this is a file or a
+     * folder */
+    struct h_file  *file;
+};
+
+/*
+ * The layout in which h_entry structs are stored on disk in version 0 of the
+ * storage format. This is the layout the h_entry struct had in memory when
+ * this format was introduced and thus must not be changed.
+ *
+ * For folders, atime is zero. For files, atime is never zero.
+ */
+struct h_entry_v0 {
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    char            name[MFAPI_MAX_LEN_NAME + 1];
+    uint64_t        remote_revision;
+    uint64_t        local_revision;
+    uint64_t        ctime;
+    uint64_t        parent;
+    /* the number of children and the pointer to them are meaningless on
+     * disk and stored as zero */
+    uint64_t        num_children;
+    uint64_t        children;
     unsigned char   hash[SHA256_DIGEST_LENGTH];
-    /*
-     * last access time to remove old locally cached files
-     * atime is also never zero for files
-     * a file that has never been accessed has an atime of 1 */
     uint64_t        atime;
-    /* file size */
     uint64_t        fsize;
 };
 
 /*
- * Each bucket is an array of pointers instead of an array of h_entry structs
- * so that the array can be changed without the memory location of the h_entry
- * struct changing because the children of each h_entry struct point to those
- * locations
+ * The header of version 1 of the storage format
  *
- * This also allows us to implement each bucket as a sorted list in the
- * future. Queries could then be done using bisection (O(log(n))) instead of
- * having to traverse all elements in the bucket (O(n)). But with 46656
- * buckets this should not make a performance difference often.
+ * All offsets are in bytes from the start of the file. See the description of
+ * the file layout above folder_tree_store for the meaning of the sections.
+ */
+struct folder_tree_header_v1 {
+    char            magic[4];
+    /* FOLDER_TREE_BYTE_ORDER as written by the machine that stored the file */
+    uint32_t        byte_order;
+    /* last seen device revision */
+    uint64_t        revision;
+    uint64_t        num_records;
+    uint64_t        num_links;
+    uint64_t        names_size;
+    uint64_t        records_offset;
+    uint64_t        links_offset;
+    uint64_t        names_offset;
+    uint64_t        file_size;
+};
+
+#define FOLDER_TREE_BYTE_ORDER 0x01020304
+
+/*
+ * The layout in which h_entry structs are stored on disk in version 1 of the
+ * storage format. All members are naturally aligned, so the struct has no
+ * padding and the records can be used directly from a mapping of the file.
+ *
+ * Instead of pointers, the record stores the index of the record of the
+ * parent, the index of the first link to its children and the offset of its
+ * name in the names section.
+ */
+struct h_entry_v1 {
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    uint64_t        name;
+    uint64_t        parent;
+    uint64_t        remote_revision;
+    uint64_t        local_revision;
+    uint64_t        ctime;
+    uint64_t        children;
+    uint32_t        num_children;
+    uint32_t        flags;
+    /* only for files */
+    uint64_t        atime;
+    uint64_t        fsize;
+    unsigned char   hash[SHA256_DIGEST_LENGTH];
+};
+
+/* flag of h_entry_v1 records of files */
+#define H_ENTRY_V1_FILE 0x1
+/* flag of h_entry_v1 records of folders whose children are paged out. Such
+ * a record has no links and its fsize member holds the number of children */
+#define H_ENTRY_V1_PAGED 0x2
+
+/*
+ * A record of the journal (see folder_tree_journal_open)
+ *
+ * Records of type JOURNAL_ENTRY carry the complete state of an entry and are
+ * followed by name_len bytes of its zero terminated name. Records of type
+ * JOURNAL_REMOVE, JOURNAL_CLEAR_CHILDREN and JOURNAL_PAGE_IN only use the key
+ * and records of type JOURNAL_REVISION only use remote_revision for the
+ * revision of the tree. Pages (see folder_tree_trim) use the same records.
+ *
+ * The checksum is calculated over the record with a checksum of zero followed
+ * by the name.
+ */
+struct journal_record {
+    uint32_t        type;
+    uint32_t        name_len;
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    char            parent[MFAPI_MAX_LEN_KEY + 1];
+    uint64_t        remote_revision;
+    uint64_t        local_revision;
+    uint64_t        ctime;
+    uint64_t        atime;
+    uint64_t        fsize;
+    unsigned char   hash[SHA256_DIGEST_LENGTH];
+    uint32_t        is_file;
+    uint32_t        checksum;
+};
+
+#define JOURNAL_ENTRY 1
+#define JOURNAL_REMOVE 2
+#define JOURNAL_CLEAR_CHILDREN 3
+#define JOURNAL_REVISION 4
+#define JOURNAL_PAGE_IN 5
+
+/*
+ * the folder whose content folder_tree_add_chunk adds to the tree as it
+ * arrives and the children that were added so far
+ */
+struct folder_tree_content {
+    folder_tree    *tree;
+    struct h_entry *entry;
+    struct h_entry **seen;
+    uint64_t        num_seen;
+};
+
+/*
+ * used to sort the folders by the time they were last used when paging out
+ */
+struct folder_tree_candidate {
+    struct h_entry *entry;
+    uint32_t        stamp;
+};
+
+/*
+ * A slot of the table of keys
+ *
+ * The table maps the keys of all entries except the root to the entries. It
+ * is an open addressing hashtable of the full key using Robin Hood hashing:
+ * when inserting, an entry takes the slot of an entry which is closer to its
+ * own home slot and that entry moves on instead. This keeps the distances of
+ * all entries from their home slots short, so that a lookup can stop as soon
+ * as it reaches a slot whose entry is closer to its home slot than the key
+ * looked up would be. Removal shifts the following entries back by one slot,
+ * so no tombstones are needed.
+ *
+ * Instead of a pointer to the entry, a slot stores its index and 32 bits of
+ * the hash of its key. This keeps the slots small and most mismatches are
+ * found without accessing the entry. Since the root is not part of the table,
+ * a slot with an index of zero is unused.
+ */
+struct key_slot {
+    uint32_t        hash;
+    uint32_t        index;
+};
+
+/*
+ * A slot of the cache of resolved paths (the dentry cache)
+ *
+ * Only the hash of the path is stored and not the path itself. On a hit, the
+ * path is compared against the names of the entry and its parents instead.
+ * This way, the cache does not need to allocate any memory.
+ *
+ * A slot with an entry of NULL is unused.
+ */
+struct dcache_slot {
+    uint64_t        hash;
+    struct h_entry *entry;
+};
+
+/*
+ * A slot of the cache of paths that were found not to exist (the negative
+ * dentry cache)
+ *
+ * The entry of the folder that did not contain the name and its revision at
+ * that time are stored together with the name itself. On a hit, the path up
+ * to the name is verified against the folder like for the dcache, so a hit is
+ * only valid while the folder was not updated. Names that do not fit are not
+ * cached. Tools mostly probe for short names like .git or desktop.ini.
+ *
+ * A slot with a parent of NULL is unused.
+ */
+struct ncache_slot {
+    uint64_t        hash;
+    struct h_entry *parent;
+    uint64_t        revision;
+    char            name[NCACHE_NAME_SIZE];
+};
+
+/*
+ * A partial cache file that is open (see filecache.c) together with the
+ * number of file handles that read from it, so that all of them share the
+ * blocks that were retrieved
+ */
+struct open_part {
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    uint64_t        revision;
+    int             num_opens;
+    filecache_part *part;
+    /* the bytes it took on disk when the size of the cache was last
+     * updated for it, because reads add blocks without the tree knowing */
+    uint64_t        size;
+};
+
+/*
+ * A file whose cached content is open together with the number of file
+ * handles. Its cached content is not removed by folder_tree_evict_filecache
  */
+struct open_file {
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    int             num_opens;
+};
 
 struct folder_tree {
     uint64_t        revision;
     char           *filecache;
-    uint64_t        bucket_lens[NUM_BUCKETS];
-    struct h_entry **buckets[NUM_BUCKETS];
+    /* the table of keys with a capacity that is zero or a power of two */
+    struct key_slot *keys;
+    uint64_t        keys_capacity;
+    uint64_t        num_keys;
     struct h_entry  root;
+    /* all h_entry structs except the root are allocated from here */
+    slab           *entries;
+    /*
+     * all h_entry structs including the root by their index. When an entry
+     * is removed, the last entry takes its place, so the array never has
+     * holes and the index of an entry can be used to store it */
+    struct h_entry **entries_by_index;
+    uint64_t        num_entries;
+    /*
+     * the indices of the entries whose parent or children changed since the
+     * last call to folder_tree_housekeep. Indices can appear more than once.
+     * If more entries are marked than the tree has, the list is dropped and
+     * dirty_overflow makes the next call check all entries instead */
+    uint32_t       *dirty;
+    uint64_t        num_dirty;
+    uint64_t        dirty_capacity;
+    bool            dirty_overflow;
+    /* the h_file structs of all files are allocated from here */
+    slab           *files;
+    /* the names of all entries */
+    strpool        *names;
+    /*
+     * the dircache the tree was loaded from if it was mapped into memory.
+     * The names of the loaded entries point into it instead of the string
+     * pool */
+    char           *map;
+    size_t          map_size;
+    /* if not NULL, all changes are appended to this journal */
+    FILE           *journal;
+    /* the directory with the children of paged out folders, one file named
+     * by the key of the folder each. NULL if folders cannot be paged */
+    char           *pages;
+    /* number of bytes folder_tree_trim keeps the tree below or zero */
+    uint64_t        memory_limit;
+    /*
+     * the value of clock when the children of an entry were last used by
+     * index of the entry or NULL while there is no memory limit. Like the
+     * counters of the caches, it is protected by dcache_lock */
+    uint32_t       *stamps;
+    uint64_t        stamps_capacity;
+    uint32_t        clock;
+    /*
+     * the trigrams of the names of all entries except the root by the index
+     * of the entry or NULL without a search index (see folder_tree_find).
+     * The ids of old names and indices are never removed from it, so
+     * num_search_ids only counts the ids of the current ones */
+    trigram_index  *search;
+    uint64_t        num_search_ids;
+    /* the partial cache files of the files that are open for reading */
+    struct open_part *parts;
+    size_t          num_parts;
+    /* the files whose cached content is open */
+    struct open_file *open_files;
+    size_t          num_open_files;
+    /*
+     * the number of bytes that the complete and partial cache files take on
+     * disk. It is updated when files are retrieved, patched, truncated,
+     * removed or when a partial file is closed and measured anew by
+     * folder_tree_evict_filecache */
+    uint64_t        cache_size;
+    /* the cached files whose content was verified and the file the manifest
+     * is stored in, or NULL if files are verified every time (see
+     * folder_tree_manifest_open) */
+    manifest       *verified;
+    char           *verified_path;
+    /* while the remote cannot be reached, outdated folders are not
+     * retrieved but their last known content is used */
+    bool            offline;
+    /* direct mapped cache of the results of folder_tree_lookup_path */
+    struct dcache_slot dcache[DCACHE_SIZE];
+    /* number of used slots, so that invalidation of an empty cache is free */
+    uint64_t        dcache_used;
+    uint64_t        dcache_hits;
+    uint64_t        dcache_misses;
+    /*
+     * direct mapped cache of paths that folder_tree_lookup_path did not
+     * find. The slots of a folder are removed when an entry is added to it,
+     * moved into it or renamed in it and when the folder is freed. To make
+     * that cheap for folders without slots, ncache_folders has a bit set
+     * for every folder that has slots, at the position that
+     * folder_tree_ncache_bit gives */
+    struct ncache_slot ncache[NCACHE_SIZE];
+    uint64_t        ncache_folders[NCACHE_SIZE / 64];
+    uint64_t        ncache_used;
+    uint64_t        ncache_hits;
+    /*
+     * read only lookups (see folder_tree_getattr) may run concurrently, so
+     * the slots and counters of both caches they update are protected by
+     * this lock. Any
+     * other function is only called by a single thread at a time which
+     * excludes all readers, so it does not have to take the lock */
+    pthread_mutex_t dcache_lock;
 };
 
 /* static functions local to this file */
 
 /* functions without remote access */
 static void     folder_tree_free_entries(folder_tree * tree);
+static void     folder_tree_free_entry_data(folder_tree * tree,
+                                            struct h_entry *entry);
+static void     folder_tree_release_name(folder_tree * tree,
+                                         const char *name);
+static folder_tree *folder_tree_load_v0(FILE * stream, const char *filecache);
+static folder_tree *folder_tree_load_v1(FILE * stream, const char *filecache);
+static int      folder_tree_check_v1(struct folder_tree_header_v1 *header,
+                                     size_t size);
+static void     folder_tree_entry_to_v1(struct h_entry *entry,
+                                        uint64_t parent, uint64_t children,
+                                        uint64_t name,
+                                        struct h_entry_v1 *record);
+static int      folder_tree_entry_from_v0(folder_tree * tree,
+                                          struct h_entry_v0 *record,
+                                          struct h_entry *entry);
+static void     folder_tree_journal_entry(folder_tree * tree,
+                                          struct h_entry *entry);
+static void     folder_tree_record_from_entry(struct h_entry *entry,
+                                              struct journal_record *record);
+static int      folder_tree_entry_from_record(folder_tree * tree,
+                                              struct h_entry *entry,
+                                              struct journal_record *record);
+static void     folder_tree_journal_key(folder_tree * tree, uint32_t type,
+                                        const char *key);
+static void     folder_tree_journal_revision(folder_tree * tree);
+static uint32_t folder_tree_journal_checksum(uint32_t hash, const void *data,
+                                             size_t len);
+static void     folder_tree_journal_write(folder_tree * tree,
+                                          struct journal_record *record,
+                                          const char *name);
+static int      folder_tree_record_write(FILE * stream,
+                                         struct journal_record *record,
+                                         const char *name);
+static int      folder_tree_record_read(FILE * stream,
+                                        struct journal_record *record,
+                                        char *name);
+static void     folder_tree_journal_flush(folder_tree * tree);
+static int      folder_tree_journal_apply(folder_tree * tree,
+                                          struct journal_record *record,
+                                          const char *name);
+static long     folder_tree_journal_replay(folder_tree * tree, FILE * stream);
+static int      folder_tree_array_grow(struct h_entry ***array,
+                                       uint64_t len);
+static int      folder_tree_index_add(folder_tree * tree,
+                                      struct h_entry *entry);
+static uint32_t folder_tree_key_hash(const char *key);
+static struct h_entry *folder_tree_keys_find(folder_tree * tree,
+                                             const char *key,
+                                             uint64_t * slot);
+static int      folder_tree_keys_reserve(folder_tree * tree, uint64_t num);
+static int      folder_tree_keys_insert(folder_tree * tree,
+                                        struct h_entry *entry);
+static void     folder_tree_keys_remove(folder_tree * tree,
+                                        struct h_entry *entry);
+static void     folder_tree_mark_dirty(folder_tree * tree,
+                                       struct h_entry *entry);
+static void     folder_tree_index_remove(folder_tree * tree,
+                                         struct h_entry *entry);
 static struct h_entry *folder_tree_lookup_key(folder_tree * tree,
                                               const char *key);
 static bool     folder_tree_is_root(struct h_entry *entry);
+static int      folder_tree_set_name(folder_tree * tree,
+                                     struct h_entry *entry, const char *name);
 static struct h_entry *folder_tree_allocate_entry(folder_tree * tree,
                                                   const char *key,
+                                                  const char *name,
                                                   struct h_entry *new_parent);
+static int      folder_tree_name_cmp(const char *component, size_t len,
+                                     const char *name);
+static uint64_t folder_tree_children_bisect(struct h_entry *parent,
+                                            const char *name, size_t len);
+static struct h_entry *folder_tree_lookup_child(struct h_entry *parent,
+                                                const char *name, size_t len);
+static int      folder_tree_children_add(struct h_entry *parent,
+                                         struct h_entry *child);
+static bool     folder_tree_children_remove(struct h_entry *parent,
+                                            struct h_entry *child);
+static int      children_name_compare(const void *a, const void *b);
 static struct h_entry *folder_tree_add_file(folder_tree * tree, mffile * file,
                                             struct h_entry *new_parent);
 static struct h_entry *folder_tree_add_folder(folder_tree * tree,
                                               mffolder * folder,
                                               struct h_entry *new_parent);
 static void     folder_tree_remove(folder_tree * tree, const char *key);
+static void     folder_tree_remove_helper(folder_tree * tree,
+                                          const char *key);
+static uint64_t folder_tree_path_hash(const char *path);
+static bool     folder_tree_dcache_matches(folder_tree * tree,
+                                           struct h_entry *entry,
+                                           const char *path, size_t len);
+static struct h_entry *folder_tree_dcache_lookup(folder_tree * tree,
+                                                 const char *path,
+                                                 uint64_t hash);
+static void     folder_tree_dcache_insert(folder_tree * tree, uint64_t hash,
+                                          struct h_entry *entry);
+static void     folder_tree_dcache_invalidate(folder_tree * tree,
+                                              struct h_entry *entry);
+static void     folder_tree_dcache_clear(folder_tree * tree);
+static bool     folder_tree_ncache_lookup(folder_tree * tree,
+                                          const char *path, uint64_t hash);
+static void     folder_tree_ncache_insert(folder_tree * tree, uint64_t hash,
+                                          struct h_entry *parent,
+                                          const char *name);
+static uint64_t folder_tree_ncache_bit(struct h_entry *parent);
+static void     folder_tree_ncache_invalidate(folder_tree * tree,
+                                              struct h_entry *parent);
+static void     folder_tree_ncache_clear(folder_tree * tree);
 static bool     folder_tree_is_parent_of(struct h_entry *parent,
                                          struct h_entry *child);
+static bool     folder_tree_is_paged_out(struct h_entry *entry);
+static uint64_t folder_tree_resident_size(folder_tree * tree);
+static void     folder_tree_touch(folder_tree * tree, struct h_entry *entry);
+static int      stamp_compare(const void *a, const void *b);
+static bool     folder_tree_can_page_out(struct h_entry *entry,
+                                         const unsigned char *busy);
+static int      folder_tree_page_out(folder_tree * tree,
+                                     struct h_entry *entry);
+static int      folder_tree_page_in(folder_tree * tree,
+                                    struct h_entry *entry);
+static void     folder_tree_page_in_key(folder_tree * tree, const char *key);
+static void     folder_tree_pages_cleanup(folder_tree * tree);
+static bool     folder_tree_is_indexed(folder_tree * tree,
+                                       struct h_entry *entry);
+static void     folder_tree_search_add(folder_tree * tree,
+                                       struct h_entry *entry);
+static void     folder_tree_search_drop(folder_tree * tree,
+                                        struct h_entry *entry);
+static int      folder_tree_search_rebuild(folder_tree * tree);
+static void     folder_tree_search_compact(folder_tree * tree);
+static void     folder_tree_find_entry(struct h_entry *entry,
+                                       const char *pattern, FILE * stream);
+static void     folder_tree_find_pages(folder_tree * tree,
+                                       const char *pattern, FILE * stream);
+static void     folder_tree_print_path(struct h_entry *entry,
+                                       FILE * stream);
 static bool     is_valid_cache_filename(const char *name, char key[],
                                         uint64_t * revision);
+static bool     is_partial_cache_filename(const char *name, char key[],
+                                          uint64_t * revision);
+static bool     folder_tree_is_cached(folder_tree * tree,
+                                      struct h_entry *entry,
+                                      uint64_t revision);
+static filecache_part *folder_tree_open_part(folder_tree * tree,
+                                             mfconn * conn,
+                                             struct h_entry *entry);
+static uint64_t folder_tree_cached_size(folder_tree * tree,
+                                        const char *key, uint64_t revision);
+static void     folder_tree_cache_resize(folder_tree * tree,
+                                         uint64_t before, uint64_t after);
+static int      folder_tree_open_file_add(folder_tree * tree,
+                                          const char *key);
+static bool     folder_tree_is_open(folder_tree * tree, const char *key);
+static void     folder_tree_set_verified(folder_tree * tree,
+                                         struct h_entry *entry,
+                                         uint64_t revision);
+static void     folder_tree_unset_verified(folder_tree * tree,
+                                           const char *key,
+                                           uint64_t revision);
 static int      atime_compare(const void *a, const void *b);
 
 /* functions with remote access */
 static struct h_entry *folder_tree_lookup_path(folder_tree * tree,
                                                mfconn * conn,
                                                const char *path);
+static void     folder_tree_entry_stat(struct h_entry *entry,
+                                       struct stat *stbuf);
+static void     folder_tree_housekeep_children(folder_tree * tree,
+                                               mfconn * conn,
+                                               struct h_entry *entry);
+static void     folder_tree_housekeep_parent(folder_tree * tree,
+                                             mfconn * conn,
+                                             struct h_entry *entry);
+static void     folder_tree_apply_content(folder_tree * tree,
+                                          struct h_entry *curr_entry,
+                                          mffolder ** folder_result,
+                                          mffile ** file_result);
+static int      folder_tree_add_chunk(int chunk, mffolder ** folder_result,
+                                      mffile ** file_result, void *data);
+static void     folder_tree_keep_children(folder_tree * tree,
+                                          struct h_entry *curr_entry,
+                                          struct h_entry **seen,
+                                          uint64_t num_seen);
+static int      entry_pointer_compare(const void *a, const void *b);
 static int      folder_tree_rebuild_helper(folder_tree * tree, mfconn * conn,
                                            struct h_entry *curr_entry);
 static int      folder_tree_update_file_info(folder_tree * tree, mfconn * conn,
                                              const char *key);
 static int      folder_tree_update_folder_info(folder_tree * tree,
                                                mfconn * conn, const char *key);
+static int      folder_tree_changes_cmp_key(const void *a, const void *b);
+static int      folder_tree_changes_cmp_parent(const void *a, const void *b);
+static void     folder_tree_changes_dedupe(struct mfconn_device_change
+                                           *changes, uint64_t num_changes,
+                                           struct mfconn_device_change
+                                           **sorted, bool * skip);
+static void     folder_tree_update_files(folder_tree * tree, mfconn * conn,
+                                         struct mfconn_device_change
+                                         **changes, uint64_t num_changes);
 
 /* persistant storage file layout:
  *
  * byte 0: 0x4D -> ASCII M
  * byte 1: 0x46 -> ASCII F
  * byte 2: 0x53 -> ASCII S  --> MFS == MediaFire Storage
- * byte 3: 0x00 -> version information
- * bytes 4-11   -> last seen device revision
- * bytes 12-19  -> number of h_entry structs including root (num_hts)
- * bytes 20...  -> h_entry structs, the first one being root
+ * byte 3: 0x01 -> version information
+ * bytes 4...   -> the remainder of struct folder_tree_header_v1
+ *
+ * The header is followed by three sections at the offsets given in the
+ * header:
+ *
+ *  - the records: num_records h_entry_v1 structs, the first one being root
+ *  - the links: num_links record indices. The children of a record are the
+ *    num_children indices starting at the index given by its children
+ *    member, in the order of their names
+ *  - the names: names_size bytes of zero terminated names which the name
+ *    member of the records are offsets into
+ *
+ * All members are stored in the byte order of the machine that wrote the
+ * file. A file written in another byte order is rejected, which makes the
+ * caller rebuild the tree from the remote.
+ *
+ * Since the file only contains offsets and no pointers, it can be mapped
+ * into memory and used without parsing it first.
  *
- * the children pointer member of the h_entry struct is useless when stored,
- * should be set to zero and not used when reading the file
+ * Files of version 0 of this format are still read but never written. They
+ * start with "MFS\0" followed by the last seen device revision, the number
+ * of records including root and that many h_entry_v0 records.
  */
 
 int folder_tree_store(folder_tree * tree, FILE * stream)
 {
-
-    /* to allow a quick mapping from keys to their offsets in the array that
-     * will be stored, we create a hashtable of the same structure as the
-     * folder_tree but instead of storing pointers to h_entries in the buckets
-     * we store their integer offset. This way, when one known in which bucket
-     * and in which position in a bucket a h_entry struct is, one can retrieve
-     * the associated integer offset. */
-
-    uint64_t      **integer_buckets;
+    struct folder_tree_header_v1 header;
+    struct h_entry_v1 record;
+    struct h_entry *entry;
     uint64_t        i,
                     j,
-                    k,
-                    num_hts;
-    size_t          ret;
-    struct h_entry *tmp_parent;
-    int             bucket_id;
-    bool            found;
-
-    integer_buckets = (uint64_t **) malloc(NUM_BUCKETS * sizeof(uint64_t *));
-    if (integer_buckets == NULL) {
-        fprintf(stderr, "cannot malloc");
-        return -1;
+                    num_hts,
+                    num_links,
+                    names_size,
+                    index;
+
+    /* the records are stored in the order of the index of the entries, so
+     * the index of an entry is also the index of its record */
+    num_hts = tree->num_entries;
+
+    num_links = 0;
+    names_size = 0;
+    for (i = 0; i < num_hts; i++) {
+        entry = tree->entries_by_index[i];
+        if (!folder_tree_is_paged_out(entry))
+            num_links += entry->num_children;
+        names_size += strlen(entry->name) + 1;
     }
 
-    /* start counting with one because the root is also stored */
-    num_hts = 1;
-    for (i = 0; i < NUM_BUCKETS; i++) {
-        if (tree->bucket_lens[i] == 0)
-            continue;
-
-        integer_buckets[i] =
-            (uint64_t *) malloc(tree->bucket_lens[i] * sizeof(uint64_t));
-        for (j = 0; j < tree->bucket_lens[i]; j++) {
-            integer_buckets[i][j] = num_hts;
-            num_hts++;
-        }
-    }
-
-    /* write four header bytes */
-    ret = fwrite("MFS\0", 1, 4, stream);
-    if (ret != 4) {
-        fprintf(stderr, "cannot fwrite\n");
-        return -1;
-    }
-
-    /* write revision */
-    ret = fwrite(&(tree->revision), sizeof(tree->revision), 1, stream);
-    if (ret != 1) {
-        fprintf(stderr, "cannot fwrite\n");
-        return -1;
-    }
-
-    /* write number of h_entries */
-    ret = fwrite(&num_hts, sizeof(num_hts), 1, stream);
-    if (ret != 1) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MFS\1", 4);
+    header.byte_order = FOLDER_TREE_BYTE_ORDER;
+    header.revision = tree->revision;
+    header.num_records = num_hts;
+    header.num_links = num_links;
+    header.names_size = names_size;
+    header.records_offset = sizeof(header);
+    header.links_offset = header.records_offset
+        + num_hts * sizeof(struct h_entry_v1);
+    header.names_offset = header.links_offset + num_links * sizeof(uint64_t);
+    header.file_size = header.names_offset + names_size;
+
+    if (fwrite(&header, sizeof(header), 1, stream) != 1) {
         fprintf(stderr, "cannot fwrite\n");
         return -1;
     }
 
-    /* write the root */
-    ret = fwrite(&(tree->root), sizeof(struct h_entry), 1, stream);
-    if (ret != 1) {
-        fprintf(stderr, "cannot fwrite\n");
-        return -1;
+    /* write the records with the index of their parent, their first link
+     * and their name */
+    num_links = 0;
+    names_size = 0;
+    for (i = 0; i < num_hts; i++) {
+        entry = tree->entries_by_index[i];
+        folder_tree_entry_to_v1(entry, i == 0 ? 0 : entry->parent.entry->index,
+                                num_links, names_size, &record);
+        if (fwrite(&record, sizeof(record), 1, stream) != 1) {
+            fprintf(stderr, "cannot fwrite\n");
+            return -1;
+        }
+        num_links += record.num_children;
+        names_size += strlen(entry->name) + 1;
     }
 
-    for (i = 0; i < NUM_BUCKETS; i++) {
-        if (tree->bucket_lens[i] == 0)
+    /* write the links in the order in which the children are kept */
+    for (i = 0; i < num_hts; i++) {
+        entry = tree->entries_by_index[i];
+        if (folder_tree_is_paged_out(entry))
             continue;
-
-        for (j = 0; j < tree->bucket_lens[i]; j++) {
-            /* save the old value of the parent to restore it later */
-            tmp_parent = tree->buckets[i][j]->parent.entry;
-            if (tmp_parent == &(tree->root)) {
-                tree->buckets[i][j]->parent.offs = 0;
-            } else {
-                bucket_id = base36_decode_triplet(tmp_parent->key);
-                found = false;
-                for (k = 0; k < tree->bucket_lens[bucket_id]; k++) {
-                    if (tree->buckets[bucket_id][k] == tmp_parent) {
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
-                    fprintf(stderr, "parent of %s was not found!\n",
-                            tree->buckets[i][j]->key);
-                    return -1;
-                }
-                tree->buckets[i][j]->parent.offs =
-                    integer_buckets[bucket_id][k];
-            }
-
-            /* write out modified record */
-            ret =
-                fwrite(tree->buckets[i][j], sizeof(struct h_entry), 1, stream);
-            if (ret != 1) {
+        for (j = 0; j < entry->num_children; j++) {
+            index = entry->children[j]->index;
+            if (fwrite(&index, sizeof(index), 1, stream) != 1) {
                 fprintf(stderr, "cannot fwrite\n");
                 return -1;
             }
-
-            /* restore original value for parent */
-            tree->buckets[i][j]->parent.entry = tmp_parent;
         }
     }
 
-    for (i = 0; i < NUM_BUCKETS; i++) {
-        if (tree->bucket_lens[i] > 0) {
-            free(integer_buckets[i]);
+    /* write the names including their terminating zero */
+    for (i = 0; i < num_hts; i++) {
+        entry = tree->entries_by_index[i];
+        if (fwrite(entry->name, strlen(entry->name) + 1, 1, stream) != 1) {
+            fprintf(stderr, "cannot fwrite\n");
+            return -1;
         }
     }
-    free(integer_buckets);
 
     return 0;
 }
 
+/*
+ * the stream can be closed once the tree is loaded. Files of version 1 stay
+ * mapped into memory until the tree is destroyed, so they must not be
+ * modified in place while the tree exists. Replace them instead.
+ */
 folder_tree    *folder_tree_load(FILE * stream, const char *filecache)
 {
-    folder_tree    *tree;
     unsigned char   tmp_buffer[4];
     size_t          ret;
-    uint64_t        num_hts;
-    uint64_t        i;
-    struct h_entry **ordered_entries;
-    struct h_entry *tmp_entry;
-    struct h_entry *parent;
-    int             bucket_id;
 
     /* read and check the first four bytes */
     ret = fread(tmp_buffer, 1, 4, stream);
@@ -317,273 +820,2866 @@ folder_tree    *folder_tree_load(FILE * stream, const char *filecache)
         return NULL;
     }
 
-    if (tmp_buffer[0] != 'M' || tmp_buffer[1] != 'F'
-        || tmp_buffer[2] != 'S' || tmp_buffer[3] != 0) {
+    if (tmp_buffer[0] != 'M' || tmp_buffer[1] != 'F' || tmp_buffer[2] != 'S') {
         fprintf(stderr, "invalid magic\n");
         return NULL;
     }
 
-    tree = (folder_tree *) calloc(1, sizeof(folder_tree));
+    switch (tmp_buffer[3]) {
+        case 0:
+            return folder_tree_load_v0(stream, filecache);
+        case 1:
+            return folder_tree_load_v1(stream, filecache);
+        default:
+            fprintf(stderr, "unsupported version %d\n", tmp_buffer[3]);
+            return NULL;
+    }
+}
 
-    /* read revision */
-    ret = fread(&(tree->revision), sizeof(tree->revision), 1, stream);
-    if (ret != 1) {
-        fprintf(stderr, "cannot fread\n");
+/*
+ * load a file of version 1 of the storage format
+ *
+ * the file is mapped into memory and the names of the entries point into the
+ * mapping instead of being copied. The records contain everything to set up
+ * the h_entry structs including the order of the children, so nothing is
+ * sorted and every record and link is visited exactly once.
+ */
+static folder_tree *folder_tree_load_v1(FILE * stream, const char *filecache)
+{
+    folder_tree    *tree;
+    struct stat     file_info;
+    char           *map;
+    size_t          map_size;
+    struct folder_tree_header_v1 *header;
+    struct h_entry_v1 *records;
+    uint64_t       *links;
+    const char     *names;
+    struct h_entry **ordered_entries;
+    struct h_entry *entry;
+    uint64_t        i,
+                    j,
+                    capacity;
+
+    if (fstat(fileno(stream), &file_info) != 0) {
+        fprintf(stderr, "cannot fstat\n");
+        return NULL;
+    }
+    map_size = file_info.st_size;
+    if (map_size < sizeof(struct folder_tree_header_v1)) {
+        fprintf(stderr, "file too short\n");
         return NULL;
     }
 
-    /* read number of h_entries to read */
-    ret = fread(&num_hts, sizeof(num_hts), 1, stream);
-    if (ret != 1) {
-        fprintf(stderr, "cannot fread\n");
+    map = (char *)mmap(NULL, map_size, PROT_READ, MAP_PRIVATE,
+                       fileno(stream), 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "cannot mmap\n");
         return NULL;
     }
 
-    /* read root */
-    ret = fread(&(tree->root), sizeof(tree->root), 1, stream);
-    if (ret != 1) {
-        fprintf(stderr, "cannot fread\n");
+    header = (struct folder_tree_header_v1 *)map;
+    if (folder_tree_check_v1(header, map_size) != 0) {
+        munmap(map, map_size);
         return NULL;
     }
-    /* zero out its array of children just in case */
-    tree->root.num_children = 0;
-    tree->root.children = NULL;
 
-    /* to effectively map integer offsets to addresses we load the file into
-     * an array of pointers to h_entry structs and free that array after we're
-     * done with setting up the hashtable */
+    records = (struct h_entry_v1 *)(map + header->records_offset);
+    links = (uint64_t *) (map + header->links_offset);
+    names = map + header->names_offset;
 
-    /* populate the array of children */
-    ordered_entries =
-        (struct h_entry **)malloc(num_hts * sizeof(struct h_entry *));
+    tree = folder_tree_create(filecache);
+    if (tree == NULL) {
+        fprintf(stderr, "folder_tree_create failed\n");
+        munmap(map, map_size);
+        return NULL;
+    }
+    tree->map = map;
+    tree->map_size = map_size;
+    tree->revision = header->revision;
+
+    /* allocate all entries first so that the links can be resolved. The
+     * entries get the indices of their records, which makes entries_by_index
+     * map the indices in the file to the entries */
+    for (i = 1; i < header->num_records; i++) {
+        entry = (struct h_entry *)slab_alloc(tree->entries);
+        if (entry == NULL) {
+            fprintf(stderr, "slab_alloc failed\n");
+            goto error;
+        }
+        if (folder_tree_index_add(tree, entry) != 0) {
+            goto error;
+        }
+    }
+    ordered_entries = tree->entries_by_index;
+
+    for (i = 0; i < header->num_records; i++) {
+        entry = ordered_entries[i];
+
+        memcpy(entry->key, records[i].key, sizeof(entry->key));
+        entry->key[sizeof(entry->key) - 1] = '\0';
+        folder_tree_release_name(tree, entry->name);
+        entry->name = names + records[i].name;
+        entry->parent.entry = ordered_entries[records[i].parent];
+        entry->remote_revision = records[i].remote_revision;
+        entry->local_revision = records[i].local_revision;
+        entry->ctime = records[i].ctime;
+        if ((records[i].flags & H_ENTRY_V1_FILE) != 0) {
+            entry->file = (struct h_file *)slab_alloc(tree->files);
+            if (entry->file == NULL) {
+                fprintf(stderr, "slab_alloc failed\n");
+                goto error;
+            }
+            memcpy(entry->file->hash, records[i].hash,
+                   sizeof(entry->file->hash));
+            entry->file->atime = records[i].atime;
+            entry->file->fsize = records[i].fsize;
+        }
 
-    /* the first entry in this array points to the memory allocated for the
-     * root */
-    ordered_entries[0] = &(tree->root);
+        /* the children of paged out folders are not part of the file */
+        if (records[i].flags == H_ENTRY_V1_PAGED
+            && records[i].num_children == 0 && records[i].fsize > 0
+            && records[i].fsize <= UINT32_MAX) {
+            entry->num_children = records[i].fsize;
+            continue;
+        }
 
-    /* read the remaining entries one by one */
-    for (i = 1; i < num_hts; i++) {
-        tmp_entry = (struct h_entry *)malloc(sizeof(struct h_entry));
-        ret = fread(tmp_entry, sizeof(struct h_entry), 1, stream);
-        if (ret != 1) {
-            fprintf(stderr, "cannot fread\n");
-            return NULL;
+        /* the links are stored in the order of the names, so the children
+         * array can be filled as is. Its capacity must follow the rules of
+         * folder_tree_array_grow */
+        entry->num_children = records[i].num_children;
+        if (entry->num_children > 0) {
+            for (capacity = 1; capacity < entry->num_children; capacity *= 2) ;
+            entry->children = (struct h_entry **)
+                malloc(capacity * sizeof(struct h_entry *));
+            if (entry->children == NULL) {
+                fprintf(stderr, "cannot malloc\n");
+                goto error;
+            }
+            for (j = 0; j < entry->num_children; j++) {
+                entry->children[j] =
+                    ordered_entries[links[records[i].children + j]];
+            }
         }
-        /* zero out the array of children */
-        tmp_entry->num_children = 0;
-        tmp_entry->children = NULL;
-        /* store pointer to it in the array */
-        ordered_entries[i] = tmp_entry;
     }
+    tree->root.parent.entry = NULL;
 
-    /* turn the parent offset value into a pointer to the memory we allocated
-     * earlier, populate the array of children for each entry and sort them
-     * into the hashtable */
-    for (i = 1; i < num_hts; i++) {
+    /* build the table of keys at its final size */
+    if (folder_tree_keys_reserve(tree, header->num_records - 1) != 0) {
+        goto error;
+    }
+    for (i = 1; i < header->num_records; i++) {
+        if (folder_tree_keys_insert(tree, ordered_entries[i]) != 0) {
+            goto error;
+        }
+    }
+
+    return tree;
+
+  error:
+    /* this also unmaps the file */
+    folder_tree_destroy(tree);
+
+    return NULL;
+}
+
+/*
+ * check that the header and all offsets of a mapped file of version 1 of the
+ * storage format are within the file and that the records form a tree below
+ * the root, so that the file can be used without further checks
+ */
+static int folder_tree_check_v1(struct folder_tree_header_v1 *header,
+                                size_t size)
+{
+    struct h_entry_v1 *records;
+    uint64_t       *links;
+    const char     *names;
+    unsigned char  *seen;
+    uint64_t       *queue;
+    uint64_t        num_reached;
+    uint64_t        i,
+                    j,
+                    k,
+                    n;
+    int             retval;
+
+    if (header->byte_order != FOLDER_TREE_BYTE_ORDER) {
+        fprintf(stderr, "dircache was written in a different byte order\n");
+        return -1;
+    }
+
+    /* the sections must follow each other in this order and their sizes
+     * must not overflow */
+    if (header->file_size != size
+        || header->num_records == 0
+        || header->num_records > size / sizeof(struct h_entry_v1)
+        || header->num_links > size / sizeof(uint64_t)
+        || header->names_size == 0
+        || header->records_offset != sizeof(struct folder_tree_header_v1)
+        || header->links_offset != header->records_offset
+        + header->num_records * sizeof(struct h_entry_v1)
+        || header->names_offset != header->links_offset
+        + header->num_links * sizeof(uint64_t)
+        || header->names_offset + header->names_size != size) {
+        fprintf(stderr, "invalid dircache header\n");
+        return -1;
+    }
+
+    records = (struct h_entry_v1 *)((char *)header + header->records_offset);
+    links = (uint64_t *) ((char *)header + header->links_offset);
+    names = (char *)header + header->names_offset;
+
+    if (names[header->names_size - 1] != '\0') {
+        fprintf(stderr, "invalid dircache names\n");
+        return -1;
+    }
+
+    for (i = 0; i < header->num_records; i++) {
+        if (records[i].name >= header->names_size
+            || records[i].parent >= header->num_records
+            || records[i].children > header->num_links
+            || records[i].num_children >
+            header->num_links - records[i].children) {
+            fprintf(stderr, "invalid dircache record %" PRIu64 "\n", i);
+            return -1;
+        }
+    }
+
+    /* every entry but the root must be reached from the root through the
+     * links exactly once, so that no entry ends up in two children arrays
+     * and no chain of parents loops. The records are visited in the order
+     * they are reached */
+    seen = (unsigned char *)calloc(header->num_records, 1);
+    queue = (uint64_t *) malloc(header->num_records * sizeof(uint64_t));
+    if (seen == NULL || queue == NULL) {
+        fprintf(stderr, "cannot allocate\n");
+        free(seen);
+        free(queue);
+        return -1;
+    }
+    retval = 0;
+    queue[0] = 0;
+    num_reached = 1;
+    for (n = 0; n < num_reached && retval == 0; n++) {
+        i = queue[n];
+        for (j = 0; j < records[i].num_children; j++) {
+            k = links[records[i].children + j];
+            if (k == 0 || k >= header->num_records
+                || records[k].parent != i || seen[k] != 0) {
+                fprintf(stderr, "invalid dircache link %" PRIu64 "\n",
+                        records[i].children + j);
+                retval = -1;
+                break;
+            }
+            seen[k] = 1;
+            queue[num_reached++] = k;
+        }
+    }
+    if (retval == 0 && num_reached != header->num_records) {
+        fprintf(stderr, "%" PRIu64 " dircache records are not linked\n",
+                header->num_records - num_reached);
+        retval = -1;
+    }
+    free(seen);
+    free(queue);
+
+    return retval;
+}
+
+/*
+ * load a file of version 0 of the storage format
+ *
+ * the four bytes of the magic have already been read
+ */
+static folder_tree *folder_tree_load_v0(FILE * stream, const char *filecache)
+{
+    folder_tree    *tree;
+    size_t          ret;
+    uint64_t        num_hts;
+    uint64_t        num_reached;
+    uint64_t        i,
+                    j;
+    struct h_entry **ordered_entries;
+    struct h_entry *tmp_entry;
+    struct h_entry *parent;
+    struct h_entry_v0 record;
+
+    tree = folder_tree_create(filecache);
+    if (tree == NULL) {
+        fprintf(stderr, "folder_tree_create failed\n");
+        return NULL;
+    }
+    ordered_entries = NULL;
+
+    /* read revision */
+    ret = fread(&(tree->revision), sizeof(tree->revision), 1, stream);
+    if (ret != 1) {
+        fprintf(stderr, "cannot fread\n");
+        goto error;
+    }
+
+    /* read number of h_entries to read */
+    ret = fread(&num_hts, sizeof(num_hts), 1, stream);
+    if (ret != 1) {
+        fprintf(stderr, "cannot fread\n");
+        goto error;
+    }
+    if (num_hts == 0 || num_hts > UINT32_MAX) {
+        fprintf(stderr, "invalid number of entries\n");
+        goto error;
+    }
+
+    /* read root */
+    ret = fread(&record, sizeof(struct h_entry_v0), 1, stream);
+    if (ret != 1) {
+        fprintf(stderr, "cannot fread\n");
+        goto error;
+    }
+    if (folder_tree_entry_from_v0(tree, &record, &(tree->root)) != 0) {
+        goto error;
+    }
+    tree->root.parent.entry = NULL;
+
+    /* to effectively map integer offsets to addresses we load the file into
+     * an array of pointers to h_entry structs and free that array after we're
+     * done with setting up the hashtable */
+
+    /* populate the array of children */
+    ordered_entries =
+        (struct h_entry **)malloc(num_hts * sizeof(struct h_entry *));
+    if (ordered_entries == NULL) {
+        fprintf(stderr, "cannot malloc\n");
+        goto error;
+    }
+
+    /* build the table of keys at its final size */
+    if (folder_tree_keys_reserve(tree, num_hts - 1) != 0) {
+        goto error;
+    }
+
+    /* the first entry in this array points to the memory allocated for the
+     * root */
+    ordered_entries[0] = &(tree->root);
+
+    /* read the remaining entries one by one */
+    for (i = 1; i < num_hts; i++) {
+        tmp_entry = (struct h_entry *)slab_alloc(tree->entries);
+        if (tmp_entry == NULL) {
+            fprintf(stderr, "slab_alloc failed\n");
+            goto error;
+        }
+        ret = fread(&record, sizeof(struct h_entry_v0), 1, stream);
+        if (ret != 1) {
+            fprintf(stderr, "cannot fread\n");
+            goto error;
+        }
+        if (folder_tree_entry_from_v0(tree, &record, tmp_entry) != 0) {
+            goto error;
+        }
+        if (folder_tree_index_add(tree, tmp_entry) != 0) {
+            goto error;
+        }
+        /* store pointer to it in the array */
+        ordered_entries[i] = tmp_entry;
+        if (tmp_entry->parent.offs >= num_hts) {
+            fprintf(stderr, "invalid parent of entry %" PRIu64 "\n", i);
+            goto error;
+        }
+    }
+
+    /* turn the parent offset value into a pointer to the memory we allocated
+     * earlier, populate the array of children for each entry and sort them
+     * into the hashtable */
+    for (i = 1; i < num_hts; i++) {
         /* the parent of this entry is at the given offset in the array */
         parent = ordered_entries[ordered_entries[i]->parent.offs];
         ordered_entries[i]->parent.entry = parent;
 
         /* use the parent information to populate the array of children */
-        parent->num_children++;
-        parent->children =
-            (struct h_entry **)realloc(parent->children,
-                                       parent->num_children *
-                                       sizeof(struct h_entry *));
-        if (parent->children == NULL) {
-            fprintf(stderr, "realloc failed\n");
-            return NULL;
+        if (folder_tree_array_grow(&(parent->children), parent->num_children)
+            != 0) {
+            goto error;
         }
-        parent->children[parent->num_children - 1] = ordered_entries[i];
+        parent->children[parent->num_children] = ordered_entries[i];
+        parent->num_children++;
 
         /* put the entry into the hashtable */
-        bucket_id = base36_decode_triplet(ordered_entries[i]->key);
-        tree->bucket_lens[bucket_id]++;
-        tree->buckets[bucket_id] =
-            (struct h_entry **)realloc(tree->buckets[bucket_id],
-                                       tree->bucket_lens[bucket_id] *
-                                       sizeof(struct h_entry *));
-        if (tree->buckets[bucket_id] == NULL) {
-            fprintf(stderr, "realloc failed\n");
-            return NULL;
+        if (folder_tree_keys_insert(tree, ordered_entries[i]) != 0) {
+            goto error;
         }
-        tree->buckets[bucket_id][tree->bucket_lens[bucket_id] - 1] =
-            ordered_entries[i];
     }
 
-    free(ordered_entries);
+    /* the stored file does not preserve the order of the children, so
+     * restore the ordering by name that the lookups rely on */
+    for (i = 0; i < num_hts; i++) {
+        if (ordered_entries[i]->num_children > 1) {
+            qsort(ordered_entries[i]->children,
+                  ordered_entries[i]->num_children, sizeof(struct h_entry *),
+                  children_name_compare);
+        }
+    }
 
-    tree->filecache = strdup(filecache);
+    /* every entry must be reached from the root, which rules out parents
+     * that form a cycle. The offsets are not needed anymore, so the array
+     * holds the entries in the order they are reached */
+    num_reached = 1;
+    for (i = 0; i < num_reached; i++) {
+        for (j = 0; j < ordered_entries[i]->num_children; j++) {
+            ordered_entries[num_reached++] = ordered_entries[i]->children[j];
+        }
+    }
+    if (num_reached != num_hts) {
+        fprintf(stderr, "%" PRIu64 " entries are not reached from the root\n",
+                num_hts - num_reached);
+        goto error;
+    }
+
+    free(ordered_entries);
 
     return tree;
+
+  error:
+    free(ordered_entries);
+    folder_tree_destroy(tree);
+
+    return NULL;
 }
 
-folder_tree    *folder_tree_create(const char *filecache)
+/*
+ * fill a record of the version 1 storage format with the information of an
+ * h_entry struct
+ *
+ * the record of the parent, the first link to the children and the name are
+ * stored at the given offsets
+ */
+static void folder_tree_entry_to_v1(struct h_entry *entry, uint64_t parent,
+                                    uint64_t children, uint64_t name,
+                                    struct h_entry_v1 *record)
 {
-    folder_tree    *tree;
+    memset(record, 0, sizeof(struct h_entry_v1));
+
+    memcpy(record->key, entry->key, sizeof(record->key));
+    record->name = name;
+    record->parent = parent;
+    record->remote_revision = entry->remote_revision;
+    record->local_revision = entry->local_revision;
+    record->ctime = entry->ctime;
+    record->children = children;
+    record->num_children = entry->num_children;
+    if (folder_tree_is_paged_out(entry)) {
+        record->flags = H_ENTRY_V1_PAGED;
+        record->num_children = 0;
+        record->fsize = entry->num_children;
+    }
+    if (entry->file != NULL) {
+        record->flags = H_ENTRY_V1_FILE;
+        memcpy(record->hash, entry->file->hash, sizeof(record->hash));
+        record->atime = entry->file->atime;
+        record->fsize = entry->file->fsize;
+    }
+}
 
-    tree = (folder_tree *) calloc(1, sizeof(folder_tree));
+/*
+ * fill an h_entry struct with the information of a record of the version 0
+ * storage format
+ *
+ * the offset of the parent is stored in parent.offs and the entry has no
+ * children
+ */
+static int folder_tree_entry_from_v0(folder_tree * tree,
+                                     struct h_entry_v0 *record,
+                                     struct h_entry *entry)
+{
+    const char     *name;
 
-    tree->filecache = strdup(filecache);
+    memcpy(entry->key, record->key, sizeof(entry->key));
+    entry->key[sizeof(entry->key) - 1] = '\0';
+    record->name[sizeof(record->name) - 1] = '\0';
+    name = strpool_intern(tree->names, record->name);
+    if (name == NULL) {
+        fprintf(stderr, "strpool_intern failed\n");
+        return -1;
+    }
+    strpool_release(tree->names, entry->name);
+    entry->name = name;
+    entry->remote_revision = record->remote_revision;
+    entry->local_revision = record->local_revision;
+    entry->ctime = record->ctime;
+    entry->parent.offs = record->parent;
+    entry->children = NULL;
+    entry->num_children = 0;
+    if (record->atime != 0) {
+        entry->file = (struct h_file *)slab_alloc(tree->files);
+        if (entry->file == NULL) {
+            fprintf(stderr, "slab_alloc failed\n");
+            return -1;
+        }
+        memcpy(entry->file->hash, record->hash, sizeof(entry->file->hash));
+        entry->file->atime = record->atime;
+        entry->file->fsize = record->fsize;
+    }
 
-    return tree;
+    return 0;
 }
 
-static void folder_tree_free_entries(folder_tree * tree)
+/*
+ * The journal
+ *
+ * Every change of the folder_tree is appended to the journal as a record
+ * which describes the change. The journal thus holds all changes since the
+ * last time the tree was stored (the last checkpoint). When the tree is loaded
+ * after a crash, replaying the journal restores the tree to the state it was
+ * in when the last record was written instead of having to rebuild it.
+ *
+ * journal file layout:
+ *
+ * byte 0: 0x4D -> ASCII M
+ * byte 1: 0x46 -> ASCII F
+ * byte 2: 0x4A -> ASCII J  --> MFJ == MediaFire Journal
+ * byte 3: 0x00 -> version information
+ * bytes 4...   -> journal_record structs, each followed by name_len bytes
+ *
+ * The records store the new state of an entry instead of the difference to
+ * the old one, so replaying a journal onto a checkpoint which already
+ * contains some of its changes does not do any harm. Thus, it is enough to
+ * empty the journal after the checkpoint has been written.
+ *
+ * A record that was only partly written because of a crash fails its
+ * checksum. Replaying stops at the first such record and the journal is
+ * truncated there.
+ */
+static void folder_tree_journal_entry(folder_tree * tree,
+                                      struct h_entry *entry)
 {
-    uint64_t        i,
-                    j;
+    struct journal_record record;
+
+    if (tree->journal == NULL)
+        return;
+
+    folder_tree_record_from_entry(entry, &record);
+
+    folder_tree_journal_write(tree, &record, entry->name);
+}
+
+/*
+ * fill a record of type JOURNAL_ENTRY with the state of an entry
+ */
+static void folder_tree_record_from_entry(struct h_entry *entry,
+                                          struct journal_record *record)
+{
+    memset(record, 0, sizeof(struct journal_record));
+    record->type = JOURNAL_ENTRY;
+    record->name_len = strlen(entry->name) + 1;
+    memcpy(record->key, entry->key, sizeof(record->key));
+    /* the root is its own parent but its parent can also be NULL */
+    if (entry->parent.entry != NULL) {
+        memcpy(record->parent, entry->parent.entry->key,
+               sizeof(record->parent));
+    }
+    record->remote_revision = entry->remote_revision;
+    record->local_revision = entry->local_revision;
+    record->ctime = entry->ctime;
+    if (entry->file != NULL) {
+        record->is_file = 1;
+        memcpy(record->hash, entry->file->hash, sizeof(record->hash));
+        record->atime = entry->file->atime;
+        record->fsize = entry->file->fsize;
+    }
+}
 
-    for (i = 0; i < NUM_BUCKETS; i++) {
-        for (j = 0; j < tree->bucket_lens[i]; j++) {
-            free(tree->buckets[i][j]->children);
-            free(tree->buckets[i][j]);
+/*
+ * set the revisions and the creation time of an entry and, for files, the
+ * information of the file to the ones of a record of type JOURNAL_ENTRY
+ */
+static int folder_tree_entry_from_record(folder_tree * tree,
+                                         struct h_entry *entry,
+                                         struct journal_record *record)
+{
+    if (record->is_file && entry->file == NULL) {
+        entry->file = (struct h_file *)slab_alloc(tree->files);
+        if (entry->file == NULL) {
+            fprintf(stderr, "slab_alloc failed\n");
+            return -1;
         }
-        free(tree->buckets[i]);
-        tree->buckets[i] = NULL;
-        tree->bucket_lens[i] = 0;
     }
-    free(tree->root.children);
-    tree->root.children = NULL;
-    tree->root.num_children = 0;
+    entry->remote_revision = record->remote_revision;
+    entry->local_revision = record->local_revision;
+    entry->ctime = record->ctime;
+    if (record->is_file) {
+        memcpy(entry->file->hash, record->hash, sizeof(entry->file->hash));
+        entry->file->atime = record->atime;
+        entry->file->fsize = record->fsize;
+    }
+
+    return 0;
+}
+
+/*
+ * write a record of type JOURNAL_REMOVE or JOURNAL_CLEAR_CHILDREN
+ */
+static void folder_tree_journal_key(folder_tree * tree, uint32_t type,
+                                    const char *key)
+{
+    struct journal_record record;
+
+    if (tree->journal == NULL)
+        return;
+
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    if (key != NULL) {
+        strncpy(record.key, key, sizeof(record.key) - 1);
+    }
+
+    folder_tree_journal_write(tree, &record, NULL);
+}
+
+static void folder_tree_journal_revision(folder_tree * tree)
+{
+    struct journal_record record;
+
+    if (tree->journal == NULL)
+        return;
+
+    memset(&record, 0, sizeof(record));
+    record.type = JOURNAL_REVISION;
+    record.remote_revision = tree->revision;
+
+    folder_tree_journal_write(tree, &record, NULL);
+}
+
+/* 32 bit FNV-1a */
+static uint32_t folder_tree_journal_checksum(uint32_t hash, const void *data,
+                                             size_t len)
+{
+    const unsigned char *bytes;
+    size_t          i;
+
+    bytes = (const unsigned char *)data;
+    for (i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static void folder_tree_journal_write(folder_tree * tree,
+                                      struct journal_record *record,
+                                      const char *name)
+{
+    if (folder_tree_record_write(tree->journal, record, name) != 0) {
+        fprintf(stderr, "cannot write journal\n");
+    }
+}
+
+/*
+ * calculate the checksum of a record and write it followed by its name
+ */
+static int folder_tree_record_write(FILE * stream,
+                                    struct journal_record *record,
+                                    const char *name)
+{
+    record->checksum = 0;
+    record->checksum = folder_tree_journal_checksum(2166136261U, record,
+                                                    sizeof(*record));
+    if (name != NULL) {
+        record->checksum = folder_tree_journal_checksum(record->checksum,
+                                                        name,
+                                                        record->name_len);
+    }
+
+    if (fwrite(record, sizeof(*record), 1, stream) != 1
+        || (name != NULL
+            && fwrite(name, record->name_len, 1, stream) != 1)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * read the next record and its name, which must have room for
+ * MFAPI_MAX_LEN_NAME + 1 bytes
+ *
+ * returns -1 at the end of the stream and if the record was only partly
+ * written or fails its checksum
+ */
+static int folder_tree_record_read(FILE * stream,
+                                   struct journal_record *record, char *name)
+{
+    uint32_t        checksum;
+
+    if (fread(record, sizeof(*record), 1, stream) != 1) {
+        return -1;
+    }
+    if (record->name_len > MFAPI_MAX_LEN_NAME + 1) {
+        return -1;
+    }
+    if (record->name_len > 0) {
+        if (fread(name, record->name_len, 1, stream) != 1) {
+            return -1;
+        }
+        name[record->name_len - 1] = '\0';
+    }
+    record->key[sizeof(record->key) - 1] = '\0';
+    record->parent[sizeof(record->parent) - 1] = '\0';
+
+    checksum = record->checksum;
+    record->checksum = 0;
+    record->checksum = folder_tree_journal_checksum(2166136261U, record,
+                                                    sizeof(*record));
+    if (record->name_len > 0) {
+        record->checksum = folder_tree_journal_checksum(record->checksum,
+                                                        name,
+                                                        record->name_len);
+    }
+    if (record->checksum != checksum) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * hand the records written so far over to the operating system so that they
+ * survive a crash of this process
+ *
+ * this is called at the end of every public function that changes the tree
+ * instead of after every record to not do a system call per record
+ */
+static void folder_tree_journal_flush(folder_tree * tree)
+{
+    if (tree->journal == NULL)
+        return;
+
+    if (fflush(tree->journal) != 0) {
+        fprintf(stderr, "cannot flush journal\n");
+    }
+}
+
+/*
+ * apply a record read from the journal
+ *
+ * this does the same changes to the tree as the functions that wrote the
+ * record did
+ */
+static int folder_tree_journal_apply(folder_tree * tree,
+                                     struct journal_record *record,
+                                     const char *name)
+{
+    struct h_entry *entry;
+    struct h_entry *parent;
+
+    switch (record->type) {
+        case JOURNAL_ENTRY:
+            parent = folder_tree_lookup_key(tree, record->parent);
+            if (parent == NULL) {
+                fprintf(stderr, "parent of %s is missing\n", record->key);
+                return -1;
+            }
+            entry = folder_tree_allocate_entry(tree, record->key, name,
+                                               parent);
+            if (entry == NULL) {
+                fprintf(stderr, "folder_tree_allocate_entry failed\n");
+                return -1;
+            }
+            entry->parent.entry = parent;
+            return folder_tree_entry_from_record(tree, entry, record);
+        case JOURNAL_REMOVE:
+            folder_tree_remove(tree, record->key);
+            return 0;
+        case JOURNAL_CLEAR_CHILDREN:
+            entry = folder_tree_lookup_key(tree, record->key);
+            if (entry == NULL) {
+                fprintf(stderr, "folder %s is missing\n", record->key);
+                return -1;
+            }
+            folder_tree_dcache_invalidate(tree, entry);
+            free(entry->children);
+            entry->children = NULL;
+            entry->num_children = 0;
+            return 0;
+        case JOURNAL_REVISION:
+            tree->revision = record->remote_revision;
+            return 0;
+        case JOURNAL_PAGE_IN:
+            folder_tree_page_in_key(tree, record->key);
+            return 0;
+        default:
+            fprintf(stderr, "unknown journal record type %" PRIu32 "\n",
+                    record->type);
+            return -1;
+    }
+}
+
+/*
+ * replay the records of the journal onto the tree and return the offset
+ * after the last valid record
+ */
+static long folder_tree_journal_replay(folder_tree * tree, FILE * stream)
+{
+    struct journal_record record;
+    char            name[MFAPI_MAX_LEN_NAME + 1];
+    unsigned char   magic[4];
+    long            offset;
+    uint64_t        num_records;
+
+    if (fread(magic, 1, 4, stream) != 4 || memcmp(magic, "MFJ\0", 4) != 0) {
+        return 0;
+    }
+
+    num_records = 0;
+    offset = ftell(stream);
+    while (folder_tree_record_read(stream, &record, name) == 0) {
+        if (folder_tree_journal_apply(tree, &record,
+                                      record.name_len > 0 ? name : NULL)
+            != 0) {
+            break;
+        }
+        num_records++;
+        offset = ftell(stream);
+    }
+
+    fprintf(stderr, "replayed %" PRIu64 " journal records\n", num_records);
+
+    return offset;
+}
+
+/*
+ * open the journal at the given path and write all further changes of the
+ * tree to it
+ *
+ * if replay is true, the changes recorded in the journal are applied to the
+ * tree first. Otherwise, the journal is emptied. This is for trees which were
+ * not loaded from the checkpoint the journal belongs to.
+ */
+int folder_tree_journal_open(folder_tree * tree, const char *path,
+                             bool replay)
+{
+    FILE           *stream;
+    long            offset;
+
+    if (tree->journal != NULL) {
+        fprintf(stderr, "journal is already open\n");
+        return -1;
+    }
+
+    stream = fopen(path, "r+");
+    if (stream == NULL) {
+        stream = fopen(path, "w+");
+    }
+    if (stream == NULL) {
+        fprintf(stderr, "cannot open journal %s\n", path);
+        return -1;
+    }
+
+    offset = 0;
+    if (replay) {
+        offset = folder_tree_journal_replay(tree, stream);
+        folder_tree_dcache_clear(tree);
+    }
+
+    /* drop everything after the last valid record */
+    if (fflush(stream) != 0 || ftruncate(fileno(stream), offset) != 0
+        || fseek(stream, offset, SEEK_SET) != 0) {
+        fprintf(stderr, "cannot truncate journal %s\n", path);
+        fclose(stream);
+        return -1;
+    }
+    if (offset == 0) {
+        if (fwrite("MFJ\0", 1, 4, stream) != 4 || fflush(stream) != 0) {
+            fprintf(stderr, "cannot write journal %s\n", path);
+            fclose(stream);
+            return -1;
+        }
+    }
+
+    tree->journal = stream;
+
+    return 0;
+}
+
+/*
+ * return the number of bytes of the journal. A journal without records has
+ * four bytes.
+ */
+uint64_t folder_tree_journal_get_size(folder_tree * tree)
+{
+    long            offset;
+
+    if (tree->journal == NULL)
+        return 0;
+
+    offset = ftell(tree->journal);
+    if (offset < 0)
+        return 0;
+
+    return offset;
+}
+
+/*
+ * store the tree in the dircache at the given path and empty the journal
+ *
+ * the tree is written to a temporary file which then replaces the dircache.
+ * This way, a crash while storing the tree leaves the old dircache and the
+ * journal intact. It also means that a dircache that the tree was loaded
+ * from and which is still mapped into memory is never modified.
+ */
+int folder_tree_checkpoint(folder_tree * tree, const char *dircache)
+{
+    char           *tmp_dircache;
+    FILE           *stream;
+    int             retval;
+
+    tmp_dircache = strdup_printf("%s.tmp", dircache);
+
+    stream = fopen(tmp_dircache, "w+");
+    if (stream == NULL) {
+        fprintf(stderr, "cannot open %s for writing\n", tmp_dircache);
+        free(tmp_dircache);
+        return -1;
+    }
+
+    retval = folder_tree_store(tree, stream);
+    if (retval == 0 && (fflush(stream) != 0 || fsync(fileno(stream)) != 0)) {
+        retval = -1;
+    }
+    if (fclose(stream) != 0 || retval != 0) {
+        fprintf(stderr, "cannot store %s\n", tmp_dircache);
+        remove(tmp_dircache);
+        free(tmp_dircache);
+        return -1;
+    }
+
+    if (rename(tmp_dircache, dircache) != 0) {
+        fprintf(stderr, "cannot rename %s\n", tmp_dircache);
+        remove(tmp_dircache);
+        free(tmp_dircache);
+        return -1;
+    }
+    free(tmp_dircache);
+
+    /* all recorded changes are part of the checkpoint now */
+    if (tree->journal != NULL) {
+        if (fflush(tree->journal) != 0
+            || ftruncate(fileno(tree->journal), 4) != 0
+            || fseek(tree->journal, 4, SEEK_SET) != 0) {
+            fprintf(stderr, "cannot truncate journal\n");
+            return -1;
+        }
+    }
+
+    /* pages of folders which are not paged out anymore are not needed to
+     * replay the journal anymore either */
+    folder_tree_pages_cleanup(tree);
+
+    /* files verified since the last checkpoint are not verified again */
+    if (tree->verified != NULL && manifest_is_dirty(tree->verified)) {
+        manifest_store(tree->verified, tree->verified_path);
+    }
+
+    return 0;
+}
+
+/*
+ * Paging
+ *
+ * With a memory limit, only the folders which were used recently keep their
+ * children in memory. The children of the other folders are written to a
+ * page in the pages directory and freed. The folder itself stays in memory
+ * with a children array of NULL while num_children keeps their number, so
+ * its attributes are still known. The children are read back from the page
+ * (paged in) once they are needed: when a path leads through the folder,
+ * when it is listed and before its children change.
+ *
+ * Only folders whose children are files or empty folders are paged out, so
+ * that pages do not nest and an entry in memory always has its parent in
+ * memory as well. Files whose content is in the file cache keep their folder
+ * in memory because folder_tree_cleanup_filecache removes the cached content
+ * of files it does not know.
+ *
+ * A page starts with "MFP\0" followed by a record of type JOURNAL_ENTRY for
+ * every child. The dircache refers to the pages of the folders that were
+ * paged out when it was written, so pages are only removed by the next
+ * checkpoint. Paging in is recorded in the journal, so that the records of
+ * later changes to the children find them when the journal is replayed.
+ *
+ * A page that is incomplete because of a crash makes its folder be retrieved
+ * from the remote again.
+ */
+
+/*
+ * use the directory at the given path for the pages of paged out folders
+ *
+ * this must be called before the journal is replayed because its records
+ * can refer to paged out folders
+ */
+int folder_tree_pages_open(folder_tree * tree, const char *path)
+{
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return -1;
+    }
+
+    free(tree->pages);
+    tree->pages = strdup(path);
+
+    return 0;
+}
+
+/*
+ * let folder_tree_trim keep the estimated memory used by the tree below the
+ * given number of bytes. A limit of zero removes the limit.
+ *
+ * the tree only keeps track of which folders were used while it has a limit
+ */
+int folder_tree_set_memory_limit(folder_tree * tree, uint64_t limit)
+{
+    uint64_t        capacity;
+
+    if (limit == 0) {
+        free(tree->stamps);
+        tree->stamps = NULL;
+        tree->stamps_capacity = 0;
+        tree->memory_limit = 0;
+        return 0;
+    }
+
+    if (tree->stamps == NULL) {
+        for (capacity = 16; capacity < tree->num_entries; capacity *= 2) ;
+        tree->stamps = (uint32_t *) calloc(capacity, sizeof(uint32_t));
+        if (tree->stamps == NULL) {
+            fprintf(stderr, "calloc failed\n");
+            return -1;
+        }
+        tree->stamps_capacity = capacity;
+    }
+    tree->memory_limit = limit;
+
+    return 0;
+}
+
+/*
+ * page out the least recently used folders until the estimated memory used
+ * by the tree is a quarter below the limit, so that the folders paged in
+ * afterwards do not make it page out again right away
+ *
+ * nothing is done while the tree is within its limit, so this can be called
+ * regularly. Otherwise, all entries are visited once. The search index is
+ * rebuilt here as well once most of its ids are stale.
+ */
+void folder_tree_trim(folder_tree * tree)
+{
+    struct folder_tree_candidate *candidates;
+    unsigned char  *busy;
+    struct h_entry *entry;
+    uint64_t        num_candidates;
+    uint64_t        num_paged;
+    uint64_t        target;
+    uint64_t        i;
+
+    folder_tree_search_compact(tree);
+
+    if (tree->stamps == NULL) {
+        return;
+    }
+
+    /* keep the order of the stamps but make room for new ones */
+    if (tree->clock > UINT32_MAX / 2) {
+        for (i = 0; i < tree->num_entries; i++) {
+            tree->stamps[i] /= 2;
+        }
+        tree->clock /= 2;
+    }
+
+    if (tree->pages == NULL
+        || folder_tree_resident_size(tree) <= tree->memory_limit) {
+        return;
+    }
+
+    busy = (unsigned char *)calloc(tree->num_entries, 1);
+    candidates = (struct folder_tree_candidate *)
+        malloc(tree->num_entries * sizeof(struct folder_tree_candidate));
+    if (busy == NULL || candidates == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        free(busy);
+        free(candidates);
+        return;
+    }
+
+    /* an entry whose parent does not list it still refers to it until it
+     * is housekept, so that parent must not be freed until then */
+    for (i = 1; i < tree->num_entries; i++) {
+        entry = tree->entries_by_index[i];
+        if (entry->parent.entry != NULL
+            && !folder_tree_is_parent_of(entry->parent.entry, entry)
+            && entry->parent.entry->index < tree->num_entries) {
+            busy[entry->parent.entry->index] = 1;
+        }
+    }
+
+    num_candidates = 0;
+    for (i = 1; i < tree->num_entries; i++) {
+        entry = tree->entries_by_index[i];
+        if (folder_tree_can_page_out(entry, busy)) {
+            candidates[num_candidates].entry = entry;
+            candidates[num_candidates].stamp = tree->stamps[i];
+            num_candidates++;
+        }
+    }
+    free(busy);
+
+    qsort(candidates, num_candidates, sizeof(struct folder_tree_candidate),
+          stamp_compare);
+
+    /* paging out moves the entries to other indices but a folder which is
+     * a candidate is never a child of another one */
+    target = tree->memory_limit - tree->memory_limit / 4;
+    num_paged = 0;
+    for (i = 0; i < num_candidates && folder_tree_resident_size(tree) > target;
+         i++) {
+        if (folder_tree_page_out(tree, candidates[i].entry) != 0) {
+            break;
+        }
+        num_paged++;
+    }
+    free(candidates);
+
+    /* the caches might refer to the freed children */
+    if (num_paged > 0) {
+        folder_tree_dcache_clear(tree);
+        folder_tree_search_compact(tree);
+    }
+
+    fprintf(stderr, "paged out %" PRIu64 " folders, %" PRIu64
+            " bytes left\n", num_paged, folder_tree_resident_size(tree));
+}
+
+static int stamp_compare(const void *a, const void *b)
+{
+    const struct folder_tree_candidate *candidate_a = a;
+    const struct folder_tree_candidate *candidate_b = b;
+
+    if (candidate_a->stamp < candidate_b->stamp)
+        return -1;
+    if (candidate_a->stamp > candidate_b->stamp)
+        return 1;
+    return 0;
+}
+
+/*
+ * estimate the memory used by the tree: every entry has its h_entry struct,
+ * a slot in the index, a link from its parent, a slot in the table of keys
+ * at its maximum load and a stamp. The ids of the current names in the search
+ * index are counted as well. The mapped dircache is not counted because the
+ * kernel can drop its pages at any time.
+ */
+static uint64_t folder_tree_resident_size(folder_tree * tree)
+{
+    return tree->num_entries * (sizeof(struct h_entry)
+                                + 2 * sizeof(struct h_entry *)
+                                + sizeof(struct key_slot) * KEYS_MAX_LOAD_DEN
+                                / KEYS_MAX_LOAD_NUM + sizeof(uint32_t))
+        + slab_get_num_objects(tree->files) * sizeof(struct h_file)
+        + strpool_get_size(tree->names)
+        + tree->num_search_ids * sizeof(uint32_t);
+}
+
+/*
+ * remember that the children of a folder were used
+ *
+ * this is called by lookups which run concurrently, so it takes the lock of
+ * the caches
+ */
+static void folder_tree_touch(folder_tree * tree, struct h_entry *entry)
+{
+    if (tree->stamps == NULL || entry == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(tree->dcache_lock));
+    tree->clock++;
+    tree->stamps[entry->index] = tree->clock;
+    pthread_mutex_unlock(&(tree->dcache_lock));
+}
+
+static bool folder_tree_is_paged_out(struct h_entry *entry)
+{
+    return entry->file == NULL && entry->children == NULL
+        && entry->num_children > 0;
+}
+
+/*
+ * check whether the children of a folder can be paged out: they must all
+ * claim the folder as their parent and be either files without content in
+ * the file cache or empty and up to date folders which are not busy
+ */
+static bool folder_tree_can_page_out(struct h_entry *entry,
+                                     const unsigned char *busy)
+{
+    struct h_entry *child;
+    uint64_t        i;
+
+    if (entry->file != NULL || entry->children == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < entry->num_children; i++) {
+        child = entry->children[i];
+        if (child->parent.entry != entry) {
+            return false;
+        }
+        if (child->file != NULL) {
+            if (child->local_revision != 0) {
+                return false;
+            }
+        } else if (child->num_children > 0 || busy[child->index]
+                   || child->local_revision != child->remote_revision) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * write the children of a folder to its page and free them
+ */
+static int folder_tree_page_out(folder_tree * tree, struct h_entry *entry)
+{
+    struct journal_record record;
+    struct h_entry *child;
+    char           *path;
+    char           *tmp_path;
+    FILE           *stream;
+    uint64_t        i;
+    int             retval;
+
+    path = strdup_printf("%s/%s", tree->pages, entry->key);
+    tmp_path = strdup_printf("%s.tmp", path);
+
+    stream = fopen(tmp_path, "w");
+    if (stream == NULL) {
+        fprintf(stderr, "cannot open %s for writing\n", tmp_path);
+        free(tmp_path);
+        free(path);
+        return -1;
+    }
+
+    retval = fwrite("MFP\0", 1, 4, stream) == 4 ? 0 : -1;
+    for (i = 0; i < entry->num_children && retval == 0; i++) {
+        folder_tree_record_from_entry(entry->children[i], &record);
+        retval = folder_tree_record_write(stream, &record,
+                                          entry->children[i]->name);
+    }
+    if (fclose(stream) != 0 || retval != 0 || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "cannot write page %s\n", path);
+        remove(tmp_path);
+        free(tmp_path);
+        free(path);
+        return -1;
+    }
+    free(tmp_path);
+    free(path);
+
+    for (i = 0; i < entry->num_children; i++) {
+        child = entry->children[i];
+        folder_tree_keys_remove(tree, child);
+        folder_tree_free_entry_data(tree, child);
+        folder_tree_index_remove(tree, child);
+        slab_free(tree->entries, child);
+    }
+    free(entry->children);
+    entry->children = NULL;
+
+    return 0;
+}
+
+/*
+ * read the children of a paged out folder back from its page
+ *
+ * children which are in memory already were moved to another folder after
+ * the folder was paged out and are skipped. If not all children can be read,
+ * the folder is marked to be retrieved from the remote again.
+ */
+static int folder_tree_page_in(folder_tree * tree, struct h_entry *entry)
+{
+    struct journal_record record;
+    char            name[MFAPI_MAX_LEN_NAME + 1];
+    unsigned char   magic[4];
+    struct h_entry *child;
+    uint64_t        num_children;
+    uint64_t        num_read;
+    char           *path;
+    FILE           *stream;
+
+    num_children = entry->num_children;
+    /* the children are added to the empty folder one by one */
+    entry->num_children = 0;
+    num_read = 0;
+
+    stream = NULL;
+    if (tree->pages != NULL) {
+        path = strdup_printf("%s/%s", tree->pages, entry->key);
+        stream = fopen(path, "r");
+        free(path);
+    }
+    if (stream != NULL && fread(magic, 1, 4, stream) == 4
+        && memcmp(magic, "MFP\0", 4) == 0) {
+        while (num_read < num_children
+               && folder_tree_record_read(stream, &record, name) == 0) {
+            if (record.type != JOURNAL_ENTRY || record.name_len == 0
+                || strcmp(record.parent, entry->key) != 0) {
+                break;
+            }
+            if (folder_tree_keys_find(tree, record.key, NULL) != NULL) {
+                num_read++;
+                continue;
+            }
+
+            child = (struct h_entry *)slab_alloc(tree->entries);
+            if (child == NULL) {
+                fprintf(stderr, "slab_alloc failed\n");
+                break;
+            }
+            memcpy(child->key, record.key, sizeof(child->key));
+            if (folder_tree_index_add(tree, child) != 0) {
+                slab_free(tree->entries, child);
+                break;
+            }
+            if (folder_tree_keys_insert(tree, child) != 0) {
+                folder_tree_index_remove(tree, child);
+                slab_free(tree->entries, child);
+                break;
+            }
+            child->parent.entry = entry;
+            if (folder_tree_set_name(tree, child, name) != 0
+                || folder_tree_children_add(entry, child) != 0
+                || folder_tree_entry_from_record(tree, child, &record) != 0) {
+                break;
+            }
+            num_read++;
+        }
+    }
+    if (stream != NULL) {
+        fclose(stream);
+    }
+
+    /* the records of all later changes refer to the children in memory */
+    folder_tree_journal_key(tree, JOURNAL_PAGE_IN, entry->key);
+
+    folder_tree_touch(tree, entry);
+
+    if (num_read != num_children) {
+        fprintf(stderr, "cannot page in %s - retrieving it again\n",
+                entry->key);
+        entry->local_revision = 0;
+        folder_tree_journal_entry(tree, entry);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * page in the folder with the given key if it is paged out
+ */
+static void folder_tree_page_in_key(folder_tree * tree, const char *key)
+{
+    struct h_entry *entry;
+
+    entry = folder_tree_keys_find(tree, key, NULL);
+    if (entry != NULL && folder_tree_is_paged_out(entry)) {
+        folder_tree_page_in(tree, entry);
+    }
+}
+
+/*
+ * remove the pages of all folders which are not paged out
+ */
+static void folder_tree_pages_cleanup(folder_tree * tree)
+{
+    DIR            *dirp;
+    struct dirent  *entryp;
+    struct h_entry *entry;
+    char           *path;
+
+    if (tree->pages == NULL) {
+        return;
+    }
+
+    dirp = opendir(tree->pages);
+    if (dirp == NULL) {
+        fprintf(stderr, "cannot open %s\n", tree->pages);
+        return;
+    }
+
+    while ((entryp = readdir(dirp)) != NULL) {
+        if (entryp->d_name[0] == '.')
+            continue;
+        entry = folder_tree_keys_find(tree, entryp->d_name, NULL);
+        if (entry != NULL && folder_tree_is_paged_out(entry))
+            continue;
+        path = strdup_printf("%s/%s", tree->pages, entryp->d_name);
+        if (unlink(path) != 0) {
+            fprintf(stderr, "cannot remove %s\n", path);
+        }
+        free(path);
+    }
+
+    closedir(dirp);
+}
+
+/*
+ * Search
+ *
+ * folder_tree_find lists the paths of all entries whose name matches a shell
+ * wildcard pattern like find -name does, but without visiting every folder.
+ * The search index maps the trigrams of all names to the indices of their
+ * entries, so only the entries that contain the trigrams of the literal parts
+ * of the pattern have to be checked. Patterns without such a part, like *.c,
+ * are checked against all entries.
+ *
+ * The index is kept up to date by the functions that name entries and give
+ * them their index. The ids of old names and indices stay in the index
+ * because the candidates are checked against the pattern anyways. Once they
+ * make up most of it, folder_tree_trim builds it anew.
+ *
+ * Only the folders whose content was retrieved are searched. The children of
+ * paged out folders are read from their pages.
+ */
+
+/* the number of stale ids in the search index that are always tolerated */
+#define SEARCH_MIN_STALE_IDS 65536
+
+/*
+ * build the search index or drop it
+ */
+int folder_tree_set_search_index(folder_tree * tree, bool enable)
+{
+    if (!enable) {
+        trigram_index_destroy(tree->search);
+        tree->search = NULL;
+        tree->num_search_ids = 0;
+        return 0;
+    }
+
+    return folder_tree_search_rebuild(tree);
+}
+
+/*
+ * write the path of every entry whose name matches the pattern to the stream,
+ * one per line
+ *
+ * the lock must be held at least for reading
+ */
+int folder_tree_find(folder_tree * tree, const char *pattern, FILE * stream)
+{
+    uint32_t       *ids;
+    size_t          num_ids;
+    uint64_t        i;
+    int             retval;
+
+    retval = 1;
+    if (tree->search != NULL) {
+        retval = trigram_index_query(tree->search, pattern, &ids, &num_ids);
+        if (retval < 0) {
+            return -1;
+        }
+    }
+
+    if (retval == 0) {
+        for (i = 0; i < num_ids; i++) {
+            if (ids[i] < tree->num_entries) {
+                folder_tree_find_entry(tree->entries_by_index[ids[i]],
+                                       pattern, stream);
+            }
+        }
+        free(ids);
+    } else {
+        for (i = 1; i < tree->num_entries; i++) {
+            folder_tree_find_entry(tree->entries_by_index[i], pattern,
+                                   stream);
+        }
+    }
+
+    folder_tree_find_pages(tree, pattern, stream);
+
+    return 0;
+}
+
+static void folder_tree_find_entry(struct h_entry *entry,
+                                   const char *pattern, FILE * stream)
+{
+    if (fnmatch(pattern, entry->name, 0) != 0) {
+        return;
+    }
+
+    folder_tree_print_path(entry, stream);
+    fputc('\n', stream);
+}
+
+/*
+ * check the children of all paged out folders against the pattern
+ *
+ * children which were moved to another folder since are skipped like when
+ * the folder is paged in
+ */
+static void folder_tree_find_pages(folder_tree * tree, const char *pattern,
+                                   FILE * stream)
+{
+    struct journal_record record;
+    char            name[MFAPI_MAX_LEN_NAME + 1];
+    unsigned char   magic[4];
+    struct h_entry *entry;
+    uint64_t        num_read;
+    uint64_t        i;
+    char           *path;
+    FILE           *page;
+
+    if (tree->pages == NULL) {
+        return;
+    }
+
+    for (i = 1; i < tree->num_entries; i++) {
+        entry = tree->entries_by_index[i];
+        if (!folder_tree_is_paged_out(entry)) {
+            continue;
+        }
+
+        path = strdup_printf("%s/%s", tree->pages, entry->key);
+        page = fopen(path, "r");
+        free(path);
+        if (page == NULL) {
+            continue;
+        }
+        if (fread(magic, 1, 4, page) != 4 || memcmp(magic, "MFP\0", 4) != 0) {
+            fclose(page);
+            continue;
+        }
+
+        for (num_read = 0; num_read < entry->num_children
+             && folder_tree_record_read(page, &record, name) == 0;
+             num_read++) {
+            if (record.type != JOURNAL_ENTRY
+                || strcmp(record.parent, entry->key) != 0) {
+                break;
+            }
+            if (fnmatch(pattern, name, 0) != 0
+                || folder_tree_keys_find(tree, record.key, NULL) != NULL) {
+                continue;
+            }
+            folder_tree_print_path(entry, stream);
+            fprintf(stream, "/%s\n", name);
+        }
+        fclose(page);
+    }
+}
+
+/*
+ * write the path of an entry without a trailing newline
+ */
+static void folder_tree_print_path(struct h_entry *entry, FILE * stream)
+{
+    if (entry->parent.entry != NULL && entry->parent.entry->index != 0) {
+        folder_tree_print_path(entry->parent.entry, stream);
+    }
+    fprintf(stream, "/%s", entry->name);
+}
+
+/*
+ * whether the entry holds its index, so that its name is in the search
+ * index under it
+ */
+static bool folder_tree_is_indexed(folder_tree * tree, struct h_entry *entry)
+{
+    return entry->index > 0 && entry->index < tree->num_entries
+        && tree->entries_by_index[entry->index] == entry;
+}
+
+/*
+ * add the name of an entry under its index to the search index
+ *
+ * if that fails, the search index is dropped and all entries are searched
+ * instead
+ */
+static void folder_tree_search_add(folder_tree * tree, struct h_entry *entry)
+{
+    if (tree->search == NULL || !folder_tree_is_indexed(tree, entry)) {
+        return;
+    }
+
+    if (trigram_index_add(tree->search, entry->index, entry->name) != 0) {
+        fprintf(stderr, "cannot update the search index\n");
+        folder_tree_set_search_index(tree, false);
+        return;
+    }
+    tree->num_search_ids += trigram_count(entry->name);
+}
+
+/*
+ * account for the name of an entry no longer being in the search index under
+ * its index because the name or the index is about to change
+ */
+static void folder_tree_search_drop(folder_tree * tree,
+                                    struct h_entry *entry)
+{
+    if (tree->search == NULL || !folder_tree_is_indexed(tree, entry)) {
+        return;
+    }
+
+    tree->num_search_ids -= trigram_count(entry->name);
+}
+
+static int folder_tree_search_rebuild(folder_tree * tree)
+{
+    uint64_t        i;
+
+    trigram_index_destroy(tree->search);
+    tree->num_search_ids = 0;
+    tree->search = trigram_index_create();
+    if (tree->search == NULL) {
+        return -1;
+    }
+
+    for (i = 1; i < tree->num_entries; i++) {
+        if (trigram_index_add(tree->search, i,
+                              tree->entries_by_index[i]->name) != 0) {
+            fprintf(stderr, "cannot build the search index\n");
+            folder_tree_set_search_index(tree, false);
+            return -1;
+        }
+        tree->num_search_ids +=
+            trigram_count(tree->entries_by_index[i]->name);
+    }
+
+    return 0;
+}
+
+/*
+ * build the search index anew once less than half of its ids are current
+ */
+static void folder_tree_search_compact(folder_tree * tree)
+{
+    if (tree->search == NULL) {
+        return;
+    }
+
+    if (trigram_index_get_num_ids(tree->search)
+        > 2 * tree->num_search_ids + SEARCH_MIN_STALE_IDS) {
+        folder_tree_search_rebuild(tree);
+    }
+}
+
+folder_tree    *folder_tree_create(const char *filecache)
+{
+    folder_tree    *tree;
+
+    tree = (folder_tree *) calloc(1, sizeof(folder_tree));
+
+    pthread_mutex_init(&(tree->dcache_lock), NULL);
+
+    tree->entries = slab_create(sizeof(struct h_entry), ENTRIES_PER_CHUNK);
+    tree->files = slab_create(sizeof(struct h_file), ENTRIES_PER_CHUNK);
+    tree->names = strpool_create();
+    if (tree->entries == NULL || tree->files == NULL || tree->names == NULL) {
+        fprintf(stderr, "cannot allocate storage for the folder_tree\n");
+        slab_destroy(tree->entries);
+        slab_destroy(tree->files);
+        strpool_destroy(tree->names);
+        pthread_mutex_destroy(&(tree->dcache_lock));
+        free(tree);
+        return NULL;
+    }
+
+    /* the root is named by the remote once it is retrieved */
+    tree->root.name = strpool_intern(tree->names, "");
+    if (folder_tree_index_add(tree, &(tree->root)) != 0) {
+        folder_tree_destroy(tree);
+        return NULL;
+    }
+
+    tree->filecache = strdup(filecache);
+
+    return tree;
+}
+
+/*
+ * free all memory referenced by an h_entry struct except for the struct
+ * itself
+ */
+static void folder_tree_free_entry_data(folder_tree * tree,
+                                        struct h_entry *entry)
+{
+    free(entry->children);
+    entry->children = NULL;
+    entry->num_children = 0;
+    slab_free(tree->files, entry->file);
+    entry->file = NULL;
+    folder_tree_search_drop(tree, entry);
+    folder_tree_release_name(tree, entry->name);
+    entry->name = NULL;
+}
+
+/*
+ * release the name of an entry unless it points into the mapped dircache
+ */
+static void folder_tree_release_name(folder_tree * tree, const char *name)
+{
+    if (tree->map != NULL && (uintptr_t) name >= (uintptr_t) tree->map
+        && (uintptr_t) name < (uintptr_t) tree->map + tree->map_size) {
+        return;
+    }
+    strpool_release(tree->names, name);
+}
+
+static void folder_tree_free_entries(folder_tree * tree)
+{
+    uint64_t        i;
+
+    for (i = 1; i < tree->num_entries; i++) {
+        folder_tree_free_entry_data(tree, tree->entries_by_index[i]);
+        slab_free(tree->entries, tree->entries_by_index[i]);
+    }
+    free(tree->keys);
+    tree->keys = NULL;
+    tree->keys_capacity = 0;
+    tree->num_keys = 0;
+    free(tree->dirty);
+    tree->dirty = NULL;
+    tree->num_dirty = 0;
+    tree->dirty_capacity = 0;
+    tree->dirty_overflow = false;
+    free(tree->root.children);
+    tree->root.children = NULL;
+    tree->root.num_children = 0;
+    /* only the root is left */
+    tree->num_entries = 1;
+    if (tree->search != NULL) {
+        folder_tree_search_rebuild(tree);
+    }
+
+    /* the cache must not reference the freed entries */
+    folder_tree_dcache_clear(tree);
+}
+
+void folder_tree_destroy(folder_tree * tree)
+{
+    size_t          i;
+
+    folder_tree_free_entries(tree);
+    folder_tree_release_name(tree, tree->root.name);
+    if (tree->map != NULL) {
+        munmap(tree->map, tree->map_size);
+    }
+    if (tree->journal != NULL) {
+        fclose(tree->journal);
+    }
+    slab_destroy(tree->entries);
+    slab_destroy(tree->files);
+    strpool_destroy(tree->names);
+    free(tree->entries_by_index);
+    free(tree->stamps);
+    free(tree->pages);
+    trigram_index_destroy(tree->search);
+    for (i = 0; i < tree->num_parts; i++) {
+        filecache_part_close(tree->parts[i].part);
+    }
+    free(tree->parts);
+    free(tree->open_files);
+    manifest_destroy(tree->verified);
+    free(tree->verified_path);
+    free(tree->filecache);
+    pthread_mutex_destroy(&(tree->dcache_lock));
+    free(tree);
+}
+
+/*
+ * make sure that an array of pointers to h_entry structs of length len has
+ * space for at least one more element
+ *
+ * the capacity of the children and index arrays is not stored. Instead, it
+ * is always the smallest power of two that is not less than their length.
+ * Thus, an array is full when its length is zero or a power of two and only
+ * then it is reallocated to double its size. This makes appending to an
+ * array amortized O(1) instead of O(n) for growing by one element each time.
+ * For this to work, arrays must never be shrunk except by freeing them when
+ * they become empty.
+ */
+static int folder_tree_array_grow(struct h_entry ***array, uint64_t len)
+{
+    struct h_entry **tmp_array;
+
+    if (len != 0 && (len & (len - 1)) != 0) {
+        return 0;
+    }
+
+    tmp_array = (struct h_entry **)realloc(*array,
+                                           (len == 0 ? 1 : len * 2) *
+                                           sizeof(struct h_entry *));
+    if (tmp_array == NULL) {
+        fprintf(stderr, "realloc failed\n");
+        return -1;
+    }
+    *array = tmp_array;
+
+    return 0;
+}
+
+/*
+ * give a new entry the next free index
+ */
+static int folder_tree_index_add(folder_tree * tree, struct h_entry *entry)
+{
+    uint32_t       *new_stamps;
+
+    if (folder_tree_array_grow(&(tree->entries_by_index), tree->num_entries)
+        != 0) {
+        return -1;
+    }
+    tree->entries_by_index[tree->num_entries] = entry;
+    entry->index = tree->num_entries;
+    tree->num_entries++;
+
+    if (tree->stamps != NULL) {
+        if (tree->num_entries > tree->stamps_capacity) {
+            new_stamps = (uint32_t *) realloc(tree->stamps,
+                                              tree->stamps_capacity * 2 *
+                                              sizeof(uint32_t));
+            if (new_stamps == NULL) {
+                fprintf(stderr, "realloc failed\n");
+                folder_tree_index_remove(tree, entry);
+                return -1;
+            }
+            tree->stamps = new_stamps;
+            tree->stamps_capacity *= 2;
+        }
+        tree->stamps[entry->index] = tree->clock;
+    }
+
+    folder_tree_search_add(tree, entry);
+
+    return 0;
+}
+
+/*
+ * give the index of a removed entry to the entry with the highest index so
+ * that the indices stay dense
+ */
+static void folder_tree_index_remove(folder_tree * tree,
+                                     struct h_entry *entry)
+{
+    struct h_entry *last;
+    uint64_t        slot;
+
+    folder_tree_search_drop(tree, entry);
+
+    last = tree->entries_by_index[tree->num_entries - 1];
+    if (last != entry) {
+        /* the table of keys refers to the entry by its index */
+        if (folder_tree_keys_find(tree, last->key, &slot) == last) {
+            tree->keys[slot].index = entry->index;
+        }
+        tree->entries_by_index[entry->index] = last;
+        if (tree->stamps != NULL) {
+            tree->stamps[entry->index] = tree->stamps[last->index];
+        }
+        last->index = entry->index;
+        /* its name is already counted under its old index */
+        if (tree->search != NULL
+            && trigram_index_add(tree->search, last->index,
+                                 last->name) != 0) {
+            fprintf(stderr, "cannot update the search index\n");
+            folder_tree_set_search_index(tree, false);
+        }
+        /* the last entry might have been marked under its old index */
+        if (tree->num_dirty > 0) {
+            folder_tree_mark_dirty(tree, last);
+        }
+    }
+    tree->num_entries--;
+}
+
+/*
+ * remember that the parent or the children of an entry changed, so that
+ * folder_tree_housekeep checks it
+ */
+static void folder_tree_mark_dirty(folder_tree * tree, struct h_entry *entry)
+{
+    uint32_t       *new_dirty;
+    uint64_t        new_capacity;
+
+    if (tree->dirty_overflow) {
+        return;
+    }
+
+    /* checking all entries is cheaper from here on */
+    if (tree->num_dirty >= tree->num_entries) {
+        free(tree->dirty);
+        tree->dirty = NULL;
+        tree->num_dirty = 0;
+        tree->dirty_capacity = 0;
+        tree->dirty_overflow = true;
+        return;
+    }
+
+    if (tree->num_dirty == tree->dirty_capacity) {
+        new_capacity = tree->dirty_capacity == 0 ? 16
+            : tree->dirty_capacity * 2;
+        new_dirty = (uint32_t *) realloc(tree->dirty,
+                                         new_capacity * sizeof(uint32_t));
+        if (new_dirty == NULL) {
+            fprintf(stderr, "realloc failed\n");
+            free(tree->dirty);
+            tree->dirty = NULL;
+            tree->num_dirty = 0;
+            tree->dirty_capacity = 0;
+            tree->dirty_overflow = true;
+            return;
+        }
+        tree->dirty = new_dirty;
+        tree->dirty_capacity = new_capacity;
+    }
+
+    tree->dirty[tree->num_dirty] = entry->index;
+    tree->num_dirty++;
+}
+
+/* 32 bit FNV-1a */
+static uint32_t folder_tree_key_hash(const char *key)
+{
+    uint32_t        hash;
+
+    hash = 2166136261U;
+    for (; *key != '\0'; key++) {
+        hash ^= (unsigned char)*key;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/*
+ * find the entry with the given key in the table of keys and the slot it
+ * occupies
+ */
+static struct h_entry *folder_tree_keys_find(folder_tree * tree,
+                                             const char *key,
+                                             uint64_t * slot)
+{
+    struct h_entry *entry;
+    uint64_t        mask;
+    uint64_t        pos;
+    uint64_t        dist;
+    uint32_t        hash;
+
+    if (tree->keys_capacity == 0) {
+        return NULL;
+    }
+
+    mask = tree->keys_capacity - 1;
+    hash = folder_tree_key_hash(key);
+    for (pos = hash & mask, dist = 0;; pos = (pos + 1) & mask, dist++) {
+        if (tree->keys[pos].index == 0) {
+            return NULL;
+        }
+        /* the key would have taken this slot if it were in the table */
+        if (((pos - (tree->keys[pos].hash & mask)) & mask) < dist) {
+            return NULL;
+        }
+        if (tree->keys[pos].hash == hash) {
+            entry = tree->entries_by_index[tree->keys[pos].index];
+            if (strcmp(entry->key, key) == 0) {
+                if (slot != NULL) {
+                    *slot = pos;
+                }
+                return entry;
+            }
+        }
+    }
+}
+
+/*
+ * make sure that the table of keys can take num keys without exceeding its
+ * maximum load. Loading a dircache calls this with the number of all
+ * entries, so that the table is only allocated once.
+ */
+static int folder_tree_keys_reserve(folder_tree * tree, uint64_t num)
+{
+    struct key_slot *old_keys;
+    uint64_t        old_capacity;
+    uint64_t        capacity;
+    uint64_t        i;
+    uint64_t        pos;
+    uint64_t        mask;
+    uint64_t        dist;
+    struct key_slot slot;
+    struct key_slot tmp_slot;
+
+    for (capacity = tree->keys_capacity == 0 ? 16 : tree->keys_capacity;
+         num * KEYS_MAX_LOAD_DEN > capacity * KEYS_MAX_LOAD_NUM;
+         capacity *= 2) ;
+
+    if (capacity == tree->keys_capacity) {
+        return 0;
+    }
+
+    old_keys = tree->keys;
+    old_capacity = tree->keys_capacity;
+
+    tree->keys = (struct key_slot *)calloc(capacity, sizeof(struct key_slot));
+    if (tree->keys == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        tree->keys = old_keys;
+        return -1;
+    }
+    tree->keys_capacity = capacity;
+
+    /* move the slots over to the new table. The keys are known to be
+     * unique, so they do not have to be compared */
+    mask = capacity - 1;
+    for (i = 0; i < old_capacity; i++) {
+        if (old_keys[i].index == 0)
+            continue;
+        slot = old_keys[i];
+        for (pos = slot.hash & mask, dist = 0;; pos = (pos + 1) & mask,
+             dist++) {
+            if (tree->keys[pos].index == 0) {
+                tree->keys[pos] = slot;
+                break;
+            }
+            if (((pos - (tree->keys[pos].hash & mask)) & mask) < dist) {
+                tmp_slot = tree->keys[pos];
+                tree->keys[pos] = slot;
+                slot = tmp_slot;
+                dist = (pos - (slot.hash & mask)) & mask;
+            }
+        }
+    }
+    free(old_keys);
+
+    return 0;
+}
+
+/*
+ * insert an entry into the table of keys
+ *
+ * fails if an entry with the same key is already part of the table
+ */
+static int folder_tree_keys_insert(folder_tree * tree, struct h_entry *entry)
+{
+    struct key_slot slot;
+    struct key_slot tmp_slot;
+    uint64_t        mask;
+    uint64_t        pos;
+    uint64_t        dist;
+    bool            displaced;
+
+    if (folder_tree_keys_reserve(tree, tree->num_keys + 1) != 0) {
+        return -1;
+    }
+
+    slot.hash = folder_tree_key_hash(entry->key);
+    slot.index = entry->index;
+
+    mask = tree->keys_capacity - 1;
+    displaced = false;
+    for (pos = slot.hash & mask, dist = 0;; pos = (pos + 1) & mask, dist++) {
+        if (tree->keys[pos].index == 0) {
+            tree->keys[pos] = slot;
+            tree->num_keys++;
+            return 0;
+        }
+        /* an entry with the same key would be found before the slot at
+         * which the new entry displaces another one */
+        if (!displaced && tree->keys[pos].hash == slot.hash
+            && strcmp(tree->entries_by_index[tree->keys[pos].index]->key,
+                      entry->key) == 0) {
+            fprintf(stderr, "key %s already exists\n", entry->key);
+            return -1;
+        }
+        if (((pos - (tree->keys[pos].hash & mask)) & mask) < dist) {
+            tmp_slot = tree->keys[pos];
+            tree->keys[pos] = slot;
+            slot = tmp_slot;
+            dist = (pos - (slot.hash & mask)) & mask;
+            displaced = true;
+        }
+    }
+}
+
+/*
+ * remove an entry from the table of keys by shifting the entries after it
+ * back until one is found that is at its home slot
+ */
+static void folder_tree_keys_remove(folder_tree * tree, struct h_entry *entry)
+{
+    uint64_t        mask;
+    uint64_t        pos;
+    uint64_t        next;
+
+    if (folder_tree_keys_find(tree, entry->key, &pos) != entry) {
+        return;
+    }
+
+    mask = tree->keys_capacity - 1;
+    for (next = (pos + 1) & mask; tree->keys[next].index != 0
+         && ((next - (tree->keys[next].hash & mask)) & mask) != 0;
+         pos = next, next = (next + 1) & mask) {
+        tree->keys[pos] = tree->keys[next];
+    }
+    tree->keys[pos].hash = 0;
+    tree->keys[pos].index = 0;
+    tree->num_keys--;
+}
+
+/*
+ * given a folderkey, lookup the h_entry struct of it in the hashtable
+ *
+ * if key is NULL, then a pointer to the root is returned
+ *
+ * if no matching h_entry struct is found, NULL is returned
+ */
+static struct h_entry *folder_tree_lookup_key(folder_tree * tree,
+                                              const char *key)
+{
+    struct h_entry *entry;
+
+    if (key == NULL || key[0] == '\0') {
+        return &(tree->root);
+    }
+
+    entry = folder_tree_keys_find(tree, key, NULL);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    fprintf(stderr, "cannot find h_entry struct for key %s\n", key);
+    return NULL;
+}
+
+/*
+ * compare the first len bytes of a path component against a zero terminated
+ * name
+ *
+ * the result has the same ordering as strcmp would have if the component
+ * were zero terminated after len bytes
+ */
+static int folder_tree_name_cmp(const char *component, size_t len,
+                                const char *name)
+{
+    int             cmp;
+
+    cmp = strncmp(component, name, len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    /* the first len bytes are equal, so the component only sorts before
+     * the name if the name is longer */
+    if (name[len] != '\0') {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * find the position of the first child in the ordered children array of a
+ * folder whose name is not less than the given name of length len
+ *
+ * this is the position of the first child of that name if it exists or the
+ * position where a child of that name would have to be inserted otherwise
+ */
+static uint64_t folder_tree_children_bisect(struct h_entry *parent,
+                                            const char *name, size_t len)
+{
+    uint64_t        lo,
+                    hi,
+                    mid;
+
+    lo = 0;
+    hi = parent->num_children;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (folder_tree_name_cmp(name, len, parent->children[mid]->name) > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ * given a folder, return its child with the given name of length len
+ *
+ * the name does not have to be zero terminated so that components of a path
+ * can be looked up without copying them
+ *
+ * if no child of that name exists, NULL is returned
+ */
+static struct h_entry *folder_tree_lookup_child(struct h_entry *parent,
+                                                const char *name, size_t len)
+{
+    uint64_t        i;
+
+    i = folder_tree_children_bisect(parent, name, len);
+
+    if (i < parent->num_children
+        && folder_tree_name_cmp(name, len, parent->children[i]->name) == 0) {
+        return parent->children[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * insert a child into the ordered children array of a folder
+ *
+ * children with the same name as an existing child are inserted after it so
+ * that lookups keep returning the child that was added first
+ */
+static int folder_tree_children_add(struct h_entry *parent,
+                                    struct h_entry *child)
+{
+    uint64_t        i;
+
+    i = folder_tree_children_bisect(parent, child->name, strlen(child->name));
+    while (i < parent->num_children
+           && strcmp(parent->children[i]->name, child->name) == 0) {
+        i++;
+    }
+
+    if (folder_tree_array_grow(&(parent->children), parent->num_children)
+        != 0) {
+        return -1;
+    }
+
+    /* move the entries on the right one place to the right */
+    memmove(parent->children + i + 1, parent->children + i,
+            sizeof(struct h_entry *) * (parent->num_children - i));
+    parent->children[i] = child;
+    parent->num_children++;
+
+    return 0;
+}
+
+/*
+ * remove a child from the ordered children array of a folder
+ *
+ * returns true if the child was found and removed and false otherwise
+ */
+static bool folder_tree_children_remove(struct h_entry *parent,
+                                        struct h_entry *child)
+{
+    uint64_t        i;
+
+    /* only compare pointers and not keys. This relies on keys being unique.
+     * Since multiple children can have the same name, check all of them */
+    for (i = folder_tree_children_bisect(parent, child->name,
+                                         strlen(child->name));
+         i < parent->num_children
+         && strcmp(parent->children[i]->name, child->name) == 0; i++) {
+        if (parent->children[i] == child) {
+            break;
+        }
+    }
+
+    if (i >= parent->num_children || parent->children[i] != child) {
+        return false;
+    }
+
+    /* move the entries on the right one place to the left */
+    memmove(parent->children + i, parent->children + i + 1,
+            sizeof(struct h_entry *) * (parent->num_children - i - 1));
+    parent->num_children--;
+    /* change the children size */
+    if (parent->num_children == 0) {
+        free(parent->children);
+        parent->children = NULL;
+    }
+
+    return true;
+}
+
+static int children_name_compare(const void *a, const void *b)
+{
+    return strcmp((*(struct h_entry **)a)->name,
+                  (*(struct h_entry **)b)->name);
+}
+
+/*
+ * given a path, return the h_entry struct of the last component
+ *
+ * the path must start with a slash
+ *
+ * the path is walked in place without copying it. Every component is looked
+ * up in the ordered children array of its parent folder using bisection.
+ *
+ * outdated folders on the way are retrieved from the remote and paged out
+ * folders on the way are paged in. If conn is NULL, the lookup fails with
+ * errno set to EAGAIN instead. If the tree is offline, the last known content
+ * of outdated folders is used. Otherwise, errno is set to ENOENT if nothing
+ * was found.
+ */
+static struct h_entry *folder_tree_lookup_path(folder_tree * tree,
+                                               mfconn * conn, const char *path)
+{
+    const char     *tmp_path;
+    const char     *slash_pos;
+    size_t          len;
+    uint64_t        hash;
+    struct h_entry *curr_dir;
+    struct h_entry *result;
+
+    if (path[0] != '/') {
+        fprintf(stderr, "Path must start with a slash\n");
+        errno = ENOENT;
+        return NULL;
+    }
+
+    curr_dir = &(tree->root);
+
+    // if the root is requested, return directly
+    if (strcmp(path, "/") == 0) {
+        return curr_dir;
+    }
+    // try the cache of resolved paths first
+    hash = folder_tree_path_hash(path);
+    result = folder_tree_dcache_lookup(tree, path, hash);
+    if (result != NULL) {
+        folder_tree_touch(tree, result->parent.entry);
+        return result;
+    }
+    // and then the cache of paths that do not exist
+    if (folder_tree_ncache_lookup(tree, path, hash)) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    // skip the leading slash
+    tmp_path = path + 1;
+    result = NULL;
+
+    for (;;) {
+        // make sure that the children of curr_dir are in memory
+        if (folder_tree_is_paged_out(curr_dir)) {
+            if (conn == NULL) {
+                errno = EAGAIN;
+                return NULL;
+            }
+            folder_tree_page_in(tree, curr_dir);
+        }
+        // make sure that curr_dir is up to date
+        if (curr_dir->file == NULL && !tree->offline
+            && curr_dir->local_revision != curr_dir->remote_revision) {
+            if (conn == NULL) {
+                errno = EAGAIN;
+                return NULL;
+            }
+            folder_tree_rebuild_helper(tree, conn, curr_dir);
+        }
+        // path with a trailing slash, so the remainder is of zero length
+        if (tmp_path[0] == '\0') {
+            // return curr_dir
+            result = curr_dir;
+            break;
+        }
+        slash_pos = strchr(tmp_path, '/');
+        if (slash_pos == NULL) {
+            // no slash found in the remaining path:
+            // find entry in current directory and return it
+            result = folder_tree_lookup_child(curr_dir, tmp_path,
+                                              strlen(tmp_path));
+
+            // remember that the up to date curr_dir has no such child
+            if (result == NULL) {
+                folder_tree_ncache_insert(tree, hash, curr_dir, tmp_path);
+            }
+
+            // make sure that result is up to date
+            if (result != NULL && result->file == NULL && !tree->offline
+                && result->local_revision != result->remote_revision) {
+                if (conn == NULL) {
+                    errno = EAGAIN;
+                    return NULL;
+                }
+                folder_tree_rebuild_helper(tree, conn, result);
+            }
+            // no matter whether the last part was found or not, iteration
+            // stops here
+            break;
+        }
+
+        len = slash_pos - tmp_path;
+
+        // a slash was found, so recurse into the directory of that name or
+        // abort if the name matches a file
+        curr_dir = folder_tree_lookup_child(curr_dir, tmp_path, len);
+
+        // a folder of matching name was not found, so we break out of this
+        // loop too
+        if (curr_dir == NULL) {
+            break;
+        }
+        // test if a file matched
+        if (curr_dir->file != NULL) {
+            fprintf(stderr, "A file can only be at the end of a path\n");
+            break;
+        }
+        // point tmp_path to the character after the last found slash
+        tmp_path = slash_pos + 1;
+    }
+
+    // only paths without a trailing slash can be verified on a later hit
+    if (result != NULL && result != &(tree->root)
+        && path[strlen(path) - 1] != '/') {
+        folder_tree_dcache_insert(tree, hash, result);
+    }
+
+    if (result != NULL && result != &(tree->root)) {
+        folder_tree_touch(tree, result->parent.entry);
+    }
+
+    if (result == NULL) {
+        errno = ENOENT;
+    }
+
+    return result;
+}
+
+/*
+ * 64 bit FNV-1a hash of a path
+ */
+static uint64_t folder_tree_path_hash(const char *path)
+{
+    uint64_t        hash;
+
+    hash = 14695981039346656037ULL;
+    for (; *path != '\0'; path++) {
+        hash ^= (unsigned char)*path;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/*
+ * check whether a cached entry is still the correct result for the first len
+ * bytes of a path
+ *
+ * the components of the path are compared from the back against the name of
+ * the entry and the names of its parents up to the root. Since the hash of
+ * the path can collide, this must be done for every hit.
+ *
+ * this also fails if any folder on the way is outdated, so that a lookup
+ * through folder_tree_lookup_path updates it as it would without the cache
+ */
+static bool folder_tree_dcache_matches(folder_tree * tree,
+                                       struct h_entry *entry, const char *path,
+                                       size_t len)
+{
+    const char     *start;
+    const char     *end;
+
+    end = path + len;
+
+    while (entry != &(tree->root)) {
+        if (entry == NULL) {
+            return false;
+        }
+        if (entry->file == NULL
+            && entry->local_revision != entry->remote_revision) {
+            return false;
+        }
+        // find the beginning of the last component
+        for (start = end; start > path && start[-1] != '/'; start--) ;
+        if (start == path) {
+            return false;
+        }
+        if (folder_tree_name_cmp(start, end - start, entry->name) != 0) {
+            return false;
+        }
+        // continue before the slash preceding this component
+        end = start - 1;
+        entry = entry->parent.entry;
+    }
+
+    if (tree->root.local_revision != tree->root.remote_revision) {
+        return false;
+    }
+    // the root was reached, so the path must be consumed up to the leading
+    // slash
+    return end == path;
+}
+
+static struct h_entry *folder_tree_dcache_lookup(folder_tree * tree,
+                                                 const char *path,
+                                                 uint64_t hash)
+{
+    struct dcache_slot *slot;
+    struct h_entry *entry;
+
+    slot = &(tree->dcache[hash & (DCACHE_SIZE - 1)]);
+
+    pthread_mutex_lock(&(tree->dcache_lock));
+    entry = slot->entry;
+    if (entry == NULL || slot->hash != hash) {
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&(tree->dcache_lock));
+
+    /* the entry itself cannot change while the lookup runs, so it is
+     * verified without holding the lock */
+    if (entry != NULL
+        && !folder_tree_dcache_matches(tree, entry, path, strlen(path))) {
+        entry = NULL;
+    }
+
+    pthread_mutex_lock(&(tree->dcache_lock));
+    if (entry != NULL) {
+        tree->dcache_hits++;
+    } else {
+        tree->dcache_misses++;
+    }
+    pthread_mutex_unlock(&(tree->dcache_lock));
+
+    return entry;
+}
+
+static void folder_tree_dcache_insert(folder_tree * tree, uint64_t hash,
+                                      struct h_entry *entry)
+{
+    struct dcache_slot *slot;
+
+    slot = &(tree->dcache[hash & (DCACHE_SIZE - 1)]);
+
+    pthread_mutex_lock(&(tree->dcache_lock));
+    if (slot->entry == NULL) {
+        tree->dcache_used++;
+    }
+    slot->hash = hash;
+    slot->entry = entry;
+    pthread_mutex_unlock(&(tree->dcache_lock));
+}
+
+/*
+ * remove all cached paths which resolve to the given entry or to any entry
+ * below it
+ *
+ * this must be called before the name or the parent of an entry changes,
+ * before the children of a folder are refetched and before an entry is freed
+ */
+static void folder_tree_dcache_invalidate(folder_tree * tree,
+                                          struct h_entry *entry)
+{
+    uint64_t        i;
+    struct h_entry *tmp_entry;
+
+    if (tree->dcache_used == 0) {
+        return;
+    }
+
+    /* the paths that were found not to exist stay valid */
+    if (entry == &(tree->root)) {
+        memset(tree->dcache, 0, sizeof(tree->dcache));
+        tree->dcache_used = 0;
+        return;
+    }
+
+    for (i = 0; i < DCACHE_SIZE; i++) {
+        for (tmp_entry = tree->dcache[i].entry;
+             tmp_entry != NULL && tmp_entry != &(tree->root);
+             tmp_entry = tmp_entry->parent.entry) {
+            if (tmp_entry == entry) {
+                tree->dcache[i].entry = NULL;
+                tree->dcache_used--;
+                break;
+            }
+        }
+    }
+}
+
+static void folder_tree_dcache_clear(folder_tree * tree)
+{
+    memset(tree->dcache, 0, sizeof(tree->dcache));
+    tree->dcache_used = 0;
+
+    folder_tree_ncache_clear(tree);
+}
+
+/*
+ * return true if the path was recently found not to exist and nothing
+ * changed in its folder since
+ */
+static bool folder_tree_ncache_lookup(folder_tree * tree, const char *path,
+                                      uint64_t hash)
+{
+    struct ncache_slot *slot;
+    struct h_entry *parent;
+    const char     *name;
+    uint64_t        revision;
+    bool            found;
+
+    name = strrchr(path, '/') + 1;
+    if (strlen(name) >= NCACHE_NAME_SIZE) {
+        return false;
+    }
+
+    slot = &(tree->ncache[hash & (NCACHE_SIZE - 1)]);
+
+    pthread_mutex_lock(&(tree->dcache_lock));
+    parent = NULL;
+    revision = 0;
+    if (slot->parent != NULL && slot->hash == hash
+        && strcmp(slot->name, name) == 0) {
+        parent = slot->parent;
+        revision = slot->revision;
+    }
+    pthread_mutex_unlock(&(tree->dcache_lock));
+
+    /* the path up to the name must still lead to the same folder which must
+     * not have been updated since */
+    found = parent != NULL && parent->remote_revision == revision
+        && folder_tree_dcache_matches(tree, parent, path, name - 1 - path);
+
+    if (found) {
+        pthread_mutex_lock(&(tree->dcache_lock));
+        tree->ncache_hits++;
+        pthread_mutex_unlock(&(tree->dcache_lock));
+    }
+
+    return found;
+}
+
+static void folder_tree_ncache_insert(folder_tree * tree, uint64_t hash,
+                                      struct h_entry *parent, const char *name)
+{
+    struct ncache_slot *slot;
+    uint64_t        bit;
+
+    if (strlen(name) >= NCACHE_NAME_SIZE) {
+        return;
+    }
+
+    slot = &(tree->ncache[hash & (NCACHE_SIZE - 1)]);
+
+    pthread_mutex_lock(&(tree->dcache_lock));
+    if (slot->parent == NULL) {
+        tree->ncache_used++;
+    }
+    slot->hash = hash;
+    slot->parent = parent;
+    slot->revision = parent->remote_revision;
+    strcpy(slot->name, name);
+    bit = folder_tree_ncache_bit(parent);
+    tree->ncache_folders[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    pthread_mutex_unlock(&(tree->dcache_lock));
 }
 
-void folder_tree_destroy(folder_tree * tree)
+/*
+ * the position of the bit of a folder in ncache_folders
+ *
+ * the address is used because the index of an entry changes when other
+ * entries are freed
+ */
+static uint64_t folder_tree_ncache_bit(struct h_entry *parent)
 {
-    folder_tree_free_entries(tree);
-    free(tree->filecache);
-    free(tree);
+    return ((uintptr_t) parent / sizeof(struct h_entry)) % NCACHE_SIZE;
 }
 
 /*
- * given a folderkey, lookup the h_entry struct of it in the hashtable
- *
- * if key is NULL, then a pointer to the root is returned
+ * remove the paths that were found not to exist in the given folder
  *
- * if no matching h_entry struct is found, NULL is returned
+ * this must be called before an entry is added to the folder, moved into it
+ * or renamed in it and before the folder is freed. Paths in other folders
+ * stay valid because a hit verifies the names and revisions of all folders
+ * up to the root
  */
-static struct h_entry *folder_tree_lookup_key(folder_tree * tree,
-                                              const char *key)
+static void folder_tree_ncache_invalidate(folder_tree * tree,
+                                          struct h_entry *parent)
 {
-    int             bucket_id;
+    uint64_t        bit;
     uint64_t        i;
 
-    if (key == NULL || key[0] == '\0') {
-        return &(tree->root);
+    bit = folder_tree_ncache_bit(parent);
+    if ((tree->ncache_folders[bit / 64] & ((uint64_t) 1 << (bit % 64)))
+        == 0) {
+        return;
     }
-    /* retrieve the right bucket for this key */
-    bucket_id = base36_decode_triplet(key);
 
-    for (i = 0; i < tree->bucket_lens[bucket_id]; i++) {
-        if (strcmp(tree->buckets[bucket_id][i]->key, key) == 0) {
-            return tree->buckets[bucket_id][i];
+    /* the bits of the remaining slots are set again */
+    memset(tree->ncache_folders, 0, sizeof(tree->ncache_folders));
+    for (i = 0; i < NCACHE_SIZE; i++) {
+        if (tree->ncache[i].parent == NULL) {
+            continue;
+        }
+        if (tree->ncache[i].parent == parent) {
+            tree->ncache[i].parent = NULL;
+            tree->ncache_used--;
+            continue;
         }
+        bit = folder_tree_ncache_bit(tree->ncache[i].parent);
+        tree->ncache_folders[bit / 64] |= (uint64_t) 1 << (bit % 64);
     }
+}
 
-    fprintf(stderr, "cannot find h_entry struct for key %s\n", key);
-    return NULL;
+static void folder_tree_ncache_clear(folder_tree * tree)
+{
+    if (tree->ncache_used == 0) {
+        return;
+    }
+
+    memset(tree->ncache, 0, sizeof(tree->ncache));
+    memset(tree->ncache_folders, 0, sizeof(tree->ncache_folders));
+    tree->ncache_used = 0;
+}
+
+void folder_tree_get_lookup_stats(folder_tree * tree, uint64_t * hits,
+                                  uint64_t * misses)
+{
+    pthread_mutex_lock(&(tree->dcache_lock));
+    *hits = tree->dcache_hits;
+    *misses = tree->dcache_misses;
+    pthread_mutex_unlock(&(tree->dcache_lock));
 }
 
 /*
- * given a path, return the h_entry struct of the last component
+ * fill stats with the number of entries of the tree, the memory used by each
+ * of its structures and the shape of the table of keys and of the folders
  *
- * the path must start with a slash
+ * this walks all entries, so it should not be called on every lookup
  */
-static struct h_entry *folder_tree_lookup_path(folder_tree * tree,
-                                               mfconn * conn, const char *path)
+void folder_tree_stats(folder_tree * tree, struct folder_tree_stats *stats)
 {
-    char           *tmp_path;
-    char           *new_path;
-    char           *slash_pos;
-    struct h_entry *curr_dir;
-    struct h_entry *result;
+    struct h_entry *entry;
     uint64_t        i;
-    bool            success;
-
-    if (path[0] != '/') {
-        fprintf(stderr, "Path must start with a slash\n");
-        return NULL;
-    }
-
-    curr_dir = &(tree->root);
-
-    // if the root is requested, return directly
-    if (strcmp(path, "/") == 0) {
-        return curr_dir;
-    }
-    // strip off the leading slash
-    new_path = strdup(path + 1);
-    tmp_path = new_path;
-    result = NULL;
-
-    for (;;) {
-        // make sure that curr_dir is up to date
-        if (curr_dir->atime == 0
-            && curr_dir->local_revision != curr_dir->remote_revision) {
-            folder_tree_rebuild_helper(tree, conn, curr_dir);
+    uint64_t        mask;
+    uint64_t        dist;
+    uint64_t        capacity;
+    uint64_t        num_links;
+    uint64_t        names_size;
+
+    memset(stats, 0, sizeof(struct folder_tree_stats));
+
+    num_links = 0;
+    names_size = 0;
+    for (i = 0; i < tree->num_entries; i++) {
+        entry = tree->entries_by_index[i];
+        names_size += strlen(entry->name) + 1;
+        if (entry->file != NULL) {
+            stats->num_files++;
+            continue;
         }
-        // path with a trailing slash, so the remainder is of zero length
-        if (tmp_path[0] == '\0') {
-            // return curr_dir
-            result = curr_dir;
-            break;
+        if (i > 0)
+            stats->num_folders++;
+        if (folder_tree_is_paged_out(entry)) {
+            stats->num_paged++;
+            continue;
         }
-        slash_pos = strchr(tmp_path, '/');
-        if (slash_pos == NULL) {
-            // no slash found in the remaining path:
-            // find entry in current directory and return it
-            for (i = 0; i < curr_dir->num_children; i++) {
-                if (strcmp(curr_dir->children[i]->name, tmp_path) == 0) {
-                    // return this directory
-                    result = curr_dir->children[i];
-
-                    // make sure that result is up to date
-                    if (result->atime == 0
-                        && result->local_revision != result->remote_revision) {
-                        folder_tree_rebuild_helper(tree, conn, result);
-                    }
-                    break;
-                }
-            }
-
-            // no matter whether the last part was found or not, iteration
-            // stops here
-            break;
+        num_links += entry->num_children;
+        if (entry->num_children > stats->max_children)
+            stats->max_children = entry->num_children;
+        /* children arrays are grown by folder_tree_array_grow */
+        if (entry->children != NULL) {
+            for (capacity = 1; capacity < entry->num_children;
+                 capacity *= 2) ;
+            stats->children_size += capacity * sizeof(struct h_entry *);
         }
+    }
+    /* the root is a folder as well */
+    stats->avg_children = (double)num_links / (stats->num_folders + 1
+                                               - stats->num_paged);
+
+    stats->entries_size = slab_get_size(tree->entries);
+    stats->files_size = slab_get_size(tree->files);
+    stats->names_size = strpool_get_size(tree->names);
+    stats->keys_size = tree->keys_capacity * sizeof(struct key_slot);
+    for (capacity = 1; capacity < tree->num_entries; capacity *= 2) ;
+    stats->index_size = capacity * sizeof(struct h_entry *);
+    stats->dirty_size = tree->dirty_capacity * sizeof(uint32_t);
+    stats->caches_size = sizeof(tree->dcache) + sizeof(tree->ncache)
+        + sizeof(tree->ncache_folders);
+    stats->map_size = tree->map_size;
+    stats->stamps_size = tree->stamps_capacity * sizeof(uint32_t);
+    if (tree->search != NULL)
+        stats->search_size = trigram_index_get_size(tree->search);
+    stats->total_size = sizeof(folder_tree) + stats->entries_size
+        + stats->files_size + stats->names_size + stats->keys_size
+        + stats->index_size + stats->children_size + stats->dirty_size
+        + stats->map_size + stats->stamps_size + stats->search_size;
+    stats->resident_size = folder_tree_resident_size(tree);
+    stats->memory_limit = tree->memory_limit;
+
+    stats->keys_capacity = tree->keys_capacity;
+    mask = tree->keys_capacity - 1;
+    for (i = 0; i < tree->keys_capacity; i++) {
+        if (tree->keys[i].index == 0)
+            continue;
+        dist = (i - (tree->keys[i].hash & mask)) & mask;
+        if (dist > stats->max_probe)
+            stats->max_probe = dist;
+        if (dist >= FOLDER_TREE_STATS_PROBE_BINS)
+            dist = FOLDER_TREE_STATS_PROBE_BINS - 1;
+        stats->probe_histogram[dist]++;
+    }
 
-        *slash_pos = '\0';
+    /* the same layout as written by folder_tree_store */
+    stats->store_size = sizeof(struct folder_tree_header_v1)
+        + tree->num_entries * sizeof(struct h_entry_v1)
+        + num_links * sizeof(uint64_t)
+        + (tree->num_entries - 1) * sizeof(uint64_t) + names_size;
+    stats->journal_size = folder_tree_journal_get_size(tree);
+
+    pthread_mutex_lock(&(tree->dcache_lock));
+    stats->dcache_hits = tree->dcache_hits;
+    stats->dcache_misses = tree->dcache_misses;
+    stats->ncache_hits = tree->ncache_hits;
+    pthread_mutex_unlock(&(tree->dcache_lock));
+}
 
-        // a slash was found, so recurse into the directory of that name or
-        // abort if the name matches a file
-        success = false;
-        for (i = 0; i < curr_dir->num_children; i++) {
-            if (strcmp(curr_dir->children[i]->name, tmp_path) == 0) {
-                // test if a file matched
-                if (curr_dir->children[i]->atime != 0) {
-                    fprintf(stderr,
-                            "A file can only be at the end of a path\n");
-                    break;
-                }
-                // a directory matched, break out of this loop and recurse
-                // deeper in the next iteration
-                curr_dir = curr_dir->children[i];
-                success = true;
-                break;
-            }
-        }
+void folder_tree_stats_print(const struct folder_tree_stats *stats,
+                             FILE * stream)
+{
+    int             i;
 
-        // either a file was part of a path or a folder of matching name was
-        // not found, so we break out of this loop too
-        if (!success) {
-            break;
-        }
-        // point tmp_path to the character after the last found slash
-        tmp_path = slash_pos + 1;
+    fprintf(stream, "entries: %" PRIu64 " files, %" PRIu64 " folders, %"
+            PRIu64 " of them paged out\n", stats->num_files,
+            stats->num_folders, stats->num_paged);
+    fprintf(stream, "memory: %" PRIu64 " bytes\n", stats->total_size);
+    fprintf(stream, "  entries:  %" PRIu64 "\n", stats->entries_size);
+    fprintf(stream, "  files:    %" PRIu64 "\n", stats->files_size);
+    fprintf(stream, "  names:    %" PRIu64 "\n", stats->names_size);
+    fprintf(stream, "  keys:     %" PRIu64 "\n", stats->keys_size);
+    fprintf(stream, "  index:    %" PRIu64 "\n", stats->index_size);
+    fprintf(stream, "  children: %" PRIu64 "\n", stats->children_size);
+    fprintf(stream, "  dirty:    %" PRIu64 "\n", stats->dirty_size);
+    fprintf(stream, "  caches:   %" PRIu64 "\n", stats->caches_size);
+    fprintf(stream, "  mapped:   %" PRIu64 "\n", stats->map_size);
+    fprintf(stream, "  stamps:   %" PRIu64 "\n", stats->stamps_size);
+    fprintf(stream, "  search:   %" PRIu64 "\n", stats->search_size);
+    if (stats->memory_limit > 0) {
+        fprintf(stream, "resident: %" PRIu64 " bytes, limit %" PRIu64
+                " bytes\n", stats->resident_size, stats->memory_limit);
+    } else {
+        fprintf(stream, "resident: %" PRIu64 " bytes, no limit\n",
+                stats->resident_size);
     }
-
-    free(new_path);
-
-    return result;
+    fprintf(stream, "key table: %" PRIu64 " slots, max probe %" PRIu64
+            "\n", stats->keys_capacity, stats->max_probe);
+    for (i = 0; i < FOLDER_TREE_STATS_PROBE_BINS; i++) {
+        fprintf(stream, "  probe %d%s: %" PRIu64 "\n", i,
+                i == FOLDER_TREE_STATS_PROBE_BINS - 1 ? "+" : "",
+                stats->probe_histogram[i]);
+    }
+    fprintf(stream, "children: max %" PRIu64 ", avg %.2f\n",
+            stats->max_children, stats->avg_children);
+    fprintf(stream, "dircache: %" PRIu64 " bytes, journal: %" PRIu64
+            " bytes\n", stats->store_size, stats->journal_size);
+    fprintf(stream, "lookup cache: %" PRIu64 " hits, %" PRIu64
+            " misses, %" PRIu64 " negative hits\n", stats->dcache_hits,
+            stats->dcache_misses, stats->ncache_hits);
 }
 
 uint64_t folder_tree_path_get_num_children(folder_tree * tree,
@@ -622,7 +3718,7 @@ bool folder_tree_path_is_file(folder_tree * tree, mfconn * conn,
     result = folder_tree_lookup_path(tree, conn, path);
 
     if (result != NULL) {
-        return result->atime != 0;
+        return result->file != NULL;
     } else {
         return false;
     }
@@ -636,7 +3732,7 @@ bool folder_tree_path_is_directory(folder_tree * tree, mfconn * conn,
     result = folder_tree_lookup_path(tree, conn, path);
 
     if (result != NULL) {
-        return result->atime == 0;
+        return result->file == NULL;
     } else {
         return false;
     }
@@ -669,22 +3765,16 @@ bool folder_tree_path_exists(folder_tree * tree, mfconn * conn,
     return result != NULL;
 }
 
-int folder_tree_getattr(folder_tree * tree, mfconn * conn, const char *path,
-                        struct stat *stbuf)
+/*
+ * fill the attributes of a file or folder
+ */
+static void folder_tree_entry_stat(struct h_entry *entry, struct stat *stbuf)
 {
-    struct h_entry *entry;
-
-    entry = folder_tree_lookup_path(tree, conn, path);
-
-    if (entry == NULL) {
-        return -ENOENT;
-    }
-
     stbuf->st_uid = geteuid();
     stbuf->st_gid = getegid();
     stbuf->st_ctime = entry->ctime;
     stbuf->st_mtime = entry->ctime;
-    if (entry->atime == 0) {
+    if (entry->file == NULL) {
         /* folder */
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = entry->num_children + 2;
@@ -696,33 +3786,95 @@ int folder_tree_getattr(folder_tree * tree, mfconn * conn, const char *path,
         /* file */
         stbuf->st_mode = S_IFREG | 0666;
         stbuf->st_nlink = 1;
-        stbuf->st_atime = entry->atime;
-        stbuf->st_size = entry->fsize;
+        stbuf->st_atime = entry->file->atime;
+        stbuf->st_size = entry->file->fsize;
         stbuf->st_blksize = 4096;
-        stbuf->st_blocks = (entry->fsize) / 4096 + 1;
+        stbuf->st_blocks = (entry->file->fsize) / 4096 + 1;
+    }
+}
+
+/*
+ * if conn is NULL, then the tree is not modified, so that multiple threads
+ * can call this function and folder_tree_readdir concurrently as long as no
+ * other function is called at the same time. If the path leads through a
+ * folder whose content has to be retrieved from the remote first, -EAGAIN is
+ * returned and the call has to be repeated with a connection.
+ */
+int folder_tree_getattr(folder_tree * tree, mfconn * conn, const char *path,
+                        struct stat *stbuf)
+{
+    struct h_entry *entry;
+
+    entry = folder_tree_lookup_path(tree, conn, path);
+
+    if (entry == NULL) {
+        return errno == EAGAIN ? -EAGAIN : -ENOENT;
     }
 
+    folder_tree_entry_stat(entry, stbuf);
+
     return 0;
 }
 
+/*
+ * like folder_tree_getattr, this does not modify the tree if conn is NULL
+ *
+ * every entry is passed to filldir together with its attributes, so that
+ * listing a directory in long format does not cost another lookup per entry.
+ * The offset of an entry is its position in the sorted children after "." and
+ * "..", so that a directory that does not fit into the buffer of filldir can
+ * be continued where the last call stopped instead of starting over.
+ */
 int folder_tree_readdir(folder_tree * tree, mfconn * conn, const char *path,
-                        void *buf, fuse_fill_dir_t filldir)
+                        void *buf, fuse_fill_dir_t filldir, off_t offset)
 {
     struct h_entry *entry;
+    struct stat     stbuf;
     uint64_t        i;
 
     entry = folder_tree_lookup_path(tree, conn, path);
 
+    if (entry == NULL && errno == EAGAIN) {
+        return -EAGAIN;
+    }
+
     /* either directory not found or found entry is not a directory */
-    if (entry == NULL || entry->atime != 0) {
+    if (entry == NULL || entry->file != NULL) {
         return -ENOENT;
     }
 
-    filldir(buf, ".", NULL, 0);
-    filldir(buf, "..", NULL, 0);
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    if (folder_tree_is_paged_out(entry)) {
+        if (conn == NULL) {
+            return -EAGAIN;
+        }
+        /* a folder whose page could not be read is retrieved again */
+        if (folder_tree_page_in(tree, entry) != 0 && !tree->offline) {
+            folder_tree_rebuild_helper(tree, conn, entry);
+        }
+    }
+    folder_tree_touch(tree, entry);
+
+    if (offset < 1) {
+        memset(&stbuf, 0, sizeof(stbuf));
+        folder_tree_entry_stat(entry, &stbuf);
+        if (filldir(buf, ".", &stbuf, 1) != 0)
+            return 0;
+    }
+    if (offset < 2) {
+        if (filldir(buf, "..", NULL, 2) != 0)
+            return 0;
+    }
 
-    for (i = 0; i < entry->num_children; i++) {
-        filldir(buf, entry->children[i]->name, NULL, 0);
+    for (i = offset < 2 ? 0 : (uint64_t) (offset - 2);
+         i < entry->num_children; i++) {
+        memset(&stbuf, 0, sizeof(stbuf));
+        folder_tree_entry_stat(entry->children[i], &stbuf);
+        if (filldir(buf, entry->children[i]->name, &stbuf, i + 3) != 0)
+            break;
     }
 
     return 0;
@@ -763,101 +3915,407 @@ int folder_tree_upload_patch(folder_tree * tree, mfconn * conn,
 
     entry = folder_tree_lookup_path(tree, conn, path);
     /* either file not found or found entry is not a file */
-    if (entry == NULL || entry->atime == 0) {
+    if (entry == NULL || entry->file == NULL) {
+        return -ENOENT;
+    }
+
+
+    temp1 = strdup(path);
+    filename = basename(temp1);
+    temp2 = strdup(path);
+    dir_name = dirname(temp2);
+
+    folder_key = folder_tree_path_get_key(tree, conn, dir_name);
+
+    retval = filecache_upload_patch(entry->key, entry->local_revision,
+                                    tree->filecache, conn, filename, folder_key);
+    free(temp1);
+    free(temp2);
+
+    if (retval != 0) {
+        fprintf(stderr, "filecache_upload_patch failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int folder_tree_truncate_file(folder_tree * tree, mfconn * conn,
+			      const char *path)
+{
+    struct h_entry *entry;
+    int             retval;
+    bool            is_file = 0;
+    const char     *key = NULL;
+    uint64_t        before;
+    uint64_t        after;
+
+    key = folder_tree_path_get_key(tree, conn, path);
+    if (key == NULL) {
+	fprintf(stderr, "key is NULL\n");
+	return -1;
+    }
+
+    is_file = folder_tree_path_is_file(tree, conn, path);
+    if (!is_file) {
+	fprintf(stderr, "Truncate is only defined for files, not folders\n");
+	return -1;
+    }
+
+    entry = folder_tree_lookup_path(tree, conn, path);
+    if (entry == NULL || entry->file == NULL) {
+	return -ENOENT;
+    }
+    before = folder_tree_cached_size(tree, entry->key,
+				     entry->local_revision);
+    if (entry->remote_revision != entry->local_revision)
+	before += folder_tree_cached_size(tree, entry->key,
+					  entry->remote_revision);
+    retval = filecache_truncate_file(entry->key, key, entry->local_revision,
+				     entry->remote_revision, tree->filecache,
+				     conn);
+    if (retval < 0) {
+	fprintf(stderr, "filecache truncate file failed\n");
+	return -1;
+    }
+    after = folder_tree_cached_size(tree, entry->key,
+				    entry->local_revision);
+    if (entry->remote_revision != entry->local_revision)
+	after += folder_tree_cached_size(tree, entry->key,
+					 entry->remote_revision);
+    folder_tree_cache_resize(tree, before, after);
+    entry->local_revision = entry->remote_revision;
+    folder_tree_journal_entry(tree, entry);
+    folder_tree_journal_flush(tree);
+
+    return 0;
+}
+
+/*
+ * open the cached content of a file, retrieving it first if necessary and
+ * update is set
+ *
+ * a file that is only read and whose content is neither cached nor can be
+ * patched is read from a partial cache file instead, so that only the parts
+ * that are read have to be retrieved. Then the partial cache file is returned
+ * in part and zero instead of a file descriptor. It has to be given back to
+ * folder_tree_close_part.
+ *
+ * until the file is given back to folder_tree_close_file, its cached content
+ * is not removed to free space
+ */
+int folder_tree_open_file(folder_tree * tree, mfconn * conn, const char *path,
+                          mode_t mode, bool update, filecache_part ** part)
+{
+    struct h_entry *entry;
+    uint64_t        local_revision;
+    uint64_t        before;
+    uint64_t        after;
+    bool            was_cached;
+    int             retval;
+
+    *part = NULL;
+
+    entry = folder_tree_lookup_path(tree, conn, path);
+
+    /* either file not found or found entry is not a file */
+    if (entry == NULL || entry->file == NULL) {
         return -ENOENT;
     }
+    fprintf(stderr, "opening %s with local %" PRIu64 " and remote %" PRIu64
+            "\n", entry->key, entry->local_revision, entry->remote_revision);
+
+    /* retrieving or patching the file changes the size of the cache */
+    local_revision = entry->local_revision;
+    before = folder_tree_cached_size(tree, entry->key, local_revision);
+    if (entry->remote_revision != local_revision)
+        before += folder_tree_cached_size(tree, entry->key,
+                                          entry->remote_revision);
+
+    was_cached = folder_tree_is_cached(tree, entry, entry->remote_revision);
+
+    if (update && (mode & O_ACCMODE) == O_RDONLY && !was_cached
+        && !folder_tree_is_cached(tree, entry, entry->local_revision)) {
+        *part = folder_tree_open_part(tree, conn, entry);
+        if (*part == NULL) {
+            fprintf(stderr, "folder_tree_open_part failed\n");
+            return -1;
+        }
+        retval = 0;
+    } else {
+        retval = filecache_open_file(entry->key, entry->local_revision,
+                                     entry->remote_revision,
+                                     entry->file->fsize, entry->file->hash,
+                                     tree->filecache, conn, mode, update);
+        if (retval == -1) {
+            fprintf(stderr, "filecache_open_file failed\n");
+            return -1;
+        }
+        /* filecache_open_file only retrieves or patches content that
+         * matches the hash afterwards */
+        if (update && !was_cached
+            && folder_tree_is_cached(tree, entry, entry->remote_revision)) {
+            folder_tree_set_verified(tree, entry, entry->remote_revision);
+        }
+    }
+
+    after = folder_tree_cached_size(tree, entry->key, local_revision);
+    if (entry->remote_revision != local_revision)
+        after += folder_tree_cached_size(tree, entry->key,
+                                         entry->remote_revision);
+    folder_tree_cache_resize(tree, before, after);
+
+    if (folder_tree_open_file_add(tree, entry->key) != 0) {
+        if (*part != NULL)
+            folder_tree_close_part(tree, *part);
+        else
+            close(retval);
+        *part = NULL;
+        return -1;
+    }
+
+    if (update && *part == NULL) {
+        /* make sure that the local_revision is equal to the remote revision
+         * because filecache_open_file took care of doing any updating if it
+         * was necessary. A partial cache file only becomes the local
+         * revision once it is complete */
+        entry->local_revision = entry->remote_revision;
+    }
+    // however the file was opened, its access time has to be updated
+    entry->file->atime = time(NULL);
+
+    /* without this, the cached content would be considered outdated after
+     * a crash */
+    folder_tree_journal_entry(tree, entry);
+    folder_tree_journal_flush(tree);
+
+    return retval;
+}
+
+/*
+ * give back a partial cache file returned by folder_tree_open_file
+ */
+void folder_tree_close_part(folder_tree * tree, filecache_part * part)
+{
+    struct h_entry *entry;
+    uint64_t        size;
+    size_t          i;
+
+    for (i = 0; i < tree->num_parts; i++) {
+        if (tree->parts[i].part != part) {
+            continue;
+        }
+        tree->parts[i].num_opens--;
+        if (tree->parts[i].num_opens > 0) {
+            return;
+        }
+        filecache_part_close(part);
+        /* the blocks that were read while it was open take space now */
+        size = folder_tree_cached_size(tree, tree->parts[i].key,
+                                       tree->parts[i].revision);
+        folder_tree_cache_resize(tree, tree->parts[i].size, size);
+        /* a partial file only becomes a cache file once it matches the
+         * hash */
+        entry = folder_tree_keys_find(tree, tree->parts[i].key, NULL);
+        if (entry != NULL && entry->file != NULL
+            && entry->remote_revision == tree->parts[i].revision
+            && folder_tree_is_cached(tree, entry, entry->remote_revision)) {
+            folder_tree_set_verified(tree, entry, entry->remote_revision);
+            entry->local_revision = entry->remote_revision;
+            folder_tree_journal_entry(tree, entry);
+            folder_tree_journal_flush(tree);
+        }
+        tree->parts[i] = tree->parts[tree->num_parts - 1];
+        tree->num_parts--;
+        return;
+    }
+
+    fprintf(stderr, "closing unknown partial file\n");
+}
+
+/*
+ * give back a file opened by folder_tree_open_file by its key, so that its
+ * cached content can be removed to free space again
+ */
+void folder_tree_close_file(folder_tree * tree, const char *key)
+{
+    size_t          i;
+
+    for (i = 0; i < tree->num_open_files; i++) {
+        if (strcmp(tree->open_files[i].key, key) != 0) {
+            continue;
+        }
+        tree->open_files[i].num_opens--;
+        if (tree->open_files[i].num_opens > 0) {
+            return;
+        }
+        tree->open_files[i] = tree->open_files[tree->num_open_files - 1];
+        tree->num_open_files--;
+        return;
+    }
 
+    fprintf(stderr, "closing unknown file %s\n", key);
+}
 
-    temp1 = strdup(path);
-    filename = basename(temp1);
-    temp2 = strdup(path);
-    dir_name = dirname(temp2);
-
-    folder_key = folder_tree_path_get_key(tree, conn, dir_name);
+static int folder_tree_open_file_add(folder_tree * tree, const char *key)
+{
+    struct open_file *open_files;
+    size_t          i;
 
-    retval = filecache_upload_patch(entry->key, entry->local_revision,
-                                    tree->filecache, conn, filename, folder_key);
-    free(temp1);
-    free(temp2);
+    for (i = 0; i < tree->num_open_files; i++) {
+        if (strcmp(tree->open_files[i].key, key) == 0) {
+            tree->open_files[i].num_opens++;
+            return 0;
+        }
+    }
 
-    if (retval != 0) {
-        fprintf(stderr, "filecache_upload_patch failed\n");
+    open_files = (struct open_file *)realloc(tree->open_files,
+                                             (tree->num_open_files + 1)
+                                             * sizeof(struct open_file));
+    if (open_files == NULL) {
+        fprintf(stderr, "realloc failed\n");
         return -1;
     }
+    tree->open_files = open_files;
+    strcpy(tree->open_files[tree->num_open_files].key, key);
+    tree->open_files[tree->num_open_files].num_opens = 1;
+    tree->num_open_files++;
 
     return 0;
 }
 
-int folder_tree_truncate_file(folder_tree * tree, mfconn * conn,
-			      const char *path)
+/*
+ * whether any revision of a file is open, completely cached or partially
+ */
+static bool folder_tree_is_open(folder_tree * tree, const char *key)
 {
-    struct h_entry *entry;
-    int             retval;
-    bool            is_file = 0;
-    const char     *key = NULL;
+    size_t          i;
 
-    key = folder_tree_path_get_key(tree, conn, path);
-    if (key == NULL) {
-	fprintf(stderr, "key is NULL\n");
-	return -1;
+    for (i = 0; i < tree->num_open_files; i++) {
+        if (strcmp(tree->open_files[i].key, key) == 0)
+            return true;
     }
-
-    is_file = folder_tree_path_is_file(tree, conn, path);
-    if (!is_file) {
-	fprintf(stderr, "Truncate is only defined for files, not folders\n");
-	return -1;
+    for (i = 0; i < tree->num_parts; i++) {
+        if (strcmp(tree->parts[i].key, key) == 0)
+            return true;
     }
 
-    entry = folder_tree_lookup_path(tree, conn, path);
-    if (entry == NULL || entry->atime == 0) {
-	return -ENOENT;
-    }
-    retval = filecache_truncate_file(entry->key, key, entry->local_revision,
-				     entry->remote_revision, tree->filecache,
-				     conn);
-    if (retval < 0) {
-	fprintf(stderr, "filecache truncate file failed\n");
-	return -1;
+    return false;
+}
+
+/*
+ * the number of bytes that a file in the cache takes on disk. Partial cache
+ * files are created with the size of the remote file but are sparse, so only
+ * the blocks that were retrieved take space
+ */
+static uint64_t folder_tree_disk_size(const struct stat *st)
+{
+    return (uint64_t) st->st_blocks * 512;
+}
+
+/*
+ * the number of bytes that the complete and partial cache files of a
+ * revision of a file take on disk
+ */
+static uint64_t folder_tree_cached_size(folder_tree * tree, const char *key,
+                                        uint64_t revision)
+{
+    static const char *const suffixes[] = { "", "_part", "_blocks" };
+    struct stat     st;
+    char           *cachefile;
+    uint64_t        size;
+    size_t          i;
+
+    size = 0;
+    for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        cachefile = strdup_printf("%s/%s_%" PRIu64 "%s", tree->filecache,
+                                  key, revision, suffixes[i]);
+        if (stat(cachefile, &st) == 0)
+            size += folder_tree_disk_size(&st);
+        free(cachefile);
     }
-    entry->local_revision = entry->remote_revision;
-      
-    return 0;
+
+    return size;
 }
 
-int folder_tree_open_file(folder_tree * tree, mfconn * conn, const char *path,
-                          mode_t mode, bool update)
+static void folder_tree_cache_resize(folder_tree * tree, uint64_t before,
+                                     uint64_t after)
 {
-    struct h_entry *entry;
+    /* the size is only an estimate between two measurements, so it must not
+     * wrap around if files were removed behind its back */
+    if (after < before && tree->cache_size < before - after)
+        tree->cache_size = 0;
+    else
+        tree->cache_size = tree->cache_size + after - before;
+}
+
+uint64_t folder_tree_get_cache_size(folder_tree * tree)
+{
+    return tree->cache_size;
+}
+
+/*
+ * whether the complete content of a revision of a file is cached
+ */
+static bool folder_tree_is_cached(folder_tree * tree, struct h_entry *entry,
+                                  uint64_t revision)
+{
+    struct stat     st;
+    char           *cachefile;
     int             retval;
 
-    entry = folder_tree_lookup_path(tree, conn, path);
+    cachefile = strdup_printf("%s/%s_%" PRIu64, tree->filecache, entry->key,
+                              revision);
+    retval = stat(cachefile, &st);
+    free(cachefile);
 
-    /* either file not found or found entry is not a file */
-    if (entry == NULL || entry->atime == 0) {
-        return -ENOENT;
-    }
-    fprintf(stderr, "opening %s with local %" PRIu64 " and remote %" PRIu64
-            "\n", entry->key, entry->local_revision, entry->remote_revision);
+    return retval == 0;
+}
 
-    retval = filecache_open_file(entry->key, entry->local_revision,
-                                 entry->remote_revision, entry->fsize,
-                                 entry->hash, tree->filecache, conn, mode,
-                                 update);
-    if (retval == -1) {
-        fprintf(stderr, "filecache_open_file failed\n");
-        return -1;
+/*
+ * return the partial cache file of the remote revision of a file, sharing it
+ * with the other file handles that read it
+ */
+static filecache_part *folder_tree_open_part(folder_tree * tree,
+                                             mfconn * conn,
+                                             struct h_entry *entry)
+{
+    struct open_part *parts;
+    filecache_part *part;
+    size_t          i;
+
+    for (i = 0; i < tree->num_parts; i++) {
+        if (tree->parts[i].revision == entry->remote_revision
+            && strcmp(tree->parts[i].key, entry->key) == 0) {
+            tree->parts[i].num_opens++;
+            return tree->parts[i].part;
+        }
     }
 
-    if (update) {
-        /* make sure that the local_revision is equal to the remote revision
-         * because filecache_open_file took care of doing any updating if it
-         * was necessary */
-        entry->local_revision = entry->remote_revision;
+    part = filecache_part_open(entry->key, entry->remote_revision,
+                               entry->file->fsize, entry->file->hash,
+                               tree->filecache, conn);
+    if (part == NULL) {
+        return NULL;
     }
-    // however the file was opened, its access time has to be updated
-    entry->atime = time(NULL);
 
-    return retval;
+    parts = (struct open_part *)realloc(tree->parts, (tree->num_parts + 1)
+                                        * sizeof(struct open_part));
+    if (parts == NULL) {
+        fprintf(stderr, "realloc failed\n");
+        filecache_part_close(part);
+        return NULL;
+    }
+    tree->parts = parts;
+    strcpy(tree->parts[tree->num_parts].key, entry->key);
+    tree->parts[tree->num_parts].revision = entry->remote_revision;
+    tree->parts[tree->num_parts].num_opens = 1;
+    tree->parts[tree->num_parts].part = part;
+    tree->parts[tree->num_parts].size =
+        folder_tree_cached_size(tree, entry->key, entry->remote_revision);
+    tree->num_parts++;
+
+    return part;
 }
 
 static bool folder_tree_is_root(struct h_entry *entry)
@@ -867,25 +4325,26 @@ static bool folder_tree_is_root(struct h_entry *entry)
         return false;
     }
 
-    return (entry->name[0] == '\0'
-            || (strncmp(entry->name, "myfiles", sizeof(entry->name)) == 0))
+    return (entry->name[0] == '\0' || strcmp(entry->name, "myfiles") == 0)
         && entry->key[0] == '\0';
 }
 
 /*
- * given a key and the new parent, this function makes sure to allocate new
- * memory if necessary and adjust the children arrays of the former and new
- * parent to accommodate for the change
+ * given a key, a name and the new parent, this function makes sure to
+ * allocate new memory if necessary and adjust the children arrays of the
+ * former and new parent to accommodate for the change
+ *
+ * the name is set by this function because the position of the entry in the
+ * ordered children array of its parent depends on it. If name is NULL, then
+ * the name of an existing entry is kept.
  */
 static struct h_entry *folder_tree_allocate_entry(folder_tree * tree,
                                                   const char *key,
+                                                  const char *name,
                                                   struct h_entry *new_parent)
 {
     struct h_entry *entry;
-    int             bucket_id;
     struct h_entry *old_parent;
-    uint64_t        i;
-    bool            found;
 
     if (tree == NULL) {
         fprintf(stderr, "tree cannot be NULL\n");
@@ -897,40 +4356,50 @@ static struct h_entry *folder_tree_allocate_entry(folder_tree * tree,
         return NULL;
     }
 
+    /* the entry might be one of the paged out children of the new parent */
+    if (folder_tree_is_paged_out(new_parent)) {
+        folder_tree_page_in(tree, new_parent);
+    }
+
     entry = folder_tree_lookup_key(tree, key);
 
     if (entry == NULL) {
         fprintf(stderr,
                 "key is NULL but this is fine, we just create it now\n");
-        /* entry was not found, so append it to the end of the bucket */
-        entry = (struct h_entry *)calloc(1, sizeof(struct h_entry));
-        bucket_id = base36_decode_triplet(key);
-        tree->bucket_lens[bucket_id]++;
-        tree->buckets[bucket_id] =
-            realloc(tree->buckets[bucket_id],
-                    sizeof(struct h_entry *) * tree->bucket_lens[bucket_id]);
-        if (tree->buckets[bucket_id] == NULL) {
-            fprintf(stderr, "realloc failed\n");
+        /* entry was not found, so create it and add it to the hashtable */
+        entry = (struct h_entry *)slab_alloc(tree->entries);
+        if (entry == NULL) {
+            fprintf(stderr, "slab_alloc failed\n");
+            return NULL;
+        }
+        strncpy(entry->key, key, sizeof(entry->key));
+        if (folder_tree_index_add(tree, entry) != 0) {
+            slab_free(tree->entries, entry);
+            return NULL;
+        }
+        if (folder_tree_keys_insert(tree, entry) != 0) {
+            folder_tree_index_remove(tree, entry);
+            slab_free(tree->entries, entry);
+            return NULL;
+        }
+
+        if (folder_tree_set_name(tree, entry, name != NULL ? name : "") != 0) {
             return NULL;
         }
-        tree->buckets[bucket_id][tree->bucket_lens[bucket_id] - 1] = entry;
 
         /* since this entry is new, just add it to the children of its parent
          *
          * since the key of this file or folder did not exist in the
          * hashtable, we do not have to check whether the parent already has
-         * it as a child but can just append to its list of children
-         */
-        new_parent->num_children++;
-        new_parent->children =
-            (struct h_entry **)realloc(new_parent->children,
-                                       new_parent->num_children *
-                                       sizeof(struct h_entry *));
-        if (new_parent->children == NULL) {
-            fprintf(stderr, "realloc failed\n");
+         * it as a child
+         *
+         * paths which did not exist before might lead to it now */
+        folder_tree_ncache_invalidate(tree, new_parent);
+        if (folder_tree_children_add(new_parent, entry) != 0) {
             return NULL;
         }
-        new_parent->children[new_parent->num_children - 1] = entry;
+        folder_tree_mark_dirty(tree, entry);
+        folder_tree_mark_dirty(tree, new_parent);
 
         return entry;
     }
@@ -940,33 +4409,29 @@ static struct h_entry *folder_tree_allocate_entry(folder_tree * tree,
 
     old_parent = entry->parent.entry;
 
+    /* cached paths to this entry and to everything below it become invalid
+     * if it is moved or renamed and its new path might have been found not
+     * to exist before */
+    if (old_parent != new_parent
+        || (name != NULL && strcmp(entry->name, name) != 0)) {
+        folder_tree_dcache_invalidate(tree, entry);
+        folder_tree_ncache_invalidate(tree, new_parent);
+    }
+
+    /* if the entry moves, then the children of both parents change */
+    if (old_parent != new_parent) {
+        folder_tree_mark_dirty(tree, entry);
+        folder_tree_mark_dirty(tree, new_parent);
+        if (old_parent != NULL) {
+            folder_tree_mark_dirty(tree, old_parent);
+        }
+    }
+
     /* check whether entry does not have a parent (this is the case for the
      * root node) */
     if (old_parent != NULL) {
         /* remove the file or folder from the old parent */
-        for (i = 0; i < old_parent->num_children; i++) {
-            if (old_parent->children[i] == entry) {
-                /* move the entries on the right one place to the left */
-                memmove(old_parent->children + i, old_parent->children + i + 1,
-                        sizeof(struct h_entry *) * (old_parent->num_children -
-                                                    i - 1));
-                old_parent->num_children--;
-                /* change the children size */
-                if (old_parent->num_children == 0) {
-                    free(old_parent->children);
-                    old_parent->children = NULL;
-                } else {
-                    old_parent->children =
-                        (struct h_entry **)realloc(old_parent->children,
-                                                   old_parent->num_children *
-                                                   sizeof(struct h_entry *));
-                    if (old_parent->children == NULL) {
-                        fprintf(stderr, "realloc failed\n");
-                        return NULL;
-                    }
-                }
-            }
-        }
+        folder_tree_children_remove(old_parent, entry);
     } else {
         /* sanity check: if the parent was NULL then this entry must be the
          * root */
@@ -978,34 +4443,56 @@ static struct h_entry *folder_tree_allocate_entry(folder_tree * tree,
         }
     }
 
-    /* and add it to the new */
     /* since the entry already existed, it can be that the new parent
-     * already contains the child */
-    found = false;
+     * already contains the child, so remove it from there as well before
+     * possibly renaming it, because otherwise it cannot be found at its
+     * position in the ordered children array anymore */
+    if (new_parent != old_parent) {
+        folder_tree_children_remove(new_parent, entry);
+    }
 
-    for (i = 0; i < new_parent->num_children; i++) {
-        if (new_parent->children[i] == entry) {
-            found = true;
-            break;
+    if (name != NULL) {
+        if (folder_tree_set_name(tree, entry, name) != 0) {
+            return NULL;
         }
     }
 
-    if (!found) {
-        new_parent->num_children++;
-        new_parent->children =
-            (struct h_entry **)realloc(new_parent->children,
-                                       new_parent->num_children *
-                                       sizeof(struct h_entry *));
-        if (new_parent->children == 0) {
-            fprintf(stderr, "realloc failed\n");
+    /* and add it to the new parent
+     *
+     * the root is never added as a child of itself */
+    if (entry != new_parent) {
+        if (folder_tree_children_add(new_parent, entry) != 0) {
             return NULL;
         }
-        new_parent->children[new_parent->num_children - 1] = entry;
     }
 
     return entry;
 }
 
+/*
+ * replace the name of an entry by the pooled copy of the given name
+ *
+ * this must only be called while the entry is not part of the children array
+ * of its parent
+ */
+static int folder_tree_set_name(folder_tree * tree, struct h_entry *entry,
+                                const char *name)
+{
+    const char     *pooled_name;
+
+    pooled_name = strpool_intern(tree->names, name);
+    if (pooled_name == NULL) {
+        fprintf(stderr, "strpool_intern failed\n");
+        return -1;
+    }
+    folder_tree_search_drop(tree, entry);
+    folder_tree_release_name(tree, entry->name);
+    entry->name = pooled_name;
+    folder_tree_search_add(tree, entry);
+
+    return 0;
+}
+
 /*
  * When adding an existing key, the old key is overwritten.
  * Return the inserted or updated key
@@ -1043,14 +4530,27 @@ static struct h_entry *folder_tree_add_file(folder_tree * tree, mffile * file,
         old_revision = old_entry->local_revision;
     }
 
-    new_entry = folder_tree_allocate_entry(tree, key, new_parent);
+    new_entry = folder_tree_allocate_entry(tree, key, file_get_name(file),
+                                           new_parent);
+    if (new_entry == NULL) {
+        fprintf(stderr, "folder_tree_allocate_entry failed\n");
+        return NULL;
+    }
+
+    /* mark this h_entry struct as a file if it is not one yet */
+    if (new_entry->file == NULL) {
+        new_entry->file = (struct h_file *)slab_alloc(tree->files);
+        if (new_entry->file == NULL) {
+            fprintf(stderr, "slab_alloc failed\n");
+            return NULL;
+        }
+        new_entry->file->atime = 1;
+    }
 
-    strncpy(new_entry->key, key, sizeof(new_entry->key));
-    strncpy(new_entry->name, file_get_name(file), sizeof(new_entry->name));
     new_entry->parent.entry = new_parent;
     new_entry->remote_revision = file_get_revision(file);
     new_entry->ctime = file_get_created(file);
-    new_entry->fsize = file_get_size(file);
+    new_entry->file->fsize = file_get_size(file);
     if (old_entry != NULL) {
         new_entry->local_revision = old_revision;
     } else {
@@ -1058,11 +4558,9 @@ static struct h_entry *folder_tree_add_file(folder_tree * tree, mffile * file,
     }
 
     /* convert the hex string into its binary representation */
-    hex2binary(file_get_hash(file), new_entry->hash);
+    hex2binary(file_get_hash(file), new_entry->file->hash);
 
-    /* mark this h_entry struct as a file if its atime is not set yet */
-    if (new_entry->atime == 0)
-        new_entry->atime = 1;
+    folder_tree_journal_entry(tree, new_entry);
 
     return new_entry;
 }
@@ -1073,74 +4571,247 @@ static struct h_entry *folder_tree_add_file(folder_tree * tree, mffile * file,
  * if the revision of the existing entry was found to be less than the new
  * entry, also update its contents
  *
- * returns a pointer to the added or updated h_entry struct
+ * returns a pointer to the added or updated h_entry struct
+ */
+static struct h_entry *folder_tree_add_folder(folder_tree * tree,
+                                              mffolder * folder,
+                                              struct h_entry *new_parent)
+{
+    struct h_entry *new_entry;
+    const char     *key;
+    const char     *name;
+    uint64_t        old_revision;
+    struct h_entry *old_entry;
+
+    if (tree == NULL) {
+        fprintf(stderr, "tree cannot be NULL\n");
+        return NULL;
+    }
+
+    if (folder == NULL) {
+        fprintf(stderr, "folder cannot be NULL\n");
+        return NULL;
+    }
+
+    if (new_parent == NULL) {
+        fprintf(stderr, "new parent cannot be NULL\n");
+        return NULL;
+    }
+
+    key = folder_get_key(folder);
+
+    /* if the folder already existed in the hashtable, store its old revision
+     * so that we can schedule an update of its content at the end of this
+     * function */
+    old_entry = folder_tree_lookup_key(tree, key);
+    if (old_entry != NULL) {
+        old_revision = old_entry->local_revision;
+    }
+
+    /* key and name can be NULL for root */
+    name = folder_get_name(folder);
+    new_entry = folder_tree_allocate_entry(tree, key, name, new_parent);
+    if (new_entry == NULL) {
+        fprintf(stderr, "folder_tree_allocate_entry failed\n");
+        return NULL;
+    }
+
+    new_entry->remote_revision = folder_get_revision(folder);
+    new_entry->ctime = folder_get_created(folder);
+    new_entry->parent.entry = new_parent;
+    if (old_entry != NULL) {
+        new_entry->local_revision = old_revision;
+    } else {
+        new_entry->local_revision = 0;
+    }
+
+    folder_tree_journal_entry(tree, new_entry);
+
+    return new_entry;
+}
+
+/*
+ * given a h_entry struct of a folder, this function gets the remote content
+ * of that folder and fills its children
+ *
+ * the chunks of the content are added to the children as they arrive. The
+ * children that the remote does not have anymore are only removed once all
+ * chunks arrived, so that a folder whose content could not be retrieved
+ * completely keeps its old children until it is retrieved again.
+ */
+static int folder_tree_rebuild_helper(folder_tree * tree, mfconn * conn,
+                                      struct h_entry *curr_entry)
+{
+    struct folder_tree_content content;
+    long            retval;
+
+    /* a paged out folder is paged in first so that its subfolders keep
+     * their revisions and are not retrieved again */
+    if (folder_tree_is_paged_out(curr_entry)) {
+        folder_tree_page_in(tree, curr_entry);
+    }
+
+    content.tree = tree;
+    content.entry = curr_entry;
+    content.seen = NULL;
+    content.num_seen = 0;
+
+    retval = mfconn_api_folder_get_content_chunks(conn, 0, curr_entry->key,
+                                                  folder_tree_add_chunk,
+                                                  &content);
+    if (retval == 0) {
+        retval = mfconn_api_folder_get_content_chunks(conn, 1,
+                                                      curr_entry->key,
+                                                      folder_tree_add_chunk,
+                                                      &content);
+    }
+    if (retval != 0) {
+        fprintf(stderr, "folder/get_content failed\n");
+        free(content.seen);
+        return -1;
+    }
+
+    folder_tree_keep_children(tree, curr_entry, content.seen,
+                              content.num_seen);
+    free(content.seen);
+
+    /* since the children have been updated, no update is needed anymore */
+    curr_entry->local_revision = curr_entry->remote_revision;
+    folder_tree_journal_entry(tree, curr_entry);
+
+    return 0;
+}
+
+/*
+ * add the folders and files of a chunk of the content of a folder to its
+ * children and free them
+ */
+static int folder_tree_add_chunk(int chunk, mffolder ** folder_result,
+                                 mffile ** file_result, void *data)
+{
+    struct folder_tree_content *content;
+    struct h_entry *entry;
+    int             retval;
+    int             i;
+
+    (void)chunk;
+
+    content = (struct folder_tree_content *)data;
+    retval = 0;
+
+    for (i = 0; folder_result != NULL && folder_result[i] != NULL; i++) {
+        if (folder_get_key(folder_result[i]) == NULL) {
+            fprintf(stderr, "folder_get_key returned NULL\n");
+            continue;
+        }
+        entry = folder_tree_add_folder(content->tree, folder_result[i],
+                                       content->entry);
+        if (entry == NULL) {
+            continue;
+        }
+        if (folder_tree_array_grow(&(content->seen), content->num_seen) != 0) {
+            retval = -1;
+            break;
+        }
+        content->seen[content->num_seen++] = entry;
+    }
+
+    for (i = 0; file_result != NULL && file_result[i] != NULL; i++) {
+        if (file_get_key(file_result[i]) == NULL) {
+            fprintf(stderr, "file_get_key returned NULL\n");
+            continue;
+        }
+        entry = folder_tree_add_file(content->tree, file_result[i],
+                                     content->entry);
+        if (entry == NULL) {
+            continue;
+        }
+        if (folder_tree_array_grow(&(content->seen), content->num_seen) != 0) {
+            retval = -1;
+            break;
+        }
+        content->seen[content->num_seen++] = entry;
+    }
+
+    folder_tree_free_content(folder_result, file_result);
+
+    return retval;
+}
+
+/*
+ * remove the children of a folder which are not among the ones that were
+ * seen while its content was retrieved
+ *
+ * like folder_tree_apply_content, this leaves the removed entries dangling
+ * until the housekeeping function cleans them up
  */
-static struct h_entry *folder_tree_add_folder(folder_tree * tree,
-                                              mffolder * folder,
-                                              struct h_entry *new_parent)
+static void folder_tree_keep_children(folder_tree * tree,
+                                      struct h_entry *curr_entry,
+                                      struct h_entry **seen,
+                                      uint64_t num_seen)
 {
-    struct h_entry *new_entry;
-    const char     *key;
-    const char     *name;
-    uint64_t        old_revision;
-    struct h_entry *old_entry;
+    struct h_entry *child;
+    uint64_t        num_kept;
+    uint64_t        i;
 
-    if (tree == NULL) {
-        fprintf(stderr, "tree cannot be NULL\n");
-        return NULL;
+    if (num_seen > 0) {
+        qsort(seen, num_seen, sizeof(struct h_entry *),
+              entry_pointer_compare);
     }
 
-    if (folder == NULL) {
-        fprintf(stderr, "folder cannot be NULL\n");
-        return NULL;
+    /* the order of the children is kept while the others are left out */
+    num_kept = 0;
+    for (i = 0; i < curr_entry->num_children; i++) {
+        child = curr_entry->children[i];
+        if (num_seen > 0
+            && bsearch(&child, seen, num_seen, sizeof(struct h_entry *),
+                       entry_pointer_compare) != NULL) {
+            curr_entry->children[num_kept++] = child;
+        } else {
+            folder_tree_mark_dirty(tree, child);
+        }
     }
-
-    if (new_parent == NULL) {
-        fprintf(stderr, "new parent cannot be NULL\n");
-        return NULL;
+    if (num_kept == curr_entry->num_children) {
+        return;
     }
 
-    key = folder_get_key(folder);
+    /* cached paths through this folder might have become invalid */
+    folder_tree_dcache_invalidate(tree, curr_entry);
+    folder_tree_mark_dirty(tree, curr_entry);
 
-    /* if the folder already existed in the hashtable, store its old revision
-     * so that we can schedule an update of its content at the end of this
-     * function */
-    old_entry = folder_tree_lookup_key(tree, key);
-    if (old_entry != NULL) {
-        old_revision = old_entry->local_revision;
+    curr_entry->num_children = num_kept;
+    if (num_kept == 0) {
+        free(curr_entry->children);
+        curr_entry->children = NULL;
     }
 
-    new_entry = folder_tree_allocate_entry(tree, key, new_parent);
-
-    /* can be NULL for root */
-    if (key != NULL)
-        strncpy(new_entry->key, key, sizeof(new_entry->key));
-    /* can be NULL for root */
-    name = folder_get_name(folder);
-    if (name != NULL)
-        strncpy(new_entry->name, name, sizeof(new_entry->name));
-    new_entry->remote_revision = folder_get_revision(folder);
-    new_entry->ctime = folder_get_created(folder);
-    new_entry->parent.entry = new_parent;
-    if (old_entry != NULL) {
-        new_entry->local_revision = old_revision;
-    } else {
-        new_entry->local_revision = 0;
+    folder_tree_journal_key(tree, JOURNAL_CLEAR_CHILDREN, curr_entry->key);
+    for (i = 0; i < curr_entry->num_children; i++) {
+        folder_tree_journal_entry(tree, curr_entry->children[i]);
     }
+}
 
-    return new_entry;
+static int entry_pointer_compare(const void *a, const void *b)
+{
+    const struct h_entry *entry_a = *(struct h_entry * const *)a;
+    const struct h_entry *entry_b = *(struct h_entry * const *)b;
+
+    if (entry_a < entry_b)
+        return -1;
+    if (entry_a > entry_b)
+        return 1;
+    return 0;
 }
 
 /*
- * given a h_entry struct of a folder, this function gets the remote content
- * of that folder and fills its children
+ * replace the children of a folder by the given folders and files and free
+ * them
  */
-static int folder_tree_rebuild_helper(folder_tree * tree, mfconn * conn,
-                                      struct h_entry *curr_entry)
+static void folder_tree_apply_content(folder_tree * tree,
+                                      struct h_entry *curr_entry,
+                                      mffolder ** folder_result,
+                                      mffile ** file_result)
 {
-    int             retval;
-    mffolder      **folder_result;
-    mffile        **file_result;
     int             i;
     const char     *key;
 
@@ -1156,163 +4827,263 @@ static int folder_tree_rebuild_helper(folder_tree * tree, mfconn * conn,
      * (including from the trash) and thus did not show up in a
      * device/get_changes call. All these entries will be cleaned up by the
      * housekeeping function
+     *
+     * cached paths through this folder might thus become invalid as well
+     *
+     * a paged out folder is paged in first so that its subfolders keep
+     * their revisions and are not retrieved again
      */
+    if (folder_tree_is_paged_out(curr_entry)) {
+        folder_tree_page_in(tree, curr_entry);
+    }
+    folder_tree_dcache_invalidate(tree, curr_entry);
+
+    for (i = 0; i < (int)curr_entry->num_children; i++) {
+        folder_tree_mark_dirty(tree, curr_entry->children[i]);
+    }
+    folder_tree_mark_dirty(tree, curr_entry);
+
     free(curr_entry->children);
     curr_entry->children = NULL;
     curr_entry->num_children = 0;
+    folder_tree_journal_key(tree, JOURNAL_CLEAR_CHILDREN, curr_entry->key);
 
     /* first folders */
-    folder_result = NULL;
-    retval =
-        mfconn_api_folder_get_content(conn, 0, curr_entry->key, &folder_result,
-                                      NULL);
-    if (retval != 0) {
-        fprintf(stderr, "folder/get_content failed\n");
-        if (folder_result != NULL) {
-            for (i = 0; folder_result[i] != NULL; i++) {
-                free(folder_result[i]);
-            }
-            free(folder_result);
-        }
-        return -1;
-    }
-
     for (i = 0; folder_result[i] != NULL; i++) {
         key = folder_get_key(folder_result[i]);
         if (key == NULL) {
             fprintf(stderr, "folder_get_key returned NULL\n");
-            folder_free(folder_result[i]);
             continue;
         }
         folder_tree_add_folder(tree, folder_result[i], curr_entry);
-        folder_free(folder_result[i]);
     }
-    free(folder_result);
 
     /* then files */
-    file_result = NULL;
-    retval =
-        mfconn_api_folder_get_content(conn, 1, curr_entry->key, NULL,
-                                      &file_result);
-    if (retval != 0) {
-        fprintf(stderr, "folder/get_content failed\n");
-        if (file_result != NULL) {
-            for (i = 0; file_result[i] != NULL; i++) {
-                file_free(file_result[i]);
-            }
-            free(file_result);
-        }
-        return -1;
-    }
-
     for (i = 0; file_result[i] != NULL; i++) {
         key = file_get_key(file_result[i]);
         if (key == NULL) {
             fprintf(stderr, "file_get_key returned NULL\n");
-            file_free(file_result[i]);
             continue;
         }
         folder_tree_add_file(tree, file_result[i], curr_entry);
-        file_free(file_result[i]);
     }
-    free(file_result);
+
+    folder_tree_free_content(folder_result, file_result);
 
     /* since the children have been updated, no update is needed anymore */
     curr_entry->local_revision = curr_entry->remote_revision;
+    folder_tree_journal_entry(tree, curr_entry);
+}
+
+/*
+ * retrieve the folders and files in the folder with the given key
+ *
+ * this does not access the tree, so it can be called by any thread with its
+ * own connection. The results are handed to folder_tree_set_content or freed
+ * by folder_tree_free_content.
+ */
+int folder_tree_fetch_content(mfconn * conn, const char *key,
+                              mffolder *** folder_result,
+                              mffile *** file_result)
+{
+    int             retval;
+
+    *folder_result = NULL;
+    *file_result = NULL;
+
+    retval = mfconn_api_folder_get_content(conn, 0, key, folder_result, NULL);
+    if (retval == 0) {
+        retval = mfconn_api_folder_get_content(conn, 1, key, NULL,
+                                               file_result);
+    }
+    if (retval != 0) {
+        fprintf(stderr, "folder/get_content failed\n");
+        folder_tree_free_content(*folder_result, *file_result);
+        *folder_result = NULL;
+        *file_result = NULL;
+        return -1;
+    }
 
     return 0;
 }
 
+void folder_tree_free_content(mffolder ** folder_result, mffile ** file_result)
+{
+    int             i;
+
+    if (folder_result != NULL) {
+        for (i = 0; folder_result[i] != NULL; i++) {
+            folder_free(folder_result[i]);
+        }
+        free(folder_result);
+    }
+    if (file_result != NULL) {
+        for (i = 0; file_result[i] != NULL; i++) {
+            file_free(file_result[i]);
+        }
+        free(file_result);
+    }
+}
+
+/*
+ * replace the children of the folder with the given key by the results of
+ * folder_tree_fetch_content and free them
+ *
+ * if the folder was removed or updated by someone else since its content
+ * was fetched, then the results are discarded
+ */
+void folder_tree_set_content(folder_tree * tree, const char *key,
+                             mffolder ** folder_result, mffile ** file_result)
+{
+    struct h_entry *entry;
+
+    entry = folder_tree_lookup_key(tree, key);
+    if (entry == NULL || entry->file != NULL
+        || entry->local_revision == entry->remote_revision) {
+        folder_tree_free_content(folder_result, file_result);
+        return;
+    }
+
+    folder_tree_apply_content(tree, entry, folder_result, file_result);
+
+    folder_tree_journal_flush(tree);
+}
+
+/*
+ * return the keys of the folders whose content has to be retrieved as a
+ * NULL terminated array that has to be freed together with its elements
+ *
+ * if key is NULL, then the whole tree is searched. Otherwise only the direct
+ * subfolders of the folder with that key are. The key of the root is the
+ * empty string.
+ */
+char          **folder_tree_get_outdated_folders(folder_tree * tree,
+                                                 const char *key)
+{
+    struct h_entry **entries;
+    struct h_entry *parent;
+    struct h_entry *entry;
+    uint64_t        num_entries;
+    uint64_t        num_keys;
+    uint64_t        i;
+    char          **keys;
+
+    if (key == NULL) {
+        entries = tree->entries_by_index;
+        num_entries = tree->num_entries;
+    } else {
+        parent = folder_tree_lookup_key(tree, key);
+        if (parent == NULL || folder_tree_is_paged_out(parent)) {
+            entries = NULL;
+            num_entries = 0;
+        } else {
+            entries = parent->children;
+            num_entries = parent->num_children;
+        }
+    }
+
+    num_keys = 0;
+    for (i = 0; i < num_entries; i++) {
+        entry = entries[i];
+        if (entry->file == NULL
+            && entry->local_revision != entry->remote_revision) {
+            num_keys++;
+        }
+    }
+
+    keys = (char **)malloc((num_keys + 1) * sizeof(char *));
+    if (keys == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        return NULL;
+    }
+
+    num_keys = 0;
+    for (i = 0; i < num_entries; i++) {
+        entry = entries[i];
+        if (entry->file == NULL
+            && entry->local_revision != entry->remote_revision) {
+            keys[num_keys] = strdup(entry->key);
+            num_keys++;
+        }
+    }
+    keys[num_keys] = NULL;
+
+    return keys;
+}
+
 /* When trying to delete a non-existing key, nothing happens */
 static void folder_tree_remove(folder_tree * tree, const char *key)
 {
-    int             bucket_id;
-    int             found;
-    uint64_t        i;
     struct h_entry *entry;
-    struct h_entry *parent;
 
     if (key == NULL) {
         fprintf(stderr, "cannot remove root\n");
         return;
     }
 
-    bucket_id = base36_decode_triplet(key);
+    /* invalidate the cached paths of the whole subtree at once instead of
+     * for every removed entry in it */
+    entry = folder_tree_keys_find(tree, key, NULL);
+    if (entry != NULL) {
+        folder_tree_dcache_invalidate(tree, entry);
+    }
+
+    folder_tree_remove_helper(tree, key);
 
-    /* check if the key exists */
-    found = 0;
-    for (i = 0; i < tree->bucket_lens[bucket_id]; i++) {
-        if (strcmp(tree->buckets[bucket_id][i]->key, key) == 0) {
-            found = 1;
-            break;
-        }
+    folder_tree_journal_key(tree, JOURNAL_REMOVE, key);
+}
+
+static void folder_tree_remove_helper(folder_tree * tree, const char *key)
+{
+    uint64_t        i;
+    struct h_entry *entry;
+    struct h_entry *parent;
+
+    if (key == NULL) {
+        fprintf(stderr, "cannot remove root\n");
+        return;
     }
 
-    if (!found) {
+    /* check if the key exists */
+    entry = folder_tree_keys_find(tree, key, NULL);
+    if (entry == NULL) {
         fprintf(stderr, "key was not found, removing nothing\n");
         return;
     }
 
-    /* if found, use the last value of i to adjust the bucket */
-    entry = tree->buckets[bucket_id][i];
-    /* move the items on the right one place to the left */
-    memmove(tree->buckets[bucket_id] + i, tree->buckets[bucket_id] + i + 1,
-            sizeof(struct h_entry *) * (tree->bucket_lens[bucket_id] - i - 1));
-    /* change bucket size */
-    tree->bucket_lens[bucket_id]--;
-    if (tree->bucket_lens[bucket_id] == 0) {
-        free(tree->buckets[bucket_id]);
-        tree->buckets[bucket_id] = NULL;
-    } else {
-        tree->buckets[bucket_id] =
-            realloc(tree->buckets[bucket_id],
-                    sizeof(struct h_entry) * tree->bucket_lens[bucket_id]);
-        if (tree->buckets[bucket_id] == NULL) {
-            fprintf(stderr, "realloc failed\n");
-            return;
-        }
-    }
+    folder_tree_keys_remove(tree, entry);
 
     /* if it is a folder, then we have to recurse into its children which
      * reference this folder as their parent because otherwise their parent
-     * pointers will reference unallocated memory */
-    if (entry->num_children > 0) {
-        for (i = 0; i < entry->num_children; i++) {
-            if (entry->children[i]->parent.entry == entry) {
-                folder_tree_remove(tree, entry->children[i]->key);
-            }
+     * pointers will reference unallocated memory
+     *
+     * since every removed child removes itself from the children array of
+     * this entry, iterate from the end so that no child is skipped
+     *
+     * the children of a paged out folder are not in memory, so there is
+     * nothing to remove. Its page is removed by the next checkpoint */
+    for (i = folder_tree_is_paged_out(entry) ? 0 : entry->num_children;
+         i > 0; i--) {
+        if (entry->children[i - 1]->parent.entry == entry) {
+            folder_tree_remove_helper(tree, entry->children[i - 1]->key);
+        } else {
+            /* its real parent might not know about it */
+            folder_tree_mark_dirty(tree, entry->children[i - 1]);
         }
     }
 
     /* remove the entry from its parent */
     parent = entry->parent.entry;
-    for (i = 0; i < parent->num_children; i++) {
-        if (entry->parent.entry->children[i] == entry) {
-            /* move the entries on the right one place to the left */
-            memmove(parent->children + i, parent->children + i + 1,
-                    sizeof(struct h_entry *) * (parent->num_children - i - 1));
-            parent->num_children--;
-            /* change the children size */
-            if (parent->num_children == 0) {
-                free(parent->children);
-                parent->children = NULL;
-            } else {
-                parent->children =
-                    (struct h_entry **)realloc(parent->children,
-                                               parent->num_children *
-                                               sizeof(struct h_entry *));
-                if (parent->children == NULL) {
-                    fprintf(stderr, "realloc failed\n");
-                    return;
-                }
-            }
-        }
+    folder_tree_children_remove(parent, entry);
+    if (entry->file == NULL) {
+        folder_tree_ncache_invalidate(tree, entry);
     }
 
-    /* remove its possible children */
-    free(entry->children);
+    /* remove its possible children, its file information and its name */
+    folder_tree_free_entry_data(tree, entry);
     /* remove entry */
-    free(entry);
+    folder_tree_index_remove(tree, entry);
+    slab_free(tree->entries, entry);
 }
 
 /*
@@ -1331,17 +5102,24 @@ static bool folder_tree_is_parent_of(struct h_entry *parent,
                                      struct h_entry *child)
 {
     uint64_t        i;
-    bool            found;
 
-    found = false;
-    for (i = 0; i < parent->num_children; i++) {
+    /* entries are never resident while their parent is paged out */
+    if (folder_tree_is_paged_out(parent)) {
+        return false;
+    }
+
+    /* the children are ordered by name, so only the children with the same
+     * name as the child have to be checked */
+    for (i = folder_tree_children_bisect(parent, child->name,
+                                         strlen(child->name));
+         i < parent->num_children
+         && strcmp(parent->children[i]->name, child->name) == 0; i++) {
         if (parent->children[i] == child) {
-            found = true;
-            break;
+            return true;
         }
     }
 
-    return found;
+    return false;
 }
 
 /*
@@ -1458,6 +5236,109 @@ static int folder_tree_update_folder_info(folder_tree * tree, mfconn * conn,
     return 0;
 }
 
+/*
+ * order changes by their key and, for the same key, by their position which
+ * is the order of their revisions
+ */
+static int folder_tree_changes_cmp_key(const void *a, const void *b)
+{
+    const struct mfconn_device_change *change_a;
+    const struct mfconn_device_change *change_b;
+    int             cmp;
+
+    change_a = *(const struct mfconn_device_change **)a;
+    change_b = *(const struct mfconn_device_change **)b;
+
+    cmp = strcmp(change_a->key, change_b->key);
+    if (cmp != 0)
+        return cmp;
+    return (change_a > change_b) - (change_a < change_b);
+}
+
+/*
+ * same as folder_tree_changes_cmp_key but for the parent
+ */
+static int folder_tree_changes_cmp_parent(const void *a, const void *b)
+{
+    const struct mfconn_device_change *change_a;
+    const struct mfconn_device_change *change_b;
+    int             cmp;
+
+    change_a = *(const struct mfconn_device_change **)a;
+    change_b = *(const struct mfconn_device_change **)b;
+
+    cmp = strcmp(change_a->parent, change_b->parent);
+    if (cmp != 0)
+        return cmp;
+    return (change_a > change_b) - (change_a < change_b);
+}
+
+/*
+ * set skip[i] for every change that is followed by another change to the
+ * same key because only the latest change of a key has to be applied
+ *
+ * sorted must have room for num_changes pointers
+ */
+static void folder_tree_changes_dedupe(struct mfconn_device_change *changes,
+                                       uint64_t num_changes,
+                                       struct mfconn_device_change **sorted,
+                                       bool * skip)
+{
+    uint64_t        i;
+
+    for (i = 0; i < num_changes; i++) {
+        sorted[i] = &(changes[i]);
+    }
+
+    qsort(sorted, num_changes, sizeof(struct mfconn_device_change *),
+          folder_tree_changes_cmp_key);
+
+    for (i = 0; i + 1 < num_changes; i++) {
+        if (strcmp(sorted[i]->key, sorted[i + 1]->key) == 0) {
+            skip[sorted[i] - changes] = true;
+        }
+    }
+}
+
+/*
+ * apply the given changes to files
+ *
+ * if more than FOLDER_TREE_REFETCH_THRESHOLD files in the same folder
+ * changed, the content of that folder is retrieved once instead of asking
+ * for the information of every file
+ */
+static void folder_tree_update_files(folder_tree * tree, mfconn * conn,
+                                     struct mfconn_device_change **changes,
+                                     uint64_t num_changes)
+{
+    struct h_entry *parent;
+    uint64_t        first;
+    uint64_t        last;
+    uint64_t        i;
+
+    qsort(changes, num_changes, sizeof(struct mfconn_device_change *),
+          folder_tree_changes_cmp_parent);
+
+    for (first = 0; first < num_changes; first = last) {
+        for (last = first + 1; last < num_changes; last++) {
+            if (strcmp(changes[first]->parent, changes[last]->parent) != 0)
+                break;
+        }
+
+        if (last - first > FOLDER_TREE_REFETCH_THRESHOLD) {
+            parent = folder_tree_lookup_key(tree, changes[first]->parent);
+            if (parent != NULL
+                && folder_tree_rebuild_helper(tree, conn, parent) == 0) {
+                continue;
+            }
+        }
+
+        for (i = first; i < last; i++) {
+            folder_tree_update_file_info(tree, conn, changes[i]->key);
+        }
+    }
+}
+
 /*
  * ask the remote if there are changes after the locally stored revision
  *
@@ -1471,9 +5352,14 @@ void folder_tree_update(folder_tree * tree, mfconn * conn, bool expect_changes)
 {
     uint64_t        revision_remote;
     uint64_t        i;
+    uint64_t        num_changes;
+    uint64_t        num_files;
     struct mfconn_device_change *changes;
+    struct mfconn_device_change **sorted;
+    bool           *skip;
     int             retval;
     struct h_entry *tmp_entry;
+    struct h_entry *parent;
     const char     *key;
     uint64_t        revision;
 
@@ -1514,12 +5400,39 @@ void folder_tree_update(folder_tree * tree, mfconn * conn, bool expect_changes)
         return;
     }
 
-    for (i = 0; changes[i].change != MFCONN_DEVICE_CHANGE_END; i++) {
+    for (num_changes = 0;
+         changes[num_changes].change != MFCONN_DEVICE_CHANGE_END;
+         num_changes++) ;
+
+    skip = (bool *) calloc(num_changes + 1, sizeof(bool));
+    sorted = (struct mfconn_device_change **)
+        malloc((num_changes + 1) * sizeof(struct mfconn_device_change *));
+    if (skip == NULL || sorted == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        free(skip);
+        free(sorted);
+        free(changes);
+        return;
+    }
+
+    /* a key can show up several times but only its latest change matters */
+    folder_tree_changes_dedupe(changes, num_changes, sorted, skip);
+
+    /*
+     * first apply deletions and changes to folders so that the parents of
+     * changed files are known when deciding what to do about them
+     */
+    for (i = 0; i < num_changes; i++) {
+        if (skip[i])
+            continue;
         key = changes[i].key;
         revision = changes[i].revision;
         switch (changes[i].change) {
             case MFCONN_DEVICE_CHANGE_DELETED_FOLDER:
             case MFCONN_DEVICE_CHANGE_DELETED_FILE:
+                /* the entry might be paged out with its parent and must
+                 * not come back when the parent is paged in */
+                folder_tree_page_in_key(tree, changes[i].parent);
                 folder_tree_remove(tree, changes[i].key);
                 break;
             case MFCONN_DEVICE_CHANGE_UPDATED_FOLDER:
@@ -1547,24 +5460,49 @@ void folder_tree_update(folder_tree * tree, mfconn * conn, bool expect_changes)
                 folder_tree_update_folder_info(tree, conn, changes[i].key);
                 break;
             case MFCONN_DEVICE_CHANGE_UPDATED_FILE:
-                /* ignore files updated in trash */
-                if (strcmp(changes[i].parent, "trash") == 0)
-                    continue;
-                /* only do anything if the revision of the change is greater
-                 * than the revision of the locally stored entry */
-                tmp_entry = folder_tree_lookup_key(tree, key);
-                if (tmp_entry != NULL
-                    && tmp_entry->remote_revision >= revision) {
-                    break;
-                }
-                /* if a file changed, update its info */
-                folder_tree_update_file_info(tree, conn, key);
-                break;
             case MFCONN_DEVICE_CHANGE_END:
                 break;
         }
     }
 
+    /* then the changed files, as few requests as possible */
+    num_files = 0;
+    for (i = 0; i < num_changes; i++) {
+        if (skip[i]
+            || changes[i].change != MFCONN_DEVICE_CHANGE_UPDATED_FILE)
+            continue;
+        /* ignore files updated in trash */
+        if (strcmp(changes[i].parent, "trash") == 0)
+            continue;
+        folder_tree_page_in_key(tree, changes[i].parent);
+        /* only do anything if the revision of the change is greater
+         * than the revision of the locally stored entry */
+        tmp_entry = folder_tree_lookup_key(tree, changes[i].key);
+        if (tmp_entry != NULL
+            && tmp_entry->remote_revision >= changes[i].revision) {
+            continue;
+        }
+        /* the content of the root is retrieved below and the content of
+         * outdated folders is retrieved before it is accessed, so the file
+         * will be updated then */
+        parent = folder_tree_lookup_key(tree, changes[i].parent);
+        if (parent != NULL && (parent == &(tree->root)
+                               || parent->local_revision !=
+                               parent->remote_revision)) {
+            continue;
+        }
+        sorted[num_files] = &(changes[i]);
+        num_files++;
+    }
+
+    fprintf(stderr, "%" PRIu64 " changes, %" PRIu64
+            " files left to update\n", num_changes, num_files);
+
+    folder_tree_update_files(tree, conn, sorted, num_files);
+
+    free(sorted);
+    free(skip);
+
     /*
      * we have to manually check the root because it never shows up in the
      * results from device_get_changes
@@ -1585,7 +5523,8 @@ void folder_tree_update(folder_tree * tree, mfconn * conn, bool expect_changes)
 
     /* the new revision of the tree is the revision of the terminating change
      * */
-    tree->revision = changes[i].revision;
+    tree->revision = changes[num_changes].revision;
+    folder_tree_journal_revision(tree);
 
     /*
      * it can happen that another change happened remotely while we were
@@ -1603,14 +5542,30 @@ void folder_tree_update(folder_tree * tree, mfconn * conn, bool expect_changes)
     /* now fix up any possible errors */
 
     /* clean the resulting folder_tree of any dangling objects */
-    fprintf(stderr, "tree before cleaning:\n");
-    folder_tree_debug(tree);
     folder_tree_housekeep(tree, conn);
-    fprintf(stderr, "tree after cleaning:\n");
-    folder_tree_debug(tree);
 
-    /* free allocated memory */
-    free(changes);
+    /* free allocated memory */
+    free(changes);
+
+    folder_tree_journal_flush(tree);
+}
+
+/*
+ * while the tree is offline, lookups do not retrieve outdated folders but
+ * use what the tree knows about them, so that the tree can be used without
+ * a connection to the remote
+ */
+void folder_tree_set_offline(folder_tree * tree, bool offline)
+{
+    tree->offline = offline;
+}
+
+/*
+ * the revision of the remote that the tree is up to date with
+ */
+uint64_t folder_tree_get_revision(folder_tree * tree)
+{
+    return tree->revision;
 }
 
 /*
@@ -1635,6 +5590,7 @@ int folder_tree_rebuild(folder_tree * tree, mfconn * conn)
         return -1;
     }
     tree->revision = revision_before;
+    folder_tree_journal_revision(tree);
 
     /* walk the remote tree to build the folder_tree */
 
@@ -1657,122 +5613,163 @@ int folder_tree_rebuild(folder_tree * tree, mfconn * conn)
 }
 
 /*
- * clean up files and folders that are never referenced
- *
- * first find all folders that have children that do not reference their
- * parent. If a discrepancy is found, ask the remote for the true list of
- * children of that folder.
+ * if any child of a folder claims to have a different parent, ask the remote
+ * for the true list of children of that folder
  *
- * then find all files and folders that have a parent that does not reference
- * them. If a discrepancy is found, ask the remote for the true parent of that
- * file.
+ * this should actually never happen
  */
-
-void folder_tree_housekeep(folder_tree * tree, mfconn * conn)
+static void folder_tree_housekeep_children(folder_tree * tree, mfconn * conn,
+                                           struct h_entry *entry)
 {
-    uint64_t        i,
-                    j,
-                    k;
-    bool            found;
-
-    /*
-     * find objects with children who claim to have a different parent
-     *
-     * this should actually never happen
-     */
+    uint64_t        k;
 
-    /* first check the root as a special case */
+    /* the children of paged out folders were consistent when they were
+     * paged out */
+    if (folder_tree_is_paged_out(entry)) {
+        return;
+    }
 
-    found = false;
-    for (k = 0; k < tree->root.num_children; k++) {
+    for (k = 0; k < entry->num_children; k++) {
         /* only compare pointers and not keys. This relies on keys
          * being unique */
-        if (tree->root.children[k]->parent.entry != &(tree->root)) {
+        if (entry->children[k]->parent.entry != entry) {
             fprintf(stderr,
-                    "root claims that %s is its child but %s doesn't think so\n",
-                    tree->root.children[k]->key, tree->root.children[k]->key);
-            found = true;
-            break;
+                    "%s claims that %s is its child but %s doesn't think so\n",
+                    folder_tree_is_root(entry) ? "root" : entry->key,
+                    entry->children[k]->key, entry->children[k]->key);
+
+            /* some recursion will be done if the helper detects that some
+             * of the children it updated have a newer revision than the
+             * existing ones. This is necessary because device/get_changes
+             * does not report changes to items which were even removed
+             * from the trash
+             */
+            folder_tree_rebuild_helper(tree, conn, entry);
+            return;
         }
     }
-    if (found) {
+}
 
-        /*
-         * some recursion will be done if the helper detects that some of the
-         * children it updated have a newer revision than the existing ones.
-         * This is necessary because device/get_changes does not report
-         * changes to items which were even removed from the trash
-         */
-
-        folder_tree_rebuild_helper(tree, conn, &(tree->root));
-    }
-
-    /* then check the hashtable */
-    for (i = 0; i < NUM_BUCKETS; i++) {
-        for (j = 0; j < tree->bucket_lens[i]; j++) {
-            found = false;
-            for (k = 0; k < tree->buckets[i][j]->num_children; k++) {
-                /* only compare pointers and not keys. This relies on keys
-                 * being unique */
-                if (tree->buckets[i][j]->children[k]->parent.entry !=
-                    tree->buckets[i][j]) {
-                    fprintf(stderr,
-                            "%s claims that %s is its child but %s doesn't think so\n",
-                            tree->buckets[i][j]->key,
-                            tree->buckets[i][j]->children[k]->key,
-                            tree->buckets[i][j]->children[k]->key);
-                    found = true;
-                    break;
-                }
-            }
-            if (found) {
+/*
+ * if the parent of an entry does not list it as its child, ask the remote
+ * for the true parent of that entry
+ *
+ * this can happen when entries in the local hashtable do not exist anymore
+ * at the remote but have not been removed locally because they have not
+ * been part of any device/get_changes results. This can happen if the
+ * remote entries have been removed completely (including from the trash)
+ */
+static void folder_tree_housekeep_parent(folder_tree * tree, mfconn * conn,
+                                         struct h_entry *entry)
+{
+    if (folder_tree_is_root(entry)) {
+        return;
+    }
 
-                /* an entry was found that claims to have a different parent,
-                 * so ask the remote to retrieve the real list of children
-                 *
-                 * some recursion will be done if the helper detects that some
-                 * of the children it updated have a newer revision than the
-                 * existing ones. This is necessary because device/get_changes
-                 * does not report changes to items which were even removed
-                 * from the trash
-                 */
-
-                folder_tree_rebuild_helper(tree, conn, tree->buckets[i][j]);
-            }
+    if (!folder_tree_is_parent_of(entry->parent.entry, entry)) {
+        fprintf(stderr, "%s claims that %s is its parent but it is not\n",
+                entry->key, entry->parent.entry->key);
+        if (entry->file == NULL) {
+            /* folder */
+            folder_tree_update_folder_info(tree, conn, entry->key);
+        } else {
+            /* file */
+            folder_tree_update_file_info(tree, conn, entry->key);
         }
     }
+}
 
-    /* find objects whose parents do not match their actual parents
-     *
-     * this can happen when entries in the local hashtable do not exist
-     * anymore at the remote but have not been removed locally because they
-     * have not been part of any device/get_changes results. This can happen
-     * if the remote entries have been removed completely (including from the
-     * trash)
-     * */
-    for (i = 0; i < NUM_BUCKETS; i++) {
-        for (j = 0; j < tree->bucket_lens[i]; j++) {
-            if (!folder_tree_is_parent_of
-                (tree->buckets[i][j]->parent.entry, tree->buckets[i][j])) {
-                fprintf(stderr,
-                        "%s claims that %s is its parent but it is not\n",
-                        tree->buckets[i][j]->key,
-                        tree->buckets[i][j]->parent.entry->key);
-                if (tree->buckets[i][j]->atime == 0) {
-                    /* folder */
-                    folder_tree_update_folder_info(tree, conn,
-                                                   tree->buckets[i][j]->key);
-                } else {
-                    /* file */
-                    folder_tree_update_file_info(tree, conn,
-                                                 tree->buckets[i][j]->key);
-                }
-            }
-        }
+/*
+ * clean up files and folders that are never referenced
+ *
+ * only the entries whose parent or children changed since the last call are
+ * checked (see folder_tree_mark_dirty). If more entries were marked than the
+ * tree has, then all entries are checked by folder_tree_housekeep_full
+ * instead.
+ *
+ * folders whose children were refetched while checking the marked entries
+ * mark their former children, so those are checked in the second pass. Any
+ * entries that are marked during the second pass are left for the next
+ * call.
+ */
+void folder_tree_housekeep(folder_tree * tree, mfconn * conn)
+{
+    uint64_t        i,
+                    num_first,
+                    num_second;
+    struct h_entry *entry;
+
+    if (tree->dirty_overflow) {
+        folder_tree_housekeep_full(tree, conn);
+        return;
+    }
+
+    /* the entries might be removed while the list is traversed and
+     * folder_tree_index_remove gives their indices to other entries. So
+     * indices beyond the end are skipped and the entry for an index is
+     * looked up again every time. If the list overflows, it is emptied, so
+     * the loops check its length in every iteration */
+    num_first = tree->num_dirty;
+    for (i = 0; i < num_first && i < tree->num_dirty; i++) {
+        if (tree->dirty[i] >= tree->num_entries)
+            continue;
+        entry = tree->entries_by_index[tree->dirty[i]];
+        folder_tree_housekeep_children(tree, conn, entry);
+    }
+
+    num_second = tree->num_dirty;
+    for (i = 0; i < num_second && i < tree->num_dirty; i++) {
+        if (tree->dirty[i] >= tree->num_entries)
+            continue;
+        entry = tree->entries_by_index[tree->dirty[i]];
+        folder_tree_housekeep_parent(tree, conn, entry);
+    }
+
+    if (tree->num_dirty >= num_second) {
+        memmove(tree->dirty, tree->dirty + num_second,
+                sizeof(uint32_t) * (tree->num_dirty - num_second));
+        tree->num_dirty -= num_second;
+    }
+
+    folder_tree_journal_flush(tree);
+}
+
+/*
+ * like folder_tree_housekeep but check all entries
+ *
+ * first find all folders that have children that do not reference their
+ * parent. If a discrepancy is found, ask the remote for the true list of
+ * children of that folder.
+ *
+ * then find all files and folders that have a parent that does not reference
+ * them. If a discrepancy is found, ask the remote for the true parent of that
+ * file.
+ */
+void folder_tree_housekeep_full(folder_tree * tree, mfconn * conn)
+{
+    uint64_t        i;
+
+    /* everything is checked now, so the marks are not needed anymore */
+    free(tree->dirty);
+    tree->dirty = NULL;
+    tree->num_dirty = 0;
+    tree->dirty_capacity = 0;
+    tree->dirty_overflow = false;
+
+    /* entries might be added or removed while the list is traversed, so the
+     * entry at position i is looked up again in every iteration */
+    for (i = 0; i < tree->num_entries; i++) {
+        folder_tree_housekeep_children(tree, conn, tree->entries_by_index[i]);
+    }
+
+    for (i = 1; i < tree->num_entries; i++) {
+        folder_tree_housekeep_parent(tree, conn, tree->entries_by_index[i]);
     }
 
     /* TODO: should this routine call folder_tree_cleanup_filecache to remove
      * unreferenced or outdated files in the cache? */
+
+    folder_tree_journal_flush(tree);
 }
 
 void folder_tree_debug_helper(folder_tree * tree, struct h_entry *ent,
@@ -1784,8 +5781,14 @@ void folder_tree_debug_helper(folder_tree * tree, struct h_entry *ent,
         ent = &(tree->root);
     }
 
+    if (folder_tree_is_paged_out(ent)) {
+        fprintf(stderr, "%*s %" PRIu32 " children paged out\n", depth + 1,
+                " ", ent->num_children);
+        return;
+    }
+
     for (i = 0; i < ent->num_children; i++) {
-        if (ent->children[i]->atime == 0) {
+        if (ent->children[i]->file == NULL) {
             /* folder */
             fprintf(stderr, "%*s d:%s k:%s p:%s\n", depth + 1, " ",
                     ent->children[i]->name, ent->children[i]->key,
@@ -1805,9 +5808,73 @@ void folder_tree_debug(folder_tree * tree)
     folder_tree_debug_helper(tree, NULL, 0);
 }
 
+/*
+ * load the manifest of the cached files whose content was verified from
+ * path and store it there on every checkpoint
+ *
+ * folder_tree_cleanup_filecache then only reads the content of files whose
+ * size, modification time or inode changed since they were verified. Without
+ * a manifest, all files are read
+ */
+int folder_tree_manifest_open(folder_tree * tree, const char *path)
+{
+    manifest       *verified;
+
+    verified = manifest_load(path);
+    if (verified == NULL) {
+        return -1;
+    }
+
+    manifest_destroy(tree->verified);
+    tree->verified = verified;
+    free(tree->verified_path);
+    tree->verified_path = strdup(path);
+
+    return 0;
+}
+
+/*
+ * record that the cached content of a revision of a file matches its hash
+ */
+static void folder_tree_set_verified(folder_tree * tree,
+                                     struct h_entry *entry, uint64_t revision)
+{
+    struct stat     st;
+    char           *cachefile;
+
+    if (tree->verified == NULL) {
+        return;
+    }
+
+    cachefile = strdup_printf("%s/%s_%" PRIu64, tree->filecache, entry->key,
+                              revision);
+    if (stat(cachefile, &st) == 0) {
+        manifest_put(tree->verified, entry->key, revision, &st,
+                     entry->file->hash);
+    }
+    free(cachefile);
+}
+
+static void folder_tree_unset_verified(folder_tree * tree, const char *key,
+                                       uint64_t revision)
+{
+    if (tree->verified == NULL) {
+        return;
+    }
+
+    manifest_remove(tree->verified, key, revision);
+}
+
 static int atime_compare(const void *a, const void *b)
 {
-    return ((struct h_entry *)a)->atime - ((struct h_entry *)b)->atime;
+    const struct h_entry *entry_a = *(struct h_entry * const *)a;
+    const struct h_entry *entry_b = *(struct h_entry * const *)b;
+
+    if (entry_a->file->atime < entry_b->file->atime)
+        return -1;
+    if (entry_a->file->atime > entry_b->file->atime)
+        return 1;
+    return 0;
 }
 
 /*
@@ -1844,8 +5911,34 @@ static bool is_valid_cache_filename(const char *name, char key[],
     return true;
 }
 
+/*
+ * partial cache files and their bitmaps are named like cache files with
+ * _part and _blocks appended
+ */
+static bool is_partial_cache_filename(const char *name, char key[],
+                                      uint64_t * revision)
+{
+    char            cache_name[64];
+    const char     *suffix;
+
+    suffix = strrchr(name, '_');
+    if (suffix == NULL || (strcmp(suffix, "_part") != 0
+                           && strcmp(suffix, "_blocks") != 0))
+        return false;
+    if ((size_t) (suffix - name) >= sizeof(cache_name))
+        return false;
+
+    memcpy(cache_name, name, suffix - name);
+    cache_name[suffix - name] = '\0';
+
+    return is_valid_cache_filename(cache_name, key, revision);
+}
+
 /* go through all files in the filecache and check:
  *
+ *  - is it a partial file?
+ *      - if it is not of the remote revision of a known file, delete
+ *      - otherwise keep it for the remaining blocks
  *  - does the filename match the known pattern?
  *      (do not act on other files to avoid accidentally touching user
  *      files)
@@ -1853,7 +5946,8 @@ static bool is_valid_cache_filename(const char *name, char key[],
  *      - if no, delete
  *  - check if its revision is equal the remote revision
  *      - if no, delete
- *  - check if its size and hash verifies
+ *  - check if its size and hash verifies, unless the manifest says that it
+ *    did not change since it was last verified
  *      - if no, delete
  *  - once all files in the cache have been processed this way, check if
  *    the sum of their sizes is greater than X and delete the oldest
@@ -1873,6 +5967,9 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
     size_t          i;
     uint64_t        sum_size;
     struct h_entry **cachefiles;
+    const struct manifest_record *record;
+    manifest       *verified;
+    struct stat     st;
 
     // from the readdir_r man page
     name_max = pathconf(tree->filecache, _PC_NAME_MAX);
@@ -1889,6 +5986,13 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
     num_cachefiles = 0;
     cachefiles = NULL;
 
+    /* the manifest is built anew from the files that are kept, so that the
+     * records of removed files do not pile up */
+    verified = NULL;
+    if (tree->verified != NULL) {
+        verified = manifest_create();
+    }
+
     for (;;) {
         endp = NULL;
         retval = readdir_r(dirp, entryp, &endp);
@@ -1896,6 +6000,7 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
             fprintf(stderr, "readdir_r failed\n");
             free(entryp);
             closedir(dirp);
+            manifest_destroy(verified);
             if (cachefiles != NULL)
                 free(cachefiles);
             return;
@@ -1907,6 +6012,22 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
             strcmp(entryp->d_name, "..") == 0)
             continue;
 
+        if (is_partial_cache_filename(entryp->d_name, key, &revision)) {
+            entry = folder_tree_lookup_key(tree, key);
+            if (entry == NULL || entry->file == NULL
+                || revision != entry->remote_revision) {
+                fprintf(stderr, "delete outdated partial file: %s\n",
+                        entryp->d_name);
+                filepath = strdup_printf("%s/%s", tree->filecache,
+                                         entryp->d_name);
+                if (unlink(filepath) != 0) {
+                    fprintf(stderr, "unlink failed\n");
+                }
+                free(filepath);
+            }
+            continue;
+        }
+
         if (!is_valid_cache_filename(entryp->d_name, key, &revision)) {
             fprintf(stderr, "not a valid cachefile: %s (ignoring)\n",
                     entryp->d_name);
@@ -1916,7 +6037,7 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
         filepath = strdup_printf("%s/%s", tree->filecache, entryp->d_name);
 
         entry = folder_tree_lookup_key(tree, key);
-        if (entry == NULL) {
+        if (entry == NULL || entry->file == NULL) {
             fprintf(stderr, "delete file not in hashtable: %s\n",
                     entryp->d_name);
             retval = unlink(filepath);
@@ -1953,17 +6074,30 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
             continue;
         }
 
-        retval = file_check_integrity(filepath, entry->fsize, entry->hash);
-        if (retval != 0) {
-            fprintf(stderr, "delete file with invalid content: %s\n",
-                    entryp->d_name);
-            retval = unlink(filepath);
+        /* reading all of the cache would take long, so files that did
+         * not change since they were verified are trusted */
+        record = NULL;
+        if (verified != NULL && stat(filepath, &st) == 0) {
+            record = manifest_find(tree->verified, key, revision);
+        }
+        if (record == NULL
+            || !manifest_record_matches(record, &st, entry->file->hash)) {
+            retval = file_check_integrity(filepath, entry->file->fsize,
+                                          entry->file->hash);
             if (retval != 0) {
-                fprintf(stderr, "unlink failed\n");
+                fprintf(stderr, "delete file with invalid content: %s\n",
+                        entryp->d_name);
+                retval = unlink(filepath);
+                if (retval != 0) {
+                    fprintf(stderr, "unlink failed\n");
+                }
+                entry->local_revision = 0;
+                free(filepath);
+                continue;
             }
-            entry->local_revision = 0;
-            free(filepath);
-            continue;
+        }
+        if (verified != NULL && stat(filepath, &st) == 0) {
+            manifest_put(verified, key, revision, &st, entry->file->hash);
         }
         free(filepath);
 
@@ -1978,6 +6112,7 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
             fprintf(stderr, "realloc failed\n");
             free(entryp);
             closedir(dirp);
+            manifest_destroy(verified);
             return;
         }
         cachefiles[num_cachefiles - 1] = entry;
@@ -1986,6 +6121,12 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
     free(entryp);
     closedir(dirp);
 
+    if (verified != NULL) {
+        manifest_destroy(tree->verified);
+        tree->verified = verified;
+        manifest_store(tree->verified, tree->verified_path);
+    }
+
     // return if there are no files in the cache
     if (num_cachefiles == 0)
         return;
@@ -1994,7 +6135,7 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
     // is larger than allowed
     sum_size = 0;
     for (i = 0; i < num_cachefiles; i++) {
-        sum_size += cachefiles[i]->fsize;
+        sum_size += cachefiles[i]->file->fsize;
     }
 
     // if the summed size is below the allowed, return
@@ -2017,9 +6158,267 @@ void folder_tree_cleanup_filecache(folder_tree * tree, uint64_t allowed_size)
             fprintf(stderr, "unlink failed\n");
         }
         entry->local_revision = 0;
+        folder_tree_unset_verified(tree, entry->key, entry->remote_revision);
         free(filepath);
-        sum_size -= entry->fsize;
+        sum_size -= entry->file->fsize;
     }
 
     free(cachefiles);
 }
+
+/* a complete or partial cache file that folder_tree_evict_filecache can
+ * remove */
+struct evict_candidate {
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    uint64_t        revision;
+    bool            partial;
+    uint64_t        size;
+    uint64_t        atime;
+};
+
+static int evict_candidate_compare(const void *a, const void *b)
+{
+    const struct evict_candidate *cand_a = (const struct evict_candidate *)a;
+    const struct evict_candidate *cand_b = (const struct evict_candidate *)b;
+
+    if (cand_a->atime < cand_b->atime)
+        return -1;
+    if (cand_a->atime > cand_b->atime)
+        return 1;
+    return 0;
+}
+
+/*
+ * if the complete and partial cache files take more than high bytes, remove
+ * the least recently used ones until they take at most low bytes
+ *
+ * the size of the cache is measured anew on the way, so that changes made
+ * behind the back of the tree do not accumulate. Files that are open are
+ * never removed. The bitmap of a partial file is removed before its data, so
+ * that no blocks are considered present that are not. Returns the number of
+ * bytes that were removed
+ */
+uint64_t folder_tree_evict_filecache(folder_tree * tree, uint64_t high,
+                                     uint64_t low)
+{
+    struct evict_candidate *candidates;
+    struct evict_candidate *cand;
+    struct dirent  *entryp;
+    struct h_entry *entry;
+    struct stat     st;
+    DIR            *dirp;
+    char           *filepath;
+    char           *blocksfile;
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    uint64_t        revision;
+    uint64_t        total;
+    uint64_t        removed;
+    size_t          num_candidates;
+    size_t          capacity;
+    size_t          i;
+    bool            partial;
+    bool            bitmap;
+
+    dirp = opendir(tree->filecache);
+    if (dirp == NULL) {
+        fprintf(stderr, "cannot open filecache\n");
+        return 0;
+    }
+
+    candidates = NULL;
+    num_candidates = 0;
+    capacity = 0;
+    total = 0;
+
+    while ((entryp = readdir(dirp)) != NULL) {
+        if (is_valid_cache_filename(entryp->d_name, key, &revision)) {
+            partial = false;
+            bitmap = false;
+        } else if (is_partial_cache_filename(entryp->d_name, key,
+                                             &revision)) {
+            partial = true;
+            bitmap = strcmp(strrchr(entryp->d_name, '_'), "_blocks") == 0;
+        } else {
+            continue;
+        }
+
+        filepath = strdup_printf("%s/%s", tree->filecache, entryp->d_name);
+        if (stat(filepath, &st) != 0) {
+            free(filepath);
+            continue;
+        }
+        free(filepath);
+        total += folder_tree_disk_size(&st);
+
+        /* a bitmap is removed together with its data */
+        if (bitmap || folder_tree_is_open(tree, key))
+            continue;
+
+        if (num_candidates == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            cand = (struct evict_candidate *)
+                realloc(candidates, capacity * sizeof(*candidates));
+            if (cand == NULL) {
+                fprintf(stderr, "realloc failed\n");
+                free(candidates);
+                closedir(dirp);
+                return 0;
+            }
+            candidates = cand;
+        }
+        cand = &(candidates[num_candidates++]);
+        strcpy(cand->key, key);
+        cand->revision = revision;
+        cand->partial = partial;
+        cand->size = folder_tree_disk_size(&st);
+        /* files which are not in the tree go first */
+        entry = folder_tree_keys_find(tree, key, NULL);
+        cand->atime = entry != NULL && entry->file != NULL
+            ? entry->file->atime : 0;
+    }
+
+    closedir(dirp);
+
+    tree->cache_size = total;
+    for (i = 0; i < tree->num_parts; i++) {
+        tree->parts[i].size = folder_tree_cached_size(tree,
+                                                      tree->parts[i].key,
+                                                      tree->parts[i].revision);
+    }
+    removed = 0;
+
+    if (total > high) {
+        qsort(candidates, num_candidates, sizeof(struct evict_candidate),
+              evict_candidate_compare);
+
+        for (i = 0; i < num_candidates && tree->cache_size > low; i++) {
+            cand = &(candidates[i]);
+            filepath = strdup_printf("%s/%s_%" PRIu64 "%s", tree->filecache,
+                                     cand->key, cand->revision,
+                                     cand->partial ? "_part" : "");
+            if (cand->partial) {
+                blocksfile = strdup_printf("%s/%s_%" PRIu64 "_blocks",
+                                           tree->filecache, cand->key,
+                                           cand->revision);
+                if (stat(blocksfile, &st) == 0 && unlink(blocksfile) == 0) {
+                    folder_tree_cache_resize(tree, folder_tree_disk_size(&st),
+                                             0);
+                    removed += folder_tree_disk_size(&st);
+                }
+                free(blocksfile);
+            }
+            fprintf(stderr, "delete file to free space: %s\n", filepath);
+            if (unlink(filepath) != 0) {
+                fprintf(stderr, "unlink failed\n");
+                free(filepath);
+                continue;
+            }
+            free(filepath);
+            folder_tree_cache_resize(tree, cand->size, 0);
+            removed += cand->size;
+            if (!cand->partial)
+                folder_tree_unset_verified(tree, cand->key, cand->revision);
+
+            entry = folder_tree_keys_find(tree, cand->key, NULL);
+            if (!cand->partial && entry != NULL
+                && entry->local_revision == cand->revision) {
+                entry->local_revision = 0;
+                folder_tree_journal_entry(tree, entry);
+            }
+        }
+
+        folder_tree_journal_flush(tree);
+    }
+
+    free(candidates);
+
+    return removed;
+}
+
+/*
+ * return the path of the next cached file after key and revision whose
+ * content was verified, so that it can be verified again in the background.
+ * key and revision are set to the returned file. Start with an empty key
+ *
+ * returns NULL after the last file or without a manifest
+ */
+char           *folder_tree_scrub_next(folder_tree * tree, char *key,
+                                       uint64_t * revision)
+{
+    const struct manifest_record *record;
+
+    if (tree->verified == NULL) {
+        return NULL;
+    }
+
+    record = manifest_next(tree->verified, key, *revision);
+    if (record == NULL) {
+        return NULL;
+    }
+
+    strcpy(key, record->key);
+    *revision = record->revision;
+
+    return strdup_printf("%s/%s_%" PRIu64, tree->filecache, key, *revision);
+}
+
+/*
+ * act on the hash of the content of a file returned by
+ * folder_tree_scrub_next. st is what fstat said about the file that was read
+ *
+ * if the file is still the one that was verified but its content does not
+ * match anymore, it is removed unless it is open. An open file is verified
+ * again with the next mount instead
+ */
+void folder_tree_scrub_result(folder_tree * tree, const char *key,
+                              uint64_t revision, const struct stat *st,
+                              const unsigned char *hash)
+{
+    const struct manifest_record *record;
+    struct h_entry *entry;
+    struct stat     now;
+    char           *cachefile;
+
+    if (tree->verified == NULL) {
+        return;
+    }
+
+    /* the file might have been replaced or verified again meanwhile */
+    record = manifest_find(tree->verified, key, revision);
+    if (record == NULL || !manifest_record_matches(record, st, record->hash)
+        || memcmp(record->hash, hash, SHA256_DIGEST_LENGTH) == 0) {
+        return;
+    }
+
+    cachefile = strdup_printf("%s/%s_%" PRIu64, tree->filecache, key,
+                              revision);
+    if (stat(cachefile, &now) != 0
+        || !manifest_record_matches(record, &now, record->hash)) {
+        free(cachefile);
+        return;
+    }
+
+    fprintf(stderr, "content of %s does not match its hash anymore\n",
+            cachefile);
+    manifest_remove(tree->verified, key, revision);
+
+    if (folder_tree_is_open(tree, key)) {
+        free(cachefile);
+        return;
+    }
+
+    if (unlink(cachefile) != 0) {
+        fprintf(stderr, "unlink failed\n");
+        free(cachefile);
+        return;
+    }
+    free(cachefile);
+    folder_tree_cache_resize(tree, folder_tree_disk_size(&now), 0);
+
+    entry = folder_tree_keys_find(tree, key, NULL);
+    if (entry != NULL && entry->local_revision == revision) {
+        entry->local_revision = 0;
+        folder_tree_journal_entry(tree, entry);
+        folder_tree_journal_flush(tree);
+    }
+}
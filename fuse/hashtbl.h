@@ -26,9 +26,63 @@
 #include <sys/types.h>
 
 #include "../mfapi/mfconn.h"
+#include "../mfapi/file.h"
+#include "../mfapi/folder.h"
+#include "filecache.h"
 
 typedef struct folder_tree folder_tree;
 
+/* the last bin counts all keys that are at least this far from their slot */
+#define FOLDER_TREE_STATS_PROBE_BINS 8
+
+/*
+ * the size and shape of a tree as returned by folder_tree_stats. All sizes
+ * are in bytes.
+ */
+struct folder_tree_stats {
+    uint64_t        num_files;
+    uint64_t        num_folders;
+    /* folders whose children are paged out */
+    uint64_t        num_paged;
+
+    /* memory by structure */
+    uint64_t        entries_size;
+    uint64_t        files_size;
+    uint64_t        names_size;
+    uint64_t        keys_size;
+    uint64_t        index_size;
+    uint64_t        children_size;
+    uint64_t        dirty_size;
+    uint64_t        caches_size;
+    uint64_t        map_size;
+    uint64_t        stamps_size;
+    uint64_t        search_size;
+    uint64_t        total_size;
+
+    /* the estimate of the memory used that is kept below the limit by
+     * folder_tree_trim */
+    uint64_t        resident_size;
+    uint64_t        memory_limit;
+
+    /* the table of keys and how far its keys are from their home slot */
+    uint64_t        keys_capacity;
+    uint64_t        probe_histogram[FOLDER_TREE_STATS_PROBE_BINS];
+    uint64_t        max_probe;
+
+    /* number of children per folder */
+    uint64_t        max_children;
+    double          avg_children;
+
+    /* size of the dircache folder_tree_store would write and of the
+     * journal */
+    uint64_t        store_size;
+    uint64_t        journal_size;
+
+    uint64_t        dcache_hits;
+    uint64_t        dcache_misses;
+    uint64_t        ncache_hits;
+};
+
 folder_tree    *folder_tree_create(const char *filecache);
 
 void            folder_tree_destroy(folder_tree * tree);
@@ -37,25 +91,91 @@ int             folder_tree_rebuild(folder_tree * tree, mfconn * conn);
 
 void            folder_tree_housekeep(folder_tree * tree, mfconn * conn);
 
+void            folder_tree_housekeep_full(folder_tree * tree, mfconn * conn);
+
 void            folder_tree_debug(folder_tree * tree);
 
+void            folder_tree_stats(folder_tree * tree,
+                                  struct folder_tree_stats *stats);
+
+void            folder_tree_stats_print(const struct folder_tree_stats *stats,
+                                        FILE * stream);
+
+void            folder_tree_get_lookup_stats(folder_tree * tree,
+                                             uint64_t * hits,
+                                             uint64_t * misses);
+
 int             folder_tree_getattr(folder_tree * tree, mfconn * conn,
                                     const char *path, struct stat *stbuf);
 
 int             folder_tree_readdir(folder_tree * tree, mfconn * conn,
                                     const char *path, void *buf,
-                                    fuse_fill_dir_t filldir);
+                                    fuse_fill_dir_t filldir, off_t offset);
 
 void            folder_tree_update(folder_tree * tree, mfconn * conn,
                                    bool expect_changes);
 
+int             folder_tree_fetch_content(mfconn * conn, const char *key,
+                                          mffolder *** folder_result,
+                                          mffile *** file_result);
+
+void            folder_tree_free_content(mffolder ** folder_result,
+                                         mffile ** file_result);
+
+void            folder_tree_set_content(folder_tree * tree, const char *key,
+                                        mffolder ** folder_result,
+                                        mffile ** file_result);
+
+char          **folder_tree_get_outdated_folders(folder_tree * tree,
+                                                 const char *key);
+
+uint64_t        folder_tree_get_revision(folder_tree * tree);
+
+void            folder_tree_set_offline(folder_tree * tree, bool offline);
+
 int             folder_tree_store(folder_tree * tree, FILE * stream);
 
 folder_tree    *folder_tree_load(FILE * stream, const char *filecache);
 
+int             folder_tree_journal_open(folder_tree * tree,
+                                         const char *path, bool replay);
+
+uint64_t        folder_tree_journal_get_size(folder_tree * tree);
+
+int             folder_tree_checkpoint(folder_tree * tree,
+                                       const char *dircache);
+
+int             folder_tree_pages_open(folder_tree * tree, const char *path);
+
+int             folder_tree_set_memory_limit(folder_tree * tree,
+                                             uint64_t limit);
+
+void            folder_tree_trim(folder_tree * tree);
+
+int             folder_tree_set_search_index(folder_tree * tree, bool enable);
+
+int             folder_tree_find(folder_tree * tree, const char *pattern,
+                                 FILE * stream);
+
 void            folder_tree_cleanup_filecache(folder_tree * tree,
                                               uint64_t allowed_size);
 
+uint64_t        folder_tree_evict_filecache(folder_tree * tree,
+                                            uint64_t high, uint64_t low);
+
+uint64_t        folder_tree_get_cache_size(folder_tree * tree);
+
+int             folder_tree_manifest_open(folder_tree * tree,
+                                          const char *path);
+
+char           *folder_tree_scrub_next(folder_tree * tree, char *key,
+                                       uint64_t * revision);
+
+void            folder_tree_scrub_result(folder_tree * tree, const char *key,
+                                         uint64_t revision,
+                                         const struct stat *st,
+                                         const unsigned char *hash);
+
 bool            folder_tree_path_exists(folder_tree * tree, mfconn * conn,
                                         const char *path);
 
@@ -77,7 +197,13 @@ bool            folder_tree_path_is_file(folder_tree * tree, mfconn * conn,
 
 int             folder_tree_open_file(folder_tree * tree, mfconn * conn,
                                       const char *path, mode_t mode,
-                                      bool update);
+                                      bool update, filecache_part ** part);
+
+void            folder_tree_close_part(folder_tree * tree,
+                                       filecache_part * part);
+
+void            folder_tree_close_file(folder_tree * tree, const char *key);
+
 int             folder_tree_truncate_file(folder_tree * tree, mfconn * conn,
 					  const char *path);
 int             folder_tree_tmp_open(folder_tree * tree);
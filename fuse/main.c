@@ -32,7 +32,9 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <pwd.h>
+#include <dirent.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 
 #include "../mfapi/mfconn.h"
@@ -65,6 +67,19 @@ struct mediafirefs_user_options
 
     unsigned int        http_flags;
     unsigned int        arg_flags;
+
+    int                 poll_min;
+    int                 poll_max;
+    int                 crawl;
+    int                 offline;
+    int                 tree_memory;
+    int                 no_search_index;
+    int                 readahead;
+    int                 cache_size;
+    int                 cache_low;
+    int                 scrub;
+    int                 checkpoint;
+    int                 housekeep;
 };
 
 static struct fuse_operations mediafirefs_oper = {
@@ -95,7 +110,7 @@ static struct fuse_operations mediafirefs_oper = {
     .readdir = mediafirefs_readdir,
     .releasedir = mediafirefs_releasedir,
     .fsyncdir = mediafirefs_fsyncdir,
-//  .init = mediafirefs_init,
+    .init = mediafirefs_init,
     .destroy = mediafirefs_destroy,
     .access = mediafirefs_access,
     .create = mediafirefs_create,
@@ -109,14 +124,23 @@ parse_arguments(int *argc, char ***argv,
                 struct mediafirefs_user_options *options, char *configfile);
 
 static void
-connect_mf(struct mediafirefs_user_options *options, mfconn ** conn);
+connect_mf(struct mediafirefs_user_options *options, mfconn ** conn,
+                bool *offline);
+
+static char *
+setup_cache_root(void);
+
+static char *
+find_cached_ekey(const char *cacheroot, const char *username);
 
 static void
-setup_cache_dir(const char *ekey, char **dircache, char **filecache);
+setup_cache_dir(const char *cacheroot, const char *username,
+                const char *ekey, char **dircache, char **filecache);
 
 static void
 open_hashtbl(const char *dircache, const char *filecache,
-                         mfconn * conn, folder_tree ** tree);
+                         mfconn * conn, bool offline, uint64_t memory_limit,
+                         uint64_t cache_size, folder_tree ** tree);
 
 
 // END of provate helper function prototypes
@@ -127,19 +151,64 @@ int main(int argc, char *argv[])
     int             ret,
                     i;
     struct mediafirefs_context_private      *ctx;
+    char                *cacheroot;
+    char                *ekey;
 
     struct mediafirefs_user_options options = {
-        NULL, NULL, NULL, NULL, -1, NULL, 0, 0,
+        NULL, NULL, NULL, NULL, -1, NULL, 0, 0, 15, 300, 0, 0, 0, 0, 64, 1024, -1, 0, 600, 3600,
     };
 
-    pthread_mutexattr_t     mutex_attr;
-
     ctx = calloc(1, sizeof(struct mediafirefs_context_private));
 
     config_file_init(&(ctx->configfile));
 
     parse_arguments(&argc, &argv, &options, ctx->configfile);
 
+    if (options.poll_min < 1 || options.poll_max < options.poll_min) {
+        fprintf(stderr, "invalid poll intervals %d and %d\n",
+                options.poll_min, options.poll_max);
+        exit(1);
+    }
+
+    if (options.checkpoint < 1) {
+        fprintf(stderr, "invalid checkpoint interval %d\n",
+                options.checkpoint);
+        exit(1);
+    }
+
+    if (options.housekeep < 1) {
+        fprintf(stderr, "invalid housekeeping interval %d\n",
+                options.housekeep);
+        exit(1);
+    }
+
+    if (options.crawl < 0) {
+        fprintf(stderr, "invalid number of crawler workers %d\n",
+                options.crawl);
+        exit(1);
+    }
+
+    if (options.tree_memory < 0) {
+        fprintf(stderr, "invalid memory limit %d\n", options.tree_memory);
+        exit(1);
+    }
+
+    if (options.readahead < 0) {
+        fprintf(stderr, "invalid readahead budget %d\n", options.readahead);
+        exit(1);
+    }
+
+    // without a low watermark, a tenth of the cache is freed at once
+    if (options.cache_low == -1)
+        options.cache_low = options.cache_size - options.cache_size / 10;
+
+    if (options.cache_size < 0 || options.cache_low < 0
+        || options.cache_low > options.cache_size) {
+        fprintf(stderr, "invalid cache sizes %d and %d\n",
+                options.cache_size, options.cache_low);
+        exit(1);
+    }
+
     if (options.username == NULL) {
         printf("login: ");
         options.username = string_line_from_stdin(false);
@@ -163,23 +232,54 @@ int main(int argc, char *argv[])
         options.password = string_line_from_stdin(true);
     }
 
-    connect_mf(&options, &(ctx->conn));
+    connect_mf(&options, &(ctx->conn), &(ctx->offline));
+
+    cacheroot = setup_cache_root();
 
-    setup_cache_dir(mfconn_get_ekey(ctx->conn), &(ctx->dircache),
+    // without a connection, the ekey is only known from an earlier mount
+    if (ctx->offline) {
+        ekey = find_cached_ekey(cacheroot, options.username);
+        if (ekey == NULL) {
+            fprintf(stderr, "no directory cache of %s from an earlier mount"
+                    " - cannot mount offline\n", options.username);
+            exit(1);
+        }
+    } else {
+        ekey = strdup(mfconn_get_ekey(ctx->conn));
+    }
+
+    setup_cache_dir(cacheroot, options.username, ekey, &(ctx->dircache),
                     &(ctx->filecache));
+    free(cacheroot);
+    free(ekey);
 
-    open_hashtbl(ctx->dircache, ctx->filecache, ctx->conn, &(ctx->tree));
+    ctx->cache_high = (uint64_t) options.cache_size * 1024 * 1024;
+    ctx->cache_low = (uint64_t) options.cache_low * 1024 * 1024;
+    ctx->scrub = options.scrub;
 
-    ctx->sv_writefiles = stringv_alloc();
-    ctx->sv_readonlyfiles = stringv_alloc();
-    ctx->last_status_check = 0;
-    ctx->interval_status_check = 60;    // TODO: make this configurable
+    open_hashtbl(ctx->dircache, ctx->filecache, ctx->conn, ctx->offline,
+                 (uint64_t) options.tree_memory * 1024 * 1024,
+                 ctx->cache_high > 0 ? ctx->cache_low : UINT64_MAX,
+                 &(ctx->tree));
 
-    pthread_mutexattr_init(&mutex_attr);
-    pthread_mutexattr_settype(&mutex_attr,PTHREAD_MUTEX_RECURSIVE);
+    // the index is built from the complete tree at once
+    if (!options.no_search_index)
+        folder_tree_set_search_index(ctx->tree, true);
 
-    pthread_mutex_init(&(ctx->mutex),
-        (const pthread_mutexattr_t*)&mutex_attr);
+    ctx->sv_writefiles = stringv_alloc();
+    ctx->sv_readonlyfiles = stringv_alloc();
+    ctx->interval_checkpoint = options.checkpoint;
+    ctx->interval_status_min = options.poll_min;
+    ctx->interval_status_max = options.poll_max;
+    ctx->interval_housekeep = options.housekeep;
+    ctx->crawl_workers = options.crawl;
+    ctx->readahead_budget = (uint64_t) options.readahead * 1024 * 1024;
+
+    pthread_rwlock_init(&(ctx->lock), NULL);
+    pthread_mutex_init(&(ctx->checkpoint_mutex), NULL);
+    pthread_cond_init(&(ctx->checkpoint_cond), NULL);
+    pthread_mutex_init(&(ctx->poll_mutex), NULL);
+    pthread_cond_init(&(ctx->poll_cond), NULL);
 
     ret = fuse_main(argc, argv, &mediafirefs_oper, ctx);
 
@@ -193,8 +293,11 @@ int main(int argc, char *argv[])
     free(ctx->filecache);
     stringv_free(ctx->sv_writefiles);
     stringv_free(ctx->sv_readonlyfiles);
-    pthread_mutex_destroy(&(ctx->mutex));
-    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_cond_destroy(&(ctx->checkpoint_cond));
+    pthread_mutex_destroy(&(ctx->checkpoint_mutex));
+    pthread_cond_destroy(&(ctx->poll_cond));
+    pthread_mutex_destroy(&(ctx->poll_mutex));
+    pthread_rwlock_destroy(&(ctx->lock));
     free(ctx);
 
     return ret;
@@ -218,6 +321,39 @@ static void usage(const char *progname)
             "    -i, --app-id id        App ID\n"
             "    -k, --api-key key      API Key\n"
             "    -l, --lazy-ssl         Disables SSL peer validation\n"
+            "    --poll-min seconds     shortest interval between checks for\n"
+            "                           remote changes (default: 15)\n"
+            "    --poll-max seconds     longest interval between checks for\n"
+            "                           remote changes (default: 300)\n"
+            "    --checkpoint seconds   interval in which the directory tree\n"
+            "                           is stored if it changed (default: 600)\n"
+            "    --housekeep seconds    interval in which the whole directory\n"
+            "                           tree is checked for consistency while\n"
+            "                           nothing changes (default: 3600)\n"
+            "    --crawl workers        retrieve the content of all folders\n"
+            "                           in the background with that many\n"
+            "                           connections (default: 0, disabled)\n"
+            "    --offline              mount read-only from the cache without\n"
+            "                           contacting the remote until it is\n"
+            "                           reached by the poll thread. This also\n"
+            "                           happens if the login fails\n"
+            "    --tree-memory MiB      keep the folders that were not used\n"
+            "                           recently on disk instead of in memory\n"
+            "                           once the directory tree needs more\n"
+            "                           (default: 0, no limit)\n"
+            "    --no-search-index      do not keep an index of the names of\n"
+            "                           all files and folders, which makes\n"
+            "                           searching them slower\n"
+            "    --readahead MiB        retrieve up to that much of files\n"
+            "                           that are read sequentially ahead of\n"
+            "                           the reads (default: 64, 0 disables)\n"
+            "    --cache-size MiB       remove the least recently used files\n"
+            "                           from the file cache once it is larger\n"
+            "                           (default: 1024, 0 for no limit)\n"
+            "    --cache-low MiB        the size the file cache is reduced to\n"
+            "                           then (default: 90%% of --cache-size)\n"
+            "    --scrub                verify the content of all cached files\n"
+            "                           in the background after mounting\n"
             "\n"
             "Notice that long options are separated from their arguments by\n"
             "a space and not an equal sign.\n" "\n", progname);
@@ -398,6 +534,27 @@ parse_arguments(int *argc, char ***argv,
         {"-k %s", offsetof(struct mediafirefs_user_options, api_key), 0},
         {"--api-key %s", offsetof(struct mediafirefs_user_options, api_key),
          0},
+        {"--poll-min %d", offsetof(struct mediafirefs_user_options, poll_min),
+         0},
+        {"--poll-max %d", offsetof(struct mediafirefs_user_options, poll_max),
+         0},
+        {"--checkpoint %d", offsetof(struct mediafirefs_user_options,
+                                     checkpoint), 0},
+        {"--housekeep %d", offsetof(struct mediafirefs_user_options,
+                                    housekeep), 0},
+        {"--crawl %d", offsetof(struct mediafirefs_user_options, crawl), 0},
+        {"--offline", offsetof(struct mediafirefs_user_options, offline), 1},
+        {"--tree-memory %d", offsetof(struct mediafirefs_user_options,
+                                      tree_memory), 0},
+        {"--no-search-index", offsetof(struct mediafirefs_user_options,
+                                       no_search_index), 1},
+        {"--readahead %d", offsetof(struct mediafirefs_user_options,
+                                    readahead), 0},
+        {"--cache-size %d", offsetof(struct mediafirefs_user_options,
+                                     cache_size), 0},
+        {"--cache-low %d", offsetof(struct mediafirefs_user_options,
+                                    cache_low), 0},
+        {"--scrub", offsetof(struct mediafirefs_user_options, scrub), 1},
 
         FUSE_OPT_KEY("-l", KEY_LAZY_SSL),
         FUSE_OPT_KEY("--lazy-ssl", KEY_LAZY_SSL),
@@ -422,9 +579,18 @@ parse_arguments(int *argc, char ***argv,
     *argv = args_snd.argv;
 }
 
+/*
+ * log in or, if the remote cannot be reached or --offline was given, create
+ * a connection that logs in later and set offline
+ *
+ * if the remote refuses the login, for example because of a wrong password,
+ * this exits instead of mounting offline
+ */
 static void connect_mf(struct mediafirefs_user_options *options,
-                       mfconn ** conn)
+                       mfconn ** conn, bool *offline)
 {
+    int             retval;
+
     if (options->app_id == -1) {
         options->app_id = 42709;
     }
@@ -433,20 +599,46 @@ static void connect_mf(struct mediafirefs_user_options *options,
         options->server = "www.mediafire.com";
     }
 
-    *conn = mfconn_create(options->server, options->username,
-                            options->password, options->app_id,
-                            options->api_key, 3, options->http_flags);
-
+    *conn = mfconn_create_offline(options->server, options->username,
+                                  options->password, options->app_id,
+                                  options->api_key, 3, options->http_flags);
     if (*conn == NULL) {
         fprintf(stderr, "Cannot establish connection\n");
         exit(1);
     }
+
+    *offline = options->offline;
+    if (*offline) {
+        return;
+    }
+
+    retval = mfconn_refresh_token(*conn);
+    if (retval == MFCONN_UNREACHABLE) {
+        fprintf(stderr, "Cannot reach the remote - mounting read-only from"
+                " the cache\n");
+        *offline = true;
+    } else if (retval != 0) {
+        fprintf(stderr, "Cannot establish connection\n");
+        mfconn_destroy(*conn);
+        exit(1);
+    }
 }
 
 static void open_hashtbl(const char *dircache, const char *filecache,
-                         mfconn * conn, folder_tree ** tree)
+                         mfconn * conn, bool offline, uint64_t memory_limit,
+                         uint64_t cache_size, folder_tree ** tree)
 {
     FILE           *fp;
+    char           *journal;
+    char           *pages;
+    char           *verified;
+
+    // all changes since the dircache was last written are in the journal
+    journal = strdup_printf("%s.journal", dircache);
+    // and the children of folders that were paged out are in the pages
+    pages = strdup_printf("%s.pages", dircache);
+    // and the cached files whose content was verified in the manifest
+    verified = strdup_printf("%s.verified", dircache);
 
     fp = fopen(dircache, "r");
     if (fp != NULL) {
@@ -460,11 +652,31 @@ static void open_hashtbl(const char *dircache, const char *filecache,
 
         if (*tree != NULL) {
 
-            // TODO: make the maximum cache size configurable
-            // size is given in bytes and current default is 1 GiB
-            folder_tree_cleanup_filecache(*tree, 1073741824);
+            // replay the journal before cleaning the file cache because
+            // the journal knows which cached files are up to date. Its
+            // records can refer to paged out folders
+            folder_tree_pages_open(*tree, pages);
+            free(pages);
+            folder_tree_journal_open(*tree, journal, true);
+            free(journal);
+            folder_tree_set_memory_limit(*tree, memory_limit);
+
+            // only files that changed since they were verified are hashed
+            folder_tree_manifest_open(*tree, verified);
+            free(verified);
+
+            // the evictor keeps the cache at this size while mounted
+            folder_tree_cleanup_filecache(*tree, cache_size);
+
+            // the changes are retrieved once the remote can be reached
+            if (offline) {
+                folder_tree_set_offline(*tree, true);
+                folder_tree_trim(*tree);
+                return;
+            }
 
             folder_tree_update(*tree, conn, false);
+            folder_tree_trim(*tree);
 
             return;
         }
@@ -472,24 +684,43 @@ static void open_hashtbl(const char *dircache, const char *filecache,
         fprintf(stderr, "cannot load directory hashtable - starting"
                 " a new one\n");
     }
+
+    if (offline) {
+        fprintf(stderr, "cannot mount offline without a directory cache\n");
+        exit(1);
+    }
+
     // file doesn't exist or is corrupt
     fprintf(stderr, "creating new hashtable\n");
     *tree = folder_tree_create(filecache);
+    folder_tree_pages_open(*tree, pages);
+    free(pages);
+    folder_tree_set_memory_limit(*tree, memory_limit);
+    folder_tree_manifest_open(*tree, verified);
+    free(verified);
 
     folder_tree_rebuild(*tree, conn);
 
+    // the journal does not belong to the new tree, so empty it and store
+    // the new tree right away so that a crash does not require another
+    // rebuild
+    folder_tree_journal_open(*tree, journal, false);
+    free(journal);
+    folder_tree_checkpoint(*tree, dircache);
+
     //folder_tree_housekeep(tree);
 
     fprintf(stderr, "tree before starting fuse:\n");
     folder_tree_debug(*tree);
 }
-
-static void setup_cache_dir(const char *ekey, char **dircache,
-                            char **filecache)
+/*
+ * create $XDG_CACHE_HOME/mediafire-tools or $HOME/.cache/mediafire-tools and
+ * return its path
+ */
+static char *setup_cache_root(void)
 {
     const char     *homedir;
     const char     *cachedir;
-    const char     *usercachedir;
 
     homedir = getenv("HOME");
     if (homedir == NULL) {
@@ -522,8 +753,72 @@ static void setup_cache_dir(const char *ekey, char **dircache,
         fprintf(stderr, "cannot create %s\n", cachedir);
         exit(1);
     }
+
+    return (char *)cachedir;
+}
+
+/*
+ * the ekey is only known after logging in, so setup_cache_dir records the
+ * username next to the dircache of every ekey. Without a connection, the
+ * directory of the ekey is found by that username.
+ *
+ * returns NULL if no directory with a dircache belongs to the username
+ */
+static char *find_cached_ekey(const char *cacheroot, const char *username)
+{
+    DIR            *dirp;
+    struct dirent  *entry;
+    char           *path;
+    char           *line;
+    char           *ekey;
+    size_t          len;
+    FILE           *fp;
+    struct stat     st;
+
+    dirp = opendir(cacheroot);
+    if (dirp == NULL)
+        return NULL;
+
+    ekey = NULL;
+    while (ekey == NULL && (entry = readdir(dirp)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        path = strdup_printf("%s/%s/username", cacheroot, entry->d_name);
+        fp = fopen(path, "r");
+        free(path);
+        if (fp == NULL)
+            continue;
+        line = NULL;
+        len = 0;
+        if (getline(&line, &len, fp) > 0
+            && strcspn(line, "\n") == strlen(username)
+            && strncmp(line, username, strlen(username)) == 0) {
+            path = strdup_printf("%s/%s/directorytree", cacheroot,
+                                 entry->d_name);
+            if (stat(path, &st) == 0)
+                ekey = strdup(entry->d_name);
+            free(path);
+        }
+        free(line);
+        fclose(fp);
+    }
+
+    closedir(dirp);
+
+    return ekey;
+}
+
+static void setup_cache_dir(const char *cacheroot, const char *username,
+                            const char *ekey, char **dircache,
+                            char **filecache)
+{
+    const char     *usercachedir;
+    char           *path;
+    FILE           *fp;
+
     /* now create the subdirectory for the current ekey */
-    usercachedir = strdup_printf("%s/%s", cachedir, ekey);
+    usercachedir = strdup_printf("%s/%s", cacheroot, ekey);
     /* EEXIST is okay, so only fail if it is something else */
     if (mkdir(usercachedir, 0755) != 0 && errno != EEXIST) {
         perror("mkdir");
@@ -531,6 +826,15 @@ static void setup_cache_dir(const char *ekey, char **dircache,
         exit(1);
     }
 
+    /* remember whose ekey it is for mounting without a connection */
+    path = strdup_printf("%s/username", usercachedir);
+    fp = fopen(path, "w");
+    if (fp != NULL) {
+        fprintf(fp, "%s\n", username);
+        fclose(fp);
+    }
+    free(path);
+
     *dircache = strdup_printf("%s/directorytree", usercachedir);
 
     *filecache = strdup_printf("%s/files", usercachedir);
@@ -540,7 +844,5 @@ static void setup_cache_dir(const char *ekey, char **dircache,
         exit(1);
     }
 
-    free((void *)cachedir);
     free((void *)usercachedir);
 }
-
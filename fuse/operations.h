@@ -30,6 +30,25 @@
 #include "../utils/stringv.h"
 
 #include "hashtbl.h"
+#include "crawler.h"
+#include "readahead.h"
+#include "evictor.h"
+#include "scrubber.h"
+
+/* the extended attribute of the mount point with the statistics of the tree */
+#define MEDIAFIREFS_XATTR_STATS "user.mediafirefs.stats"
+/*
+ * the extended attributes of the mount point starting with this prefix list
+ * the paths of all entries whose name matches the rest of the attribute name
+ */
+#define MEDIAFIREFS_XATTR_FIND "user.mediafirefs.find."
+/*
+ * the same list starting with the path at the number that follows this
+ * prefix and a dot, to read lists which do not fit into one attribute
+ */
+#define MEDIAFIREFS_XATTR_FIND_FROM "user.mediafirefs.findfrom."
+/* the largest value of an extended attribute that the kernel passes on */
+#define MEDIAFIREFS_XATTR_MAX_SIZE 65536
 
 struct fuse_conn_info;
 struct fuse_file_info;
@@ -42,6 +61,17 @@ struct mediafirefs_openfile
     int             fd;
     char           *path;
 
+    // the key of the file whose cached content is open or NULL for new
+    // files, to give it back to folder_tree_close_file
+    char           *key;
+
+    // if not NULL, the file is read from this partial cache file instead
+    // and fd is not used
+    filecache_part *part;
+
+    // the access pattern of reads from part
+    struct readahead_stream ra;
+
     // whether or not a patch has to be uploaded when closing
     bool            is_readonly;
 
@@ -58,9 +88,61 @@ struct mediafirefs_context_private
     mfconn              *conn;
     folder_tree         *tree;
     account_t           *account;
-    time_t              last_status_check;
-    time_t              interval_status_check;
-    pthread_mutex_t     mutex;
+    /* callbacks which only read the tree and the members of this struct
+     * take this lock for reading, so that they run concurrently. All others
+     * take it for writing */
+    pthread_rwlock_t    lock;
+    /* the thread started by mediafirefs_init that regularly writes a
+     * checkpoint of the tree and empties the journal. It waits on
+     * checkpoint_cond with checkpoint_mutex until it is stopped or the
+     * interval passed */
+    pthread_t           checkpoint_thread;
+    pthread_mutex_t     checkpoint_mutex;
+    pthread_cond_t      checkpoint_cond;
+    bool                checkpoint_running;
+    bool                checkpoint_stop;
+    time_t              interval_checkpoint;
+    /* the thread started by mediafirefs_init that asks the remote for
+     * changes. It waits between interval_status_min and
+     * interval_status_max seconds on poll_cond with poll_mutex until it is
+     * stopped, the interval passed or poll_reset is set by
+     * mediafirefs_poll_soon */
+    pthread_t           poll_thread;
+    pthread_mutex_t     poll_mutex;
+    pthread_cond_t      poll_cond;
+    bool                poll_running;
+    bool                poll_stop;
+    bool                poll_reset;
+    time_t              interval_status_min;
+    time_t              interval_status_max;
+    time_t              interval_housekeep;
+    /* true while the remote could not be reached since the mount. Then the
+     * tree and the cached files are only read and the poll thread tries to
+     * connect instead of asking for changes. Once the remote was reached,
+     * this stays false */
+    bool                offline;
+    /* set by the poll thread if the remote refused the login while offline,
+     * for example because of a wrong password. Then it stops trying to
+     * connect and the mount stays offline */
+    bool                login_refused;
+    /* started by mediafirefs_init if crawl_workers is not zero to retrieve
+     * the content of all folders in the background */
+    crawler             *crawler;
+    int                 crawl_workers;
+    /* started by mediafirefs_init if readahead_budget is not zero to
+     * retrieve the blocks of partial cache files ahead of sequential reads.
+     * At most readahead_budget bytes are scheduled at the same time */
+    readahead_pool      *readahead;
+    uint64_t            readahead_budget;
+    /* started by mediafirefs_init if cache_high is not zero to keep the
+     * file cache between cache_low and cache_high bytes */
+    evictor             *evictor;
+    uint64_t            cache_high;
+    uint64_t            cache_low;
+    /* started by mediafirefs_init if scrub is set to verify the content of
+     * the file cache once */
+    scrubber            *scrubber;
+    bool                scrub;
     char                *configfile;
     char                *dircache;
     char                *filecache;
@@ -128,4 +210,7 @@ int             mediafirefs_create(const char *path, mode_t mode,
 int             mediafirefs_utimens(const char *path,
                                     const struct timespec tv[2]);
 
+void            mediafirefs_poll_soon(struct mediafirefs_context_private
+                                      *ctx);
+
 #endif
@@ -108,11 +108,11 @@ int mediafirefs_access(const char *path, int mode)
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_rdlock(&(ctx->lock));
 
     fprintf(stderr, "access is a no-op\n");
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
@@ -59,11 +59,11 @@ int mediafirefs_chmod(const char *path, mode_t mode)
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_rdlock(&(ctx->lock));
 
     fprintf(stderr, "chmod not implemented\n");
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return -ENOSYS;
 }
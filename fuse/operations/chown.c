@@ -61,11 +61,11 @@ int mediafirefs_chown(const char *path, uid_t uid, gid_t gid)
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_rdlock(&(ctx->lock));
 
     fprintf(stderr, "chown not implemented\n");
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return -ENOSYS;
 }
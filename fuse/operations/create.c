@@ -68,27 +68,35 @@ int mediafirefs_create(const char *path, mode_t mode,
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
+
+    if (ctx->offline) {
+        pthread_rwlock_unlock(&(ctx->lock));
+        return -EROFS;
+    }
 
     fd = folder_tree_tmp_open(ctx->tree);
     if (fd < 0) {
         fprintf(stderr, "folder_tree_tmp_open failed\n");
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         return -EACCES;
     }
 
     openfile = malloc(sizeof(struct mediafirefs_openfile));
     openfile->fd = fd;
+    openfile->part = NULL;
+    memset(&(openfile->ra), 0, sizeof(openfile->ra));
     openfile->is_local = true;
     openfile->is_readonly = false;
     openfile->path = strdup(path);
+    openfile->key = NULL;
     openfile->is_flushed = false;
     file_info->fh = (uintptr_t) openfile;
 
     // add to writefiles
     stringv_add(ctx->sv_writefiles, path);
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     mediafirefs_flush(path, file_info);
 
@@ -27,6 +27,7 @@
 //#include <stddef.h>
 #include <pthread.h>
 #include <stdio.h>
+//#include <inttypes.h>
 //#include <stdlib.h>
 //#include <unistd.h>
 //#include <string.h>
@@ -34,9 +35,9 @@
 //#include <sys/stat.h>
 //#include <fcntl.h>
 //#include <fuse/fuse_common.h>
-//#include <stdint.h>
+#include <stdint.h>
 //#include <libgen.h>
-//#include <stdbool.h>
+#include <stdbool.h>
 //#include <time.h>
 //#include <openssl/sha.h>
 //#include <sys/statvfs.h>
@@ -46,37 +47,70 @@
 //#include "../../mfapi/apicalls.h"
 //#include "../../utils/stringv.h"
 //#include "../../utils/hash.h"
+#include "../crawler.h"
+#include "../readahead.h"
+#include "../evictor.h"
+#include "../scrubber.h"
 #include "../hashtbl.h"
 #include "../operations.h"
 
 void mediafirefs_destroy(void *user_ptr)
 {
     printf("FUNCTION: destroy\n");
-    FILE           *fd;
     struct mediafirefs_context_private *ctx;
+    struct folder_tree_stats stats;
 
     ctx = (struct mediafirefs_context_private *)user_ptr;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    /* stop the checkpoint thread first because it uses the tree */
+    if (ctx->checkpoint_running) {
+        pthread_mutex_lock(&(ctx->checkpoint_mutex));
+        ctx->checkpoint_stop = true;
+        pthread_cond_signal(&(ctx->checkpoint_cond));
+        pthread_mutex_unlock(&(ctx->checkpoint_mutex));
+        pthread_join(ctx->checkpoint_thread, NULL);
+        ctx->checkpoint_running = false;
+    }
 
-    fprintf(stderr, "storing hashtable\n");
+    /* and the poll thread because it uses the tree and the connection */
+    if (ctx->poll_running) {
+        pthread_mutex_lock(&(ctx->poll_mutex));
+        ctx->poll_stop = true;
+        pthread_cond_signal(&(ctx->poll_cond));
+        pthread_mutex_unlock(&(ctx->poll_mutex));
+        pthread_join(ctx->poll_thread, NULL);
+        ctx->poll_running = false;
+    }
 
-    fd = fopen(ctx->dircache, "w+");
+    /* and then the crawler, which the poll thread starts when it leaves the
+     * offline mode */
+    crawler_stop(ctx->crawler);
+    ctx->crawler = NULL;
 
-    if (fd == NULL) {
-        fprintf(stderr, "cannot open %s for writing\n", ctx->dircache);
-        pthread_mutex_unlock(&(ctx->mutex));
-        return;
-    }
+    /* and the readahead, whose workers retrieve blocks of open files */
+    readahead_stop(ctx->readahead);
+    ctx->readahead = NULL;
+
+    /* and the evictor because it uses the tree */
+    evictor_stop(ctx->evictor);
+    ctx->evictor = NULL;
 
-    folder_tree_store(ctx->tree, fd);
+    /* and the scrubber */
+    scrubber_stop(ctx->scrubber);
+    ctx->scrubber = NULL;
 
-    fclose(fd);
+    pthread_rwlock_wrlock(&(ctx->lock));
+
+    fprintf(stderr, "storing hashtable\n");
+
+    folder_tree_checkpoint(ctx->tree, ctx->dircache);
+
+    folder_tree_stats(ctx->tree, &stats);
+    folder_tree_stats_print(&stats, stderr);
 
     folder_tree_destroy(ctx->tree);
 
     mfconn_destroy(ctx->conn);
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 }
-
@@ -79,12 +79,12 @@ int mediafirefs_flush(const char *path, struct fuse_file_info *file_info)
     // zero out check result to prevent spurious results later
     memset(&check_result,0,sizeof(check_result));
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
 
 
     if (openfile->is_readonly) {
 	/* nothing to do here */
-	pthread_mutex_unlock(&(ctx->mutex));
+	pthread_rwlock_unlock(&(ctx->lock));
 	return 0;
     }
         // if the file only exists locally, an initial upload has to be done
@@ -108,7 +108,7 @@ int mediafirefs_flush(const char *path, struct fuse_file_info *file_info)
             fprintf(stderr, "failed to calculate hash\n");
             free(temp1);
             free(temp2);
-            pthread_mutex_unlock(&(ctx->mutex));
+            pthread_rwlock_unlock(&(ctx->lock));
             return -EACCES;
         }
 
@@ -126,7 +126,7 @@ int mediafirefs_flush(const char *path, struct fuse_file_info *file_info)
             fprintf(stderr, "hash: %s\n",hash);
             fprintf(stderr, "size: %jd\n",size);
             fprintf(stderr, "folder_key: %s\n",folder_key);
-            pthread_mutex_unlock(&(ctx->mutex));
+            pthread_rwlock_unlock(&(ctx->lock));
             return -EACCES;
         }
 
@@ -143,7 +143,7 @@ int mediafirefs_flush(const char *path, struct fuse_file_info *file_info)
 
             if (retval != 0) {
                 fprintf(stderr, "mfconn_api_upload_instant failed\n");
-                pthread_mutex_unlock(&(ctx->mutex));
+                pthread_rwlock_unlock(&(ctx->lock));
                 return -EACCES;
             }
         } else {
@@ -164,7 +164,7 @@ int mediafirefs_flush(const char *path, struct fuse_file_info *file_info)
                 fprintf(stderr, "size: %jd\n",size);
                 fprintf(stderr, "folder_key: %s\n",folder_key);
 
-                pthread_mutex_unlock(&(ctx->mutex));
+                pthread_rwlock_unlock(&(ctx->lock));
                 return -EACCES;
             }
             // poll for completion
@@ -173,7 +173,7 @@ int mediafirefs_flush(const char *path, struct fuse_file_info *file_info)
 
             if (retval != 0) {
                 fprintf(stderr, "mfconn_upload_poll_for_completion failed\n");
-                pthread_mutex_unlock(&(ctx->mutex));
+                pthread_rwlock_unlock(&(ctx->lock));
                 return -1;
             }
             else
@@ -183,8 +183,9 @@ int mediafirefs_flush(const char *path, struct fuse_file_info *file_info)
         }
 
         folder_tree_update(ctx->tree, ctx->conn, true);
+        mediafirefs_poll_soon(ctx);
 	    openfile->is_flushed = true;
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         return 0;
     }
 
@@ -196,7 +197,7 @@ int mediafirefs_flush(const char *path, struct fuse_file_info *file_info)
 
     if (retval != 0) {
 	    fprintf(stderr, "folder_tree_upload_patch failed\n");
-	    pthread_mutex_unlock(&(ctx->mutex));
+	    pthread_rwlock_unlock(&(ctx->lock));
 	    return -EACCES;
     }
     else
@@ -206,9 +207,10 @@ int mediafirefs_flush(const char *path, struct fuse_file_info *file_info)
 
 
     folder_tree_update(ctx->tree, ctx->conn, true);
+    mediafirefs_poll_soon(ctx);
 
     openfile->is_flushed = true;
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
@@ -62,11 +62,11 @@ int mediafirefs_fsyncdir(const char *path, int datasync,
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_rdlock(&(ctx->lock));
 
     fprintf(stderr, "fsyncdir not implemented\n");
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return -ENOSYS;
 }
@@ -30,7 +30,7 @@
 #include <pthread.h>
 #include <unistd.h>
 //#include <string.h>
-//#include <errno.h>
+#include <errno.h>
 #include <sys/stat.h>
 //#include <fcntl.h>
 //#include <fuse/fuse_common.h>
@@ -53,26 +53,25 @@
 int mediafirefs_getattr(const char *path, struct stat *stbuf)
 {
     printf("FUNCTION: getattr. path: %s\n", path);
-    /*
-     * since getattr is called before every other call (except for getattr,
-     * read and write) wee only call folder_tree_update in the getattr call
-     * and not the others
-     */
     struct mediafirefs_context_private *ctx;
     int             retval;
-    time_t          now;
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    /* most calls are answered from the tree alone, so they only take the
+     * lock for reading and can run concurrently. Only if the path leads
+     * through an outdated folder, the lock is taken for writing and the
+     * folder is retrieved. Remote changes are picked up by the poll thread
+     * started in mediafirefs_init. */
+    pthread_rwlock_rdlock(&(ctx->lock));
 
-    now = time(NULL);
-    if (now - ctx->last_status_check > ctx->interval_status_check) {
-        folder_tree_update(ctx->tree, ctx->conn, false);
-        ctx->last_status_check = now;
-    }
+    retval = folder_tree_getattr(ctx->tree, NULL, path, stbuf);
 
-    retval = folder_tree_getattr(ctx->tree, ctx->conn, path, stbuf);
+    if (retval == -EAGAIN) {
+        pthread_rwlock_unlock(&(ctx->lock));
+        pthread_rwlock_wrlock(&(ctx->lock));
+        retval = folder_tree_getattr(ctx->tree, ctx->conn, path, stbuf);
+    }
 
     if (retval != 0 && stringv_mem(ctx->sv_writefiles, path)) {
         stbuf->st_uid = geteuid();
@@ -86,7 +85,7 @@ int mediafirefs_getattr(const char *path, struct stat *stbuf)
         retval = 0;
     }
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return retval;
 }
@@ -24,12 +24,14 @@
 #define FUSE_USE_VERSION 30
 
 #include <fuse/fuse.h>
+#include <inttypes.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <pthread.h>
-//#include <stdlib.h>
+#include <stdlib.h>
 //#include <unistd.h>
-//#include <string.h>
+#include <string.h>
 #include <errno.h>
 //#include <sys/stat.h>
 //#include <fcntl.h>
@@ -46,28 +48,148 @@
 //#include "../../mfapi/apicalls.h"
 //#include "../../utils/stringv.h"
 //#include "../../utils/hash.h"
-//#include "../hashtbl.h"
+#include "../hashtbl.h"
 #include "../operations.h"
 
+/*
+ * the largest line that ends a list which was cut, "... " and the number of
+ * the first path that is missing
+ */
+#define FIND_MARKER_SIZE 32
+
+static size_t   getxattr_page(char *text, size_t len, uint64_t first,
+                              char **page);
+
+/*
+ * the statistics of the folder tree can be read from the mount point with
+ * "getfattr -n user.mediafirefs.stats --only-values <mountpoint>"
+ *
+ * and the paths of all files and folders whose name matches a shell wildcard
+ * pattern like with find -name with
+ * "getfattr -n 'user.mediafirefs.find.<pattern>' --only-values <mountpoint>".
+ * If the paths do not fit into an attribute, the list ends with a line of
+ * "... <n>" after the last one that fits. The paths from the n-th on are
+ * read with "user.mediafirefs.findfrom.<n>.<pattern>", which might end with
+ * such a line again. Paths are counted from zero.
+ */
 int mediafirefs_getxattr(const char *path, const char *name, char *value,
                          size_t size)
 {
     printf("FUNCTION: getxattr. path: %s\n", path);
 
-    (void)path;
-    (void)name;
-    (void)value;
-    (void)size;
     struct mediafirefs_context_private *ctx;
+    struct folder_tree_stats stats;
+    const char     *pattern;
+    char           *end;
+    FILE           *stream;
+    char           *text;
+    char           *page;
+    uint64_t        first;
+    size_t          len;
+    int             retval;
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    if (strcmp(path, "/") != 0)
+        return -ENODATA;
+
+    pattern = NULL;
+    first = 0;
+    if (strncmp(name, MEDIAFIREFS_XATTR_FIND,
+                strlen(MEDIAFIREFS_XATTR_FIND)) == 0) {
+        pattern = name + strlen(MEDIAFIREFS_XATTR_FIND);
+    } else if (strncmp(name, MEDIAFIREFS_XATTR_FIND_FROM,
+                       strlen(MEDIAFIREFS_XATTR_FIND_FROM)) == 0) {
+        pattern = name + strlen(MEDIAFIREFS_XATTR_FIND_FROM);
+        first = strtoull(pattern, &end, 10);
+        if (end == pattern || *end != '.')
+            return -ENODATA;
+        pattern = end + 1;
+    } else if (strcmp(name, MEDIAFIREFS_XATTR_STATS) != 0) {
+        return -ENODATA;
+    }
+
+    text = NULL;
+    len = 0;
+    stream = open_memstream(&text, &len);
+    if (stream == NULL) {
+        fprintf(stderr, "open_memstream failed\n");
+        return -ENOMEM;
+    }
+
+    if (pattern != NULL) {
+        pthread_rwlock_rdlock(&(ctx->lock));
+        retval = folder_tree_find(ctx->tree, pattern, stream);
+        pthread_rwlock_unlock(&(ctx->lock));
+    } else {
+        pthread_rwlock_rdlock(&(ctx->lock));
+        folder_tree_stats(ctx->tree, &stats);
+        pthread_rwlock_unlock(&(ctx->lock));
+
+        folder_tree_stats_print(&stats, stream);
+        retval = 0;
+    }
+    if (fclose(stream) != 0 || retval != 0) {
+        free(text);
+        return -ENOMEM;
+    }
 
-    fprintf(stderr, "getxattr not implemented\n");
+    len = getxattr_page(text, len, first, &page);
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    if (size == 0) {
+        retval = len;
+    } else if (size < len) {
+        retval = -ERANGE;
+    } else {
+        memcpy(value, page, len);
+        retval = len;
+    }
 
-    return -ENOSYS;
+    free(text);
+
+    return retval;
 }
 
+/*
+ * skip the first lines of the text and cut the rest after the last line that
+ * fits into an attribute together with a line that tells where to go on
+ *
+ * returns the length of the page that starts at *page
+ */
+static size_t getxattr_page(char *text, size_t len, uint64_t first,
+                            char **page)
+{
+    char           *line_end;
+    uint64_t        num_lines;
+    size_t          page_len;
+
+    *page = text;
+    for (num_lines = 0; num_lines < first && len > 0; num_lines++) {
+        line_end = memchr(*page, '\n', len);
+        if (line_end == NULL)
+            line_end = *page + len - 1;
+        len -= line_end + 1 - *page;
+        *page = line_end + 1;
+    }
+
+    if (len <= MEDIAFIREFS_XATTR_MAX_SIZE)
+        return len;
+
+    page_len = MEDIAFIREFS_XATTR_MAX_SIZE - FIND_MARKER_SIZE;
+    while (page_len > 0 && (*page)[page_len - 1] != '\n')
+        page_len--;
+    /* a path that does not fit into a page is left out so that the list
+     * goes on after it */
+    if (page_len == 0)
+        num_lines++;
+    for (line_end = *page; line_end < *page + page_len; line_end++) {
+        if (*line_end == '\n')
+            num_lines++;
+    }
+
+    /* the marker replaces a part of the text that was cut */
+    page_len += snprintf(*page + page_len, FIND_MARKER_SIZE, "... %" PRIu64
+                         "\n", num_lines);
+
+    return page_len;
+}
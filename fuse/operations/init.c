@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup and struct timespec
+#define _XOPEN_SOURCE 700       // for S_IFDIR and S_IFREG (on linux,
+                                // posix_c_source is enough but this is needed
+                                // on freebsd)
+
+#define FUSE_USE_VERSION 30
+
+#include <fuse/fuse.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "../../mfapi/apicalls.h"
+#include "../crawler.h"
+#include "../readahead.h"
+#include "../evictor.h"
+#include "../scrubber.h"
+#include "../hashtbl.h"
+#include "../operations.h"
+
+/*
+ * the journal contains nothing but its four byte header
+ */
+#define EMPTY_JOURNAL_SIZE 4
+
+static void    *mediafirefs_checkpoint_thread(void *user_ptr);
+static void    *mediafirefs_poll_thread(void *user_ptr);
+static bool     mediafirefs_poll(struct mediafirefs_context_private *ctx);
+static bool     mediafirefs_connect(struct mediafirefs_context_private *ctx);
+
+/*
+ * threads have to be started here and not in main because fuse_main forks
+ * into the background before calling this function
+ */
+void           *mediafirefs_init(struct fuse_conn_info *conn)
+{
+    printf("FUNCTION: init\n");
+    struct mediafirefs_context_private *ctx;
+    int             retval;
+
+    (void)conn;
+
+    ctx = fuse_get_context()->private_data;
+
+    retval = pthread_create(&(ctx->checkpoint_thread), NULL,
+                            mediafirefs_checkpoint_thread, ctx);
+    if (retval != 0) {
+        fprintf(stderr, "cannot start checkpoint thread\n");
+    } else {
+        ctx->checkpoint_running = true;
+    }
+
+    retval = pthread_create(&(ctx->poll_thread), NULL,
+                            mediafirefs_poll_thread, ctx);
+    if (retval != 0) {
+        fprintf(stderr, "cannot start poll thread\n");
+    } else {
+        ctx->poll_running = true;
+    }
+
+    /* while offline, the crawler is started once the remote is reached */
+    if (ctx->crawl_workers > 0 && !ctx->offline) {
+        ctx->crawler = crawler_start(ctx->tree, &(ctx->lock), ctx->conn,
+                                     ctx->crawl_workers);
+    }
+
+    /* four connections are enough to keep a few sequential readers ahead */
+    if (ctx->readahead_budget > 0) {
+        ctx->readahead = readahead_start(4, ctx->readahead_budget);
+    }
+
+    if (ctx->cache_high > 0) {
+        ctx->evictor = evictor_start(ctx->tree, &(ctx->lock), ctx->cache_high,
+                                     ctx->cache_low, 600);
+    }
+
+    if (ctx->scrub) {
+        ctx->scrubber = scrubber_start(ctx->tree, &(ctx->lock));
+    }
+
+    return ctx;
+}
+
+/*
+ * make the poll thread ask the remote for changes after the shortest
+ * interval again
+ *
+ * this is called after local changes were uploaded because the remote might
+ * still be processing them or other clients might react to them
+ */
+void mediafirefs_poll_soon(struct mediafirefs_context_private *ctx)
+{
+    pthread_mutex_lock(&(ctx->poll_mutex));
+    ctx->poll_reset = true;
+    pthread_cond_signal(&(ctx->poll_cond));
+    pthread_mutex_unlock(&(ctx->poll_mutex));
+}
+
+/*
+ * every interval_checkpoint seconds, store the tree if the journal contains
+ * changes so that the journal that has to be replayed after a crash stays
+ * short
+ *
+ * the tree is stored while holding the lock for reading, so this only
+ * blocks operations which modify the tree for the time it takes to write the
+ * dircache
+ */
+static void    *mediafirefs_checkpoint_thread(void *user_ptr)
+{
+    struct mediafirefs_context_private *ctx;
+    struct timespec deadline;
+    int             retval;
+
+    ctx = (struct mediafirefs_context_private *)user_ptr;
+
+    pthread_mutex_lock(&(ctx->checkpoint_mutex));
+
+    while (!ctx->checkpoint_stop) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += ctx->interval_checkpoint;
+
+        retval = 0;
+        while (!ctx->checkpoint_stop && retval != ETIMEDOUT) {
+            retval = pthread_cond_timedwait(&(ctx->checkpoint_cond),
+                                            &(ctx->checkpoint_mutex),
+                                            &deadline);
+        }
+        if (ctx->checkpoint_stop)
+            break;
+
+        pthread_rwlock_rdlock(&(ctx->lock));
+        if (folder_tree_journal_get_size(ctx->tree) > EMPTY_JOURNAL_SIZE) {
+            fprintf(stderr, "writing checkpoint\n");
+            folder_tree_checkpoint(ctx->tree, ctx->dircache);
+        }
+        pthread_rwlock_unlock(&(ctx->lock));
+    }
+
+    pthread_mutex_unlock(&(ctx->checkpoint_mutex));
+
+    return NULL;
+}
+
+/*
+ * regularly ask the remote for changes and apply them to the tree
+ *
+ * the interval starts at interval_status_min and doubles every time that
+ * nothing changed up to interval_status_max. It falls back to
+ * interval_status_min whenever a change was found or mediafirefs_poll_soon
+ * was called. This way, an idle mount causes few requests while changes
+ * show up quickly when there is activity.
+ *
+ * every interval_housekeep seconds, all entries of the tree are checked for
+ * consistency after a poll that found no changes. After every poll, the
+ * folders that were not used recently are paged out if the tree exceeds its
+ * memory limit.
+ *
+ * while offline, the same intervals are used to try to reach the remote
+ * instead.
+ */
+static void    *mediafirefs_poll_thread(void *user_ptr)
+{
+    struct mediafirefs_context_private *ctx;
+    struct timespec deadline;
+    time_t          interval;
+    time_t          last_poll;
+    time_t          last_housekeep;
+    bool            changed;
+    int             retval;
+
+    ctx = (struct mediafirefs_context_private *)user_ptr;
+
+    interval = ctx->interval_status_min;
+    last_poll = time(NULL);
+    last_housekeep = last_poll;
+
+    pthread_mutex_lock(&(ctx->poll_mutex));
+
+    while (!ctx->poll_stop) {
+        retval = 0;
+        while (!ctx->poll_stop && retval != ETIMEDOUT) {
+            /* a call to mediafirefs_poll_soon shortens the interval that
+             * is currently waited for */
+            if (ctx->poll_reset) {
+                interval = ctx->interval_status_min;
+            }
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            if (deadline.tv_sec >= last_poll + interval)
+                break;
+            deadline.tv_sec = last_poll + interval;
+            deadline.tv_nsec = 0;
+            retval = pthread_cond_timedwait(&(ctx->poll_cond),
+                                            &(ctx->poll_mutex), &deadline);
+        }
+        if (ctx->poll_stop)
+            break;
+
+        ctx->poll_reset = false;
+        pthread_mutex_unlock(&(ctx->poll_mutex));
+
+        /* only this thread changes ctx->offline, so it can be read without
+         * taking the lock */
+        if (ctx->offline) {
+            changed = !ctx->login_refused && mediafirefs_connect(ctx);
+        } else {
+            changed = mediafirefs_poll(ctx);
+        }
+        last_poll = time(NULL);
+
+        /* updates only check the entries they touched, so once in a while
+         * and only while nothing changes, check the whole tree */
+        if (!changed && !ctx->offline
+            && last_poll - last_housekeep >= ctx->interval_housekeep) {
+            pthread_rwlock_wrlock(&(ctx->lock));
+            folder_tree_housekeep_full(ctx->tree, ctx->conn);
+            pthread_rwlock_unlock(&(ctx->lock));
+            last_housekeep = last_poll;
+        }
+
+        pthread_rwlock_wrlock(&(ctx->lock));
+        folder_tree_trim(ctx->tree);
+        pthread_rwlock_unlock(&(ctx->lock));
+
+        pthread_mutex_lock(&(ctx->poll_mutex));
+
+        if (changed || ctx->poll_reset) {
+            interval = ctx->interval_status_min;
+        } else if (interval < ctx->interval_status_max) {
+            interval *= 2;
+            if (interval > ctx->interval_status_max)
+                interval = ctx->interval_status_max;
+        }
+    }
+
+    pthread_mutex_unlock(&(ctx->poll_mutex));
+
+    return NULL;
+}
+
+/*
+ * ask the remote for its revision and update the tree if it changed
+ *
+ * device/get_status is called with the lock taken for reading, so lookups
+ * continue while it runs. Callbacks which read the tree never use the
+ * connection, so the lock still makes sure that only a single thread uses it
+ * at a time. Only if the remote revision differs, the lock is taken for
+ * writing to apply the changes.
+ *
+ * returns true if the tree was updated
+ */
+static bool mediafirefs_poll(struct mediafirefs_context_private *ctx)
+{
+    uint64_t        revision_remote;
+    bool            changed;
+    int             retval;
+
+    pthread_rwlock_rdlock(&(ctx->lock));
+    retval = mfconn_api_device_get_status(ctx->conn, &revision_remote);
+    changed = retval == 0
+        && revision_remote != folder_tree_get_revision(ctx->tree);
+    pthread_rwlock_unlock(&(ctx->lock));
+
+    if (retval != 0) {
+        fprintf(stderr, "device/get_status failed\n");
+        return false;
+    }
+
+    if (!changed) {
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&(ctx->lock));
+    /* another callback might have updated the tree in the meantime */
+    if (revision_remote != folder_tree_get_revision(ctx->tree)) {
+        folder_tree_update(ctx->tree, ctx->conn, true);
+    }
+    pthread_rwlock_unlock(&(ctx->lock));
+
+    return true;
+}
+
+/*
+ * try to reach the remote and leave the offline mode if it worked
+ *
+ * while offline, no other thread uses the connection, so the session token
+ * is requested without holding the lock. Then the tree is brought up to date
+ * with the changes made remotely in the meantime and outdated folders are
+ * retrieved again when they are accessed.
+ *
+ * if the remote refuses the login, login_refused is set so that it is not
+ * tried again
+ *
+ * returns true if the remote was reached
+ */
+static bool mediafirefs_connect(struct mediafirefs_context_private *ctx)
+{
+    int             retval;
+
+    retval = mfconn_refresh_token(ctx->conn);
+    if (retval == MFCONN_UNREACHABLE) {
+        fprintf(stderr, "remote still unreachable, staying offline\n");
+        return false;
+    }
+    if (retval != 0) {
+        fprintf(stderr, "remote refused the login, staying offline until"
+                " the next mount\n");
+        ctx->login_refused = true;
+        return false;
+    }
+
+    fprintf(stderr, "remote reached, switching to online mode\n");
+
+    pthread_rwlock_wrlock(&(ctx->lock));
+    ctx->offline = false;
+    folder_tree_set_offline(ctx->tree, false);
+    folder_tree_update(ctx->tree, ctx->conn, false);
+    if (ctx->crawl_workers > 0) {
+        ctx->crawler = crawler_start(ctx->tree, &(ctx->lock), ctx->conn,
+                                     ctx->crawl_workers);
+    }
+    pthread_rwlock_unlock(&(ctx->lock));
+
+    return true;
+}
@@ -29,7 +29,7 @@
 //#include <stdlib.h>
 //#include <unistd.h>
 #include <pthread.h>
-//#include <string.h>
+#include <string.h>
 #include <errno.h>
 //#include <sys/stat.h>
 //#include <fcntl.h>
@@ -54,19 +54,16 @@ int mediafirefs_listxattr(const char *path, char *list, size_t size)
 {
     printf("FUNCTION: listxattr. path: %s\n", path);
 
-    (void)path;
-    (void)list;
-    (void)size;
-    struct mediafirefs_context_private *ctx;
+    /* only the mount point has an attribute (see mediafirefs_getxattr) */
+    if (strcmp(path, "/") != 0)
+        return 0;
 
-    ctx = fuse_get_context()->private_data;
+    if (size == 0)
+        return sizeof(MEDIAFIREFS_XATTR_STATS);
+    if (size < sizeof(MEDIAFIREFS_XATTR_STATS))
+        return -ERANGE;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    memcpy(list, MEDIAFIREFS_XATTR_STATS, sizeof(MEDIAFIREFS_XATTR_STATS));
 
-    fprintf(stderr, "listxattr not implemented\n");
-
-    pthread_mutex_unlock(&(ctx->mutex));
-
-    return -ENOSYS;
+    return sizeof(MEDIAFIREFS_XATTR_STATS);
 }
-
@@ -63,7 +63,12 @@ int mediafirefs_mkdir(const char *path, mode_t mode)
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
+
+    if (ctx->offline) {
+        pthread_rwlock_unlock(&(ctx->lock));
+        return -EROFS;
+    }
 
     /* we don't need to check whether the path already existed because the
      * getattr call made before this one takes care of that
@@ -83,7 +88,7 @@ int mediafirefs_mkdir(const char *path, mode_t mode)
     basename = strrchr(dirname, '/');
     if (basename == NULL) {
         fprintf(stderr, "cannot find slash\n");
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         return -ENOENT;
     }
 
@@ -104,7 +109,7 @@ int mediafirefs_mkdir(const char *path, mode_t mode)
     retval = mfconn_api_folder_create(ctx->conn, key, basename);
     if (retval != 0) {
         fprintf(stderr, "mfconn_api_folder_create unsuccessful\n");
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         // FIXME: find better errno in this case
         return -EAGAIN;
     }
@@ -112,8 +117,9 @@ int mediafirefs_mkdir(const char *path, mode_t mode)
     free(dirname);
 
     folder_tree_update(ctx->tree, ctx->conn, true);
+    mediafirefs_poll_soon(ctx);
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
@@ -30,7 +30,7 @@
 #include <stdlib.h>
 //#include <unistd.h>
 #include <string.h>
-//#include <errno.h>
+#include <errno.h>
 //#include <sys/stat.h>
 //#include <fcntl.h>
 #include <stdint.h>
@@ -53,6 +53,7 @@
 #include "../../utils/stringv.h"
 //#include "../../utils/hash.h"
 #include "../hashtbl.h"
+#include "../evictor.h"
 #include "../operations.h"
 
 
@@ -78,23 +79,38 @@ int mediafirefs_open(const char *path, struct fuse_file_info *file_info)
     int             fd;
     struct mediafirefs_openfile *openfile;
     struct mediafirefs_context_private *ctx;
+    filecache_part *part;
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
+
+    /* while offline, only files whose content is in the cache can be read
+     * and no attempt is made to update them */
+    if (ctx->offline && (file_info->flags & O_ACCMODE) != O_RDONLY) {
+        pthread_rwlock_unlock(&(ctx->lock));
+        return -EROFS;
+    }
 
     fd = folder_tree_open_file(ctx->tree, ctx->conn, path, file_info->flags,
-                               true);
+                               !ctx->offline, &part);
     if (fd < 0) {
         fprintf(stderr, "folder_tree_file_open unsuccessful\n");
-        pthread_mutex_unlock(&(ctx->mutex));
+        /* the file is not in the cache */
+        if (ctx->offline && fd == -1)
+            fd = -ENETUNREACH;
+        pthread_rwlock_unlock(&(ctx->lock));
         return fd;
     }
 
     openfile = malloc(sizeof(struct mediafirefs_openfile));
-    openfile->fd = fd;
+    openfile->fd = part != NULL ? -1 : fd;
+    openfile->part = part;
+    memset(&(openfile->ra), 0, sizeof(openfile->ra));
     openfile->is_local = false;
     openfile->path = strdup(path);
+    openfile->key = strdup(folder_tree_path_get_key(ctx->tree, ctx->conn,
+                                                    path));
     openfile->is_flushed = true;
 
     if ((file_info->flags & O_ACCMODE) == O_RDONLY) {
@@ -109,7 +125,10 @@ int mediafirefs_open(const char *path, struct fuse_file_info *file_info)
 
     file_info->fh = (uintptr_t) openfile;
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    // the file might have been retrieved, which makes the cache grow
+    evictor_notify(ctx->evictor);
+
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
@@ -47,6 +47,7 @@
 //#include "../../utils/stringv.h"
 //#include "../../utils/hash.h"
 //#include "../hashtbl.h"
+#include "../readahead.h"
 #include "../operations.h"
 
 
@@ -58,16 +59,24 @@ int mediafirefs_read(const char *path, char *buf, size_t size, off_t offset,
     (void)path;
     ssize_t         retval;
     struct mediafirefs_context_private *ctx;
+    struct mediafirefs_openfile *openfile;
 
     ctx = fuse_get_context()->private_data;
-    pthread_mutex_lock(&(ctx->mutex));
+    openfile = (struct mediafirefs_openfile *)(uintptr_t) file_info->fh;
 
-    retval =
-        pread(((struct mediafirefs_openfile *)(uintptr_t) file_info->fh)->fd,
-              buf, size, offset);
+    /* partial cache files have a lock of their own, so the lock of the
+     * context is not held while missing blocks are retrieved */
+    if (openfile->part != NULL) {
+        readahead_access(ctx->readahead, &(openfile->ra), openfile->part,
+                         offset, size);
+        return filecache_part_read(openfile->part, buf, size, offset);
+    }
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_rdlock(&(ctx->lock));
+
+    retval = pread(openfile->fd, buf, size, offset);
+
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return retval;
 }
-
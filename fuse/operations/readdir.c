@@ -30,7 +30,7 @@
 //#include <stdlib.h>
 #include <unistd.h>
 //#include <string.h>
-//#include <errno.h>
+#include <errno.h>
 //#include <sys/stat.h>
 //#include <fcntl.h>
 //#include <fuse/fuse_common.h>
@@ -53,16 +53,24 @@ int mediafirefs_readdir(const char *path, void *buf, fuse_fill_dir_t filldir,
                         off_t offset, struct fuse_file_info *info)
 {
     printf("FUNCTION: readdir. path: %s\n", path);
-    (void)offset;
     (void)info;
     struct mediafirefs_context_private *ctx;
     int             retval;
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
-    retval = folder_tree_readdir(ctx->tree, ctx->conn, path, buf, filldir);
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_rdlock(&(ctx->lock));
+    retval = folder_tree_readdir(ctx->tree, NULL, path, buf, filldir,
+                                 offset);
+    pthread_rwlock_unlock(&(ctx->lock));
+
+    /* the folder has to be retrieved from the remote first */
+    if (retval == -EAGAIN) {
+        pthread_rwlock_wrlock(&(ctx->lock));
+        retval = folder_tree_readdir(ctx->tree, ctx->conn, path, buf,
+                                     filldir, offset);
+        pthread_rwlock_unlock(&(ctx->lock));
+    }
 
     return retval;
 }
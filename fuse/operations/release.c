@@ -73,7 +73,7 @@ int mediafirefs_release(const char *path, struct fuse_file_info *file_info)
     // zero out check result to prevent spurious results later
     memset(&check_result,0,sizeof(check_result));
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
 
     openfile = (struct mediafirefs_openfile *)(uintptr_t) file_info->fh;
 
@@ -86,10 +86,17 @@ int mediafirefs_release(const char *path, struct fuse_file_info *file_info)
             exit(1);
         }
 
-        close(openfile->fd);
+        if (openfile->part != NULL)
+            folder_tree_close_part(ctx->tree, openfile->part);
+        else
+            close(openfile->fd);
+        if (openfile->key != NULL) {
+            folder_tree_close_file(ctx->tree, openfile->key);
+            free(openfile->key);
+        }
         free(openfile->path);
         free(openfile);
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         return 0;
     }
     // if the file is not readonly, its entry in writefiles has to be removed
@@ -101,12 +108,17 @@ int mediafirefs_release(const char *path, struct fuse_file_info *file_info)
 
     close(openfile->fd);
 
+    if (openfile->key != NULL) {
+        folder_tree_close_file(ctx->tree, openfile->key);
+        free(openfile->key);
+    }
     free(openfile->path);
     free(openfile);
 
     folder_tree_update(ctx->tree, ctx->conn, true);
+    mediafirefs_poll_soon(ctx);
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
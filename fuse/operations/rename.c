@@ -68,14 +68,19 @@ int mediafirefs_rename(const char *oldpath, const char *newpath)
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
+
+    if (ctx->offline) {
+        pthread_rwlock_unlock(&(ctx->lock));
+        return -EROFS;
+    }
 
     is_file = folder_tree_path_is_file(ctx->tree, ctx->conn, oldpath);
 
     key = folder_tree_path_get_key(ctx->tree, ctx->conn, oldpath);
     if (key == NULL) {
         fprintf(stderr, "key is NULL\n");
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         return -ENOENT;
     }
     // check if the directory changed
@@ -92,7 +97,7 @@ int mediafirefs_rename(const char *oldpath, const char *newpath)
             free(temp2);
         free(olddir);
         free(newdir);
-            pthread_mutex_unlock(&(ctx->mutex));
+            pthread_rwlock_unlock(&(ctx->lock));
             return -ENOENT;
         }
 
@@ -111,7 +116,7 @@ int mediafirefs_rename(const char *oldpath, const char *newpath)
             free(temp2);
         free(olddir);
         free(newdir);
-            pthread_mutex_unlock(&(ctx->mutex));
+            pthread_rwlock_unlock(&(ctx->lock));
             return -ENOENT;
         }
     }
@@ -158,7 +163,7 @@ int mediafirefs_rename(const char *oldpath, const char *newpath)
             free(oldname);
             free(newname);
 
-            pthread_mutex_unlock(&(ctx->mutex));
+            pthread_rwlock_unlock(&(ctx->lock));
             return -ENOENT;
         }
     }
@@ -169,8 +174,9 @@ int mediafirefs_rename(const char *oldpath, const char *newpath)
     free(newname);
 
     folder_tree_update(ctx->tree, ctx->conn, true);
+    mediafirefs_poll_soon(ctx);
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
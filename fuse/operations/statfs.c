@@ -70,7 +70,7 @@ int mediafirefs_statfs(const char *path, struct statvfs *buf)
     ctx = fuse_get_context()->private_data;
 
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
 
     // instantiate an account object and set the dirty flag on the size
     if(ctx->account == NULL)
@@ -81,7 +81,8 @@ int mediafirefs_statfs(const char *path, struct statvfs *buf)
 
     state_flags = account_get_state_flags(ctx->account);
 
-    if(state_flags & ACCOUNT_FLAG_DIRTY_SIZE)
+    // while offline, the size stays dirty until the remote can be reached
+    if((state_flags & ACCOUNT_FLAG_DIRTY_SIZE) && !ctx->offline)
     {
         memset(space_total, 0, sizeof(space_total));
         memset(space_used, 0, sizeof(space_used));
@@ -102,7 +103,7 @@ int mediafirefs_statfs(const char *path, struct statvfs *buf)
 
     if (bytes_total == 0) {
 
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         return -ENOSYS;         // returning -ENOENT might make more sense
     }
 
@@ -119,7 +120,7 @@ int mediafirefs_statfs(const char *path, struct statvfs *buf)
     buf->f_bfree = (bytes_free / 65536);
     buf->f_bavail = (bytes_free / 65536);
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
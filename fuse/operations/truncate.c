@@ -61,22 +61,27 @@ int mediafirefs_truncate(const char *path, off_t length)
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
+
+    if (ctx->offline) {
+        pthread_rwlock_unlock(&(ctx->lock));
+        return -EROFS;
+    }
 
     if (length != 0) {
 	fprintf(stderr, "Truncate is not defined for length other than 0\n");
-	pthread_mutex_unlock(&(ctx->mutex));
+	pthread_rwlock_unlock(&(ctx->lock));
 	return -EINVAL;
     }
 
     retval = folder_tree_truncate_file(ctx->tree, ctx->conn, path);
 
     if (retval == -1) {
-	pthread_mutex_unlock(&(ctx->mutex));
+	pthread_rwlock_unlock(&(ctx->lock));
 	return -ENOENT;
     }
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
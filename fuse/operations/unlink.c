@@ -61,7 +61,12 @@ int mediafirefs_unlink(const char *path)
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
+
+    if (ctx->offline) {
+        pthread_rwlock_unlock(&(ctx->lock));
+        return -EROFS;
+    }
 
     /* no need to check
      *  - if path is directory
@@ -74,14 +79,14 @@ int mediafirefs_unlink(const char *path)
     key = folder_tree_path_get_key(ctx->tree, ctx->conn, path);
     if (key == NULL) {
         fprintf(stderr, "key is NULL\n");
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         return -ENOENT;
     }
 
     retval = mfconn_api_file_delete(ctx->conn, key);
     if (retval != 0) {
         fprintf(stderr, "mfconn_api_file_create unsuccessful\n");
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         // FIXME: find better errno in this case
         return -EAGAIN;
     }
@@ -92,8 +97,9 @@ int mediafirefs_unlink(const char *path)
 
     /* retrieve remote changes to not get out of sync */
     folder_tree_update(ctx->tree, ctx->conn, true);
+    mediafirefs_poll_soon(ctx);
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
@@ -68,7 +68,12 @@ int mediafirefs_utimens(const char *path, const struct timespec tv[2])
 
     ctx = fuse_get_context()->private_data;
 
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
+
+    if (ctx->offline) {
+        pthread_rwlock_unlock(&(ctx->lock));
+        return -EROFS;
+    }
 
     is_file = folder_tree_path_is_file(ctx->tree, ctx->conn, path);
 
@@ -76,7 +81,7 @@ int mediafirefs_utimens(const char *path, const struct timespec tv[2])
     key = folder_tree_path_get_key(ctx->tree, ctx->conn, path);
     if (key == NULL) {
         fprintf(stderr, "key is NULL\n");
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         return -ENOENT;
     }
     // call tzset if needed
@@ -90,7 +95,7 @@ int mediafirefs_utimens(const char *path, const struct timespec tv[2])
 
     if (localtime_r((const time_t *)&since_epoch, &local_time) == NULL) {
         fprintf(stderr, "utimens not implemented\n");
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
 
         return -ENOSYS;
     }
@@ -107,11 +112,11 @@ int mediafirefs_utimens(const char *path, const struct timespec tv[2])
     }
 
     if (retval == -1) {
-        pthread_mutex_unlock(&(ctx->mutex));
+        pthread_rwlock_unlock(&(ctx->lock));
         return -ENOENT;
     }
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return 0;
 }
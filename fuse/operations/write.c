@@ -60,14 +60,14 @@ int mediafirefs_write(const char *path, const char *buf, size_t size,
     struct mediafirefs_openfile *openfile;
 
     ctx = fuse_get_context()->private_data;
-    pthread_mutex_lock(&(ctx->mutex));
+    pthread_rwlock_wrlock(&(ctx->lock));
 
     openfile = (struct mediafirefs_openfile *)(uintptr_t) file_info->fh;
 
     retval = pwrite(openfile->fd, buf, size, offset);
     openfile->is_flushed = false;
 
-    pthread_mutex_unlock(&(ctx->mutex));
+    pthread_rwlock_unlock(&(ctx->lock));
 
     return retval;
 }
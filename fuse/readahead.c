@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../mfapi/mfconn.h"
+#include "filecache.h"
+#include "readahead.h"
+
+/*
+ * Readahead retrieves the blocks of partial cache files (see filecache.c)
+ * before they are read, so that sequential reads do not wait for the
+ * network.
+ *
+ * Every file handle keeps a readahead_stream. A read that starts where the
+ * last one ended is a sequential hit and doubles the window of bytes that
+ * are retrieved ahead of the reads, starting at READAHEAD_MIN_WINDOW up to
+ * READAHEAD_MAX_WINDOW. Any other read resets the window to zero.
+ *
+ * The bytes ahead of the reads are put into a queue in ranges of at most
+ * READAHEAD_CHUNK bytes, so that a reader never waits for more than one
+ * range, and a number of worker threads retrieve them. The bytes in the
+ * queue and in flight are bounded by a budget that is shared by all files,
+ * so that many files which are read at the same time do not saturate the
+ * link with data that is not read yet. What does not fit is scheduled by
+ * later reads.
+ *
+ * Every range holds a reference to its partial file, so it stays valid
+ * after the file was closed. Nothing is retrieved for closed files.
+ */
+
+#define READAHEAD_MIN_WINDOW 1048576
+#define READAHEAD_MAX_WINDOW (32 * 1048576)
+#define READAHEAD_CHUNK (4 * 1048576)
+
+struct readahead_item {
+    filecache_part *part;
+    uint64_t        offset;
+    uint64_t        length;
+    struct readahead_item *next;
+};
+
+struct readahead_pool {
+    /* protects all members below and is used together with cond to wake up
+     * the workers */
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+
+    /* the ranges are retrieved in the order in which they were scheduled */
+    struct readahead_item *queue_head;
+    struct readahead_item *queue_tail;
+    /* the number of bytes in the queue and in flight and their limit */
+    uint64_t        num_bytes;
+    uint64_t        budget;
+    bool            stop;
+
+    pthread_t      *workers;
+    int             num_workers;
+};
+
+static void    *readahead_worker(void *user_ptr);
+
+readahead_pool *readahead_start(int num_workers, uint64_t budget)
+{
+    readahead_pool *ra;
+    int             i;
+
+    if (num_workers < 1 || budget == 0)
+        return NULL;
+
+    ra = (readahead_pool *) calloc(1, sizeof(readahead_pool));
+    if (ra == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+    ra->workers = (pthread_t *) calloc(num_workers, sizeof(pthread_t));
+    if (ra->workers == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        free(ra);
+        return NULL;
+    }
+    ra->budget = budget;
+    pthread_mutex_init(&(ra->mutex), NULL);
+    pthread_cond_init(&(ra->cond), NULL);
+
+    for (i = 0; i < num_workers; i++) {
+        if (pthread_create(&(ra->workers[ra->num_workers]), NULL,
+                           readahead_worker, ra) != 0) {
+            fprintf(stderr, "cannot start readahead worker\n");
+            continue;
+        }
+        ra->num_workers++;
+    }
+
+    if (ra->num_workers == 0) {
+        readahead_stop(ra);
+        return NULL;
+    }
+
+    return ra;
+}
+
+/*
+ * stop all workers and free the pool
+ *
+ * ranges which are in flight are finished first, the others are dropped
+ */
+void readahead_stop(readahead_pool * ra)
+{
+    struct readahead_item *item;
+    int             i;
+
+    if (ra == NULL)
+        return;
+
+    pthread_mutex_lock(&(ra->mutex));
+    ra->stop = true;
+    pthread_cond_broadcast(&(ra->cond));
+    pthread_mutex_unlock(&(ra->mutex));
+
+    for (i = 0; i < ra->num_workers; i++) {
+        pthread_join(ra->workers[i], NULL);
+    }
+
+    /* now no other thread accesses the queue anymore */
+    while (ra->queue_head != NULL) {
+        item = ra->queue_head;
+        ra->queue_head = item->next;
+        filecache_part_unref(item->part);
+        free(item);
+    }
+
+    pthread_cond_destroy(&(ra->cond));
+    pthread_mutex_destroy(&(ra->mutex));
+    free(ra->workers);
+    free(ra);
+}
+
+/*
+ * record a read of a file handle and schedule the bytes ahead of it if the
+ * access is sequential
+ *
+ * this is called before the read itself, so that the first ranges ahead are
+ * retrieved while the read waits for its own blocks
+ */
+void readahead_access(readahead_pool * ra,
+                      struct readahead_stream *stream, filecache_part * part,
+                      uint64_t offset, size_t size)
+{
+    struct readahead_item *item;
+    uint64_t        end;
+    uint64_t        start;
+    uint64_t        length;
+
+    if (ra == NULL || size == 0)
+        return;
+
+    end = offset + size;
+
+    /* the stream is protected by the mutex as well because fuse may call
+     * read concurrently for the same file handle */
+    pthread_mutex_lock(&(ra->mutex));
+
+    if (offset == stream->next_offset) {
+        if (stream->window == 0)
+            stream->window = READAHEAD_MIN_WINDOW;
+        else if (stream->window < READAHEAD_MAX_WINDOW)
+            stream->window *= 2;
+    } else {
+        stream->window = 0;
+        stream->scheduled = 0;
+    }
+    stream->next_offset = end;
+
+    if (stream->window == 0) {
+        pthread_mutex_unlock(&(ra->mutex));
+        return;
+    }
+
+    start = stream->scheduled > end ? stream->scheduled : end;
+
+    while (!ra->stop && start < end + stream->window
+           && ra->num_bytes < ra->budget) {
+        length = end + stream->window - start;
+        if (length > READAHEAD_CHUNK)
+            length = READAHEAD_CHUNK;
+        if (length > ra->budget - ra->num_bytes)
+            length = ra->budget - ra->num_bytes;
+
+        item = (struct readahead_item *)calloc(1,
+                                               sizeof(struct
+                                                      readahead_item));
+        if (item == NULL) {
+            fprintf(stderr, "calloc failed\n");
+            break;
+        }
+        filecache_part_ref(part);
+        item->part = part;
+        item->offset = start;
+        item->length = length;
+        if (ra->queue_tail == NULL)
+            ra->queue_head = item;
+        else
+            ra->queue_tail->next = item;
+        ra->queue_tail = item;
+        ra->num_bytes += length;
+        start += length;
+        pthread_cond_signal(&(ra->cond));
+    }
+    stream->scheduled = start;
+
+    pthread_mutex_unlock(&(ra->mutex));
+}
+
+static void    *readahead_worker(void *user_ptr)
+{
+    readahead_pool *ra;
+    struct readahead_item *item;
+
+    ra = (readahead_pool *) user_ptr;
+
+    pthread_mutex_lock(&(ra->mutex));
+
+    while (!ra->stop) {
+        if (ra->queue_head == NULL) {
+            pthread_cond_wait(&(ra->cond), &(ra->mutex));
+            continue;
+        }
+
+        item = ra->queue_head;
+        ra->queue_head = item->next;
+        if (ra->queue_head == NULL)
+            ra->queue_tail = NULL;
+        pthread_mutex_unlock(&(ra->mutex));
+
+        filecache_part_prefetch(item->part, item->offset, item->length);
+        filecache_part_unref(item->part);
+
+        pthread_mutex_lock(&(ra->mutex));
+        ra->num_bytes -= item->length;
+        free(item);
+    }
+
+    pthread_mutex_unlock(&(ra->mutex));
+
+    return NULL;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __FUSE_READAHEAD_H__
+#define __FUSE_READAHEAD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "../mfapi/mfconn.h"
+
+#include "filecache.h"
+
+typedef struct readahead_pool readahead_pool;
+
+/* the access pattern of a file handle. It is all zero when it is opened */
+struct readahead_stream {
+    /* where the next read starts if the access is sequential */
+    uint64_t        next_offset;
+    /* the number of bytes retrieved ahead of the reads, zero while the
+     * access is not sequential */
+    uint64_t        window;
+    /* the end of the bytes that were already scheduled */
+    uint64_t        scheduled;
+};
+
+readahead_pool *readahead_start(int num_workers, uint64_t budget);
+
+void            readahead_access(readahead_pool * ra,
+                                 struct readahead_stream *stream,
+                                 filecache_part * part, uint64_t offset,
+                                 size_t size);
+
+void            readahead_stop(readahead_pool * ra);
+
+#endif
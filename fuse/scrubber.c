@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for fileno
+
+#include <inttypes.h>
+#include <openssl/sha.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "hashtbl.h"
+#include "scrubber.h"
+#include "../mfapi/apicalls.h"
+
+/*
+ * The scrubber verifies the content of the file cache in the background.
+ *
+ * When mounting, only the cached files whose size, modification time or
+ * inode differ from the verified manifest are hashed again. The scrubber
+ * reads all other files once after mounting, to catch content that changed
+ * without any of these, for example through bit rot. The lock of the
+ * context is only held to pick the next file and to act on its hash, not
+ * while the file is read, and the scrubber checks whether it should stop
+ * after every chunk so that unmounting does not wait for a large file.
+ */
+
+#define SCRUBBER_CHUNK_SIZE 65536
+
+struct scrubber {
+    folder_tree    *tree;
+    /* the lock of the context which protects the tree */
+    pthread_rwlock_t *lock;
+
+    pthread_t       thread;
+    /* protects stop */
+    pthread_mutex_t mutex;
+    bool            stop;
+};
+
+static void    *scrubber_main(void *user_ptr);
+
+scrubber       *scrubber_start(folder_tree * tree, pthread_rwlock_t * lock)
+{
+    scrubber       *scrubber;
+    int             retval;
+
+    scrubber = (struct scrubber *)calloc(1, sizeof(struct scrubber));
+    if (scrubber == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+
+    scrubber->tree = tree;
+    scrubber->lock = lock;
+    pthread_mutex_init(&(scrubber->mutex), NULL);
+
+    retval = pthread_create(&(scrubber->thread), NULL, scrubber_main,
+                            scrubber);
+    if (retval != 0) {
+        fprintf(stderr, "cannot start scrubber thread\n");
+        pthread_mutex_destroy(&(scrubber->mutex));
+        free(scrubber);
+        return NULL;
+    }
+
+    return scrubber;
+}
+
+/*
+ * stop the scrubber and free it
+ *
+ * the file which is being read is abandoned
+ */
+void scrubber_stop(scrubber * scrubber)
+{
+    if (scrubber == NULL)
+        return;
+
+    pthread_mutex_lock(&(scrubber->mutex));
+    scrubber->stop = true;
+    pthread_mutex_unlock(&(scrubber->mutex));
+
+    pthread_join(scrubber->thread, NULL);
+
+    pthread_mutex_destroy(&(scrubber->mutex));
+    free(scrubber);
+}
+
+static bool scrubber_stopped(scrubber * scrubber)
+{
+    bool            stop;
+
+    pthread_mutex_lock(&(scrubber->mutex));
+    stop = scrubber->stop;
+    pthread_mutex_unlock(&(scrubber->mutex));
+
+    return stop;
+}
+
+/*
+ * hash the content of file like calc_sha256 but give up once the scrubber
+ * is stopped
+ *
+ * returns 0 on success, 1 if the scrubber was stopped and -1 on error
+ */
+static int scrubber_hash(scrubber * scrubber, FILE * file,
+                         unsigned char *hash)
+{
+    SHA256_CTX      sha256;
+    unsigned char   buffer[SCRUBBER_CHUNK_SIZE];
+    size_t          bytes_read;
+
+    SHA256_Init(&sha256);
+
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        SHA256_Update(&sha256, buffer, bytes_read);
+        if (scrubber_stopped(scrubber))
+            return 1;
+    }
+    if (ferror(file)) {
+        fprintf(stderr, "fread failed\n");
+        return -1;
+    }
+
+    SHA256_Final(hash, &sha256);
+
+    return 0;
+}
+
+static void    *scrubber_main(void *user_ptr)
+{
+    scrubber       *scrubber;
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    uint64_t        revision;
+    char           *cachefile;
+    FILE           *fh;
+    struct stat     st;
+    unsigned char   hash[SHA256_DIGEST_LENGTH];
+    uint64_t        num_files;
+    int             retval;
+
+    scrubber = (struct scrubber *)user_ptr;
+
+    key[0] = '\0';
+    revision = 0;
+    num_files = 0;
+
+    while (!scrubber_stopped(scrubber)) {
+        pthread_rwlock_rdlock(scrubber->lock);
+        cachefile = folder_tree_scrub_next(scrubber->tree, key, &revision);
+        pthread_rwlock_unlock(scrubber->lock);
+        if (cachefile == NULL)
+            break;
+
+        /* the file might have been removed meanwhile */
+        fh = fopen(cachefile, "r");
+        free(cachefile);
+        if (fh == NULL)
+            continue;
+
+        /* the stat of the file that is read tells the tree whether it is
+         * still the one that was verified */
+        if (fstat(fileno(fh), &st) != 0) {
+            fprintf(stderr, "fstat failed\n");
+            fclose(fh);
+            continue;
+        }
+
+        retval = scrubber_hash(scrubber, fh, hash);
+        fclose(fh);
+        if (retval != 0)
+            continue;
+
+        pthread_rwlock_wrlock(scrubber->lock);
+        folder_tree_scrub_result(scrubber->tree, key, revision, &st, hash);
+        pthread_rwlock_unlock(scrubber->lock);
+
+        num_files++;
+    }
+
+    if (!scrubber_stopped(scrubber)) {
+        fprintf(stderr, "verified %" PRIu64 " files in the file cache\n",
+                num_files);
+    }
+
+    return NULL;
+}
@@ -104,6 +104,19 @@ long            mfconn_api_folder_get_content(mfconn * conn, const int mode,
                                               mffolder *** folder_result,
                                               mffile *** file_result);
 
+/*
+ * called by mfconn_api_folder_get_content_chunks with the number of a chunk
+ * and its folders or files, which the handler has to free
+ */
+typedef int     (*ContentChunkHandler) (int chunk, mffolder ** folders,
+                                        mffile ** files, void *data);
+
+long            mfconn_api_folder_get_content_chunks(mfconn * conn,
+                                                     const int mode,
+                                                     const char *folderkey,
+                                                     ContentChunkHandler
+                                                     handler, void *data);
+
 int             mfconn_api_folder_get_info(mfconn * conn, mffolder * folder,
                                            const char *folderkey);
 
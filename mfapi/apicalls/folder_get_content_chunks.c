@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) 2013 Bryan Christ <bryan.christ@mediafire.com>
+ *               2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+#ifndef __OpenBSD__
+#define _XOPEN_SOURCE           // for strptime
+#endif
+
+#include <time.h>
+#include <jansson.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../../utils/http.h"
+#include "../folder.h"
+#include "../file.h"
+#include "../mfconn.h"
+#include "../apicalls.h"        // IWYU pragma: keep
+
+/*
+ * the number of items requested per call. The official documentation says
+ * that up to 1000 items are supported but there is a server-side fix up that
+ * needs to take place first, so there is a temporary hard limit of 400.
+ */
+#define FOLDER_GET_CONTENT_CHUNK_SIZE 400
+
+/*
+ * passed to the decoding functions which append the folders or files of a
+ * chunk to result and store whether the remote has more chunks
+ */
+struct folder_get_content_chunk {
+    void           *result;
+    int             more_chunks;
+};
+
+static int      _decode_folder_get_content_folders(mfhttp * conn, void *data);
+
+static int      _decode_folder_get_content_files(mfhttp * conn, void *data);
+
+static int      _folder_get_content_chunk(mfconn * conn, const int mode,
+                                          const char *folderkey, int chunk,
+                                          struct folder_get_content_chunk
+                                          *chunk_data);
+
+/*
+ * the state shared by the threads that retrieve the chunks of one listing
+ *
+ * every thread takes the next chunk that nobody retrieved yet until the
+ * chunk after the last one or after one that failed is reached. The number
+ * of chunks is only known once the remote answers a chunk with
+ * more_chunks=no, so the chunks which were already requested after that one
+ * are answered without items and are ignored.
+ */
+struct folder_get_content_fetch {
+    pthread_mutex_t mutex;
+    pthread_mutex_t handler_mutex;
+    int             mode;
+    const char     *folderkey;
+    ContentChunkHandler handler;
+    void           *data;
+    int             next_chunk;
+    int             last_chunk;
+    int             failed_chunk;
+    long            retval;
+};
+
+/* the connection of one of the threads of a listing */
+struct folder_get_content_worker {
+    struct folder_get_content_fetch *fetch;
+    mfconn         *conn;
+    pthread_t       thread;
+};
+
+static int      _folder_get_content_fetch(struct folder_get_content_fetch
+                                          *fetch, mfconn * conn, int chunk);
+
+static void    *_folder_get_content_worker(void *user_ptr);
+
+/*
+ * retrieve the folders (mode 0) or files (mode 1) in a folder and hand them
+ * to the handler one chunk of FOLDER_GET_CONTENT_CHUNK_SIZE items at a time
+ *
+ * the first chunk is retrieved with the given connection. If the remote has
+ * more chunks, the others are retrieved in parallel with the connections
+ * that mfconn_get_helper keeps next to it, because every signed call changes
+ * the secret key of a connection so that the calls on one connection cannot
+ * overlap.
+ *
+ * the handler is called as soon as a chunk with items arrives, so the chunks
+ * might be handed to it in any order but never at the same time. It takes
+ * over the NULL terminated array of the items and returns 0 on success. If
+ * retrieving any chunk fails, then the chunks that were handed to the
+ * handler are not the whole content of the folder.
+ */
+long
+mfconn_api_folder_get_content_chunks(mfconn * conn, const int mode,
+                                     const char *folderkey,
+                                     ContentChunkHandler handler, void *data)
+{
+    struct folder_get_content_fetch fetch;
+    struct folder_get_content_worker workers[MFCONN_MAX_HELPERS];
+    int             num_workers;
+    int             i;
+
+    if (conn == NULL || handler == NULL)
+        return -1;
+
+    if (folderkey == NULL)
+        folderkey = "myfiles";
+
+    pthread_mutex_init(&(fetch.mutex), NULL);
+    pthread_mutex_init(&(fetch.handler_mutex), NULL);
+    fetch.mode = mode;
+    fetch.folderkey = folderkey;
+    fetch.handler = handler;
+    fetch.data = data;
+    fetch.next_chunk = 2;
+    fetch.last_chunk = INT_MAX;
+    fetch.failed_chunk = INT_MAX;
+    fetch.retval = 0;
+
+    if (_folder_get_content_fetch(&fetch, conn, 1) == 0
+        && fetch.last_chunk > 1) {
+        num_workers = 0;
+        for (i = 0; i < MFCONN_MAX_HELPERS; i++) {
+            workers[num_workers].fetch = &fetch;
+            workers[num_workers].conn = mfconn_get_helper(conn, i);
+            if (workers[num_workers].conn == NULL)
+                break;
+            if (pthread_create(&(workers[num_workers].thread), NULL,
+                               _folder_get_content_worker,
+                               &(workers[num_workers])) != 0)
+                break;
+            num_workers++;
+        }
+
+        /* the given connection takes chunks as well, so that the listing
+         * is retrieved even if no helper can log in */
+        while (_folder_get_content_fetch(&fetch, conn, 0) == 0) ;
+
+        for (i = 0; i < num_workers; i++)
+            pthread_join(workers[i].thread, NULL);
+    }
+
+    pthread_mutex_destroy(&(fetch.handler_mutex));
+    pthread_mutex_destroy(&(fetch.mutex));
+
+    if (fetch.failed_chunk <= fetch.last_chunk) {
+        fprintf(stderr, "failed to retrieve chunk %d\n", fetch.failed_chunk);
+        return fetch.retval;
+    }
+
+    return 0;
+}
+
+static void    *_folder_get_content_worker(void *user_ptr)
+{
+    struct folder_get_content_worker *worker;
+
+    worker = (struct folder_get_content_worker *)user_ptr;
+
+    while (_folder_get_content_fetch(worker->fetch, worker->conn, 0) == 0) ;
+
+    return NULL;
+}
+
+/*
+ * retrieve the given chunk, or the next one that nobody took yet if chunk
+ * is zero, and hand its items to the handler
+ *
+ * returns -1 once there is no chunk left to take or if it failed
+ */
+static int
+_folder_get_content_fetch(struct folder_get_content_fetch *fetch,
+                          mfconn * conn, int chunk)
+{
+    struct folder_get_content_chunk chunk_data;
+    void           *items;
+    int             retval;
+
+    if (chunk == 0) {
+        pthread_mutex_lock(&(fetch->mutex));
+        if (fetch->next_chunk > fetch->last_chunk
+            || fetch->next_chunk > fetch->failed_chunk) {
+            pthread_mutex_unlock(&(fetch->mutex));
+            return -1;
+        }
+        chunk = fetch->next_chunk++;
+        pthread_mutex_unlock(&(fetch->mutex));
+    }
+
+    items = NULL;
+    chunk_data.result = &items;
+    chunk_data.more_chunks = 0;
+    retval = _folder_get_content_chunk(conn, fetch->mode, fetch->folderkey,
+                                       chunk, &chunk_data);
+    /* the chunks after the last one have no items and are left out */
+    if (retval == 0 && (items == NULL || ((void **)items)[0] == NULL)) {
+        free(items);
+    } else if (retval == 0) {
+        pthread_mutex_lock(&(fetch->handler_mutex));
+        if (fetch->mode == 0)
+            retval = fetch->handler(chunk, (mffolder **) items, NULL,
+                                    fetch->data);
+        else
+            retval = fetch->handler(chunk, NULL, (mffile **) items,
+                                    fetch->data);
+        pthread_mutex_unlock(&(fetch->handler_mutex));
+    }
+
+    pthread_mutex_lock(&(fetch->mutex));
+    if (retval != 0) {
+        if (chunk < fetch->failed_chunk) {
+            fetch->failed_chunk = chunk;
+            fetch->retval = retval;
+        }
+    } else if (!chunk_data.more_chunks && chunk < fetch->last_chunk) {
+        fetch->last_chunk = chunk;
+    }
+    pthread_mutex_unlock(&(fetch->mutex));
+
+    return retval != 0 ? -1 : 0;
+}
+
+static int
+_folder_get_content_chunk(mfconn * conn, const int mode,
+                          const char *folderkey, int chunk,
+                          struct folder_get_content_chunk *chunk_data)
+{
+    const char     *api_call;
+    int             retval;
+    char           *content_type;
+    mfhttp         *http;
+    int             i;
+
+    if (mode == 0)
+        content_type = "folders";
+    else
+        content_type = "files";
+
+    retval = -1;
+    for (i = 0; i < mfconn_get_max_num_retries(conn); i++) {
+        api_call = mfconn_create_signed_get(conn, 0,
+                                            "folder/get_content.php",
+                                            "?folder_key=%s"
+                                            "&content_type=%s"
+                                            "&chunk=%d"
+                                            "&chunk_size=%d"
+                                            "&response_format=json",
+                                            folderkey, content_type, chunk,
+                                            FOLDER_GET_CONTENT_CHUNK_SIZE);
+        if (api_call == NULL) {
+            fprintf(stderr, "mfconn_create_signed_get failed\n");
+            return -1;
+        }
+
+        http = http_create();
+
+        if (mfconn_get_http_flags(conn) & HTTP_FLAG_LAZY_SSL) {
+
+            http_set_connect_flags(http, HTTP_FLAG_LAZY_SSL);
+        }
+
+        /* the decoding functions only append to the result once the
+         * response was found to be valid, so a failed try does not leave
+         * anything behind */
+        if (mode == 0)
+            http_set_data_handler(http, _decode_folder_get_content_folders,
+                                  (void *)chunk_data);
+        else
+            http_set_data_handler(http, _decode_folder_get_content_files,
+                                  (void *)chunk_data);
+
+        retval = http_get_buf(http, api_call);
+
+        http_destroy(http);
+
+        mfconn_update_secret_key(conn);
+
+        free((void *)api_call);
+
+        if (retval != 127 && retval != 28)
+            break;
+
+        // if there was either a curl timeout or a token error, get a new
+        // token and try again
+        //
+        // on a curl timeout we get a new token because it is likely that we
+        // lost signature synchronization (we don't know whether the server
+        // accepted or rejected the last call)
+        fprintf(stderr, "got error %d - negotiate a new token\n", retval);
+        retval = mfconn_refresh_token(conn);
+        if (retval != 0) {
+            fprintf(stderr, "failed to get a new token\n");
+            break;
+        }
+    }
+
+    return retval;
+}
+
+/*
+ * store whether the remote has more chunks after the one in node
+ */
+static void _decode_more_chunks(json_t * node, int *more_chunks)
+{
+    json_t         *j_obj;
+    const char     *value;
+
+    *more_chunks = 0;
+
+    j_obj = json_object_get(node, "more_chunks");
+    if (j_obj == NULL)
+        return;
+
+    value = json_string_value(j_obj);
+    if (value != NULL && strcmp(value, "yes") == 0)
+        *more_chunks = 1;
+}
+
+static int _decode_folder_get_content_folders(mfhttp * conn, void *user_ptr)
+{
+    json_error_t    error;
+    json_t         *root;
+    json_t         *node;
+    json_t         *data;
+
+    json_t         *folders_array;
+    json_t         *folderkey;
+    json_t         *folder_name;
+    json_t         *j_obj;
+
+    char           *ret;
+    struct tm       tm;
+    int             retval;
+
+    int             array_sz;
+    int             i = 0;
+
+    struct folder_get_content_chunk *chunk_data;
+    mffolder     ***mffolder_result;
+    mffolder       *tmp_folder;
+    mffolder      **tmp_result;
+    size_t          len_mffolder_result;
+
+    chunk_data = (struct folder_get_content_chunk *)user_ptr;
+    if (chunk_data == NULL)
+        return -1;
+    mffolder_result = (mffolder ***) chunk_data->result;
+
+    root = http_parse_buf_json(conn, 0, &error);
+
+    if (root == NULL) {
+        fprintf(stderr, "http_parse_buf_json failed at line %d\n", error.line);
+        fprintf(stderr, "error message: %s\n", error.text);
+        return -1;
+    }
+
+    node = json_object_get(root, "response");
+
+    retval = mfapi_check_response(node, "folder/get_content");
+    if (retval != 0) {
+        fprintf(stderr, "invalid response\n");
+        json_decref(root);
+        return retval;
+    }
+
+    node = json_object_get(node, "folder_content");
+
+    folders_array = json_object_get(node, "folders");
+    if (!json_is_array(folders_array)) {
+        fprintf(stderr, "is not an array: folders");
+        json_decref(root);
+        return -1;
+    }
+
+    _decode_more_chunks(node, &(chunk_data->more_chunks));
+
+    // append to the results of the previous chunks, overwriting their
+    // terminating element
+    len_mffolder_result = 0;
+    if (*mffolder_result != NULL) {
+        while ((*mffolder_result)[len_mffolder_result] != NULL)
+            len_mffolder_result++;
+    }
+    array_sz = json_array_size(folders_array);
+
+    // make room for all items of this chunk and the terminating element.
+    // If that fails, the results of the previous chunks are left as they are
+    tmp_result =
+        (mffolder **) realloc(*mffolder_result,
+                              (len_mffolder_result + array_sz + 1) *
+                              sizeof(mffolder *));
+    if (tmp_result == NULL) {
+        fprintf(stderr, "realloc failed\n");
+        json_decref(root);
+        return -1;
+    }
+    *mffolder_result = tmp_result;
+    for (i = 0; i < array_sz; i++) {
+        data = json_array_get(folders_array, i);
+
+        if (json_is_object(data)) {
+            folderkey = json_object_get(data, "folderkey");
+
+            folder_name = json_object_get(data, "name");
+
+            if (folderkey != NULL && folder_name != NULL) {
+                tmp_folder = folder_alloc();
+
+                folder_set_key(tmp_folder, json_string_value(folderkey));
+                folder_set_name(tmp_folder, json_string_value(folder_name));
+
+                j_obj = json_object_get(data, "revision");
+                if (j_obj != NULL) {
+                    folder_set_revision(tmp_folder,
+                                        atoll(json_string_value(j_obj)));
+                }
+
+                j_obj = json_object_get(data, "parent");
+                if (j_obj != NULL) {
+                    folder_set_parent(tmp_folder, json_string_value(j_obj));
+                }
+
+                j_obj = json_object_get(data, "created");
+                if (j_obj != NULL) {
+                    memset(&tm, 0, sizeof(struct tm));
+                    ret =
+                        (char *)strptime(json_string_value(j_obj), "%F %T",
+                                         &tm);
+                    if (ret[0] == '\0') {
+                        folder_set_created(tmp_folder, mktime(&tm));
+                    }
+                }
+
+                (*mffolder_result)[len_mffolder_result] = tmp_folder;
+                len_mffolder_result++;
+            }
+        }
+    }
+
+    // write an empty last element
+    (*mffolder_result)[len_mffolder_result] = NULL;
+
+    if (root != NULL)
+        json_decref(root);
+
+    return 0;
+}
+
+static int _decode_folder_get_content_files(mfhttp * conn, void *user_ptr)
+{
+    json_error_t    error;
+    json_t         *root;
+    json_t         *node;
+    json_t         *data;
+
+    json_t         *files_array;
+    json_t         *quickkey;
+    json_t         *file_name;
+    json_t         *j_obj;
+    int             retval;
+
+    char           *ret;
+    struct tm       tm;
+
+    int             array_sz;
+    int             i = 0;
+
+    struct folder_get_content_chunk *chunk_data;
+    mffile       ***mffile_result;
+    mffile         *tmp_file;
+    mffile        **tmp_result;
+    size_t          len_mffile_result;
+
+    chunk_data = (struct folder_get_content_chunk *)user_ptr;
+    if (chunk_data == NULL)
+        return -1;
+    mffile_result = (mffile ***) chunk_data->result;
+
+    root = http_parse_buf_json(conn, 0, &error);
+
+    if (root == NULL) {
+        fprintf(stderr, "http_parse_buf_json failed at line %d\n", error.line);
+        fprintf(stderr, "error message: %s\n", error.text);
+        return -1;
+    }
+
+    node = json_object_get(root, "response");
+
+    retval = mfapi_check_response(node, "folder/get_content");
+    if (retval != 0) {
+        fprintf(stderr, "invalid response\n");
+        json_decref(root);
+        return retval;
+    }
+
+    node = json_object_get(node, "folder_content");
+
+    files_array = json_object_get(node, "files");
+    if (!json_is_array(files_array)) {
+        fprintf(stderr, "is not an array: files");
+        json_decref(root);
+        return -1;
+    }
+
+    _decode_more_chunks(node, &(chunk_data->more_chunks));
+
+    // append to the results of the previous chunks, overwriting their
+    // terminating element
+    len_mffile_result = 0;
+    if (*mffile_result != NULL) {
+        while ((*mffile_result)[len_mffile_result] != NULL)
+            len_mffile_result++;
+    }
+    array_sz = json_array_size(files_array);
+
+    // make room for all items of this chunk and the terminating element.
+    // If that fails, the results of the previous chunks are left as they are
+    tmp_result =
+        (mffile **) realloc(*mffile_result,
+                            (len_mffile_result + array_sz + 1) *
+                            sizeof(mffile *));
+    if (tmp_result == NULL) {
+        fprintf(stderr, "realloc failed\n");
+        json_decref(root);
+        return -1;
+    }
+    *mffile_result = tmp_result;
+    for (i = 0; i < array_sz; i++) {
+        data = json_array_get(files_array, i);
+
+        if (json_is_object(data)) {
+            quickkey = json_object_get(data, "quickkey");
+
+            file_name = json_object_get(data, "filename");
+
+            if (quickkey != NULL && file_name != NULL) {
+                tmp_file = file_alloc();
+
+                file_set_key(tmp_file, json_string_value(quickkey));
+                file_set_name(tmp_file, json_string_value(file_name));
+
+                j_obj = json_object_get(data, "size");
+                if (j_obj != NULL) {
+                    file_set_size(tmp_file, atoll(json_string_value(j_obj)));
+                }
+
+                j_obj = json_object_get(data, "created");
+                if (j_obj != NULL) {
+                    memset(&tm, 0, sizeof(struct tm));
+                    ret = strptime(json_string_value(j_obj), "%F %T", &tm);
+                    if (ret[0] == '\0') {
+                        file_set_created(tmp_file, mktime(&tm));
+                    }
+                }
+
+                j_obj = json_object_get(data, "revision");
+                if (j_obj != NULL) {
+                    file_set_revision(tmp_file,
+                                      atoll(json_string_value(j_obj)));
+                }
+
+                j_obj = json_object_get(data, "hash");
+                if (j_obj != NULL) {
+                    file_set_hash(tmp_file, json_string_value(j_obj));
+                }
+
+                (*mffile_result)[len_mffile_result] = tmp_file;
+                len_mffile_result++;
+            }
+        }
+    }
+
+    // write an empty last element
+    (*mffile_result)[len_mffile_result] = NULL;
+
+    json_decref(root);
+
+    return 0;
+}
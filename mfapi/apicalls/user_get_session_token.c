@@ -61,6 +61,9 @@ mfconn_api_user_get_session_token(mfconn * conn, const char *server,
     if (conn == NULL)
         return -1;
 
+    /* nothing is decoded if the remote cannot be reached */
+    memset(&response, 0, sizeof(response));
+
     for (i = 0; i < mfconn_get_max_num_retries(conn); i++) {
         if (*secret_time != NULL) {
             free(*secret_time);
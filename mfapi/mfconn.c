@@ -46,6 +46,8 @@ struct mfconn {
     char           *app_key;
     int             max_num_retries;
     unsigned int    http_flags;
+    /* the connections created by mfconn_get_helper */
+    mfconn         *helpers[MFCONN_MAX_HELPERS];
 };
 
 mfconn         *mfconn_create(const char *server, const char *username,
@@ -56,6 +58,37 @@ mfconn         *mfconn_create(const char *server, const char *username,
     mfconn         *conn;
     int             retval;
 
+    conn = mfconn_create_offline(server, username, password, app_id,
+                                 app_key, max_num_retries, http_flags);
+    if (conn == NULL)
+        return NULL;
+
+    retval = mfconn_refresh_token(conn);
+    if (retval != 0) {
+        fprintf(stderr, "error: mfconn_api_user_get_session_token\n");
+        mfconn_destroy(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+/*
+ * create a connection without contacting the remote
+ *
+ * the connection has no session token until mfconn_refresh_token succeeds,
+ * so it can be created while the remote is unreachable and be used once it
+ * becomes reachable again
+ */
+mfconn         *mfconn_create_offline(const char *server,
+                                      const char *username,
+                                      const char *password, int app_id,
+                                      const char *app_key,
+                                      int max_num_retries,
+                                      unsigned int http_flags)
+{
+    mfconn         *conn;
+
     if (server == NULL)
         return NULL;
 
@@ -83,22 +116,23 @@ mfconn         *mfconn_create(const char *server, const char *username,
     conn->session_token = NULL;
     conn->ekey = NULL;
     conn->http_flags = http_flags;
-    retval = mfconn_api_user_get_session_token(conn, conn->server,
-                                               conn->username, conn->password,
-                                               conn->app_id, conn->app_key,
-                                               &(conn->secret_key),
-                                               &(conn->secret_time),
-                                               &(conn->session_token),
-                                               &(conn->ekey));
-
-    if (retval != 0) {
-        fprintf(stderr, "error: mfconn_api_user_get_session_token\n");
-        return NULL;
-    }
 
     return conn;
 }
 
+/*
+ * create a new connection with the same credentials as the given one
+ *
+ * the new connection obtains its own session token so that it can be used
+ * concurrently with the original connection by another thread
+ */
+mfconn         *mfconn_clone(mfconn * conn)
+{
+    return mfconn_create(conn->server, conn->username, conn->password,
+                         conn->app_id, conn->app_key, conn->max_num_retries,
+                         conn->http_flags);
+}
+
 int mfconn_refresh_token(mfconn * conn)
 {
     int             retval;
@@ -118,6 +152,10 @@ int mfconn_refresh_token(mfconn * conn)
                                                &(conn->ekey));
     if (retval != 0) {
         fprintf(stderr, "user/get_session_token failed\n");
+        /* the API calls pass on the error code of curl if the request did
+         * not get an answer while the error codes of the API start at 100 */
+        if (retval == MFCONN_UNREACHABLE || (retval > 0 && retval < 100))
+            return MFCONN_UNREACHABLE;
         return -1;
     }
     return 0;
@@ -139,8 +177,33 @@ unsigned int mfconn_get_http_flags(mfconn * conn)
     return conn->http_flags;
 }
 
+/*
+ * return one of the connections that are kept next to the given one to
+ * retrieve the chunks of a listing in parallel, or NULL if it cannot log in
+ *
+ * the connection is cloned from the given one on first use and kept until
+ * the given one is destroyed, so that only the first large listing has to
+ * log in again
+ */
+mfconn         *mfconn_get_helper(mfconn * conn, int i)
+{
+    if (conn == NULL || i < 0 || i >= MFCONN_MAX_HELPERS)
+        return NULL;
+
+    if (conn->helpers[i] == NULL)
+        conn->helpers[i] = mfconn_clone(conn);
+
+    return conn->helpers[i];
+}
+
 void mfconn_destroy(mfconn * conn)
 {
+    int             i;
+
+    for (i = 0; i < MFCONN_MAX_HELPERS; i++) {
+        if (conn->helpers[i] != NULL)
+            mfconn_destroy(conn->helpers[i]);
+    }
     free(conn->server);
     free(conn->username);
     free(conn->password);
@@ -437,6 +500,11 @@ const char     *mfconn_get_ekey(mfconn * conn)
     return conn->ekey;
 }
 
+bool mfconn_is_authenticated(mfconn * conn)
+{
+    return conn->session_token != NULL;
+}
+
 int mfconn_upload_poll_for_completion(mfconn * conn, const char *upload_key)
 {
     int             status;
@@ -19,6 +19,7 @@
 #ifndef __MFAPI_MFCONN_H__
 #define __MFAPI_MFCONN_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -31,8 +32,28 @@ mfconn         *mfconn_create(const char *server, const char *username,
                               const char *app_key, int max_num_retries,
                               unsigned int flags);
 
+mfconn         *mfconn_create_offline(const char *server,
+                                      const char *username,
+                                      const char *password, int app_id,
+                                      const char *app_key,
+                                      int max_num_retries,
+                                      unsigned int flags);
+
+/*
+ * returned by mfconn_refresh_token if the remote could not be reached, as
+ * opposed to -1 if it answered but refused the login
+ */
+#define MFCONN_UNREACHABLE -2
+
 int             mfconn_refresh_token(mfconn * conn);
 
+mfconn         *mfconn_clone(mfconn * conn);
+
+/* the number of connections mfconn_get_helper keeps next to one */
+#define MFCONN_MAX_HELPERS 3
+
+mfconn         *mfconn_get_helper(mfconn * conn, int i);
+
 void            mfconn_destroy(mfconn * conn);
 
 void            mfconn_set_http_flags(mfconn * conn, unsigned int http_flags);
@@ -64,6 +85,8 @@ uint32_t        mfconn_get_secret_key(mfconn * conn);
 
 const char     *mfconn_get_ekey(mfconn * conn);
 
+bool            mfconn_is_authenticated(mfconn * conn);
+
 int             mfconn_get_max_num_retries(mfconn * conn);
 
 int             mfconn_upload_poll_for_completion(mfconn * conn,
@@ -88,4 +88,10 @@ int             mfshell_cmd_changes(mfshell * mfshell, int argc,
 int             mfshell_cmd_updates(mfshell * mfshell, int argc,
                                     char *const argv[]);
 
+int             mfshell_cmd_treestats(mfshell * mfshell, int argc,
+                                      char *const argv[]);
+
+int             mfshell_cmd_find(mfshell * mfshell, int argc,
+                                 char *const argv[]);
+
 #endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../fuse/hashtbl.h"
+#include "../../utils/strings.h"
+#include "../dircache.h"
+#include "../mfshell.h"
+#include "../commands.h"        // IWYU pragma: keep
+
+/*
+ * print the paths of all files and folders in the dircache of mediafire-fuse
+ * whose name matches the pattern, like the user.mediafirefs.find attribute
+ * of a mount but without a limit on the length of the list
+ */
+int mfshell_cmd_find(mfshell * mfshell, int argc, char *const argv[])
+{
+    folder_tree    *tree;
+    char           *dircache;
+    int             retval;
+
+    if (mfshell == NULL)
+        return -1;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Invalid number of arguments\n");
+        return -1;
+    }
+
+    if (argc == 3)
+        dircache = strdup_printf("%s", argv[2]);
+    else
+        dircache = mfshell_dircache_default(mfshell);
+    if (dircache == NULL)
+        return -1;
+
+    tree = mfshell_dircache_load(dircache);
+    free(dircache);
+    if (tree == NULL)
+        return -1;
+
+    retval = folder_tree_find(tree, argv[1], stdout);
+    if (retval != 0)
+        fprintf(stderr, "cannot search for %s\n", argv[1]);
+
+    folder_tree_destroy(tree);
+
+    return retval;
+}
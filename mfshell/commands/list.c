@@ -90,6 +90,10 @@ int mfshell_cmd_list(mfshell * mfshell, int argc, char *const argv[])
         mfconn_api_folder_get_content(mfshell->conn, 1,
                                       folder_get_key(mfshell->folder_curr),
                                       NULL, &file_result);
+
+    if (file_result == NULL) {
+        return -1;
+    }
 /*
     for (i = 0; file_result[i] != NULL; i++) {
         printf("%s %s\n", file_get_name(file_result[i]),
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "../../fuse/hashtbl.h"
+#include "../../utils/strings.h"
+#include "../dircache.h"
+#include "../mfshell.h"
+#include "../commands.h"        // IWYU pragma: keep
+
+/*
+ * print the statistics of the folder tree in the dircache of mediafire-fuse
+ *
+ * the journal is not replayed, so only its size is reported
+ */
+int mfshell_cmd_treestats(mfshell * mfshell, int argc, char *const argv[])
+{
+    struct folder_tree_stats stats;
+    struct stat     journal_stat;
+    folder_tree    *tree;
+    char           *dircache;
+    char           *journal;
+
+    if (mfshell == NULL)
+        return -1;
+
+    if (argc > 2) {
+        fprintf(stderr, "Invalid number of arguments\n");
+        return -1;
+    }
+
+    if (argc == 2)
+        dircache = strdup_printf("%s", argv[1]);
+    else
+        dircache = mfshell_dircache_default(mfshell);
+    if (dircache == NULL)
+        return -1;
+
+    tree = mfshell_dircache_load(dircache);
+    if (tree == NULL) {
+        free(dircache);
+        return -1;
+    }
+
+    folder_tree_stats(tree, &stats);
+
+    journal = strdup_printf("%s.journal", dircache);
+    if (stat(journal, &journal_stat) == 0)
+        stats.journal_size = journal_stat.st_size;
+    free(journal);
+
+    folder_tree_stats_print(&stats, stdout);
+
+    folder_tree_destroy(tree);
+    free(dircache);
+
+    return 0;
+}
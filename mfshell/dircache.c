@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup
+
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/mfconn.h"
+#include "../utils/strings.h"
+#include "dircache.h"
+#include "mfshell.h"
+
+/*
+ * the dircache that mediafire-fuse keeps for the account of the connection
+ */
+char           *mfshell_dircache_default(mfshell * mfshell)
+{
+    const char     *homedir;
+    const char     *cachedir;
+    const char     *ekey;
+
+    if (mfshell->conn == NULL) {
+        fprintf(stderr, "not authenticated, give the dircache instead\n");
+        return NULL;
+    }
+
+    ekey = mfconn_get_ekey(mfshell->conn);
+    if (ekey == NULL) {
+        fprintf(stderr, "cannot get ekey\n");
+        return NULL;
+    }
+
+    cachedir = getenv("XDG_CACHE_HOME");
+    if (cachedir != NULL) {
+        return strdup_printf("%s/mediafire-tools/%s/directorytree", cachedir,
+                             ekey);
+    }
+
+    homedir = getenv("HOME");
+    if (homedir == NULL) {
+        fprintf(stderr, "HOME is not set, give the dircache instead\n");
+        return NULL;
+    }
+
+    return strdup_printf("%s/.cache/mediafire-tools/%s/directorytree",
+                         homedir, ekey);
+}
+
+/*
+ * load the folder tree from the dircache of mediafire-fuse
+ *
+ * the journal is not replayed because that would modify it while
+ * mediafire-fuse might be running. The folders that mediafire-fuse moved out
+ * of memory are read from the pages next to the dircache if there are any.
+ */
+folder_tree    *mfshell_dircache_load(const char *dircache)
+{
+    struct stat     pages_stat;
+    folder_tree    *tree;
+    char           *dircache_copy;
+    char           *filecache;
+    char           *pages;
+    FILE           *fp;
+
+    fp = fopen(dircache, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "cannot open %s\n", dircache);
+        return NULL;
+    }
+
+    /* the file cache is next to the dircache but it is not accessed */
+    dircache_copy = strdup(dircache);
+    filecache = strdup_printf("%s/files", dirname(dircache_copy));
+    free(dircache_copy);
+
+    tree = folder_tree_load(fp, filecache);
+    fclose(fp);
+    free(filecache);
+    if (tree == NULL) {
+        fprintf(stderr, "cannot load %s\n", dircache);
+        return NULL;
+    }
+
+    /* opening the pages would create them if they do not exist */
+    pages = strdup_printf("%s.pages", dircache);
+    if (stat(pages, &pages_stat) == 0 && S_ISDIR(pages_stat.st_mode)
+        && folder_tree_pages_open(tree, pages) != 0) {
+        free(pages);
+        folder_tree_destroy(tree);
+        return NULL;
+    }
+    free(pages);
+
+    return tree;
+}
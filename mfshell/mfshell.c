@@ -68,6 +68,11 @@ struct mfcmd    commands[] = {
      mfshell_cmd_changes},
     {"updates", "[quickkey] [revision]", "list available updates for a file",
      mfshell_cmd_updates},
+    {"treestats", "[dircache]",
+     "show statistics of the folder tree of mediafire-fuse",
+     mfshell_cmd_treestats},
+    {"find", "<pattern> [dircache]",
+     "find names in the folder tree of mediafire-fuse", mfshell_cmd_find},
     {NULL, NULL, NULL, NULL}
 };
 
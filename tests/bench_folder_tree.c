@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Benchmark of the folder_tree without network access
+ *
+ * The API calls used by the folder_tree are replaced by the functions below
+ * which describe a synthetic remote. Since every API call lives in its own
+ * object file of the mfapi library, the linker picks the definitions from
+ * here instead of the ones from the library.
+ *
+ * The synthetic remote has num_folders folders which form a tree in which
+ * every folder has up to 16 subfolders. Every folder including the root
+ * contains files_per_folder files.
+ *
+ * usage:
+ *
+ *     bench_folder_tree generate dircache num_folders files_per_folder
+ *     bench_folder_tree load dircache
+ *
+ * generate crawls the whole synthetic remote and stores the result in the
+ * file dircache. It also reports the time an update without remote changes
+ * takes, as it happens after every local change. load loads that file. Both
+ * report the time they took and
+ * the peak resident set size of the process. Run load in a fresh process
+ * so that its peak resident set size is not influenced by the crawl. The
+ * folder_tree is very verbose on stderr, so redirect it to /dev/null.
+ *
+ * The throughput of storing and loading is reported in entries and
+ * megabytes per second. With 100 files per folder, 10000 folders give about
+ * one million entries and 50000 folders give about five million entries.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup and clock_gettime
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/apicalls.h"
+#include "../mfapi/file.h"
+#include "../mfapi/folder.h"
+#include "../mfapi/mfconn.h"
+
+#define BENCH_FANOUT 16
+
+/*
+ * the API calls below never look at the connection. But the folder_tree
+ * only fetches the content of folders if it is given one, so it gets a
+ * pointer to this instead of NULL
+ */
+static char     bench_dummy_conn;
+#define BENCH_CONN ((mfconn *)&bench_dummy_conn)
+
+static uint64_t bench_num_folders;
+static uint64_t bench_files_per_folder;
+
+static const char bench_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+/*
+ * the first three characters of a key select the bucket in the folder_tree,
+ * so they are derived from a hash of n to spread the keys. The remaining
+ * characters encode n in base 36.
+ */
+static void bench_make_key(char *key, size_t len, uint64_t n)
+{
+    uint64_t        hash;
+    size_t          i;
+
+    hash = n * 11400714819323198485ULL;
+    for (i = 0; i < 3; i++) {
+        key[i] = bench_digits[(hash >> (16 * i + 16)) % 36];
+    }
+    for (i = len; i > 3; i--) {
+        key[i - 1] = bench_digits[n % 36];
+        n /= 36;
+    }
+    key[len] = '\0';
+}
+
+static uint64_t bench_parse_key(const char *key)
+{
+    uint64_t        n;
+    size_t          i;
+
+    n = 0;
+    for (i = 3; key[i] != '\0'; i++) {
+        n = n * 36 + (strchr(bench_digits, key[i]) - bench_digits);
+    }
+
+    return n;
+}
+
+/* the root has index zero, all other folders have indices starting at one */
+static uint64_t bench_folder_index(const char *folderkey)
+{
+    if (folderkey == NULL || folderkey[0] == '\0'
+        || strcmp(folderkey, "myfiles") == 0) {
+        return 0;
+    }
+
+    return bench_parse_key(folderkey);
+}
+
+static void bench_fill_folder(mffolder * folder, uint64_t n)
+{
+    char            key[14];
+    char            name[32];
+
+    bench_make_key(key, 13, n);
+    folder_set_key(folder, key);
+    snprintf(name, sizeof(name), "folder %" PRIu64, n);
+    folder_set_name(folder, name);
+    folder_set_revision(folder, 1);
+    folder_set_created(folder, 1400000000);
+    if ((n - 1) / BENCH_FANOUT != 0) {
+        bench_make_key(key, 13, (n - 1) / BENCH_FANOUT);
+        folder_set_parent(folder, key);
+    }
+}
+
+static void bench_fill_file(mffile * file, uint64_t n)
+{
+    char            key[16];
+    char            name[32];
+    char            hash[65];
+
+    bench_make_key(key, 15, n);
+    file_set_key(file, key);
+    snprintf(name, sizeof(name), "file %" PRIu64 ".dat", n);
+    file_set_name(file, name);
+    file_set_revision(file, 1);
+    file_set_created(file, 1400000000);
+    file_set_size(file, n % 100000);
+    memset(hash, 'a', 64);
+    hash[64] = '\0';
+    file_set_hash(file, hash);
+    if (n / bench_files_per_folder != 0) {
+        bench_make_key(key, 13, n / bench_files_per_folder);
+        file_set_parent(file, key);
+    }
+}
+
+long
+mfconn_api_folder_get_content_chunks(mfconn * conn, const int mode,
+                                     const char *folderkey,
+                                     ContentChunkHandler handler, void *data)
+{
+    mffolder      **folder_result;
+    mffile        **file_result;
+    uint64_t        parent;
+    uint64_t        first;
+    uint64_t        i;
+    uint64_t        num;
+
+    (void)conn;
+
+    parent = bench_folder_index(folderkey);
+
+    if (mode == 0) {
+        first = parent * BENCH_FANOUT + 1;
+        num = 0;
+        if (first <= bench_num_folders) {
+            num = bench_num_folders - first + 1;
+            if (num > BENCH_FANOUT)
+                num = BENCH_FANOUT;
+        }
+        folder_result = (mffolder **) calloc(num + 1, sizeof(mffolder *));
+        for (i = 0; i < num; i++) {
+            folder_result[i] = folder_alloc();
+            bench_fill_folder(folder_result[i], first + i);
+        }
+        return handler(1, folder_result, NULL, data);
+    } else {
+        first = parent * bench_files_per_folder;
+        num = bench_files_per_folder;
+        file_result = (mffile **) calloc(num + 1, sizeof(mffile *));
+        for (i = 0; i < num; i++) {
+            file_result[i] = file_alloc();
+            bench_fill_file(file_result[i], first + i);
+        }
+        return handler(1, NULL, file_result, data);
+    }
+}
+
+int mfconn_api_folder_get_info(mfconn * conn, mffolder * folder,
+                               const char *folderkey)
+{
+    uint64_t        n;
+
+    (void)conn;
+
+    n = bench_folder_index(folderkey);
+    if (n == 0) {
+        folder_set_name(folder, "myfiles");
+        folder_set_revision(folder, 1);
+        return 0;
+    }
+    if (n > bench_num_folders) {
+        return -1;
+    }
+    bench_fill_folder(folder, n);
+
+    return 0;
+}
+
+int mfconn_api_file_get_info(mfconn * conn, mffile * file,
+                             const char *quickkey)
+{
+    (void)conn;
+
+    bench_fill_file(file, bench_parse_key(quickkey));
+
+    return 0;
+}
+
+int mfconn_api_device_get_status(mfconn * conn, uint64_t * revision)
+{
+    (void)conn;
+
+    *revision = 1;
+
+    return 0;
+}
+
+int mfconn_api_device_get_changes(mfconn * conn, uint64_t revision,
+                                  struct mfconn_device_change **changes)
+{
+    (void)conn;
+    (void)revision;
+
+    *changes = (struct mfconn_device_change *)
+        calloc(1, sizeof(struct mfconn_device_change));
+    (*changes)[0].change = MFCONN_DEVICE_CHANGE_END;
+    (*changes)[0].revision = 1;
+
+    return 0;
+}
+
+struct bench_names {
+    char          **names;
+    bool           *is_directory;
+    size_t          len;
+};
+
+static int bench_filldir(void *buf, const char *name,
+                         const struct stat *stbuf, off_t off)
+{
+    struct bench_names *names;
+
+    (void)off;
+
+    names = (struct bench_names *)buf;
+
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return 0;
+
+    names->names = (char **)realloc(names->names,
+                                    (names->len + 1) * sizeof(char *));
+    names->names[names->len] = strdup(name);
+    names->is_directory = (bool *) realloc(names->is_directory,
+                                           (names->len + 1) * sizeof(bool));
+    names->is_directory[names->len] = S_ISDIR(stbuf->st_mode);
+    names->len++;
+
+    return 0;
+}
+
+/*
+ * recursively list all folders below the given path, which makes the
+ * folder_tree fetch their content
+ *
+ * the names are copied out first because the children arrays can change
+ * while the subfolders are fetched
+ */
+static uint64_t bench_crawl(folder_tree * tree, const char *path)
+{
+    struct bench_names names;
+    char           *subpath;
+    uint64_t        count;
+    size_t          i;
+
+    memset(&names, 0, sizeof(names));
+    folder_tree_readdir(tree, BENCH_CONN, path, &names, bench_filldir, 0);
+
+    count = names.len;
+    for (i = 0; i < names.len; i++) {
+        subpath = (char *)malloc(strlen(path) + strlen(names.names[i]) + 2);
+        sprintf(subpath, "%s/%s", strcmp(path, "/") == 0 ? "" : path,
+                names.names[i]);
+        if (names.is_directory[i]) {
+            count += bench_crawl(tree, subpath);
+        }
+        free(subpath);
+        free(names.names[i]);
+    }
+    free(names.names);
+    free(names.is_directory);
+
+    return count;
+}
+
+static double bench_elapsed(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec)
+        + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static long bench_maxrss(void)
+{
+    struct rusage   usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+static double bench_file_size(const char *path)
+{
+    struct stat     file_info;
+
+    if (stat(path, &file_info) != 0) {
+        return 0;
+    }
+
+    return file_info.st_size / (1024.0 * 1024.0);
+}
+
+static int bench_generate(const char *dircache)
+{
+    folder_tree    *tree;
+    struct timespec start;
+    uint64_t        count;
+    FILE           *stream;
+    double          elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    tree = folder_tree_create("/nonexistent");
+    if (folder_tree_rebuild(tree, BENCH_CONN) != 0) {
+        fprintf(stderr, "folder_tree_rebuild failed\n");
+        return 1;
+    }
+    count = bench_crawl(tree, "/");
+
+    printf("generate: %" PRIu64 " entries in %.3f s, max rss %ld KiB\n",
+           count, bench_elapsed(&start), bench_maxrss());
+
+    /* the first update checks all entries touched by the crawl */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    folder_tree_update(tree, BENCH_CONN, true);
+    elapsed = bench_elapsed(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    folder_tree_update(tree, BENCH_CONN, true);
+    printf("update: %.3f s after the crawl, %.3f s after that\n", elapsed,
+           bench_elapsed(&start));
+
+    stream = fopen(dircache, "w");
+    if (stream == NULL) {
+        fprintf(stderr, "cannot open %s\n", dircache);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    folder_tree_store(tree, stream);
+    fclose(stream);
+    elapsed = bench_elapsed(&start);
+    /* the root is stored as well */
+    printf("store: %.3f s, %.0f entries/s, %.1f MiB/s\n", elapsed,
+           (count + 1) / elapsed, bench_file_size(dircache) / elapsed);
+
+    folder_tree_destroy(tree);
+
+    return 0;
+}
+
+static int bench_load(const char *dircache)
+{
+    folder_tree    *tree;
+    struct timespec start;
+    long            rss_before;
+    FILE           *stream;
+    double          elapsed;
+
+    stream = fopen(dircache, "r");
+    if (stream == NULL) {
+        fprintf(stderr, "cannot open %s\n", dircache);
+        return 1;
+    }
+
+    rss_before = bench_maxrss();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tree = folder_tree_load(stream, "/nonexistent");
+    fclose(stream);
+    if (tree == NULL) {
+        fprintf(stderr, "folder_tree_load failed\n");
+        return 1;
+    }
+
+    elapsed = bench_elapsed(&start);
+    printf("load: %.3f s, %.1f MiB/s, max rss %ld KiB (%ld KiB before "
+           "loading)\n", elapsed, bench_file_size(dircache) / elapsed,
+           bench_maxrss(), rss_before);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    folder_tree_destroy(tree);
+    printf("destroy: %.3f s\n", bench_elapsed(&start));
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 5 && strcmp(argv[1], "generate") == 0) {
+        bench_num_folders = strtoull(argv[3], NULL, 10);
+        bench_files_per_folder = strtoull(argv[4], NULL, 10);
+        if (bench_files_per_folder == 0) {
+            fprintf(stderr, "files_per_folder must be at least one\n");
+            return 1;
+        }
+        return bench_generate(argv[2]);
+    }
+
+    if (argc == 3 && strcmp(argv[1], "load") == 0) {
+        return bench_load(argv[2]);
+    }
+
+    fprintf(stderr, "usage: %s generate dircache num_folders "
+            "files_per_folder\n", argv[0]);
+    fprintf(stderr, "       %s load dircache\n", argv[0]);
+
+    return 1;
+}
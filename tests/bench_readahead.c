@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Benchmark of sequential reads from partial cache files with and without
+ * readahead
+ *
+ * The file is served by a small HTTP server on 127.0.0.1 which is started
+ * by the benchmark and supports range requests. Every request is answered
+ * after latency milliseconds and every connection sends at most bandwidth
+ * MiB per second, so that the results resemble a remote server. The API
+ * call that returns the link of the file is replaced by the function below.
+ * Since every API call lives in its own object file of the mfapi library,
+ * the linker picks the definition from here instead of the one from the
+ * library.
+ *
+ * usage:
+ *
+ *     bench_readahead cachedir size_mib latency_ms bandwidth_mib
+ *
+ * The file is read with reads of 128 KiB as the kernel issues them, first
+ * without readahead and then with a budget of 64 MiB. For every run the
+ * throughput and the time the reads waited for the network are reported.
+ * The partial files are removed from cachedir after every run. Unset
+ * http_proxy before running it.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup and clock_gettime
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <openssl/sha.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mfapi/apicalls.h"
+#include "../mfapi/file.h"
+#include "../mfapi/mfconn.h"
+#include "../fuse/filecache.h"
+#include "../fuse/readahead.h"
+
+#define BENCH_READ_SIZE 131072
+#define BENCH_QUICKKEY "benchreadahead1"
+
+static unsigned char *bench_data;
+static uint64_t bench_size;
+static long     bench_latency_ms;
+static uint64_t bench_bandwidth;
+static int      bench_port;
+
+int mfconn_api_file_get_links(mfconn * conn, mffile * file,
+                              const char *quickkey,
+                              enum mfconn_file_link_type link_mask)
+{
+    char            url[64];
+
+    (void)conn;
+    (void)link_mask;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", bench_port,
+             quickkey);
+    file_set_direct_link(file, url);
+
+    return 0;
+}
+
+static void bench_sleep(double seconds)
+{
+    struct timespec ts;
+
+    if (seconds <= 0)
+        return;
+    ts.tv_sec = (time_t) seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+static double bench_elapsed(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec)
+        + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int bench_send(int sock, const void *buf, size_t len)
+{
+    const char     *p;
+    ssize_t         sent;
+
+    p = (const char *)buf;
+    while (len > 0) {
+        sent = send(sock, p, len, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return -1;
+        p += sent;
+        len -= sent;
+    }
+
+    return 0;
+}
+
+/* answer a single request and close the connection */
+static void    *bench_serve(void *user_ptr)
+{
+    char            request[4096];
+    char            header[256];
+    struct timespec start;
+    const char     *range;
+    uint64_t        first;
+    uint64_t        last;
+    uint64_t        offset;
+    size_t          len;
+    size_t          chunk;
+    ssize_t         got;
+    int             sock;
+
+    sock = (int)(intptr_t) user_ptr;
+
+    len = 0;
+    while (len < sizeof(request) - 1) {
+        got = recv(sock, request + len, sizeof(request) - 1 - len, 0);
+        if (got <= 0)
+            break;
+        len += got;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL)
+            break;
+    }
+    request[len] = '\0';
+
+    first = 0;
+    last = bench_size - 1;
+    range = strstr(request, "Range: bytes=");
+    if (range != NULL) {
+        sscanf(range, "Range: bytes=%" SCNu64 "-%" SCNu64, &first, &last);
+        if (last >= bench_size)
+            last = bench_size - 1;
+        snprintf(header, sizeof(header),
+                 "HTTP/1.1 206 Partial Content\r\n"
+                 "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64
+                 "\r\nContent-Length: %" PRIu64 "\r\n"
+                 "Connection: close\r\n\r\n", first, last, bench_size,
+                 last - first + 1);
+    } else {
+        snprintf(header, sizeof(header),
+                 "HTTP/1.1 200 OK\r\nContent-Length: %" PRIu64 "\r\n"
+                 "Connection: close\r\n\r\n", bench_size);
+    }
+
+    bench_sleep(bench_latency_ms / 1000.0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (bench_send(sock, header, strlen(header)) == 0) {
+        /* send in pieces of 64 KiB and wait until the bandwidth allows
+         * the next one */
+        for (offset = first; offset <= last; offset += chunk) {
+            chunk = 65536;
+            if (chunk > last - offset + 1)
+                chunk = last - offset + 1;
+            if (bench_send(sock, bench_data + offset, chunk) != 0)
+                break;
+            bench_sleep((double)(offset + chunk - first) / bench_bandwidth
+                        - bench_elapsed(&start));
+        }
+    }
+
+    close(sock);
+
+    return NULL;
+}
+
+static void    *bench_server(void *user_ptr)
+{
+    pthread_t       thread;
+    int             listener;
+    int             sock;
+
+    listener = (int)(intptr_t) user_ptr;
+
+    for (;;) {
+        sock = accept(listener, NULL, NULL);
+        if (sock < 0)
+            continue;
+        if (pthread_create(&thread, NULL, bench_serve,
+                           (void *)(intptr_t) sock) != 0) {
+            close(sock);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    return NULL;
+}
+
+static int bench_start_server(void)
+{
+    struct sockaddr_in addr;
+    socklen_t       addr_len;
+    pthread_t       thread;
+    int             listener;
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fprintf(stderr, "cannot create socket\n");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    addr_len = sizeof(addr);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listener, 64) != 0
+        || getsockname(listener, (struct sockaddr *)&addr, &addr_len) != 0) {
+        fprintf(stderr, "cannot listen on 127.0.0.1\n");
+        close(listener);
+        return -1;
+    }
+    bench_port = ntohs(addr.sin_port);
+
+    if (pthread_create(&thread, NULL, bench_server,
+                       (void *)(intptr_t) listener) != 0) {
+        fprintf(stderr, "cannot start server thread\n");
+        close(listener);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+static void bench_remove(const char *cachedir, const char *suffix)
+{
+    char            path[4096];
+
+    snprintf(path, sizeof(path), "%s/%s_1%s", cachedir, BENCH_QUICKKEY,
+             suffix);
+    unlink(path);
+}
+
+static int bench_run(const char *cachedir, const unsigned char *fhash,
+                     uint64_t budget)
+{
+    filecache_part *part;
+    readahead_pool *ra;
+    struct readahead_stream stream;
+    struct timespec start;
+    struct timespec read_start;
+    char           *buf;
+    uint64_t        offset;
+    uint64_t        expected;
+    double          waited;
+    double          elapsed;
+    int             retval;
+
+    bench_remove(cachedir, "");
+    bench_remove(cachedir, "_part");
+    bench_remove(cachedir, "_blocks");
+
+    buf = (char *)malloc(BENCH_READ_SIZE);
+    ra = readahead_start(4, budget);
+    memset(&stream, 0, sizeof(stream));
+
+    part = filecache_part_open(BENCH_QUICKKEY, 1, bench_size, fhash,
+                               cachedir, NULL);
+    if (part == NULL) {
+        fprintf(stderr, "filecache_part_open failed\n");
+        readahead_stop(ra);
+        free(buf);
+        return -1;
+    }
+
+    waited = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (offset = 0; offset < bench_size; offset += BENCH_READ_SIZE) {
+        readahead_access(ra, &stream, part, offset, BENCH_READ_SIZE);
+        clock_gettime(CLOCK_MONOTONIC, &read_start);
+        retval = filecache_part_read(part, buf, BENCH_READ_SIZE, offset);
+        waited += bench_elapsed(&read_start);
+        expected = bench_size - offset;
+        if (expected > BENCH_READ_SIZE)
+            expected = BENCH_READ_SIZE;
+        if (retval < 0 || (uint64_t) retval != expected
+            || memcmp(buf, bench_data + offset, retval) != 0) {
+            fprintf(stderr, "read at %" PRIu64 " failed\n", offset);
+            break;
+        }
+    }
+    elapsed = bench_elapsed(&start);
+
+    filecache_part_close(part);
+    readahead_stop(ra);
+    free(buf);
+
+    printf("readahead %3" PRIu64 " MiB: %.3f s, %.1f MiB/s, "
+           "%.3f s waiting for the network\n", budget / 1048576, elapsed,
+           bench_size / 1048576.0 / elapsed, waited);
+
+    bench_remove(cachedir, "");
+    bench_remove(cachedir, "_part");
+    bench_remove(cachedir, "_blocks");
+
+    return offset < bench_size ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char   fhash[SHA256_DIGEST_LENGTH];
+    uint64_t        state;
+    uint64_t        i;
+
+    if (argc != 5) {
+        fprintf(stderr, "usage: %s cachedir size_mib latency_ms "
+                "bandwidth_mib\n", argv[0]);
+        return 1;
+    }
+
+    bench_size = strtoull(argv[2], NULL, 10) * 1048576;
+    bench_latency_ms = strtol(argv[3], NULL, 10);
+    bench_bandwidth = strtoull(argv[4], NULL, 10) * 1048576;
+    if (bench_size == 0 || bench_latency_ms < 0 || bench_bandwidth == 0) {
+        fprintf(stderr, "size and bandwidth must be at least one\n");
+        return 1;
+    }
+
+    bench_data = (unsigned char *)malloc(bench_size);
+    if (bench_data == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        return 1;
+    }
+    state = 1;
+    for (i = 0; i < bench_size; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        bench_data[i] = (unsigned char)(state >> 56);
+    }
+    SHA256(bench_data, bench_size, fhash);
+
+    if (bench_start_server() != 0)
+        return 1;
+
+    if (bench_run(argv[1], fhash, 0) != 0
+        || bench_run(argv[1], fhash, 64 * 1048576) != 0)
+        return 1;
+
+    free(bench_data);
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Checks shared by the tests
+ *
+ * A test reports every check that fails and goes on, so that one run shows
+ * all failures. It returns test_result() from main.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for nanosleep
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "check.h"
+
+static int      test_failed;
+
+void test_check(bool condition, const char *what)
+{
+    if (!condition) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        test_failed = 1;
+    }
+}
+
+/*
+ * returns 1 if any check failed and 0 otherwise
+ */
+int test_result(void)
+{
+    return test_failed;
+}
+
+void test_sleep_ms(long ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mock_http.h"
+
+/*
+ * A small HTTP server on 127.0.0.1 for tests which talk to a mocked remote
+ *
+ * Every connection is answered by the handler in a thread of its own and
+ * closed afterwards, so curl never reuses a connection. The tests have to
+ * run without http_proxy set, which ctest takes care of.
+ */
+
+struct mock_http_request {
+    mock_http_handler handler;
+    int             sock;
+};
+
+static void    *mock_http_serve(void *user_ptr)
+{
+    struct mock_http_request *req;
+    char            request[8192];
+    size_t          len;
+    ssize_t         got;
+
+    req = (struct mock_http_request *)user_ptr;
+
+    len = 0;
+    request[0] = '\0';
+    while (len < sizeof(request) - 1) {
+        got = recv(req->sock, request + len, sizeof(request) - 1 - len, 0);
+        if (got <= 0)
+            break;
+        len += got;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL)
+            break;
+    }
+
+    req->handler(req->sock, request);
+
+    close(req->sock);
+    free(req);
+
+    return NULL;
+}
+
+static void    *mock_http_accept(void *user_ptr)
+{
+    struct mock_http_request *listener;
+    struct mock_http_request *req;
+    pthread_t       thread;
+    int             sock;
+
+    listener = (struct mock_http_request *)user_ptr;
+
+    for (;;) {
+        sock = accept(listener->sock, NULL, NULL);
+        if (sock < 0)
+            continue;
+        req = (struct mock_http_request *)
+            malloc(sizeof(struct mock_http_request));
+        if (req == NULL) {
+            close(sock);
+            continue;
+        }
+        req->handler = listener->handler;
+        req->sock = sock;
+        if (pthread_create(&thread, NULL, mock_http_serve, req) != 0) {
+            close(sock);
+            free(req);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    return NULL;
+}
+
+/*
+ * start the server in the background. It runs until the process exits
+ *
+ * returns the port it listens on or -1 on error
+ */
+int mock_http_start(mock_http_handler handler)
+{
+    struct mock_http_request *listener;
+    struct sockaddr_in addr;
+    socklen_t       addr_len;
+    pthread_t       thread;
+
+    listener = (struct mock_http_request *)
+        malloc(sizeof(struct mock_http_request));
+    if (listener == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
+    }
+    listener->handler = handler;
+    listener->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener->sock < 0) {
+        fprintf(stderr, "cannot create socket\n");
+        free(listener);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    addr_len = sizeof(addr);
+    if (bind(listener->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listener->sock, 64) != 0
+        || getsockname(listener->sock, (struct sockaddr *)&addr,
+                       &addr_len) != 0) {
+        fprintf(stderr, "cannot listen on 127.0.0.1\n");
+        close(listener->sock);
+        free(listener);
+        return -1;
+    }
+
+    if (pthread_create(&thread, NULL, mock_http_accept, listener) != 0) {
+        fprintf(stderr, "cannot start server thread\n");
+        close(listener->sock);
+        free(listener);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return ntohs(addr.sin_port);
+}
+
+int mock_http_send(int sock, const void *buf, size_t len)
+{
+    const char     *p;
+    ssize_t         sent;
+
+    p = (const char *)buf;
+    while (len > 0) {
+        sent = send(sock, p, len, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return -1;
+        p += sent;
+        len -= sent;
+    }
+
+    return 0;
+}
+
+/*
+ * send a complete response with the given status like "200 OK"
+ */
+int mock_http_respond(int sock, const char *status, const void *body,
+                      size_t len)
+{
+    char            header[256];
+
+    snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Length: %zu\r\n"
+             "Connection: close\r\n\r\n", status, len);
+
+    if (mock_http_send(sock, header, strlen(header)) != 0)
+        return -1;
+
+    return mock_http_send(sock, body, len);
+}
+
+/*
+ * copy the value of the query parameter name of the request line into value
+ *
+ * returns 0 if the parameter was found and -1 otherwise
+ */
+int mock_http_query(const char *request, const char *name, char *value,
+                    size_t size)
+{
+    const char     *end;
+    const char     *p;
+    size_t          name_len;
+    size_t          len;
+
+    end = strchr(request, '\r');
+    if (end == NULL)
+        end = request + strlen(request);
+    name_len = strlen(name);
+
+    for (p = strchr(request, '?'); p != NULL && p < end;
+         p = strchr(p + 1, '&')) {
+        if (strncmp(p + 1, name, name_len) != 0 || p[name_len + 1] != '=')
+            continue;
+        p += name_len + 2;
+        len = strcspn(p, "& \r");
+        if (len >= size)
+            return -1;
+        memcpy(value, p, len);
+        value[len] = '\0';
+        return 0;
+    }
+
+    return -1;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __TESTS_MOCK_HTTP_H__
+#define __TESTS_MOCK_HTTP_H__
+
+#include <stddef.h>
+
+/*
+ * called in a thread of its own for every request with the socket of the
+ * connection and the request line and headers. The connection is closed
+ * once the handler returns
+ */
+typedef void    (*mock_http_handler) (int sock, const char *request);
+
+int             mock_http_start(mock_http_handler handler);
+
+int             mock_http_send(int sock, const void *buf, size_t len);
+
+int             mock_http_respond(int sock, const char *status,
+                                  const void *body, size_t len);
+
+int             mock_http_query(const char *request, const char *name,
+                                char *value, size_t size);
+
+#endif
@@ -0,0 +1,749 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup, mkdtemp and nanosleep
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/apicalls.h"
+#include "../mfapi/file.h"
+#include "../mfapi/folder.h"
+#include "../mfapi/mfconn.h"
+#include "../utils/strings.h"
+#include "mock_remote.h"
+
+/*
+ * A remote in memory for tests of the folder_tree and the modules around it
+ *
+ * The API calls used by them are replaced by the functions below. Since
+ * every API call lives in its own object file of the mfapi library, the
+ * linker picks the definitions from here instead of the ones from the
+ * library, so no request ever leaves the process.
+ *
+ * Every change of the remote increases its device revision and is reported
+ * by device/get_changes like the real remote does. While the remote is set
+ * offline, all API calls fail. The calls are counted either way, so tests
+ * can check which requests an operation needed.
+ *
+ * The content of files is not kept here. file/get_links returns the prefix
+ * set by mock_remote_set_links followed by the key of the file, so that a
+ * test can serve the content itself.
+ */
+
+#define MOCK_REMOTE_MAX_ENTRIES 8192
+/* the number of items folder/get_content hands over at a time */
+#define MOCK_REMOTE_CHUNK_SIZE 400
+
+struct mock_remote_entry {
+    char            key[16];
+    char            parent[16];
+    char            name[64];
+    uint64_t        revision;
+    uint64_t        size;
+    char            hash[65];
+    bool            is_folder;
+    bool            deleted;
+};
+
+static pthread_mutex_t mock_remote_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_remote_entry mock_remote_entries[MOCK_REMOTE_MAX_ENTRIES];
+static uint64_t mock_remote_num_entries;
+static struct mfconn_device_change *mock_remote_changes;
+static uint64_t mock_remote_num_changes;
+static uint64_t mock_remote_revision = 1;
+static bool     mock_remote_offline;
+static bool     mock_remote_refused;
+static long     mock_remote_delay;
+static uint64_t mock_remote_failing_chunk;
+static char     mock_remote_links[64];
+static uint64_t mock_remote_concurrent;
+static struct mock_remote_calls mock_remote_calls;
+
+/* the caller must hold the mutex */
+static struct mock_remote_entry *mock_remote_find(const char *key)
+{
+    uint64_t        i;
+
+    for (i = 0; i < mock_remote_num_entries; i++) {
+        if (strcmp(mock_remote_entries[i].key, key) == 0
+            && !mock_remote_entries[i].deleted)
+            return &(mock_remote_entries[i]);
+    }
+
+    return NULL;
+}
+
+/* the caller must hold the mutex */
+static void mock_remote_record(struct mock_remote_entry *entry,
+                               enum mfconn_device_change_type change)
+{
+    struct mfconn_device_change *changes;
+
+    mock_remote_revision++;
+    entry->revision = mock_remote_revision;
+
+    changes = (struct mfconn_device_change *)
+        realloc(mock_remote_changes, (mock_remote_num_changes + 1)
+                * sizeof(struct mfconn_device_change));
+    if (changes == NULL) {
+        fprintf(stderr, "realloc failed\n");
+        abort();
+    }
+    mock_remote_changes = changes;
+    memset(&(changes[mock_remote_num_changes]), 0,
+           sizeof(struct mfconn_device_change));
+    changes[mock_remote_num_changes].change = change;
+    strcpy(changes[mock_remote_num_changes].key, entry->key);
+    strcpy(changes[mock_remote_num_changes].parent, entry->parent);
+    changes[mock_remote_num_changes].revision = mock_remote_revision;
+    mock_remote_num_changes++;
+}
+
+/* the caller must hold the mutex */
+static const char *mock_remote_add(const char *parent, const char *name,
+                                   uint64_t size, bool is_folder)
+{
+    struct mock_remote_entry *entry;
+
+    if (mock_remote_num_entries == MOCK_REMOTE_MAX_ENTRIES) {
+        fprintf(stderr, "the mocked remote is full\n");
+        abort();
+    }
+
+    entry = &(mock_remote_entries[mock_remote_num_entries]);
+    /* folder keys have 13 characters and file keys have 15 */
+    if (is_folder)
+        snprintf(entry->key, sizeof(entry->key), "fold%09" PRIu64,
+                 mock_remote_num_entries);
+    else
+        snprintf(entry->key, sizeof(entry->key), "file%011" PRIu64,
+                 mock_remote_num_entries);
+    snprintf(entry->parent, sizeof(entry->parent), "%s",
+             parent != NULL ? parent : "");
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    entry->size = size;
+    memset(entry->hash, '0', 64);
+    entry->hash[64] = '\0';
+    entry->is_folder = is_folder;
+    entry->deleted = false;
+    mock_remote_num_entries++;
+
+    mock_remote_record(entry, is_folder ? MFCONN_DEVICE_CHANGE_UPDATED_FOLDER
+                       : MFCONN_DEVICE_CHANGE_UPDATED_FILE);
+
+    return entry->key;
+}
+
+/*
+ * add a folder to the folder with the given key. The key of the root is
+ * NULL.
+ *
+ * returns the key of the new folder
+ */
+const char     *mock_remote_add_folder(const char *parent, const char *name)
+{
+    const char     *key;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    key = mock_remote_add(parent, name, 0, true);
+    pthread_mutex_unlock(&mock_remote_mutex);
+
+    return key;
+}
+
+const char     *mock_remote_add_file(const char *parent, const char *name,
+                                     uint64_t size)
+{
+    const char     *key;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    key = mock_remote_add(parent, name, size, false);
+    pthread_mutex_unlock(&mock_remote_mutex);
+
+    return key;
+}
+
+/*
+ * give the file or folder with the given key a new revision and, if name is
+ * not NULL, a new name
+ */
+void mock_remote_change(const char *key, const char *name)
+{
+    struct mock_remote_entry *entry;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    entry = mock_remote_find(key);
+    if (entry == NULL) {
+        fprintf(stderr, "the mocked remote has no key %s\n", key);
+        abort();
+    }
+    if (name != NULL)
+        snprintf(entry->name, sizeof(entry->name), "%s", name);
+    mock_remote_record(entry, entry->is_folder
+                       ? MFCONN_DEVICE_CHANGE_UPDATED_FOLDER
+                       : MFCONN_DEVICE_CHANGE_UPDATED_FILE);
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+void mock_remote_delete(const char *key)
+{
+    struct mock_remote_entry *entry;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    entry = mock_remote_find(key);
+    if (entry == NULL) {
+        fprintf(stderr, "the mocked remote has no key %s\n", key);
+        abort();
+    }
+    entry->deleted = true;
+    mock_remote_record(entry, entry->is_folder
+                       ? MFCONN_DEVICE_CHANGE_DELETED_FOLDER
+                       : MFCONN_DEVICE_CHANGE_DELETED_FILE);
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+/*
+ * remove a file or folder without reporting it as a change, like the remote
+ * does for entries that are removed from the trash as well
+ */
+void mock_remote_purge(const char *key)
+{
+    struct mock_remote_entry *entry;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    entry = mock_remote_find(key);
+    if (entry == NULL) {
+        fprintf(stderr, "the mocked remote has no key %s\n", key);
+        abort();
+    }
+    entry->deleted = true;
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+/*
+ * set the SHA-256 of the content of a file as 64 hexadecimal digits without
+ * changing its revision. Files have a hash of zeros otherwise
+ */
+void mock_remote_set_hash(const char *key, const char *hash)
+{
+    struct mock_remote_entry *entry;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    entry = mock_remote_find(key);
+    if (entry == NULL || strlen(hash) != 64) {
+        fprintf(stderr, "cannot set the hash of %s\n", key);
+        abort();
+    }
+    strcpy(entry->hash, hash);
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+/*
+ * let file/get_links return prefix followed by the key of the file
+ */
+void mock_remote_set_links(const char *prefix)
+{
+    pthread_mutex_lock(&mock_remote_mutex);
+    snprintf(mock_remote_links, sizeof(mock_remote_links), "%s", prefix);
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+uint64_t mock_remote_get_revision(void)
+{
+    uint64_t        revision;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    revision = mock_remote_revision;
+    pthread_mutex_unlock(&mock_remote_mutex);
+
+    return revision;
+}
+
+void mock_remote_set_online(bool online)
+{
+    pthread_mutex_lock(&mock_remote_mutex);
+    mock_remote_offline = !online;
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+/*
+ * let the remote refuse every login like it does for wrong credentials
+ */
+void mock_remote_set_refused(bool refused)
+{
+    pthread_mutex_lock(&mock_remote_mutex);
+    mock_remote_refused = refused;
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+/*
+ * let every folder/get_content take the given number of microseconds
+ */
+void mock_remote_set_delay(long usec)
+{
+    pthread_mutex_lock(&mock_remote_mutex);
+    mock_remote_delay = usec;
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+/*
+ * let folder/get_content fail at the chunk with the given number after it
+ * handed over the chunks before it, or never if it is zero
+ */
+void mock_remote_set_failing_chunk(uint64_t chunk)
+{
+    pthread_mutex_lock(&mock_remote_mutex);
+    mock_remote_failing_chunk = chunk;
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+void mock_remote_get_calls(struct mock_remote_calls *calls)
+{
+    pthread_mutex_lock(&mock_remote_mutex);
+    *calls = mock_remote_calls;
+    pthread_mutex_unlock(&mock_remote_mutex);
+}
+
+/*
+ * the number of API calls made so far
+ */
+uint64_t mock_remote_num_calls(void)
+{
+    struct mock_remote_calls calls;
+
+    mock_remote_get_calls(&calls);
+
+    return calls.user_get_session_token + calls.folder_get_content
+        + calls.folder_get_info + calls.file_get_info
+        + calls.file_get_links + calls.device_get_status + calls.device_get_changes;
+}
+
+/*
+ * log in to the mocked remote
+ */
+mfconn         *mock_remote_connect(void)
+{
+    return mfconn_create("mock.invalid", "user", "password", 42, NULL, 3, 0);
+}
+
+/*
+ * retrieve the content of every folder of the tree whose content is not
+ * known yet, like the crawler does but without threads
+ *
+ * returns 0 on success and -1 on error
+ */
+int mock_remote_fetch_all(folder_tree * tree, mfconn * conn)
+{
+    mffolder      **folder_result;
+    mffile        **file_result;
+    char          **keys;
+    int             retval;
+    int             i;
+
+    retval = 0;
+    while (retval == 0) {
+        keys = folder_tree_get_outdated_folders(tree, NULL);
+        if (keys == NULL)
+            return -1;
+        if (keys[0] == NULL) {
+            free(keys);
+            break;
+        }
+        for (i = 0; keys[i] != NULL; i++) {
+            if (retval == 0) {
+                retval = folder_tree_fetch_content(conn, keys[i],
+                                                   &folder_result,
+                                                   &file_result);
+            }
+            if (retval == 0) {
+                folder_tree_set_content(tree, keys[i], folder_result,
+                                        file_result);
+            }
+            free(keys[i]);
+        }
+        free(keys);
+    }
+
+    return retval;
+}
+
+/*
+ * create an empty directory for the file cache or the dircache of a test
+ *
+ * returns its path which has to be freed or NULL on error
+ */
+char           *mock_remote_mkdtemp(void)
+{
+    const char     *tmpdir;
+    char           *path;
+
+    tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL || tmpdir[0] == '\0')
+        tmpdir = "/tmp";
+
+    path = strdup_printf("%s/mediafire-test-XXXXXX", tmpdir);
+    if (mkdtemp(path) == NULL) {
+        fprintf(stderr, "cannot create a directory in %s\n", tmpdir);
+        free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+/*
+ * remove a directory created by mock_remote_mkdtemp with everything in it
+ */
+void mock_remote_rmtree(const char *path)
+{
+    struct dirent  *ent;
+    struct stat     st;
+    char           *child;
+    DIR            *dir;
+
+    dir = opendir(path);
+    if (dir == NULL)
+        return;
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        child = strdup_printf("%s/%s", path, ent->d_name);
+        if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode))
+            mock_remote_rmtree(child);
+        else
+            unlink(child);
+        free(child);
+    }
+    closedir(dir);
+
+    rmdir(path);
+}
+
+/*
+ * the caller must hold the mutex
+ *
+ * while offline, this fails with the error code curl has if it cannot
+ * connect (CURLE_COULDNT_CONNECT)
+ */
+static int mock_remote_begin(uint64_t * counter)
+{
+    (*counter)++;
+
+    return mock_remote_offline ? 7 : 0;
+}
+
+int mfconn_api_user_get_session_token(mfconn * conn, const char *server,
+                                      const char *username,
+                                      const char *password, int app_id,
+                                      const char *app_key,
+                                      uint32_t * secret_key,
+                                      char **secret_time,
+                                      char **session_token, char **ekey)
+{
+    int             retval;
+
+    (void)conn;
+    (void)server;
+    (void)username;
+    (void)password;
+    (void)app_id;
+    (void)app_key;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    retval = mock_remote_begin(&mock_remote_calls.user_get_session_token);
+    /* the error code of the API for wrong credentials */
+    if (retval == 0 && mock_remote_refused)
+        retval = 107;
+    pthread_mutex_unlock(&mock_remote_mutex);
+    if (retval != 0)
+        return retval;
+
+    *secret_key = 1;
+    *secret_time = strdup("1400000000.0000");
+    *session_token = strdup("mocktoken");
+    *ekey = strdup("mockekey");
+
+    return 0;
+}
+
+static void mock_remote_fill_folder(mffolder * folder,
+                                    struct mock_remote_entry *entry)
+{
+    folder_set_key(folder, entry->key);
+    folder_set_name(folder, entry->name);
+    folder_set_parent(folder, entry->parent);
+    folder_set_revision(folder, entry->revision);
+    folder_set_created(folder, 1400000000);
+}
+
+static void mock_remote_fill_file(mffile * file,
+                                  struct mock_remote_entry *entry)
+{
+    file_set_key(file, entry->key);
+    file_set_name(file, entry->name);
+    file_set_parent(file, entry->parent);
+    file_set_revision(file, entry->revision);
+    file_set_created(file, 1400000000);
+    file_set_size(file, entry->size);
+    file_set_hash(file, entry->hash);
+}
+
+static bool mock_remote_is_root(const char *key)
+{
+    return key == NULL || key[0] == '\0' || strcmp(key, "myfiles") == 0;
+}
+
+/*
+ * the content is handed over in chunks like the remote does, the first one
+ * first and the others from the last one on, so that handlers cannot rely on
+ * the order of the chunks
+ */
+long
+mfconn_api_folder_get_content_chunks(mfconn * conn, const int mode,
+                                     const char *folderkey,
+                                     ContentChunkHandler handler, void *data)
+{
+    struct mock_remote_entry *entry;
+    struct timespec delay;
+    const char     *parent;
+    uint64_t        failing_chunk;
+    void          **items;
+    void          **chunk;
+    uint64_t        num_chunks;
+    uint64_t        num;
+    uint64_t        len;
+    uint64_t        i;
+    int             retval;
+
+    (void)conn;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    delay.tv_sec = mock_remote_delay / 1000000;
+    delay.tv_nsec = (mock_remote_delay % 1000000) * 1000;
+    mock_remote_concurrent++;
+    if (mock_remote_concurrent > mock_remote_calls.max_concurrent)
+        mock_remote_calls.max_concurrent = mock_remote_concurrent;
+    pthread_mutex_unlock(&mock_remote_mutex);
+    if (delay.tv_sec > 0 || delay.tv_nsec > 0)
+        nanosleep(&delay, NULL);
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    mock_remote_concurrent--;
+    if (mock_remote_begin(&mock_remote_calls.folder_get_content) != 0) {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+
+    parent = mock_remote_is_root(folderkey) ? "" : folderkey;
+    if (parent[0] != '\0' && mock_remote_find(parent) == NULL) {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+
+    items = (void **)calloc(mock_remote_num_entries + 1, sizeof(void *));
+    num = 0;
+    for (i = 0; i < mock_remote_num_entries; i++) {
+        entry = &(mock_remote_entries[i]);
+        if (entry->deleted || strcmp(entry->parent, parent) != 0
+            || entry->is_folder != (mode == 0))
+            continue;
+        if (mode == 0) {
+            items[num] = folder_alloc();
+            mock_remote_fill_folder((mffolder *) items[num], entry);
+        } else {
+            items[num] = file_alloc();
+            mock_remote_fill_file((mffile *) items[num], entry);
+        }
+        num++;
+    }
+    failing_chunk = mock_remote_failing_chunk;
+    pthread_mutex_unlock(&mock_remote_mutex);
+
+    /* an empty folder is answered with one empty chunk */
+    num_chunks = num == 0 ? 1
+        : (num + MOCK_REMOTE_CHUNK_SIZE - 1) / MOCK_REMOTE_CHUNK_SIZE;
+    retval = 0;
+    for (i = 0; i < num_chunks; i++) {
+        num = i == 0 ? 0 : num_chunks - i;
+        chunk = (void **)calloc(MOCK_REMOTE_CHUNK_SIZE + 1, sizeof(void *));
+        for (len = 0; len < MOCK_REMOTE_CHUNK_SIZE
+             && items[num * MOCK_REMOTE_CHUNK_SIZE + len] != NULL; len++)
+            chunk[len] = items[num * MOCK_REMOTE_CHUNK_SIZE + len];
+
+        /* the chunks after a failed one are not handed over */
+        if (retval != 0 || num + 1 == failing_chunk) {
+            for (len = 0; chunk[len] != NULL; len++) {
+                if (mode == 0)
+                    folder_free((mffolder *) chunk[len]);
+                else
+                    file_free((mffile *) chunk[len]);
+            }
+            free(chunk);
+            retval = -1;
+            continue;
+        }
+
+        if (mode == 0)
+            retval = handler(num + 1, (mffolder **) chunk, NULL, data);
+        else
+            retval = handler(num + 1, NULL, (mffile **) chunk, data);
+    }
+    free(items);
+
+    return retval;
+}
+
+int mfconn_api_folder_get_info(mfconn * conn, mffolder * folder,
+                               const char *folderkey)
+{
+    struct mock_remote_entry *entry;
+
+    (void)conn;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    if (mock_remote_begin(&mock_remote_calls.folder_get_info) != 0) {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+
+    if (mock_remote_is_root(folderkey)) {
+        folder_set_name(folder, "myfiles");
+        folder_set_revision(folder, 1);
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return 0;
+    }
+
+    entry = mock_remote_find(folderkey);
+    if (entry == NULL || !entry->is_folder) {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+    mock_remote_fill_folder(folder, entry);
+    pthread_mutex_unlock(&mock_remote_mutex);
+
+    return 0;
+}
+
+int mfconn_api_file_get_info(mfconn * conn, mffile * file,
+                             const char *quickkey)
+{
+    struct mock_remote_entry *entry;
+
+    (void)conn;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    if (mock_remote_begin(&mock_remote_calls.file_get_info) != 0) {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+
+    entry = mock_remote_find(quickkey);
+    if (entry == NULL || entry->is_folder) {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+    mock_remote_fill_file(file, entry);
+    pthread_mutex_unlock(&mock_remote_mutex);
+
+    return 0;
+}
+
+int mfconn_api_file_get_links(mfconn * conn, mffile * file,
+                              const char *quickkey,
+                              enum mfconn_file_link_type link_mask)
+{
+    struct mock_remote_entry *entry;
+    char           *url;
+
+    (void)conn;
+    (void)link_mask;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    if (mock_remote_begin(&mock_remote_calls.file_get_links) != 0) {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+
+    entry = mock_remote_find(quickkey);
+    if (entry == NULL || entry->is_folder || mock_remote_links[0] == '\0') {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+    url = strdup_printf("%s%s", mock_remote_links, entry->key);
+    pthread_mutex_unlock(&mock_remote_mutex);
+    file_set_direct_link(file, url);
+    free(url);
+
+    return 0;
+}
+
+int mfconn_api_device_get_status(mfconn * conn, uint64_t * revision)
+{
+    (void)conn;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    if (mock_remote_begin(&mock_remote_calls.device_get_status) != 0) {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+    *revision = mock_remote_revision;
+    pthread_mutex_unlock(&mock_remote_mutex);
+
+    return 0;
+}
+
+int mfconn_api_device_get_changes(mfconn * conn, uint64_t revision,
+                                  struct mfconn_device_change **changes)
+{
+    uint64_t        first;
+    uint64_t        num;
+
+    (void)conn;
+
+    pthread_mutex_lock(&mock_remote_mutex);
+    if (mock_remote_begin(&mock_remote_calls.device_get_changes) != 0) {
+        pthread_mutex_unlock(&mock_remote_mutex);
+        return -1;
+    }
+
+    /* the changes are ordered by their revision */
+    for (first = 0; first < mock_remote_num_changes
+         && mock_remote_changes[first].revision <= revision; first++) ;
+    num = mock_remote_num_changes - first;
+
+    *changes = (struct mfconn_device_change *)
+        calloc(num + 1, sizeof(struct mfconn_device_change));
+    if (num > 0)
+        memcpy(*changes, &(mock_remote_changes[first]),
+               num * sizeof(struct mfconn_device_change));
+    (*changes)[num].change = MFCONN_DEVICE_CHANGE_END;
+    (*changes)[num].revision = mock_remote_revision;
+    pthread_mutex_unlock(&mock_remote_mutex);
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __TESTS_MOCK_REMOTE_H__
+#define __TESTS_MOCK_REMOTE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/mfconn.h"
+
+/* the number of calls of every API call the remote answered or refused */
+struct mock_remote_calls {
+    uint64_t        user_get_session_token;
+    uint64_t        folder_get_content;
+    uint64_t        folder_get_info;
+    uint64_t        file_get_info;
+    uint64_t        file_get_links;
+    uint64_t        device_get_status;
+    uint64_t        device_get_changes;
+    /* the most folder/get_content calls that were answered at the same
+     * time */
+    uint64_t        max_concurrent;
+};
+
+const char     *mock_remote_add_folder(const char *parent, const char *name);
+
+const char     *mock_remote_add_file(const char *parent, const char *name,
+                                     uint64_t size);
+
+void            mock_remote_change(const char *key, const char *name);
+
+void            mock_remote_delete(const char *key);
+
+void            mock_remote_purge(const char *key);
+
+void            mock_remote_set_hash(const char *key, const char *hash);
+
+void            mock_remote_set_links(const char *prefix);
+
+uint64_t        mock_remote_get_revision(void);
+
+void            mock_remote_set_online(bool online);
+
+void            mock_remote_set_refused(bool refused);
+
+void            mock_remote_set_delay(long usec);
+
+void            mock_remote_set_failing_chunk(uint64_t chunk);
+
+void            mock_remote_get_calls(struct mock_remote_calls *calls);
+
+uint64_t        mock_remote_num_calls(void);
+
+mfconn         *mock_remote_connect(void);
+
+int             mock_remote_fetch_all(folder_tree * tree, mfconn * conn);
+
+char           *mock_remote_mkdtemp(void);
+
+void            mock_remote_rmtree(const char *path);
+
+#endif
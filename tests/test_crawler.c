@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of the crawler against a mocked remote
+ *
+ * After folder_tree_rebuild only the content of the root is known. The
+ * crawler has to retrieve the content of all other folders with at most
+ * TEST_NUM_WORKERS requests at the same time. A file is renamed remotely
+ * while the crawl runs, which the crawl has to pick up with a single
+ * device/get_changes at its end. Afterwards, every path has to resolve
+ * without a connection.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for pthread_rwlock_t
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../fuse/crawler.h"
+#include "../fuse/hashtbl.h"
+#include "../mfapi/mfconn.h"
+#include "check.h"
+#include "mock_remote.h"
+
+#define TEST_NUM_DIRS 8
+#define TEST_NUM_SUBDIRS 8
+#define TEST_NUM_FILES 4
+#define TEST_NUM_WORKERS 4
+
+/*
+ * wait up to ten seconds for the given call to be made more than count
+ * times
+ */
+static bool test_wait_calls(size_t offset, uint64_t count)
+{
+    struct mock_remote_calls calls;
+    int             i;
+
+    for (i = 0; i < 10000; i++) {
+        mock_remote_get_calls(&calls);
+        if (*(uint64_t *) ((char *)&calls + offset) > count)
+            return true;
+        test_sleep_ms(1);
+    }
+
+    return false;
+}
+
+int main(void)
+{
+    struct folder_tree_stats stats;
+    struct mock_remote_calls before;
+    struct mock_remote_calls after;
+    pthread_rwlock_t lock;
+    folder_tree    *tree;
+    crawler        *crawler;
+    mfconn         *conn;
+    const char     *dir;
+    const char     *sub;
+    const char     *renamed;
+    char           *filecache;
+    char          **outdated;
+    char            name[64];
+    uint64_t        num_outdated;
+    int             i;
+    int             j;
+    int             k;
+
+    renamed = NULL;
+    mock_remote_add_file(NULL, "readme.txt", 10);
+    for (i = 0; i < TEST_NUM_DIRS; i++) {
+        snprintf(name, sizeof(name), "dir %d", i);
+        dir = mock_remote_add_folder(NULL, name);
+        for (j = 0; j < TEST_NUM_SUBDIRS; j++) {
+            snprintf(name, sizeof(name), "sub %d", j);
+            sub = mock_remote_add_folder(dir, name);
+            for (k = 0; k < TEST_NUM_FILES; k++) {
+                snprintf(name, sizeof(name), "file %d.dat", k);
+                if (i == TEST_NUM_DIRS - 1 && j == 0 && k == 0)
+                    renamed = mock_remote_add_file(sub, name, k);
+                else
+                    mock_remote_add_file(sub, name, k);
+            }
+        }
+    }
+
+    conn = mock_remote_connect();
+    filecache = mock_remote_mkdtemp();
+    if (conn == NULL || filecache == NULL)
+        return 1;
+    tree = folder_tree_create(filecache);
+    pthread_rwlock_init(&lock, NULL);
+
+    if (folder_tree_rebuild(tree, conn) != 0) {
+        fprintf(stderr, "folder_tree_rebuild failed\n");
+        return 1;
+    }
+
+    outdated = folder_tree_get_outdated_folders(tree, NULL);
+    for (num_outdated = 0; outdated[num_outdated] != NULL; num_outdated++)
+        free(outdated[num_outdated]);
+    free(outdated);
+    test_check(num_outdated == TEST_NUM_DIRS,
+               "only the root is known after the rebuild");
+
+    mock_remote_set_delay(2000);
+    mock_remote_get_calls(&before);
+
+    crawler = crawler_start(tree, &lock, conn, TEST_NUM_WORKERS);
+    test_check(crawler != NULL, "crawler_start");
+
+    /* rename a file while the crawl runs */
+    test_check(test_wait_calls(offsetof(struct mock_remote_calls,
+                                        folder_get_content),
+                               before.folder_get_content + 20),
+               "the crawl started");
+    mock_remote_change(renamed, "renamed.dat");
+
+    /* the crawl ends with device/get_status and device/get_changes */
+    test_check(test_wait_calls(offsetof(struct mock_remote_calls,
+                                        device_get_status),
+                               before.device_get_status),
+               "the crawl finished");
+    crawler_stop(crawler);
+
+    mock_remote_get_calls(&after);
+    printf("%" PRIu64 " folder/get_content with at most %" PRIu64
+           " at the same time, %" PRIu64 " device/get_changes\n",
+           after.folder_get_content - before.folder_get_content,
+           after.max_concurrent,
+           after.device_get_changes - before.device_get_changes);
+    test_check(after.max_concurrent <= TEST_NUM_WORKERS,
+               "no more requests than workers");
+    test_check(after.max_concurrent > 1, "the workers ran in parallel");
+    test_check(after.device_get_changes - before.device_get_changes == 1,
+               "a single device/get_changes");
+
+    outdated = folder_tree_get_outdated_folders(tree, NULL);
+    test_check(outdated[0] == NULL, "no folder is outdated after the crawl");
+    for (i = 0; outdated[i] != NULL; i++)
+        free(outdated[i]);
+    free(outdated);
+
+    folder_tree_stats(tree, &stats);
+    test_check(stats.num_folders == TEST_NUM_DIRS * (1 + TEST_NUM_SUBDIRS),
+               "all folders are known");
+    test_check(stats.num_files
+               == 1 + TEST_NUM_DIRS * TEST_NUM_SUBDIRS * TEST_NUM_FILES,
+               "all files are known");
+
+    /* the lookups must not need the remote anymore */
+    snprintf(name, sizeof(name), "/dir %d/sub 0/renamed.dat",
+             TEST_NUM_DIRS - 1);
+    test_check(folder_tree_path_exists(tree, NULL, name),
+               "the renamed file is found");
+    snprintf(name, sizeof(name), "/dir %d/sub 0/file 0.dat",
+             TEST_NUM_DIRS - 1);
+    test_check(!folder_tree_path_exists(tree, NULL, name),
+               "the old name is gone");
+    test_check(folder_tree_path_exists(tree, NULL, "/dir 0/sub 7/file 3.dat"),
+               "a file in the first folder is found");
+
+    folder_tree_destroy(tree);
+    pthread_rwlock_destroy(&lock);
+    mfconn_destroy(conn);
+    mock_remote_rmtree(filecache);
+    free(filecache);
+
+    return test_result();
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of loading dircache files that were written by hand
+ *
+ * A root with a folder that contains a file is stored in version 0 and in
+ * version 1 of the storage format and has to load. Files with a parent
+ * outside of the file, with records that are not linked from the root or
+ * with parents that form a cycle have to be rejected.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/apicalls.h"
+#include "../utils/strings.h"
+#include "check.h"
+#include "mock_remote.h"
+
+/* the on-disk layouts of fuse/hashtbl.c */
+struct test_entry_v0 {
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    char            name[MFAPI_MAX_LEN_NAME + 1];
+    uint64_t        remote_revision;
+    uint64_t        local_revision;
+    uint64_t        ctime;
+    uint64_t        parent;
+    uint64_t        num_children;
+    uint64_t        children;
+    unsigned char   hash[32];
+    uint64_t        atime;
+    uint64_t        fsize;
+};
+
+struct test_header_v1 {
+    char            magic[4];
+    uint32_t        byte_order;
+    uint64_t        revision;
+    uint64_t        num_records;
+    uint64_t        num_links;
+    uint64_t        names_size;
+    uint64_t        records_offset;
+    uint64_t        links_offset;
+    uint64_t        names_offset;
+    uint64_t        file_size;
+};
+
+struct test_entry_v1 {
+    char            key[MFAPI_MAX_LEN_KEY + 1];
+    uint64_t        name;
+    uint64_t        parent;
+    uint64_t        remote_revision;
+    uint64_t        local_revision;
+    uint64_t        ctime;
+    uint64_t        children;
+    uint32_t        num_children;
+    uint32_t        flags;
+    uint64_t        atime;
+    uint64_t        fsize;
+    unsigned char   hash[32];
+};
+
+/* the root, the folder "a" and the file "b" in it */
+#define TEST_NUM_ENTRIES 3
+/* the names of the version 1 records at the offsets 0, 1 and 3 */
+#define TEST_NAMES "\0a\0b"
+
+static const char *test_keys[TEST_NUM_ENTRIES] = {
+    "", "folderkey00001", "filekey0000001"
+};
+
+static char    *test_dir;
+
+/*
+ * write a file of version 0 in which entry i has the parent parents[i]
+ */
+static char    *test_write_v0(const char *name, const uint64_t * parents)
+{
+    struct test_entry_v0 record;
+    uint64_t        num;
+    uint64_t        revision;
+    char           *path;
+    FILE           *stream;
+    int             i;
+
+    path = strdup_printf("%s/%s", test_dir, name);
+    stream = fopen(path, "w");
+    if (stream == NULL)
+        return path;
+    fwrite("MFS\0", 1, 4, stream);
+    revision = 1;
+    fwrite(&revision, sizeof(revision), 1, stream);
+    num = TEST_NUM_ENTRIES;
+    fwrite(&num, sizeof(num), 1, stream);
+    for (i = 0; i < TEST_NUM_ENTRIES; i++) {
+        memset(&record, 0, sizeof(record));
+        strcpy(record.key, test_keys[i]);
+        strcpy(record.name, i == 1 ? "a" : i == 2 ? "b" : "");
+        record.remote_revision = 1;
+        record.local_revision = 1;
+        record.parent = parents[i];
+        if (i == 2) {
+            record.atime = 1;
+            record.fsize = 10;
+        }
+        fwrite(&record, sizeof(record), 1, stream);
+    }
+    fclose(stream);
+
+    return path;
+}
+
+/*
+ * write a file of version 1 in which entry i has the parent parents[i] and
+ * is linked from the entry links[i]. An entry linked from
+ * TEST_NUM_ENTRIES is not linked at all
+ */
+static char    *test_write_v1(const char *name, const uint64_t * parents,
+                              const uint64_t * links)
+{
+    struct test_header_v1 header;
+    struct test_entry_v1 records[TEST_NUM_ENTRIES];
+    uint64_t        link_array[TEST_NUM_ENTRIES];
+    uint64_t        num_links;
+    char           *path;
+    FILE           *stream;
+    int             i;
+    int             j;
+
+    memset(records, 0, sizeof(records));
+    num_links = 0;
+    for (i = 0; i < TEST_NUM_ENTRIES; i++) {
+        strcpy(records[i].key, test_keys[i]);
+        records[i].name = i == 1 ? 1 : i == 2 ? 3 : 0;
+        records[i].parent = parents[i];
+        records[i].remote_revision = 1;
+        records[i].local_revision = 1;
+        records[i].children = num_links;
+        for (j = 1; j < TEST_NUM_ENTRIES; j++) {
+            if (links[j] == (uint64_t) i) {
+                link_array[num_links++] = j;
+                records[i].num_children++;
+            }
+        }
+    }
+    /* the file */
+    records[2].flags = 0x1;
+    records[2].atime = 1;
+    records[2].fsize = 10;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MFS\1", 4);
+    header.byte_order = 0x01020304;
+    header.revision = 1;
+    header.num_records = TEST_NUM_ENTRIES;
+    header.num_links = num_links;
+    header.names_size = sizeof(TEST_NAMES);
+    header.records_offset = sizeof(header);
+    header.links_offset = header.records_offset + sizeof(records);
+    header.names_offset = header.links_offset + num_links * sizeof(uint64_t);
+    header.file_size = header.names_offset + header.names_size;
+
+    path = strdup_printf("%s/%s", test_dir, name);
+    stream = fopen(path, "w");
+    if (stream == NULL)
+        return path;
+    fwrite(&header, sizeof(header), 1, stream);
+    fwrite(records, sizeof(records), 1, stream);
+    fwrite(link_array, sizeof(uint64_t), num_links, stream);
+    fwrite(TEST_NAMES, 1, sizeof(TEST_NAMES), stream);
+    fclose(stream);
+
+    return path;
+}
+
+/*
+ * load the file and return -1 if it was rejected, 1 if the file is found at
+ * /a/b and 0 otherwise
+ */
+static int test_load(char *path)
+{
+    struct stat     stbuf;
+    folder_tree    *tree;
+    FILE           *stream;
+    int             loaded;
+
+    stream = fopen(path, "r");
+    free(path);
+    if (stream == NULL)
+        return 0;
+    tree = folder_tree_load(stream, test_dir);
+    fclose(stream);
+    if (tree == NULL)
+        return -1;
+    loaded = folder_tree_getattr(tree, NULL, "/a/b", &stbuf) == 0
+        && S_ISREG(stbuf.st_mode);
+    folder_tree_destroy(tree);
+
+    return loaded;
+}
+
+int main(void)
+{
+    static const uint64_t tree[] = { 0, 0, 1 };
+    static const uint64_t outside[] = { 0, 0, 7 };
+    static const uint64_t cycle[] = { 0, 2, 1 };
+    static const uint64_t unlinked[] = { 0, 0, TEST_NUM_ENTRIES };
+
+    test_dir = mock_remote_mkdtemp();
+    if (test_dir == NULL)
+        return 1;
+
+    test_check(test_load(test_write_v0("v0", tree)) == 1,
+               "a version 0 file loads");
+    test_check(test_load(test_write_v0("v0_outside", outside)) == -1,
+               "a version 0 parent outside of the file is rejected");
+    test_check(test_load(test_write_v0("v0_cycle", cycle)) == -1,
+               "version 0 parents that form a cycle are rejected");
+
+    test_check(test_load(test_write_v1("v1", tree, tree)) == 1,
+               "a version 1 file loads");
+    test_check(test_load(test_write_v1("v1_unlinked", tree, unlinked)) == -1,
+               "a version 1 record that is not linked is rejected");
+    test_check(test_load(test_write_v1("v1_cycle", cycle, cycle)) == -1,
+               "version 1 parents that form a cycle are rejected");
+
+    mock_remote_rmtree(test_dir);
+    free(test_dir);
+
+    return test_result();
+}
@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of reading files through partial cache files against a mocked remote
+ *
+ * The content of the file is served by mock_http with range requests. A file
+ * that was only read in part must not count as cached, so that its folder
+ * can still be paged out, and only its blocks that were read count towards
+ * the size of the cache. Once all of it was read, it has to stay in the
+ * cache when the cache is cleaned up and has to open without the remote.
+ *
+ * A partial cache file whose blocks are all present already is only checked
+ * against the hash by the first read and not while it is opened.
+ *
+ * The first block of another file is served slowly. A prefetch while it is
+ * retrieved must retrieve the blocks behind it.
+ *
+ * Two more files are served by a server that ignores range requests, so
+ * that they are streamed. The stream of the first stalls after its first
+ * block, which must neither hold up closing the file nor keep the stream
+ * running afterwards. The stream of the second fails with an error whose
+ * body must not be written to the partial file.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup and clock_gettime
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <openssl/sha.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/mfconn.h"
+#include "../utils/hash.h"
+#include "../utils/strings.h"
+#include "check.h"
+#include "mock_http.h"
+#include "mock_remote.h"
+
+/* three blocks of partial cache files and a bit */
+#define TEST_SIZE (3 * 1048576 + 1000)
+#define TEST_READ_SIZE 131072
+
+static unsigned char *test_content;
+
+static pthread_mutex_t test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t test_requests;
+/* the files whose stream stalls or fails and whether the stalled stream
+ * was closed by the client */
+static const char *test_stall_key;
+static const char *test_error_key;
+static const char *test_slow_key;
+static bool     test_stall_closed;
+
+static double test_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t test_num_requests(void)
+{
+    uint64_t        requests;
+
+    pthread_mutex_lock(&test_mutex);
+    requests = test_requests;
+    pthread_mutex_unlock(&test_mutex);
+
+    return requests;
+}
+
+static bool test_is_key(const char *request, const char *key)
+{
+    size_t          len;
+
+    if (key == NULL)
+        return false;
+    len = strlen(key);
+
+    return strncmp(request + 5, key, len) == 0 && request[5 + len] == ' ';
+}
+
+/*
+ * send the start of the whole file, ignoring any range, and then wait up to
+ * twenty seconds for the client to close the connection
+ */
+static void test_respond_stall(int sock, bool stream)
+{
+    struct pollfd   pfd;
+    char            header[256];
+    char            c;
+
+    snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+             "Content-Length: %d\r\nConnection: close\r\n\r\n",
+             TEST_SIZE);
+    if (mock_http_send(sock, header, strlen(header)) != 0
+        || mock_http_send(sock, test_content, 1572864) != 0)
+        return;
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 20000) == 1 && recv(sock, &c, 1, 0) <= 0 && stream) {
+        pthread_mutex_lock(&test_mutex);
+        test_stall_closed = true;
+        pthread_mutex_unlock(&test_mutex);
+    }
+}
+
+/*
+ * serve the content of the file, honouring range requests
+ */
+static void test_handler(int sock, const char *request)
+{
+    const char     *p;
+    char            header[256];
+    uint64_t        start;
+    uint64_t        end;
+
+    pthread_mutex_lock(&test_mutex);
+    test_requests++;
+    pthread_mutex_unlock(&test_mutex);
+
+    if (strncmp(request, "GET /file", 9) != 0) {
+        mock_http_respond(sock, "404 Not Found", "", 0);
+        return;
+    }
+
+    p = strstr(request, "\r\nRange: bytes=");
+    if (test_is_key(request, test_stall_key)) {
+        test_respond_stall(sock, p == NULL);
+        return;
+    }
+    if (test_is_key(request, test_error_key)) {
+        if (p == NULL)
+            mock_http_respond(sock, "503 Service Unavailable",
+                              "try again later", 15);
+        else
+            mock_http_respond(sock, "200 OK", test_content, TEST_SIZE);
+        return;
+    }
+    if (p == NULL) {
+        mock_http_respond(sock, "200 OK", test_content, TEST_SIZE);
+        return;
+    }
+    if (sscanf(p + 15, "%" SCNu64 "-%" SCNu64, &start, &end) != 2
+        || start > end || end >= TEST_SIZE) {
+        mock_http_respond(sock, "416 Range Not Satisfiable", "", 0);
+        return;
+    }
+    if (test_is_key(request, test_slow_key) && start == 0)
+        test_sleep_ms(500);
+    snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\n"
+             "Content-Length: %" PRIu64 "\r\n"
+             "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%d\r\n"
+             "Connection: close\r\n\r\n", end - start + 1, start, end,
+             TEST_SIZE);
+    if (mock_http_send(sock, header, strlen(header)) == 0)
+        mock_http_send(sock, test_content + start, end - start + 1);
+}
+
+static void    *test_read_main(void *user_ptr)
+{
+    filecache_part *part;
+    char            buf[100];
+
+    part = (filecache_part *) user_ptr;
+    if (filecache_part_read(part, buf, sizeof(buf), 0) != sizeof(buf)
+        || memcmp(buf, test_content, sizeof(buf)) != 0)
+        test_check(false, "the slow block is read");
+
+    return NULL;
+}
+
+static bool test_write_file(const char *path, const void *buf, size_t len)
+{
+    FILE           *stream;
+    bool            written;
+
+    stream = fopen(path, "w");
+    if (stream == NULL)
+        return false;
+    written = fwrite(buf, 1, len, stream) == len;
+
+    return fclose(stream) == 0 && written;
+}
+
+/*
+ * read length bytes from offset of a partial cache file and compare them to
+ * the content
+ */
+static bool test_read_part(filecache_part * part, uint64_t offset,
+                           uint64_t length)
+{
+    char           *buf;
+    uint64_t        end;
+    int             len;
+    bool            matches;
+
+    buf = (char *)malloc(TEST_READ_SIZE);
+    matches = true;
+    for (end = offset + length; matches && offset < end; offset += len) {
+        len = filecache_part_read(part, buf, TEST_READ_SIZE, offset);
+        matches = len > 0 && memcmp(buf, test_content + offset, len) == 0;
+    }
+    free(buf);
+
+    return matches;
+}
+
+int main(void)
+{
+    struct folder_tree_stats stats;
+    unsigned char   hash[SHA256_DIGEST_LENGTH];
+    filecache_part *part;
+    folder_tree    *tree;
+    mfconn         *conn;
+    const char     *data;
+    const char     *key;
+    const char     *done;
+    char           *filecache;
+    char           *cachefile;
+    char           *donefile;
+    char           *pages;
+    char           *path;
+    char           *hex;
+    char            prefix[64];
+    char            buf[256];
+    char            zeros[256];
+    uint64_t        revision;
+    uint64_t        done_revision;
+    uint64_t        error_revision;
+    double          start;
+    uint64_t        num_calls;
+    uint64_t        requests;
+    uint64_t        cache_size;
+    struct stat     st;
+    pthread_t       reader;
+    bool            closed;
+    int             port;
+    int             fd;
+    int             i;
+
+    memset(zeros, 0, sizeof(zeros));
+    closed = false;
+    test_content = (unsigned char *)malloc(TEST_SIZE);
+    for (i = 0; i < TEST_SIZE; i++)
+        test_content[i] = (unsigned char)(i * 7 + i / 4096);
+    SHA256(test_content, TEST_SIZE, hash);
+    hex = binary2hex(hash, SHA256_DIGEST_LENGTH);
+
+    port = mock_http_start(test_handler);
+    if (port < 0)
+        return 1;
+    snprintf(prefix, sizeof(prefix), "http://127.0.0.1:%d/", port);
+    mock_remote_set_links(prefix);
+
+    data = mock_remote_add_folder(NULL, "data");
+    key = mock_remote_add_file(data, "big.bin", TEST_SIZE);
+    mock_remote_set_hash(key, hex);
+    revision = mock_remote_get_revision();
+    done = mock_remote_add_file(data, "done.bin", TEST_SIZE);
+    mock_remote_set_hash(done, hex);
+    done_revision = mock_remote_get_revision();
+    test_stall_key = mock_remote_add_file(data, "stall.bin", TEST_SIZE);
+    mock_remote_set_hash(test_stall_key, hex);
+    test_error_key = mock_remote_add_file(data, "error.bin", TEST_SIZE);
+    mock_remote_set_hash(test_error_key, hex);
+    error_revision = mock_remote_get_revision();
+    test_slow_key = mock_remote_add_file(data, "slow.bin", TEST_SIZE);
+    mock_remote_set_hash(test_slow_key, hex);
+    free(hex);
+
+    conn = mock_remote_connect();
+    filecache = mock_remote_mkdtemp();
+    if (conn == NULL || filecache == NULL)
+        return 1;
+    cachefile = strdup_printf("%s/%s_%" PRIu64, filecache, key, revision);
+    donefile = strdup_printf("%s/%s_%" PRIu64, filecache, done,
+                             done_revision);
+    pages = strdup_printf("%s/pages", filecache);
+
+    tree = folder_tree_create(filecache);
+    if (folder_tree_rebuild(tree, conn) != 0
+        || mock_remote_fetch_all(tree, conn) != 0
+        || folder_tree_pages_open(tree, pages) != 0) {
+        fprintf(stderr, "cannot retrieve the tree\n");
+        return 1;
+    }
+
+    /* reading the start only retrieves the first block */
+    fd = folder_tree_open_file(tree, conn, "/data/big.bin", O_RDONLY, true,
+                               &part);
+    test_check(fd == 0 && part != NULL, "the file opens partially");
+    if (part == NULL)
+        return 1;
+    requests = test_num_requests();
+    test_check(test_read_part(part, 0, 100), "the start is read");
+    test_check(test_num_requests() - requests == 1, "one block is retrieved");
+    folder_tree_close_part(tree, part);
+    folder_tree_close_file(tree, key);
+    test_check(stat(cachefile, &st) != 0, "the file is not complete");
+    cache_size = folder_tree_get_cache_size(tree);
+    printf("the cache takes %" PRIu64 " bytes after reading one block\n",
+           cache_size);
+    test_check(cache_size >= 1048576 && cache_size < TEST_SIZE / 2,
+               "a partial file counts with the blocks that were read");
+
+    /* a file that is only partially cached does not keep its folder */
+    folder_tree_set_memory_limit(tree, 1);
+    folder_tree_trim(tree);
+    folder_tree_stats(tree, &stats);
+    test_check(stats.num_paged == 1,
+               "the folder of a partially cached file is paged out");
+
+    /* reading the rest completes the file */
+    fd = folder_tree_open_file(tree, conn, "/data/big.bin", O_RDONLY, true,
+                               &part);
+    test_check(fd == 0 && part != NULL, "the file opens partially again");
+    if (part == NULL)
+        return 1;
+    test_check(test_read_part(part, 0, TEST_SIZE), "the whole file is read");
+    folder_tree_close_part(tree, part);
+    folder_tree_close_file(tree, key);
+    test_check(stat(cachefile, &st) == 0, "the file is complete");
+    cache_size = folder_tree_get_cache_size(tree);
+    folder_tree_evict_filecache(tree, UINT64_MAX, 0);
+    test_check(cache_size >= TEST_SIZE
+               && cache_size == folder_tree_get_cache_size(tree),
+               "the size of the cache is counted like it is measured");
+
+    /* the complete file is the local revision now */
+    folder_tree_cleanup_filecache(tree, UINT64_MAX);
+    test_check(stat(cachefile, &st) == 0,
+               "the complete file stays in the cache");
+    num_calls = mock_remote_num_calls();
+    requests = test_num_requests();
+    fd = folder_tree_open_file(tree, conn, "/data/big.bin", O_RDONLY, false,
+                               &part);
+    test_check(fd > 0 && part == NULL, "the complete file opens");
+    if (fd > 0) {
+        test_check(pread(fd, buf, sizeof(buf), TEST_SIZE - sizeof(buf))
+                   == sizeof(buf)
+                   && memcmp(buf, test_content + TEST_SIZE - sizeof(buf),
+                             sizeof(buf)) == 0, "the complete file is read");
+        close(fd);
+        folder_tree_close_file(tree, key);
+    }
+    test_check(mock_remote_num_calls() == num_calls
+               && test_num_requests() == requests,
+               "the complete file needs no remote");
+
+    /* all blocks were retrieved by an earlier mount */
+    path = strdup_printf("%s_part", donefile);
+    test_check(test_write_file(path, test_content, TEST_SIZE),
+               "writing the partial file");
+    free(path);
+    path = strdup_printf("%s_blocks", donefile);
+    test_check(test_write_file(path, "\x0f", 1), "writing the bitmap");
+    free(path);
+    fd = folder_tree_open_file(tree, conn, "/data/done.bin", O_RDONLY, true,
+                               &part);
+    test_check(fd == 0 && part != NULL, "the present file opens partially");
+    if (part == NULL)
+        return 1;
+    test_check(stat(donefile, &st) != 0,
+               "the present file is not checked when it is opened");
+    requests = test_num_requests();
+    test_check(test_read_part(part, 0, 100), "the present file is read");
+    test_check(stat(donefile, &st) == 0,
+               "the present file is complete after the first read");
+    test_check(test_num_requests() == requests,
+               "the present file needs no blocks");
+    folder_tree_close_part(tree, part);
+    folder_tree_close_file(tree, done);
+
+    /* a prefetch does not stop at a block that is being retrieved */
+    fd = folder_tree_open_file(tree, conn, "/data/slow.bin", O_RDONLY, true,
+                               &part);
+    test_check(fd == 0 && part != NULL, "the slow file opens partially");
+    if (part == NULL)
+        return 1;
+    requests = test_num_requests();
+    pthread_create(&reader, NULL, test_read_main, part);
+    for (i = 0; i < 5000 && test_num_requests() == requests; i++)
+        test_sleep_ms(1);
+    test_check(filecache_part_prefetch(part, 0, TEST_SIZE) == 0,
+               "prefetching the slow file");
+    test_check(test_num_requests() - requests == 2,
+               "the blocks behind the slow block are prefetched");
+    pthread_join(reader, NULL);
+    requests = test_num_requests();
+    test_check(test_read_part(part, 0, TEST_SIZE)
+               && test_num_requests() == requests,
+               "the slow file is read without further requests");
+    folder_tree_close_part(tree, part);
+    folder_tree_close_file(tree, test_slow_key);
+
+    /* a stalled stream is stopped by closing the file */
+    fd = folder_tree_open_file(tree, conn, "/data/stall.bin", O_RDONLY, true,
+                               &part);
+    test_check(fd == 0 && part != NULL, "the stalling file opens partially");
+    if (part == NULL)
+        return 1;
+    test_check(test_read_part(part, 0, 100),
+               "the start of the stalling file is streamed");
+    start = test_now();
+    folder_tree_close_part(tree, part);
+    folder_tree_close_file(tree, test_stall_key);
+    test_check(test_now() - start < 1,
+               "closing does not wait for the stalled stream");
+    for (i = 0; i < 5000; i++) {
+        pthread_mutex_lock(&test_mutex);
+        closed = test_stall_closed;
+        pthread_mutex_unlock(&test_mutex);
+        if (closed)
+            break;
+        test_sleep_ms(1);
+    }
+    test_check(closed, "the stalled stream is aborted");
+
+    /* the body of an error is not written */
+    fd = folder_tree_open_file(tree, conn, "/data/error.bin", O_RDONLY, true,
+                               &part);
+    test_check(fd == 0 && part != NULL, "the failing file opens partially");
+    if (part == NULL)
+        return 1;
+    test_check(filecache_part_read(part, buf, sizeof(buf), 0) == -EIO,
+               "reading the failing file fails");
+    folder_tree_close_part(tree, part);
+    folder_tree_close_file(tree, test_error_key);
+    path = strdup_printf("%s/%s_%" PRIu64 "_part", filecache,
+                         test_error_key, error_revision);
+    fd = open(path, O_RDONLY);
+    free(path);
+    memset(buf, 'x', sizeof(buf));
+    test_check(fd >= 0 && pread(fd, buf, sizeof(buf), 0) == sizeof(buf)
+               && memcmp(buf, zeros, sizeof(buf)) == 0,
+               "the partial file does not contain the error");
+    if (fd >= 0)
+        close(fd);
+
+    folder_tree_destroy(tree);
+    mfconn_destroy(conn);
+    mock_remote_rmtree(filecache);
+    free(filecache);
+    free(cachefile);
+    free(donefile);
+    free(pages);
+    free(test_content);
+
+    return test_result();
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of reading the result of a search through the extended attributes of
+ * the mount point against a mocked remote
+ *
+ * The paths of more files than fit into one attribute are read page by page
+ * with user.mediafirefs.findfrom until a page does not end with a line that
+ * tells where to go on. Every path has to be read exactly once and no page
+ * may be larger than an attribute.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup and strtok_r
+
+#define FUSE_USE_VERSION 30
+
+#include <fuse/fuse.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../fuse/hashtbl.h"
+#include "../fuse/operations.h"
+#include "../mfapi/mfconn.h"
+#include "check.h"
+#include "mock_remote.h"
+
+#define TEST_NUM_FILES 3000
+
+static struct mediafirefs_context_private test_ctx;
+static struct fuse_context test_context;
+
+/* mediafirefs_getxattr takes the context from here */
+struct fuse_context *fuse_get_context(void)
+{
+    test_context.private_data = &test_ctx;
+
+    return &test_context;
+}
+
+/*
+ * read the attribute like getfattr does and return its value or NULL
+ */
+static char    *test_getxattr(const char *name, int *len)
+{
+    char           *value;
+
+    *len = mediafirefs_getxattr("/", name, NULL, 0);
+    if (*len < 0)
+        return NULL;
+    value = malloc(*len + 1);
+    if (value == NULL)
+        return NULL;
+    *len = mediafirefs_getxattr("/", name, value, *len);
+    if (*len < 0) {
+        free(value);
+        return NULL;
+    }
+    value[*len] = '\0';
+
+    return value;
+}
+
+int main(void)
+{
+    const char     *docs;
+    char           *filecache;
+    char           *value;
+    char           *line;
+    char           *saveptr;
+    char            name[128];
+    bool            seen[TEST_NUM_FILES];
+    bool            seen_twice;
+    uint64_t        next;
+    int             num_pages;
+    int             num_seen;
+    int             len;
+    int             i;
+
+    docs = mock_remote_add_folder(NULL, "documents of the quarterly reports");
+    for (i = 0; i < TEST_NUM_FILES; i++) {
+        snprintf(name, sizeof(name), "report %04d of the finance team.pdf", i);
+        mock_remote_add_file(docs, name, 1);
+    }
+    mock_remote_add_file(docs, "notes.txt", 1);
+
+    test_ctx.conn = mock_remote_connect();
+    filecache = mock_remote_mkdtemp();
+    if (test_ctx.conn == NULL || filecache == NULL)
+        return 1;
+    pthread_rwlock_init(&(test_ctx.lock), NULL);
+    test_ctx.tree = folder_tree_create(filecache);
+    if (folder_tree_rebuild(test_ctx.tree, test_ctx.conn) != 0
+        || mock_remote_fetch_all(test_ctx.tree, test_ctx.conn) != 0
+        || folder_tree_set_search_index(test_ctx.tree, true) != 0) {
+        fprintf(stderr, "cannot retrieve the tree\n");
+        return 1;
+    }
+
+    memset(seen, 0, sizeof(seen));
+    seen_twice = false;
+    num_seen = 0;
+    num_pages = 0;
+    snprintf(name, sizeof(name), "user.mediafirefs.find.*.pdf");
+    for (;;) {
+        value = test_getxattr(name, &len);
+        if (value == NULL) {
+            test_check(false, "a page is read");
+            break;
+        }
+        num_pages++;
+        test_check(len <= MEDIAFIREFS_XATTR_MAX_SIZE,
+                   "a page fits into an attribute");
+        next = 0;
+        for (line = strtok_r(value, "\n", &saveptr); line != NULL;
+             line = strtok_r(NULL, "\n", &saveptr)) {
+            if (sscanf(line, "... %" SCNu64, &next) == 1)
+                break;
+            if (sscanf(line, "/documents of the quarterly reports/report %d",
+                       &i) != 1 || i < 0 || i >= TEST_NUM_FILES) {
+                test_check(false, "only matching paths are listed");
+                continue;
+            }
+            seen_twice |= seen[i];
+            if (!seen[i])
+                num_seen++;
+            seen[i] = true;
+        }
+        free(value);
+        if (next == 0 || num_pages > TEST_NUM_FILES)
+            break;
+        snprintf(name, sizeof(name), "user.mediafirefs.findfrom.%" PRIu64
+                 ".*.pdf", next);
+    }
+    printf("%d paths in %d pages\n", num_seen, num_pages);
+    test_check(num_pages > 1, "the list does not fit into one page");
+    test_check(num_seen == TEST_NUM_FILES, "every path is listed");
+    test_check(!seen_twice, "no path is listed twice");
+
+    test_check(mediafirefs_getxattr("/", "user.mediafirefs.findfrom.*.pdf",
+                                    NULL, 0) == -ENODATA,
+               "a page without a number does not exist");
+
+    folder_tree_destroy(test_ctx.tree);
+    pthread_rwlock_destroy(&(test_ctx.lock));
+    mfconn_destroy(test_ctx.conn);
+    mock_remote_rmtree(filecache);
+    free(filecache);
+
+    return test_result();
+}
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of folder/get_content against a mocked remote
+ *
+ * The remote is served by mock_http and has a single folder with
+ * TEST_NUM_FOLDERS subfolders and TEST_NUM_FILES files. It answers in chunks
+ * of the requested size and reports a token error once in the middle of the
+ * files, which has to be answered by a new session token and a retry of the
+ * same chunk. Every answer takes a moment, so that the chunks after the first
+ * are requested at the same time through the helpers of the connection. The
+ * API call that returns the session token is replaced by the function
+ * below. Since every API call lives in its own object file of the mfapi
+ * library, the linker picks the definition from here instead of the one from
+ * the library. The chunks are also handed to a handler of the test as they
+ * arrive, which has to get every chunk once and one at a time.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup, open_memstream and nanosleep
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../mfapi/apicalls.h"
+#include "../mfapi/file.h"
+#include "../mfapi/folder.h"
+#include "../mfapi/mfconn.h"
+#include "mock_http.h"
+
+#define TEST_FOLDERKEY "testfolder123"
+#define TEST_NUM_FOLDERS 1000
+#define TEST_NUM_FILES 100000
+/* the chunk of files which fails with a token error the first time */
+#define TEST_FAILING_CHUNK 100
+
+static pthread_mutex_t test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int      test_num_requests;
+static int      test_num_tokens;
+static int      test_failed_once;
+static int      test_in_flight;
+static int      test_max_in_flight;
+
+/* the chunks handed to test_chunk_handler */
+static int      test_num_chunks;
+static int      test_num_items;
+static bool     test_chunk_seen[TEST_NUM_FILES / 400 + 1];
+static bool     test_chunk_twice;
+static bool     test_in_handler;
+static bool     test_handler_overlap;
+
+int mfconn_api_user_get_session_token(mfconn * conn, const char *server,
+                                      const char *username,
+                                      const char *password, int app_id,
+                                      const char *app_key,
+                                      uint32_t * secret_key,
+                                      char **secret_time,
+                                      char **session_token, char **ekey)
+{
+    (void)conn;
+    (void)server;
+    (void)username;
+    (void)password;
+    (void)app_id;
+    (void)app_key;
+
+    pthread_mutex_lock(&test_mutex);
+    test_num_tokens++;
+    pthread_mutex_unlock(&test_mutex);
+
+    *secret_key = 1;
+    *secret_time = strdup("1400000000.0000");
+    *session_token = strdup("testtoken");
+    *ekey = strdup("testekey");
+
+    return 0;
+}
+
+static void test_folder_key(char *key, size_t size, long n)
+{
+    snprintf(key, size, "f%012ld", n);
+}
+
+static void test_file_key(char *key, size_t size, long n)
+{
+    snprintf(key, size, "q%014ld", n);
+}
+
+static void test_handler(int sock, const char *request)
+{
+    char            content_type[16];
+    char            folder_key[32];
+    char            value[16];
+    char            key[16];
+    char           *body;
+    size_t          body_len;
+    FILE           *stream;
+    long            chunk;
+    long            chunk_size;
+    long            total;
+    long            i;
+    bool            fail;
+    struct timespec delay;
+
+    if (strstr(request, "/folder/get_content.php?") == NULL
+        || mock_http_query(request, "folder_key", folder_key,
+                           sizeof(folder_key)) != 0
+        || strcmp(folder_key, TEST_FOLDERKEY) != 0
+        || mock_http_query(request, "content_type", content_type,
+                           sizeof(content_type)) != 0
+        || mock_http_query(request, "chunk", value, sizeof(value)) != 0
+        || (chunk = atol(value)) < 1
+        || mock_http_query(request, "chunk_size", value, sizeof(value)) != 0
+        || (chunk_size = atol(value)) < 1) {
+        mock_http_respond(sock, "404 Not Found", "", 0);
+        return;
+    }
+
+    total = strcmp(content_type, "folders") == 0 ? TEST_NUM_FOLDERS
+        : TEST_NUM_FILES;
+
+    pthread_mutex_lock(&test_mutex);
+    test_num_requests++;
+    test_in_flight++;
+    if (test_in_flight > test_max_in_flight)
+        test_max_in_flight = test_in_flight;
+    fail = strcmp(content_type, "files") == 0
+        && chunk == TEST_FAILING_CHUNK && !test_failed_once;
+    if (fail)
+        test_failed_once = 1;
+    pthread_mutex_unlock(&test_mutex);
+
+    delay.tv_sec = 0;
+    delay.tv_nsec = 1000000;
+    nanosleep(&delay, NULL);
+
+    stream = open_memstream(&body, &body_len);
+    if (fail) {
+        fprintf(stream, "{\"response\":{\"action\":\"folder/get_content\","
+                "\"result\":\"Error\",\"error\":127,"
+                "\"message\":\"The session token is invalid\"}}");
+    } else {
+        fprintf(stream, "{\"response\":{\"action\":\"folder/get_content\","
+                "\"result\":\"Success\",\"folder_content\":{"
+                "\"chunk_size\":\"%ld\",\"content_type\":\"%s\","
+                "\"chunk_number\":\"%ld\",\"more_chunks\":\"%s\",\"%s\":[",
+                chunk_size, content_type, chunk,
+                chunk * chunk_size < total ? "yes" : "no", content_type);
+        for (i = (chunk - 1) * chunk_size;
+             i < chunk * chunk_size && i < total; i++) {
+            if (i > (chunk - 1) * chunk_size)
+                fputc(',', stream);
+            if (strcmp(content_type, "folders") == 0) {
+                test_folder_key(key, sizeof(key), i);
+                fprintf(stream, "{\"folderkey\":\"%s\",\"name\":\"folder "
+                        "%ld\",\"revision\":\"1\",\"parent\":\"%s\","
+                        "\"created\":\"2014-01-01 00:00:00\"}", key, i,
+                        TEST_FOLDERKEY);
+            } else {
+                test_file_key(key, sizeof(key), i);
+                fprintf(stream, "{\"quickkey\":\"%s\",\"filename\":\"file "
+                        "%ld\",\"size\":\"%ld\",\"revision\":\"1\","
+                        "\"created\":\"2014-01-01 00:00:00\",\"hash\":"
+                        "\"0000000000000000000000000000000000000000000000"
+                        "000000000000000000\"}", key, i, i);
+            }
+        }
+        fprintf(stream, "]}}}");
+    }
+    fclose(stream);
+
+    pthread_mutex_lock(&test_mutex);
+    test_in_flight--;
+    pthread_mutex_unlock(&test_mutex);
+
+    mock_http_respond(sock, "200 OK", body, body_len);
+    free(body);
+}
+
+/*
+ * remember which chunks of files arrived and whether any of them was handed
+ * over twice or while another one was
+ */
+static int test_chunk_handler(int chunk, mffolder ** folders, mffile ** files,
+                              void *data)
+{
+    int             i;
+
+    (void)data;
+
+    test_handler_overlap |= test_in_handler;
+    test_in_handler = true;
+
+    if (folders != NULL || files == NULL || chunk < 1
+        || chunk > TEST_NUM_FILES / 400 + 1) {
+        test_chunk_twice = true;
+    } else {
+        test_chunk_twice |= test_chunk_seen[chunk - 1];
+        test_chunk_seen[chunk - 1] = true;
+    }
+    test_num_chunks++;
+    for (i = 0; files != NULL && files[i] != NULL; i++) {
+        test_num_items++;
+        file_free(files[i]);
+    }
+    free(files);
+
+    test_in_handler = false;
+
+    return 0;
+}
+
+int main(void)
+{
+    char            server[32];
+    char            key[16];
+    mfconn         *conn;
+    mffolder      **folders;
+    mffile        **files;
+    long            retval;
+    long            i;
+    int             port;
+    int             failed;
+
+    port = mock_http_start(test_handler);
+    if (port < 0)
+        return 1;
+    snprintf(server, sizeof(server), "127.0.0.1:%d", port);
+
+    conn = mfconn_create(server, "user", "password", 42, NULL, 3, 0);
+    if (conn == NULL) {
+        fprintf(stderr, "mfconn_create failed\n");
+        return 1;
+    }
+
+    failed = 0;
+    folders = NULL;
+    files = NULL;
+
+    retval = mfconn_api_folder_get_content(conn, 0, TEST_FOLDERKEY,
+                                           &folders, NULL);
+    if (retval != 0) {
+        fprintf(stderr, "retrieving the folders failed\n");
+        return 1;
+    }
+    for (i = 0; folders[i] != NULL; i++) {
+        test_folder_key(key, sizeof(key), i);
+        if (strcmp(folder_get_key(folders[i]), key) != 0) {
+            fprintf(stderr, "folder %ld is %s\n", i,
+                    folder_get_key(folders[i]));
+            failed = 1;
+            break;
+        }
+        folder_free(folders[i]);
+    }
+    if (i != TEST_NUM_FOLDERS) {
+        fprintf(stderr, "got %ld of %d folders\n", i, TEST_NUM_FOLDERS);
+        failed = 1;
+    }
+    for (; folders[i] != NULL; i++)
+        folder_free(folders[i]);
+    free(folders);
+
+    retval = mfconn_api_folder_get_content(conn, 1, TEST_FOLDERKEY,
+                                           NULL, &files);
+    if (retval != 0) {
+        fprintf(stderr, "retrieving the files failed\n");
+        return 1;
+    }
+    for (i = 0; files[i] != NULL; i++) {
+        test_file_key(key, sizeof(key), i);
+        if (strcmp(file_get_key(files[i]), key) != 0) {
+            fprintf(stderr, "file %ld is %s\n", i, file_get_key(files[i]));
+            failed = 1;
+            break;
+        }
+        file_free(files[i]);
+    }
+    if (i != TEST_NUM_FILES) {
+        fprintf(stderr, "got %ld of %d files\n", i, TEST_NUM_FILES);
+        failed = 1;
+    }
+    for (; files[i] != NULL; i++)
+        file_free(files[i]);
+    free(files);
+
+    /* one request per chunk of 400 items and one retry. The number of
+     * chunks is only known once the last one arrived, so each connection
+     * might have asked for one chunk after it. The helpers log in once */
+    printf("%d requests, %d session tokens, %d at the same time\n",
+           test_num_requests, test_num_tokens, test_max_in_flight);
+    if (test_num_requests < 3 + 250 + 1
+        || test_num_requests > 3 + 250 + 1 + 2 * MFCONN_MAX_HELPERS
+        || test_num_tokens != 2 + MFCONN_MAX_HELPERS) {
+        fprintf(stderr, "expected 254 requests and %d session tokens\n",
+                2 + MFCONN_MAX_HELPERS);
+        failed = 1;
+    }
+    if (test_max_in_flight < 2) {
+        fprintf(stderr, "the chunks were not requested in parallel\n");
+        failed = 1;
+    }
+
+    retval = mfconn_api_folder_get_content_chunks(conn, 1, TEST_FOLDERKEY,
+                                                  test_chunk_handler, NULL);
+    if (retval != 0) {
+        fprintf(stderr, "retrieving the chunks of files failed\n");
+        return 1;
+    }
+    printf("%d chunks with %d items\n", test_num_chunks, test_num_items);
+    if (test_num_items != TEST_NUM_FILES || test_chunk_twice
+        || test_handler_overlap) {
+        fprintf(stderr, "every chunk has to be handed over once\n");
+        failed = 1;
+    }
+    for (i = 0; i < TEST_NUM_FILES / 400; i++) {
+        if (!test_chunk_seen[i]) {
+            fprintf(stderr, "chunk %ld is missing\n", i + 1);
+            failed = 1;
+        }
+    }
+
+    mfconn_destroy(conn);
+
+    return failed;
+}
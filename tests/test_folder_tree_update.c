@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of how folder_tree_update applies the changes reported by
+ * device/get_changes against a mocked remote
+ *
+ * The remote reports 14 changes: one file three times, five files in one
+ * folder, two files in the root, two files in a folder that changed as well
+ * and a single file in another folder. Only the latest change of the first
+ * file and of the single file need a file/get_info. The five files are
+ * replaced by retrieving their folder and the root is retrieved anyway.
+ * The changed folder needs a folder/get_info and its files are updated once
+ * it is accessed.
+ *
+ * A folder whose content is retrieved in three chunks keeps its children
+ * while one of the chunks fails and only drops a file that was removed
+ * without being reported once all chunks arrived.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/mfconn.h"
+#include "check.h"
+#include "mock_remote.h"
+
+int main(void)
+{
+    struct mock_remote_calls before;
+    struct mock_remote_calls after;
+    folder_tree    *tree;
+    mfconn         *conn;
+    const char     *folder_a;
+    const char     *folder_b;
+    const char     *folder_c;
+    const char     *folder_d;
+    const char     *file_a;
+    const char     *files_b[5];
+    const char     *files_c[2];
+    const char     *file_d;
+    const char     *folder_e;
+    const char     *file_e;
+    const char     *files_root[2];
+    char           *filecache;
+    char            name[64];
+    char            path[64];
+    uint64_t        num_calls;
+    int             i;
+
+    files_root[0] = mock_remote_add_file(NULL, "root 0", 1);
+    files_root[1] = mock_remote_add_file(NULL, "root 1", 1);
+    folder_a = mock_remote_add_folder(NULL, "a");
+    file_a = mock_remote_add_file(folder_a, "a 0", 1);
+    mock_remote_add_file(folder_a, "unchanged", 1);
+    folder_b = mock_remote_add_folder(NULL, "b");
+    for (i = 0; i < 5; i++) {
+        snprintf(name, sizeof(name), "b %d", i);
+        files_b[i] = mock_remote_add_file(folder_b, name, 1);
+    }
+    folder_c = mock_remote_add_folder(NULL, "c");
+    files_c[0] = mock_remote_add_file(folder_c, "c 0", 1);
+    files_c[1] = mock_remote_add_file(folder_c, "c 1", 1);
+    folder_d = mock_remote_add_folder(NULL, "d");
+    file_d = mock_remote_add_file(folder_d, "d 0", 1);
+    folder_e = mock_remote_add_folder(NULL, "e");
+    file_e = mock_remote_add_file(folder_e, "e 0", 1);
+    for (i = 1; i < 1000; i++) {
+        snprintf(name, sizeof(name), "e %d", i);
+        mock_remote_add_file(folder_e, name, 1);
+    }
+
+    conn = mock_remote_connect();
+    filecache = mock_remote_mkdtemp();
+    if (conn == NULL || filecache == NULL)
+        return 1;
+    tree = folder_tree_create(filecache);
+    if (folder_tree_rebuild(tree, conn) != 0
+        || mock_remote_fetch_all(tree, conn) != 0) {
+        fprintf(stderr, "cannot retrieve the tree\n");
+        return 1;
+    }
+
+    mock_remote_change(file_a, "a 1");
+    mock_remote_change(file_a, "a 2");
+    mock_remote_change(file_a, "a 3");
+    for (i = 0; i < 5; i++) {
+        snprintf(name, sizeof(name), "b %d changed", i);
+        mock_remote_change(files_b[i], name);
+    }
+    mock_remote_change(files_root[0], "root 0 changed");
+    mock_remote_change(files_root[1], "root 1 changed");
+    mock_remote_change(files_c[0], "c 0 changed");
+    mock_remote_change(files_c[1], "c 1 changed");
+    mock_remote_change(folder_c, "c changed");
+    mock_remote_change(file_d, "d 0 changed");
+
+    mock_remote_get_calls(&before);
+    folder_tree_update(tree, conn, false);
+    mock_remote_get_calls(&after);
+
+    printf("%" PRIu64 " file/get_info, %" PRIu64 " folder/get_info, %"
+           PRIu64 " folder/get_content\n",
+           after.file_get_info - before.file_get_info,
+           after.folder_get_info - before.folder_get_info,
+           after.folder_get_content - before.folder_get_content);
+    test_check(after.device_get_changes - before.device_get_changes == 1,
+               "one device/get_changes");
+    test_check(after.file_get_info - before.file_get_info == 2,
+               "file/get_info only for the first and the single file");
+    test_check(after.folder_get_info - before.folder_get_info == 1,
+               "folder/get_info for the changed folder");
+    test_check(after.folder_get_content - before.folder_get_content == 4,
+               "folder/get_content for the root and the five files");
+    test_check(folder_tree_get_revision(tree) == mock_remote_get_revision(),
+               "the tree is up to date");
+
+    /* all but the files in the changed folder resolve without the remote */
+    test_check(folder_tree_path_exists(tree, NULL, "/a/a 3"),
+               "the latest name of the file that changed three times");
+    test_check(!folder_tree_path_exists(tree, NULL, "/a/a 0"),
+               "the first name of the file that changed three times");
+    test_check(folder_tree_path_exists(tree, NULL, "/a/unchanged"),
+               "the unchanged file");
+    for (i = 0; i < 5; i++) {
+        snprintf(path, sizeof(path), "/b/b %d changed", i);
+        test_check(folder_tree_path_exists(tree, NULL, path),
+                   "the five files in the same folder");
+    }
+    test_check(folder_tree_path_exists(tree, NULL, "/root 0 changed")
+               && folder_tree_path_exists(tree, NULL, "/root 1 changed"),
+               "the files in the root");
+    test_check(folder_tree_path_exists(tree, NULL, "/d/d 0 changed"),
+               "the single file");
+    test_check(!folder_tree_path_exists(tree, NULL, "/c changed/c 0 changed"),
+               "the changed folder is retrieved when it is accessed");
+    test_check(folder_tree_path_exists(tree, conn, "/c changed/c 0 changed")
+               && folder_tree_path_exists(tree, conn,
+                                          "/c changed/c 1 changed"),
+               "the files in the changed folder");
+
+    /* nothing changed since, so device/get_status is all it takes */
+    num_calls = mock_remote_num_calls();
+    folder_tree_update(tree, conn, false);
+    test_check(mock_remote_num_calls() - num_calls == 1,
+               "an update without changes");
+
+    mock_remote_purge(file_e);
+    mock_remote_change(folder_e, "e");
+    folder_tree_update(tree, conn, false);
+    mock_remote_set_failing_chunk(2);
+    test_check(folder_tree_path_exists(tree, conn, "/e/e 0")
+               && folder_tree_path_exists(tree, conn, "/e/e 500")
+               && folder_tree_path_exists(tree, conn, "/e/e 999"),
+               "the folder keeps its children while a chunk fails");
+    mock_remote_set_failing_chunk(0);
+    test_check(folder_tree_path_exists(tree, conn, "/e/e 999")
+               && folder_tree_path_exists(tree, NULL, "/e/e 1")
+               && folder_tree_path_exists(tree, NULL, "/e/e 500"),
+               "the folder is retrieved once all chunks arrive");
+    test_check(!folder_tree_path_exists(tree, NULL, "/e/e 0"),
+               "the file that was removed without a change is dropped");
+
+    folder_tree_destroy(tree);
+    mfconn_destroy(conn);
+    mock_remote_rmtree(filecache);
+    free(filecache);
+
+    return test_result();
+}
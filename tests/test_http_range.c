@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of http_get_range against a server served by mock_http
+ *
+ * The server answers a range request correctly, with a range that starts at
+ * another offset, without a Content-Range or with the whole resource. Only
+ * the correct answer may be written to the file.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for pread
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../utils/http.h"
+#include "check.h"
+#include "mock_http.h"
+
+#define TEST_SIZE 1000
+#define TEST_OFFSET 100
+#define TEST_LENGTH 50
+
+static char     test_content[TEST_SIZE];
+
+static void test_respond_range(int sock, const char *range,
+                               uint64_t start, uint64_t end)
+{
+    char            header[256];
+
+    snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\n"
+             "Content-Length: %" PRIu64 "\r\n%s%s%s"
+             "Connection: close\r\n\r\n", end - start + 1,
+             range != NULL ? "Content-Range: " : "",
+             range != NULL ? range : "", range != NULL ? "\r\n" : "");
+
+    if (mock_http_send(sock, header, strlen(header)) == 0)
+        mock_http_send(sock, test_content + start, end - start + 1);
+}
+
+static void test_handler(int sock, const char *request)
+{
+    const char     *p;
+    char            range[64];
+    uint64_t        start;
+    uint64_t        end;
+
+    p = strstr(request, "\r\nRange: bytes=");
+    if (p == NULL
+        || sscanf(p + 15, "%" SCNu64 "-%" SCNu64, &start, &end) != 2
+        || start > end || end >= TEST_SIZE) {
+        mock_http_respond(sock, "416 Range Not Satisfiable", "", 0);
+        return;
+    }
+
+    if (strncmp(request, "GET /range ", 11) == 0) {
+        snprintf(range, sizeof(range), "bytes %" PRIu64 "-%" PRIu64 "/%d",
+                 start, end, TEST_SIZE);
+        test_respond_range(sock, range, start, end);
+    } else if (strncmp(request, "GET /shifted ", 13) == 0) {
+        snprintf(range, sizeof(range), "bytes %" PRIu64 "-%" PRIu64 "/%d",
+                 start + 1, end + 1, TEST_SIZE);
+        test_respond_range(sock, range, start + 1, end + 1);
+    } else if (strncmp(request, "GET /norange ", 13) == 0) {
+        test_respond_range(sock, NULL, start, end);
+    } else if (strncmp(request, "GET /whole ", 11) == 0) {
+        mock_http_respond(sock, "200 OK", test_content, TEST_SIZE);
+    } else {
+        mock_http_respond(sock, "404 Not Found", "", 0);
+    }
+}
+
+/*
+ * request the range from path into an empty file and return the result of
+ * http_get_range. The file must afterwards either hold exactly the range or
+ * nothing at all
+ */
+static int test_get_range(mfhttp * http, int port, const char *path,
+                          bool *written)
+{
+    char            url[64];
+    char            buf[TEST_SIZE];
+    FILE           *stream;
+    ssize_t         len;
+    int             retval;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", port, path);
+    stream = tmpfile();
+    if (stream == NULL)
+        return -1;
+    retval = http_get_range(http, url, fileno(stream), TEST_OFFSET,
+                            TEST_LENGTH);
+    len = pread(fileno(stream), buf, sizeof(buf), 0);
+    *written = len > 0;
+    if (len > 0) {
+        test_check(len == TEST_OFFSET + TEST_LENGTH
+                   && memcmp(buf + TEST_OFFSET, test_content + TEST_OFFSET,
+                             TEST_LENGTH) == 0,
+                   "only the requested range is written");
+    }
+    fclose(stream);
+
+    return retval;
+}
+
+int main(void)
+{
+    mfhttp         *http;
+    bool            written;
+    int             port;
+    int             i;
+
+    for (i = 0; i < TEST_SIZE; i++)
+        test_content[i] = 'a' + i % 26;
+
+    port = mock_http_start(test_handler);
+    if (port < 0)
+        return 1;
+    http = http_create();
+
+    test_check(test_get_range(http, port, "/range", &written) == 0
+               && written, "a matching range is accepted");
+    test_check(test_get_range(http, port, "/shifted", &written) != 0
+               && !written, "a range at another offset is rejected");
+    test_check(test_get_range(http, port, "/norange", &written) != 0
+               && !written, "a partial response without a range is rejected");
+    test_check(test_get_range(http, port, "/whole", &written) == 1
+               && !written, "the whole resource is reported");
+
+    http_destroy(http);
+
+    return test_result();
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of the cache of paths that do not exist against a mocked remote
+ *
+ * Probing names that do not exist has to be answered from the cache without
+ * remote calls. A name that appears through a file change has to resolve
+ * right away while the names of other folders stay in the cache. A name in a
+ * folder that changed remotely must not be answered from the cache but by
+ * retrieving the folder again.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/mfconn.h"
+#include "check.h"
+#include "mock_remote.h"
+
+#define TEST_NUM_PROBES 1000
+
+static const char *test_missing[] = {
+    "/project/.git",
+    "/project/._main.c",
+    "/project/src/desktop.ini",
+    "/project/src/.main.c.swp",
+};
+
+#define TEST_NUM_MISSING (sizeof(test_missing) / sizeof(test_missing[0]))
+
+int main(void)
+{
+    struct folder_tree_stats stats;
+    struct stat     stbuf;
+    folder_tree    *tree;
+    mfconn         *conn;
+    const char     *project;
+    const char     *src;
+    char           *filecache;
+    uint64_t        num_calls;
+    uint64_t        hits;
+    size_t          i;
+    int             j;
+    int             retval;
+
+    project = mock_remote_add_folder(NULL, "project");
+    mock_remote_add_file(project, "main.c", 100);
+    mock_remote_add_file(project, "Makefile", 100);
+    src = mock_remote_add_folder(project, "src");
+    mock_remote_add_file(src, "main.c", 100);
+
+    conn = mock_remote_connect();
+    filecache = mock_remote_mkdtemp();
+    if (conn == NULL || filecache == NULL)
+        return 1;
+    tree = folder_tree_create(filecache);
+    if (folder_tree_rebuild(tree, conn) != 0
+        || mock_remote_fetch_all(tree, conn) != 0) {
+        fprintf(stderr, "cannot retrieve the tree\n");
+        return 1;
+    }
+
+    num_calls = mock_remote_num_calls();
+    for (j = 0; j < TEST_NUM_PROBES; j++) {
+        for (i = 0; i < TEST_NUM_MISSING; i++) {
+            retval = folder_tree_getattr(tree, conn, test_missing[i], &stbuf);
+            if (retval != -ENOENT) {
+                fprintf(stderr, "%s: %d\n", test_missing[i], retval);
+                test_check(false, "a missing name is not found");
+            }
+        }
+    }
+    folder_tree_stats(tree, &stats);
+    hits = stats.ncache_hits;
+    printf("%" PRIu64 " of %d probes answered from the cache\n", hits,
+           (int)(TEST_NUM_PROBES * TEST_NUM_MISSING));
+    test_check(hits == (TEST_NUM_PROBES - 1) * TEST_NUM_MISSING,
+               "all but the first probe of every name hit the cache");
+    test_check(mock_remote_num_calls() == num_calls,
+               "probing made no remote calls");
+    test_check(folder_tree_path_exists(tree, NULL, "/project/src/main.c"),
+               "existing names are still found");
+
+    /* a name that appears through a file change */
+    mock_remote_add_file(project, ".git", 1);
+    folder_tree_update(tree, conn, false);
+    test_check(folder_tree_getattr(tree, NULL, "/project/.git", &stbuf) == 0,
+               "a new file is found right away");
+    folder_tree_stats(tree, &stats);
+    hits = stats.ncache_hits;
+    test_check(folder_tree_getattr(tree, NULL, "/project/src/.main.c.swp",
+                                   &stbuf) == -ENOENT,
+               "a name in another folder is still missing");
+    folder_tree_stats(tree, &stats);
+    test_check(stats.ncache_hits == hits + 1,
+               "a change keeps the names of other folders in the cache");
+    test_check(folder_tree_getattr(tree, NULL, "/project/._main.c", &stbuf)
+               == -ENOENT, "another name in the changed folder is missing");
+    folder_tree_stats(tree, &stats);
+    test_check(stats.ncache_hits == hits + 1,
+               "a change removes the names of its folder from the cache");
+
+    /* a name in a folder that changed remotely, whose files are only known
+     * once the folder is retrieved again */
+    mock_remote_add_file(src, "desktop.ini", 1);
+    mock_remote_change(src, NULL);
+    folder_tree_update(tree, conn, false);
+    test_check(folder_tree_getattr(tree, NULL, "/project/src/desktop.ini",
+                                   &stbuf) == -EAGAIN,
+               "a changed folder is not answered from the cache");
+    num_calls = mock_remote_num_calls();
+    test_check(folder_tree_getattr(tree, conn, "/project/src/desktop.ini",
+                                   &stbuf) == 0,
+               "the new file in the changed folder is found");
+    test_check(mock_remote_num_calls() - num_calls == 2,
+               "the changed folder is retrieved");
+    test_check(folder_tree_getattr(tree, conn, "/project/src/.main.c.swp",
+                                   &stbuf) == -ENOENT,
+               "other names are still missing");
+
+    folder_tree_destroy(tree);
+    mfconn_destroy(conn);
+    mock_remote_rmtree(filecache);
+    free(filecache);
+
+    return test_result();
+}
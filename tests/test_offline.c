@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of the read-only offline mode against a mocked remote
+ *
+ * A tree is retrieved and stored like an online mount does and a file is
+ * read, which puts it into the file cache. A folder then changes remotely
+ * and the remote becomes unreachable. The tree loaded from the dircache
+ * has to serve the last known content of that folder and the cached file
+ * without any remote calls, while a file that is not cached fails right
+ * away. Once the remote is reachable again, the connection logs in and the
+ * tree catches up with the remote changes, like the poll thread does. A
+ * login that the remote refuses must not be taken for an unreachable remote.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/mfconn.h"
+#include "../utils/strings.h"
+#include "check.h"
+#include "mock_remote.h"
+
+#define TEST_CONTENT "cached content\n"
+
+/*
+ * open a file read-only like the open operation does and return the file
+ * descriptor or a negative value on error
+ */
+static int test_open(folder_tree * tree, mfconn * conn, const char *path,
+                     const char *key, bool update)
+{
+    filecache_part *part;
+    int             fd;
+
+    fd = folder_tree_open_file(tree, conn, path, O_RDONLY, update, &part);
+    if (fd < 0)
+        return fd;
+    if (part != NULL) {
+        /* the content was not in the cache */
+        folder_tree_close_part(tree, part);
+        folder_tree_close_file(tree, key);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void test_close(folder_tree * tree, const char *key, int fd)
+{
+    close(fd);
+    folder_tree_close_file(tree, key);
+}
+
+int main(void)
+{
+    struct stat     stbuf;
+    folder_tree    *tree;
+    mfconn         *conn;
+    const char     *docs;
+    const char     *cached;
+    const char     *uncached;
+    char           *filecache;
+    char           *dircache;
+    char           *cachefile;
+    char            buf[64];
+    uint64_t        revision;
+    uint64_t        num_calls;
+    FILE           *stream;
+    ssize_t         len;
+    int             fd;
+
+    docs = mock_remote_add_folder(NULL, "docs");
+    cached = mock_remote_add_file(docs, "cached.txt", strlen(TEST_CONTENT));
+    revision = mock_remote_get_revision();
+    uncached = mock_remote_add_file(docs, "uncached.txt", 10);
+
+    conn = mock_remote_connect();
+    filecache = mock_remote_mkdtemp();
+    if (conn == NULL || filecache == NULL)
+        return 1;
+    dircache = strdup_printf("%s/dircache", filecache);
+
+    /* the online mount */
+    tree = folder_tree_create(filecache);
+    if (folder_tree_rebuild(tree, conn) != 0
+        || mock_remote_fetch_all(tree, conn) != 0) {
+        fprintf(stderr, "cannot retrieve the tree\n");
+        return 1;
+    }
+
+    /* a file that was read before is in the cache */
+    cachefile = strdup_printf("%s/%s_%" PRIu64, filecache, cached, revision);
+    stream = fopen(cachefile, "w");
+    if (stream == NULL) {
+        fprintf(stderr, "cannot create %s\n", cachefile);
+        return 1;
+    }
+    fputs(TEST_CONTENT, stream);
+    fclose(stream);
+    free(cachefile);
+    fd = test_open(tree, conn, "/docs/cached.txt", cached, true);
+    test_check(fd >= 0, "opening the cached file online");
+    if (fd >= 0)
+        test_close(tree, cached, fd);
+
+    /* the remote changes and the tree learns about it */
+    mock_remote_add_file(docs, "new.txt", 1);
+    mock_remote_change(docs, NULL);
+    folder_tree_update(tree, conn, false);
+
+    /* online but without a connection, the changed folder is not served */
+    test_check(folder_tree_getattr(tree, NULL, "/docs/cached.txt", &stbuf)
+               == -EAGAIN, "an outdated folder needs the remote online");
+
+    stream = fopen(dircache, "w");
+    if (stream == NULL || folder_tree_store(tree, stream) != 0) {
+        fprintf(stderr, "cannot store the tree\n");
+        return 1;
+    }
+    fclose(stream);
+    folder_tree_destroy(tree);
+    mfconn_destroy(conn);
+
+    /* the offline mount */
+    mock_remote_set_online(false);
+    test_check(mock_remote_connect() == NULL, "logging in fails offline");
+    conn = mfconn_create_offline("mock.invalid", "user", "password", 42,
+                                 NULL, 3, 0);
+    test_check(conn != NULL, "a connection can be created offline");
+    stream = fopen(dircache, "r");
+    tree = stream != NULL ? folder_tree_load(stream, filecache) : NULL;
+    if (tree == NULL) {
+        fprintf(stderr, "cannot load the tree\n");
+        return 1;
+    }
+    fclose(stream);
+    folder_tree_set_offline(tree, true);
+
+    num_calls = mock_remote_num_calls();
+    test_check(folder_tree_getattr(tree, conn, "/docs/cached.txt", &stbuf)
+               == 0, "an outdated folder is served offline");
+    test_check(folder_tree_getattr(tree, conn, "/docs/missing.txt", &stbuf)
+               == -ENOENT, "a missing file is not found offline");
+    fd = test_open(tree, conn, "/docs/cached.txt", cached, false);
+    test_check(fd >= 0, "a cached file opens offline");
+    if (fd >= 0) {
+        len = read(fd, buf, sizeof(buf) - 1);
+        test_check(len == (ssize_t) strlen(TEST_CONTENT)
+                   && memcmp(buf, TEST_CONTENT, len) == 0,
+                   "the cached file has its content");
+        test_close(tree, cached, fd);
+    }
+    test_check(test_open(tree, conn, "/docs/uncached.txt", uncached, false)
+               < 0,
+               "a file that is not cached fails offline");
+    test_check(mock_remote_num_calls() == num_calls,
+               "no remote calls while offline");
+
+    /* the remote is reachable again and changed in the meantime */
+    mock_remote_add_file(NULL, "offline.txt", 1);
+    test_check(mfconn_refresh_token(conn) == MFCONN_UNREACHABLE,
+               "logging in fails while the remote is unreachable");
+    mock_remote_set_online(true);
+    mock_remote_set_refused(true);
+    test_check(mfconn_refresh_token(conn) == -1,
+               "a refused login is told apart from an unreachable remote");
+    mock_remote_set_refused(false);
+    test_check(mfconn_refresh_token(conn) == 0, "logging in once it is back");
+    folder_tree_set_offline(tree, false);
+    folder_tree_update(tree, conn, false);
+    test_check(folder_tree_get_revision(tree) == mock_remote_get_revision(),
+               "the tree caught up with the remote");
+    test_check(folder_tree_getattr(tree, conn, "/offline.txt", &stbuf) == 0,
+               "the file added while offline is found");
+    test_check(folder_tree_getattr(tree, conn, "/docs/new.txt", &stbuf) == 0,
+               "the changed folder is retrieved online");
+
+    folder_tree_destroy(tree);
+    mfconn_destroy(conn);
+    mock_remote_rmtree(filecache);
+    free(filecache);
+    free(dircache);
+
+    return test_result();
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Test of paging out the children of folders against a mocked remote
+ *
+ * The tree is trimmed to half its size. The folders that were used last
+ * must stay in memory while others are paged out. A paged out folder must
+ * be listed from its page without remote calls, also after the tree was
+ * stored and loaded again. A checkpoint must remove the pages that are not
+ * needed anymore and a page that is incomplete must make the folder be
+ * retrieved from the remote again.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strdup and truncate
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "../fuse/hashtbl.h"
+#include "../mfapi/mfconn.h"
+#include "../utils/strings.h"
+#include "check.h"
+#include "mock_remote.h"
+
+#define TEST_NUM_LEAVES 20
+#define TEST_NUM_FILES 50
+
+static int test_count(void *buf, const char *name, const struct stat *stbuf,
+                      off_t off)
+{
+    (void)name;
+    (void)stbuf;
+    (void)off;
+
+    (*(int *)buf)++;
+
+    return 0;
+}
+
+/*
+ * the number of entries in a directory besides . and ..
+ */
+static int test_count_pages(const char *path)
+{
+    struct dirent  *ent;
+    DIR            *dir;
+    int             count;
+
+    dir = opendir(path);
+    if (dir == NULL)
+        return -1;
+    count = 0;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] != '.')
+            count++;
+    }
+    closedir(dir);
+
+    return count;
+}
+
+/*
+ * return the number of the first leaf whose children are paged out or -1
+ *
+ * this must not page anything in, so it looks up the files without a
+ * connection
+ */
+static int test_find_paged(folder_tree * tree, int first)
+{
+    struct stat     stbuf;
+    char            path[64];
+    int             i;
+
+    for (i = first; i < TEST_NUM_LEAVES; i++) {
+        snprintf(path, sizeof(path), "/leaf %d/file 0", i);
+        if (folder_tree_getattr(tree, NULL, path, &stbuf) == -EAGAIN)
+            return i;
+    }
+
+    return -1;
+}
+
+int main(void)
+{
+    struct folder_tree_stats stats;
+    struct stat     stbuf;
+    folder_tree    *tree;
+    mfconn         *conn;
+    const char     *leaves[TEST_NUM_LEAVES];
+    const char     *outer;
+    const char     *inner;
+    char           *filecache;
+    char           *dircache;
+    char           *pages;
+    char           *page;
+    char            name[64];
+    uint64_t        num_calls;
+    uint64_t        limit;
+    FILE           *stream;
+    int             count;
+    int             paged;
+    int             i;
+    int             j;
+
+    for (i = 0; i < TEST_NUM_LEAVES; i++) {
+        snprintf(name, sizeof(name), "leaf %d", i);
+        leaves[i] = mock_remote_add_folder(NULL, name);
+        for (j = 0; j < TEST_NUM_FILES; j++) {
+            snprintf(name, sizeof(name), "file %d", j);
+            mock_remote_add_file(leaves[i], name, j);
+        }
+    }
+    outer = mock_remote_add_folder(NULL, "outer");
+    inner = mock_remote_add_folder(outer, "inner");
+    mock_remote_add_file(inner, "file 0", 1);
+
+    conn = mock_remote_connect();
+    filecache = mock_remote_mkdtemp();
+    if (conn == NULL || filecache == NULL)
+        return 1;
+    dircache = strdup_printf("%s/dircache", filecache);
+    pages = strdup_printf("%s.pages", dircache);
+
+    tree = folder_tree_create(filecache);
+    if (folder_tree_pages_open(tree, pages) != 0
+        || folder_tree_rebuild(tree, conn) != 0
+        || mock_remote_fetch_all(tree, conn) != 0) {
+        fprintf(stderr, "cannot retrieve the tree\n");
+        return 1;
+    }
+
+    folder_tree_stats(tree, &stats);
+    limit = stats.resident_size / 2;
+    folder_tree_set_memory_limit(tree, limit);
+
+    /* the last leaf was used most recently */
+    count = 0;
+    folder_tree_readdir(tree, conn, "/leaf 19", &count, test_count, 0);
+
+    folder_tree_trim(tree);
+    folder_tree_stats(tree, &stats);
+    printf("paged out %" PRIu64 " folders, %" PRIu64 " of %" PRIu64
+           " bytes left\n", stats.num_paged, stats.resident_size, limit);
+    test_check(stats.num_paged > 0, "folders were paged out");
+    test_check(stats.resident_size <= limit, "the tree is within its limit");
+    test_check(test_count_pages(pages) == (int)stats.num_paged,
+               "every paged out folder has a page");
+    test_check(folder_tree_getattr(tree, NULL, "/leaf 19/file 0", &stbuf)
+               == 0, "the folder used last stays in memory");
+    test_check(folder_tree_getattr(tree, NULL, "/outer/inner", &stbuf) == 0,
+               "a folder with a subfolder that has children stays in memory");
+
+    /* listing a paged out folder reads its page */
+    paged = test_find_paged(tree, 0);
+    test_check(paged >= 0, "a leaf is paged out");
+    num_calls = mock_remote_num_calls();
+    snprintf(name, sizeof(name), "/leaf %d", paged);
+    count = 0;
+    test_check(folder_tree_readdir(tree, NULL, name, &count, test_count, 0)
+               == -EAGAIN, "paging in needs a connection");
+    test_check(folder_tree_readdir(tree, conn, name, &count, test_count, 0)
+               == 0 && count == TEST_NUM_FILES + 2,
+               "a paged out folder is listed completely");
+    test_check(mock_remote_num_calls() == num_calls,
+               "paging in made no remote calls");
+
+    /* the page of the folder that was paged in is removed */
+    test_check(folder_tree_checkpoint(tree, dircache) == 0, "checkpoint");
+    folder_tree_stats(tree, &stats);
+    test_check(test_count_pages(pages) == (int)stats.num_paged,
+               "a checkpoint removes the pages that are not needed");
+    folder_tree_destroy(tree);
+
+    /* the paged out folders are still paged out after loading */
+    stream = fopen(dircache, "r");
+    tree = stream != NULL ? folder_tree_load(stream, filecache) : NULL;
+    if (tree == NULL || folder_tree_pages_open(tree, pages) != 0) {
+        fprintf(stderr, "cannot load the tree\n");
+        return 1;
+    }
+    fclose(stream);
+    paged = test_find_paged(tree, 0);
+    test_check(paged >= 0, "a leaf is paged out after loading");
+    num_calls = mock_remote_num_calls();
+    snprintf(name, sizeof(name), "/leaf %d/file %d", paged,
+             TEST_NUM_FILES - 1);
+    test_check(folder_tree_getattr(tree, conn, name, &stbuf) == 0
+               && mock_remote_num_calls() == num_calls,
+               "a loaded paged out folder is paged in");
+
+    /* an incomplete page makes the folder be retrieved again */
+    paged = test_find_paged(tree, paged + 1);
+    test_check(paged >= 0, "another leaf is paged out after loading");
+    if (paged >= 0) {
+        page = strdup_printf("%s/%s", pages, leaves[paged]);
+        test_check(truncate(page, 40) == 0, "truncating a page");
+        free(page);
+        num_calls = mock_remote_num_calls();
+        snprintf(name, sizeof(name), "/leaf %d/file %d", paged,
+                 TEST_NUM_FILES - 1);
+        test_check(folder_tree_getattr(tree, conn, name, &stbuf) == 0
+                   && mock_remote_num_calls() - num_calls == 2,
+                   "a folder with an incomplete page is retrieved");
+    }
+
+    folder_tree_destroy(tree);
+    mfconn_destroy(conn);
+    mock_remote_rmtree(filecache);
+    free(filecache);
+    free(dircache);
+    free(pages);
+
+    return test_result();
+}
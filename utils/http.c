@@ -16,12 +16,18 @@
  *
  */
 
+#define _POSIX_C_SOURCE 200809L // for pwrite
+
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
 
 #include "http.h"
 
@@ -35,6 +41,10 @@ static size_t   http_write_buf_cb(char *data, size_t size, size_t nmemb,
                                   void *user_ptr);
 static size_t   http_write_file_cb(char *data, size_t size, size_t nmemb,
                                    void *user_ptr);
+static size_t   http_write_range_cb(char *data, size_t size, size_t nmemb,
+                                    void *user_ptr);
+static size_t   http_header_range_cb(char *data, size_t size, size_t nmemb,
+                                     void *user_ptr);
 
 struct mfhttp {
     CURL           *curl_handle;
@@ -47,6 +57,17 @@ struct mfhttp {
     bool            show_progress;
     char            error_buf[CURL_ERROR_SIZE];
     FILE           *stream;
+    /* the file written by http_get_range and http_get_fd, the part of it
+     * that is left and whether only a range was requested */
+    int             fd;
+    uint64_t        fd_offset;
+    uint64_t        fd_end;
+    bool            fd_range;
+    bool            fd_range_ignored;
+    /* whether the Content-Range of the response matches the request */
+    bool            fd_range_matches;
+    FdProgress      fd_progress;
+    void           *fd_progress_data;
 
     DataHandler     data_handler;
     void           *cb_data;
@@ -75,6 +96,7 @@ static void http_curl_reset(mfhttp * conn)
     curl_easy_setopt(conn->curl_handle, CURLOPT_ERRORBUFFER, conn->error_buf);
     curl_easy_setopt(conn->curl_handle, CURLOPT_PROXY, getenv("http_proxy"));
     curl_easy_setopt(conn->curl_handle, CURLOPT_VERBOSE, 0L);
+    conn->fd_progress = NULL;
 
     // it should never take 5 seconds to establish a connection to the server
     curl_easy_setopt(conn->curl_handle, CURLOPT_CONNECTTIMEOUT, 5);
@@ -157,6 +179,11 @@ http_progress_cb(void *user_ptr, double dltotal, double dlnow,
     conn->dl_len = dltotal;
     conn->dl_now = dlnow;
 
+    /* this is also called while no data arrives, so that a transfer to a
+     * file which stalls can still be aborted */
+    if (conn->fd_progress != NULL)
+        return conn->fd_progress(conn->fd_progress_data, conn->fd_offset);
+
     return 0;
 }
 
@@ -293,6 +320,195 @@ http_write_file_cb(char *data, size_t size, size_t nmemb, void *user_ptr)
     return size * ret;
 }
 
+/*
+ * retrieve length bytes of the resource starting at offset with a range
+ * request and write them to fd at the same offset
+ *
+ * fails if the server does not answer with exactly this range or if the
+ * transfer stalls for a minute. If it answers with the whole resource
+ * instead, 1 is returned.
+ */
+int http_get_range(mfhttp * conn, const char *url, int fd, uint64_t offset,
+                   uint64_t length)
+{
+    char            range[64];
+    int             retval;
+
+    if (length == 0)
+        return 0;
+
+    snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64, offset,
+             offset + length - 1);
+
+    http_curl_reset(conn);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_URL, url);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_RANGE, range);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_READFUNCTION,
+                     http_read_buf_cb);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_READDATA, (void *)conn);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_WRITEFUNCTION,
+                     http_write_range_cb);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_WRITEDATA, (void *)conn);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_HEADERFUNCTION,
+                     http_header_range_cb);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_HEADERDATA, (void *)conn);
+    // a stalled range fails instead of holding up the readers waiting for it
+    curl_easy_setopt(conn->curl_handle, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_LOW_SPEED_TIME, 60L);
+    conn->fd = fd;
+    conn->fd_offset = offset;
+    conn->fd_end = offset + length;
+    conn->fd_range = true;
+    conn->fd_range_ignored = false;
+    conn->fd_range_matches = false;
+    retval = curl_easy_perform(conn->curl_handle);
+    if (conn->fd_range_ignored) {
+        fprintf(stderr, "server does not support ranges\n");
+        return 1;
+    }
+    if (retval != CURLE_OK) {
+        fprintf(stderr, "error curl_easy_perform %s\n\r", conn->error_buf);
+        return retval;
+    }
+    if (conn->fd_offset != conn->fd_end) {
+        fprintf(stderr, "range %s is incomplete\n", range);
+        return -1;
+    }
+    return 0;
+}
+
+static          size_t
+http_write_range_cb(char *data, size_t size, size_t nmemb, void *user_ptr)
+{
+    mfhttp         *conn;
+    size_t          data_len;
+    long            response_code;
+    ssize_t         ret;
+
+    if (user_ptr == NULL)
+        return 0;
+    conn = (mfhttp *) user_ptr;
+
+    data_len = size * nmemb;
+
+    curl_easy_getinfo(conn->curl_handle, CURLINFO_RESPONSE_CODE,
+                      &response_code);
+    if (!conn->fd_range && response_code != 200) {
+        // the body of an error must not end up in the file
+        fprintf(stderr, "server answered with %ld\n", response_code);
+        return 0;
+    }
+    if (conn->fd_range) {
+        // a server that ignores the range sends the whole resource instead
+        if (response_code == 200) {
+            conn->fd_range_ignored = true;
+            return 0;
+        }
+        if (response_code != 206 || !conn->fd_range_matches
+            || data_len > conn->fd_end - conn->fd_offset) {
+            fprintf(stderr, "server did not send the requested range\n");
+            return 0;
+        }
+    }
+
+    ret = pwrite(conn->fd, data, data_len, conn->fd_offset);
+    if (ret < 0) {
+        perror("pwrite");
+        return 0;
+    }
+    conn->fd_offset += ret;
+
+    if (conn->fd_progress != NULL
+        && conn->fd_progress(conn->fd_progress_data, conn->fd_offset) != 0)
+        return 0;
+
+    return ret;
+}
+
+/*
+ * check that the Content-Range of a partial response starts at the requested
+ * offset and ends with the requested length
+ *
+ * the headers of every response are passed, including those of redirects,
+ * so the result is reset by each status line
+ */
+static          size_t
+http_header_range_cb(char *data, size_t size, size_t nmemb, void *user_ptr)
+{
+    mfhttp         *conn;
+    size_t          data_len;
+    char            header[128];
+    uint64_t        start;
+    uint64_t        end;
+
+    if (user_ptr == NULL)
+        return 0;
+    conn = (mfhttp *) user_ptr;
+
+    data_len = size * nmemb;
+
+    if (data_len >= 5 && strncmp(data, "HTTP/", 5) == 0) {
+        conn->fd_range_matches = false;
+        return data_len;
+    }
+
+    if (data_len < 14 || data_len >= sizeof(header)
+        || strncasecmp(data, "Content-Range:", 14) != 0)
+        return data_len;
+
+    memcpy(header, data, data_len);
+    header[data_len] = '\0';
+    if (sscanf(header + 14, " bytes %" SCNu64 "-%" SCNu64, &start, &end) != 2)
+        return data_len;
+
+    // the body is not written yet, so fd_offset is still the requested start
+    conn->fd_range_matches = (start == conn->fd_offset
+                              && end + 1 == conn->fd_end);
+    if (!conn->fd_range_matches)
+        fprintf(stderr, "server sent the range %" PRIu64 "-%" PRIu64
+                " instead of %" PRIu64 "-%" PRIu64 "\n", start, end,
+                conn->fd_offset, conn->fd_end - 1);
+
+    return data_len;
+}
+
+/*
+ * retrieve the whole resource and write it to fd from its start
+ *
+ * after every write and periodically while waiting for data, progress is
+ * called with the number of bytes written so far. If it returns non-zero,
+ * the transfer is aborted. Only a response with status 200 is written and
+ * the transfer fails if it stalls for a minute.
+ */
+int http_get_fd(mfhttp * conn, const char *url, int fd,
+                FdProgress progress, void *progress_data)
+{
+    int             retval;
+
+    http_curl_reset(conn);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_URL, url);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_READFUNCTION,
+                     http_read_buf_cb);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_READDATA, (void *)conn);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_WRITEFUNCTION,
+                     http_write_range_cb);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_WRITEDATA, (void *)conn);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(conn->curl_handle, CURLOPT_LOW_SPEED_TIME, 60L);
+    conn->fd = fd;
+    conn->fd_offset = 0;
+    conn->fd_end = UINT64_MAX;
+    conn->fd_range = false;
+    conn->fd_progress = progress;
+    conn->fd_progress_data = progress_data;
+    retval = curl_easy_perform(conn->curl_handle);
+    if (retval != CURLE_OK) {
+        fprintf(stderr, "error curl_easy_perform %s\n\r", conn->error_buf);
+        return retval;
+    }
+    return 0;
+}
+
 static          size_t
 http_read_file_cb(char *data, size_t size, size_t nmemb, void *user_ptr)
 {
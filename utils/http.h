@@ -31,6 +31,8 @@ typedef struct mfhttp mfhttp;
 
 typedef int     (*DataHandler) (mfhttp * conn, void *data);
 
+typedef int     (*FdProgress) (void *data, uint64_t num_written);
+
 mfhttp         *http_create(void);
 
 void            http_destroy(mfhttp * conn);
@@ -48,6 +50,12 @@ int             http_post_buf(mfhttp * conn, const char *url,
 int             http_get_file(mfhttp * conn, const char *url,
                               const char *path);
 
+int             http_get_range(mfhttp * conn, const char *url, int fd,
+                               uint64_t offset, uint64_t length);
+
+int             http_get_fd(mfhttp * conn, const char *url, int fd,
+                            FdProgress progress, void *progress_data);
+
 json_t         *http_parse_buf_json(mfhttp * conn, size_t flags,
                                     json_error_t * error);
 
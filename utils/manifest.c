@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for st_mtim and fileno
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "manifest.h"
+
+/*
+ * A manifest of the cached files whose content was verified against their
+ * hash
+ *
+ * Every record holds the size, modification time and inode a file had when
+ * it was verified. As long as stat reports the same values and the expected
+ * hash did not change, the file is assumed to be unchanged and does not have
+ * to be read again.
+ *
+ * The records are kept sorted by key and revision, so that they can be found
+ * by binary search and walked in order. On disk, the manifest is a header
+ * followed by the records as they are in memory. It is only used on the
+ * machine that wrote it, so a manifest with a different byte order or record
+ * size is ignored and all files are verified once more.
+ */
+
+#define MANIFEST_MAGIC "MFVM"
+#define MANIFEST_BYTE_ORDER 0x01020304
+
+struct manifest_header {
+    char            magic[4];
+    uint32_t        byte_order;
+    uint32_t        record_size;
+    uint32_t        reserved;
+    uint64_t        num_records;
+};
+
+struct manifest {
+    struct manifest_record *records;
+    size_t          num_records;
+    size_t          capacity;
+    /* whether records changed since the manifest was loaded or stored */
+    bool            dirty;
+};
+
+manifest       *manifest_create(void)
+{
+    manifest       *manifest;
+
+    manifest = (struct manifest *)calloc(1, sizeof(struct manifest));
+    if (manifest == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+
+    return manifest;
+}
+
+/*
+ * load a manifest stored by manifest_store
+ *
+ * if the file does not exist or cannot be read, an empty manifest is
+ * returned, so that all files are verified again
+ */
+manifest       *manifest_load(const char *path)
+{
+    manifest       *manifest;
+    struct manifest_header header;
+    FILE           *stream;
+    size_t          i;
+
+    manifest = manifest_create();
+    if (manifest == NULL)
+        return NULL;
+
+    stream = fopen(path, "r");
+    if (stream == NULL)
+        return manifest;
+
+    if (fread(&header, sizeof(header), 1, stream) != 1
+        || memcmp(header.magic, MANIFEST_MAGIC, 4) != 0
+        || header.byte_order != MANIFEST_BYTE_ORDER
+        || header.record_size != sizeof(struct manifest_record)
+        || header.num_records > SIZE_MAX / sizeof(struct manifest_record)) {
+        fprintf(stderr, "ignoring manifest %s in an unknown format\n", path);
+        fclose(stream);
+        return manifest;
+    }
+
+    if (header.num_records > 0) {
+        manifest->records = (struct manifest_record *)
+            malloc(header.num_records * sizeof(struct manifest_record));
+        if (manifest->records == NULL
+            || fread(manifest->records, sizeof(struct manifest_record),
+                     header.num_records, stream) != header.num_records) {
+            fprintf(stderr, "cannot read manifest %s\n", path);
+            free(manifest->records);
+            manifest->records = NULL;
+            fclose(stream);
+            return manifest;
+        }
+        manifest->num_records = header.num_records;
+        manifest->capacity = header.num_records;
+    }
+    fclose(stream);
+
+    /* a manifest that was modified by hand must not break the search */
+    for (i = 0; i < manifest->num_records; i++) {
+        manifest->records[i].key[MANIFEST_MAX_LEN_KEY] = '\0';
+        if (i > 0 && (strcmp(manifest->records[i - 1].key,
+                             manifest->records[i].key) > 0
+                      || (strcmp(manifest->records[i - 1].key,
+                                 manifest->records[i].key) == 0
+                          && manifest->records[i - 1].revision >=
+                          manifest->records[i].revision))) {
+            fprintf(stderr, "ignoring unsorted manifest %s\n", path);
+            free(manifest->records);
+            manifest->records = NULL;
+            manifest->num_records = 0;
+            manifest->capacity = 0;
+            return manifest;
+        }
+    }
+
+    return manifest;
+}
+
+/*
+ * write the manifest to a temporary file next to path and rename it, so that
+ * a crash leaves either the old or the new manifest
+ */
+int manifest_store(manifest * manifest, const char *path)
+{
+    struct manifest_header header;
+    FILE           *stream;
+    char           *tmp_path;
+    size_t          len;
+    int             retval;
+
+    len = strlen(path) + 5;
+    tmp_path = (char *)malloc(len);
+    if (tmp_path == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
+    }
+    snprintf(tmp_path, len, "%s.tmp", path);
+
+    stream = fopen(tmp_path, "w");
+    if (stream == NULL) {
+        fprintf(stderr, "cannot open %s for writing\n", tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, 4);
+    header.byte_order = MANIFEST_BYTE_ORDER;
+    header.record_size = sizeof(struct manifest_record);
+    header.num_records = manifest->num_records;
+
+    retval = 0;
+    if (fwrite(&header, sizeof(header), 1, stream) != 1
+        || fwrite(manifest->records, sizeof(struct manifest_record),
+                  manifest->num_records, stream) != manifest->num_records
+        || fflush(stream) != 0 || fsync(fileno(stream)) != 0) {
+        retval = -1;
+    }
+    if (fclose(stream) != 0 || retval != 0
+        || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "cannot store manifest %s\n", path);
+        remove(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+    free(tmp_path);
+
+    manifest->dirty = false;
+
+    return 0;
+}
+
+static int manifest_compare(const struct manifest_record *record,
+                            const char *key, uint64_t revision)
+{
+    int             retval;
+
+    retval = strcmp(record->key, key);
+    if (retval != 0)
+        return retval;
+    if (record->revision < revision)
+        return -1;
+    if (record->revision > revision)
+        return 1;
+    return 0;
+}
+
+/* the position of the first record that is not smaller than key and
+ * revision */
+static size_t manifest_lower_bound(manifest * manifest, const char *key,
+                                   uint64_t revision)
+{
+    size_t          low;
+    size_t          high;
+    size_t          mid;
+
+    low = 0;
+    high = manifest->num_records;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (manifest_compare(&(manifest->records[mid]), key, revision) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/*
+ * record that a revision of a file with the given stat information was
+ * verified against hash, replacing an earlier record of it
+ */
+int manifest_put(manifest * manifest, const char *key, uint64_t revision,
+                 const struct stat *st, const unsigned char *hash)
+{
+    struct manifest_record *records;
+    struct manifest_record *record;
+    size_t          pos;
+    size_t          capacity;
+
+    if (strlen(key) > MANIFEST_MAX_LEN_KEY) {
+        fprintf(stderr, "key %s is too long for the manifest\n", key);
+        return -1;
+    }
+
+    pos = manifest_lower_bound(manifest, key, revision);
+    if (pos == manifest->num_records
+        || manifest_compare(&(manifest->records[pos]), key, revision) != 0) {
+        if (manifest->num_records == manifest->capacity) {
+            capacity = manifest->capacity == 0 ? 64 : manifest->capacity * 2;
+            records = (struct manifest_record *)
+                realloc(manifest->records,
+                        capacity * sizeof(struct manifest_record));
+            if (records == NULL) {
+                fprintf(stderr, "realloc failed\n");
+                return -1;
+            }
+            manifest->records = records;
+            manifest->capacity = capacity;
+        }
+        memmove(&(manifest->records[pos + 1]), &(manifest->records[pos]),
+                (manifest->num_records - pos)
+                * sizeof(struct manifest_record));
+        manifest->num_records++;
+    }
+
+    record = &(manifest->records[pos]);
+    memset(record, 0, sizeof(struct manifest_record));
+    strcpy(record->key, key);
+    record->revision = revision;
+    record->size = st->st_size;
+    record->mtime_sec = st->st_mtim.tv_sec;
+    record->mtime_nsec = st->st_mtim.tv_nsec;
+    record->inode = st->st_ino;
+    memcpy(record->hash, hash, MANIFEST_HASH_LENGTH);
+    manifest->dirty = true;
+
+    return 0;
+}
+
+/* the record of a revision of a file or NULL */
+const struct manifest_record *manifest_find(manifest * manifest,
+                                            const char *key,
+                                            uint64_t revision)
+{
+    size_t          pos;
+
+    pos = manifest_lower_bound(manifest, key, revision);
+    if (pos == manifest->num_records
+        || manifest_compare(&(manifest->records[pos]), key, revision) != 0)
+        return NULL;
+
+    return &(manifest->records[pos]);
+}
+
+/*
+ * the record that follows the given key and revision or NULL, so that all
+ * records can be walked starting with an empty key while records are added
+ * and removed. The returned record is only valid until the next change
+ */
+const struct manifest_record *manifest_next(manifest * manifest,
+                                            const char *key,
+                                            uint64_t revision)
+{
+    size_t          pos;
+
+    pos = manifest_lower_bound(manifest, key, revision);
+    if (pos < manifest->num_records
+        && manifest_compare(&(manifest->records[pos]), key, revision) == 0)
+        pos++;
+    if (pos == manifest->num_records)
+        return NULL;
+
+    return &(manifest->records[pos]);
+}
+
+void manifest_remove(manifest * manifest, const char *key, uint64_t revision)
+{
+    size_t          pos;
+
+    pos = manifest_lower_bound(manifest, key, revision);
+    if (pos == manifest->num_records
+        || manifest_compare(&(manifest->records[pos]), key, revision) != 0)
+        return;
+
+    memmove(&(manifest->records[pos]), &(manifest->records[pos + 1]),
+            (manifest->num_records - pos - 1)
+            * sizeof(struct manifest_record));
+    manifest->num_records--;
+    manifest->dirty = true;
+}
+
+/*
+ * whether a file with the given stat information is still the one that was
+ * verified and whether its content was verified against hash
+ */
+bool manifest_record_matches(const struct manifest_record *record,
+                             const struct stat *st,
+                             const unsigned char *hash)
+{
+    return record->size == (uint64_t) st->st_size
+        && record->mtime_sec == (int64_t) st->st_mtim.tv_sec
+        && record->mtime_nsec == (int64_t) st->st_mtim.tv_nsec
+        && record->inode == (uint64_t) st->st_ino
+        && memcmp(record->hash, hash, MANIFEST_HASH_LENGTH) == 0;
+}
+
+size_t manifest_get_num_records(manifest * manifest)
+{
+    return manifest->num_records;
+}
+
+bool manifest_is_dirty(manifest * manifest)
+{
+    return manifest->dirty;
+}
+
+void manifest_destroy(manifest * manifest)
+{
+    if (manifest == NULL)
+        return;
+
+    free(manifest->records);
+    free(manifest);
+}
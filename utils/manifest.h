@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _MFUTILS_MANIFEST_H_
+#define _MFUTILS_MANIFEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define MANIFEST_MAX_LEN_KEY 15
+#define MANIFEST_HASH_LENGTH 32
+
+/* a file whose content was verified together with what stat said about it
+ * at that time */
+struct manifest_record {
+    char            key[MANIFEST_MAX_LEN_KEY + 1];
+    uint64_t        revision;
+    uint64_t        size;
+    int64_t         mtime_sec;
+    int64_t         mtime_nsec;
+    uint64_t        inode;
+    unsigned char   hash[MANIFEST_HASH_LENGTH];
+};
+
+typedef struct manifest manifest;
+
+manifest       *manifest_create(void);
+
+manifest       *manifest_load(const char *path);
+
+int             manifest_store(manifest * manifest, const char *path);
+
+int             manifest_put(manifest * manifest, const char *key,
+                             uint64_t revision, const struct stat *st,
+                             const unsigned char *hash);
+
+const struct manifest_record *manifest_find(manifest * manifest,
+                                            const char *key,
+                                            uint64_t revision);
+
+const struct manifest_record *manifest_next(manifest * manifest,
+                                            const char *key,
+                                            uint64_t revision);
+
+void            manifest_remove(manifest * manifest, const char *key,
+                                uint64_t revision);
+
+bool            manifest_record_matches(const struct manifest_record *record,
+                                        const struct stat *st,
+                                        const unsigned char *hash);
+
+size_t          manifest_get_num_records(manifest * manifest);
+
+bool            manifest_is_dirty(manifest * manifest);
+
+void            manifest_destroy(manifest * manifest);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+/*
+ * A slab allocator for objects of a fixed size
+ *
+ * Objects are carved out of chunks which each hold objs_per_chunk objects.
+ * This replaces one malloc per object by one malloc per chunk, which avoids
+ * the per-allocation overhead of malloc and the fragmentation of the heap
+ * when millions of small objects are allocated.
+ *
+ * Freed objects are kept in a singly linked list which is threaded through
+ * the freed objects themselves and are handed out again by the next
+ * allocations. Memory is only returned to the system when the slab is
+ * destroyed.
+ */
+
+struct slab {
+    size_t          obj_size;
+    size_t          objs_per_chunk;
+    /* array of chunks, the last one being the one currently carved up */
+    char          **chunks;
+    size_t          num_chunks;
+    /* number of objects already handed out from the last chunk */
+    size_t          last_chunk_used;
+    /* list of freed objects */
+    void           *free_list;
+    /* number of objects currently allocated */
+    size_t          num_objects;
+};
+
+slab           *slab_create(size_t obj_size, size_t objs_per_chunk)
+{
+    slab           *s;
+    size_t          align;
+
+    if (obj_size == 0 || objs_per_chunk == 0) {
+        fprintf(stderr, "object size and chunk size must not be zero\n");
+        return NULL;
+    }
+
+    s = (slab *) calloc(1, sizeof(slab));
+    if (s == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+
+    /* a freed object must be able to hold the pointer to the next freed
+     * object and all objects are aligned to eight bytes which is enough for
+     * structs of integers and pointers */
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+    align = sizeof(uint64_t);
+    s->obj_size = (obj_size + align - 1) / align * align;
+    s->objs_per_chunk = objs_per_chunk;
+    /* the first allocation will add a new chunk */
+    s->last_chunk_used = objs_per_chunk;
+
+    return s;
+}
+
+/*
+ * return a zeroed object or NULL if no memory could be allocated
+ */
+void           *slab_alloc(slab * s)
+{
+    void           *obj;
+    char          **tmp_chunks;
+
+    if (s->free_list != NULL) {
+        obj = s->free_list;
+        s->free_list = *(void **)obj;
+        memset(obj, 0, s->obj_size);
+        s->num_objects++;
+        return obj;
+    }
+
+    if (s->last_chunk_used == s->objs_per_chunk) {
+        /* the array of chunks grows to double its size when it gets full
+         * which is the case whenever its length is a power of two */
+        if ((s->num_chunks & (s->num_chunks - 1)) == 0) {
+            tmp_chunks = (char **)realloc(s->chunks,
+                                          (s->num_chunks == 0 ? 1 :
+                                           s->num_chunks * 2) *
+                                          sizeof(char *));
+            if (tmp_chunks == NULL) {
+                fprintf(stderr, "realloc failed\n");
+                return NULL;
+            }
+            s->chunks = tmp_chunks;
+        }
+        /* calloc so that freshly carved objects are already zeroed */
+        s->chunks[s->num_chunks] =
+            (char *)calloc(s->objs_per_chunk, s->obj_size);
+        if (s->chunks[s->num_chunks] == NULL) {
+            fprintf(stderr, "calloc failed\n");
+            return NULL;
+        }
+        s->num_chunks++;
+        s->last_chunk_used = 0;
+    }
+
+    obj = s->chunks[s->num_chunks - 1] + s->last_chunk_used * s->obj_size;
+    s->last_chunk_used++;
+    s->num_objects++;
+
+    return obj;
+}
+
+/*
+ * give an object back to the slab it was allocated from
+ */
+void slab_free(slab * s, void *obj)
+{
+    if (obj == NULL)
+        return;
+
+    *(void **)obj = s->free_list;
+    s->free_list = obj;
+    s->num_objects--;
+}
+
+size_t slab_get_num_objects(slab * s)
+{
+    return s->num_objects;
+}
+
+/*
+ * return the number of bytes allocated by the slab for its objects
+ */
+size_t slab_get_size(slab * s)
+{
+    return s->num_chunks * s->objs_per_chunk * s->obj_size;
+}
+
+void slab_destroy(slab * s)
+{
+    size_t          i;
+
+    if (s == NULL)
+        return;
+
+    for (i = 0; i < s->num_chunks; i++) {
+        free(s->chunks[i]);
+    }
+    free(s->chunks);
+    free(s);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _MFUTILS_SLAB_H_
+#define _MFUTILS_SLAB_H_
+
+#include <stddef.h>
+
+typedef struct slab slab;
+
+slab           *slab_create(size_t obj_size, size_t objs_per_chunk);
+
+void           *slab_alloc(slab * s);
+
+void            slab_free(slab * s, void *obj);
+
+size_t          slab_get_num_objects(slab * s);
+
+size_t          slab_get_size(slab * s);
+
+void            slab_destroy(slab * s);
+
+#endif
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "strpool.h"
+#include "slab.h"
+
+/*
+ * A pool of reference counted, immutable strings
+ *
+ * Interning the same string twice returns the same pointer, so every
+ * distinct string is stored only once no matter how often it is used. Each
+ * string is stored with just as much memory as it needs instead of in a
+ * buffer of the maximum possible length.
+ *
+ * The strings are found through an open addressing hashtable with linear
+ * probing whose size is always a power of two. Deleted slots are marked
+ * with a tombstone so that probe sequences are not interrupted.
+ *
+ * The memory for the strings comes from one slab per size class of
+ * STRPOOL_CLASS_SIZE bytes, so storing millions of short strings does not
+ * cost one malloc each. Only strings longer than the largest size class are
+ * allocated with malloc.
+ */
+
+#define STRPOOL_CLASS_SIZE 16
+#define STRPOOL_NUM_CLASSES 17
+#define STRPOOL_STRINGS_PER_CHUNK 4096
+
+struct strpool_str {
+    uint32_t        refcount;
+    uint32_t        hash;
+    char            str[];
+};
+
+struct strpool {
+    struct strpool_str **slots;
+    size_t          num_slots;
+    /* number of live strings */
+    size_t          num_strings;
+    /* number of slots which are either live or tombstones */
+    size_t          num_used;
+    /* number of bytes used by the live strings */
+    size_t          size;
+    slab           *classes[STRPOOL_NUM_CLASSES];
+};
+
+/* marks a slot whose string was removed */
+static struct strpool_str strpool_tombstone;
+
+#define STRPOOL_TOMBSTONE (&strpool_tombstone)
+
+static uint32_t strpool_hash(const char *str)
+{
+    uint32_t        hash;
+
+    /* 32 bit FNV-1a */
+    hash = 2166136261U;
+    for (; *str != '\0'; str++) {
+        hash ^= (unsigned char)*str;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static struct strpool_str *strpool_from_str(const char *str)
+{
+    return (struct strpool_str *)(str - offsetof(struct strpool_str, str));
+}
+
+/*
+ * return the size class for a string of length len or STRPOOL_NUM_CLASSES if
+ * it is too long for all of them
+ */
+static size_t strpool_class(size_t len)
+{
+    size_t          size;
+
+    size = sizeof(struct strpool_str) + len + 1;
+
+    return (size - 1) / STRPOOL_CLASS_SIZE;
+}
+
+static int strpool_resize(strpool * pool, size_t num_slots)
+{
+    struct strpool_str **slots;
+    size_t          i,
+                    j;
+
+    slots =
+        (struct strpool_str **)calloc(num_slots,
+                                      sizeof(struct strpool_str *));
+    if (slots == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return -1;
+    }
+
+    /* reinsert the live strings, which drops all tombstones */
+    for (i = 0; i < pool->num_slots; i++) {
+        if (pool->slots[i] == NULL || pool->slots[i] == STRPOOL_TOMBSTONE)
+            continue;
+        for (j = pool->slots[i]->hash & (num_slots - 1); slots[j] != NULL;
+             j = (j + 1) & (num_slots - 1)) ;
+        slots[j] = pool->slots[i];
+    }
+
+    free(pool->slots);
+    pool->slots = slots;
+    pool->num_slots = num_slots;
+    pool->num_used = pool->num_strings;
+
+    return 0;
+}
+
+strpool        *strpool_create(void)
+{
+    strpool        *pool;
+
+    size_t          i;
+
+    pool = (strpool *) calloc(1, sizeof(strpool));
+    if (pool == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+
+    for (i = 0; i < STRPOOL_NUM_CLASSES; i++) {
+        pool->classes[i] = slab_create((i + 1) * STRPOOL_CLASS_SIZE,
+                                       STRPOOL_STRINGS_PER_CHUNK);
+        if (pool->classes[i] == NULL) {
+            strpool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    if (strpool_resize(pool, 1024) != 0) {
+        strpool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/*
+ * return the pooled copy of str, adding it to the pool if it is not in it yet
+ *
+ * every call must be paired with a call to strpool_release once the returned
+ * string is not used anymore
+ */
+const char     *strpool_intern(strpool * pool, const char *str)
+{
+    uint32_t        hash;
+    size_t          i;
+    size_t          len;
+    size_t          tombstone;
+    size_t          class;
+    struct strpool_str *s;
+
+    /* keep the load factor including tombstones below three quarters */
+    if ((pool->num_used + 1) * 4 > pool->num_slots * 3) {
+        if (strpool_resize(pool, pool->num_strings * 2 > pool->num_slots ?
+                           pool->num_slots * 2 : pool->num_slots) != 0) {
+            return NULL;
+        }
+    }
+
+    hash = strpool_hash(str);
+    tombstone = pool->num_slots;
+    for (i = hash & (pool->num_slots - 1); pool->slots[i] != NULL;
+         i = (i + 1) & (pool->num_slots - 1)) {
+        if (pool->slots[i] == STRPOOL_TOMBSTONE) {
+            if (tombstone == pool->num_slots)
+                tombstone = i;
+            continue;
+        }
+        if (pool->slots[i]->hash == hash
+            && strcmp(pool->slots[i]->str, str) == 0) {
+            pool->slots[i]->refcount++;
+            return pool->slots[i]->str;
+        }
+    }
+
+    len = strlen(str);
+    class = strpool_class(len);
+    if (class < STRPOOL_NUM_CLASSES) {
+        s = (struct strpool_str *)slab_alloc(pool->classes[class]);
+    } else {
+        s = (struct strpool_str *)malloc(sizeof(struct strpool_str) + len +
+                                         1);
+    }
+    if (s == NULL) {
+        fprintf(stderr, "cannot allocate string\n");
+        return NULL;
+    }
+    s->refcount = 1;
+    s->hash = hash;
+    memcpy(s->str, str, len + 1);
+
+    /* reuse the first tombstone on the probe sequence if there was one */
+    if (tombstone != pool->num_slots) {
+        i = tombstone;
+    } else {
+        pool->num_used++;
+    }
+    pool->slots[i] = s;
+    pool->num_strings++;
+    pool->size += len + 1;
+
+    return s->str;
+}
+
+/*
+ * drop a reference to a string returned by strpool_intern and remove it from
+ * the pool if that was the last reference
+ */
+void strpool_release(strpool * pool, const char *str)
+{
+    struct strpool_str *s;
+    size_t          i;
+    size_t          len;
+    size_t          class;
+
+    if (str == NULL)
+        return;
+
+    s = strpool_from_str(str);
+    s->refcount--;
+    if (s->refcount > 0)
+        return;
+
+    for (i = s->hash & (pool->num_slots - 1); pool->slots[i] != s;
+         i = (i + 1) & (pool->num_slots - 1)) {
+        if (pool->slots[i] == NULL) {
+            fprintf(stderr, "string %s is not part of the pool\n", str);
+            return;
+        }
+    }
+    pool->slots[i] = STRPOOL_TOMBSTONE;
+    pool->num_strings--;
+    len = strlen(s->str);
+    pool->size -= len + 1;
+    class = strpool_class(len);
+    if (class < STRPOOL_NUM_CLASSES) {
+        slab_free(pool->classes[class], s);
+    } else {
+        free(s);
+    }
+}
+
+size_t strpool_get_num_strings(strpool * pool)
+{
+    return pool->num_strings;
+}
+
+/*
+ * return the number of bytes used by the strings in the pool, not counting
+ * their headers, the unused space in their size classes and the hashtable
+ */
+size_t strpool_get_size(strpool * pool)
+{
+    return pool->size;
+}
+
+void strpool_destroy(strpool * pool)
+{
+    size_t          i;
+
+    if (pool == NULL)
+        return;
+
+    /* only the long strings were allocated with malloc, the others are
+     * freed with their slabs */
+    for (i = 0; i < pool->num_slots; i++) {
+        if (pool->slots[i] == NULL || pool->slots[i] == STRPOOL_TOMBSTONE)
+            continue;
+        if (strpool_class(strlen(pool->slots[i]->str)) >= STRPOOL_NUM_CLASSES)
+            free(pool->slots[i]);
+    }
+    for (i = 0; i < STRPOOL_NUM_CLASSES; i++) {
+        slab_destroy(pool->classes[i]);
+    }
+    free(pool->slots);
+    free(pool);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _MFUTILS_STRPOOL_H_
+#define _MFUTILS_STRPOOL_H_
+
+#include <stddef.h>
+
+typedef struct strpool strpool;
+
+strpool        *strpool_create(void);
+
+const char     *strpool_intern(strpool * pool, const char *str);
+
+void            strpool_release(strpool * pool, const char *str);
+
+size_t          strpool_get_num_strings(strpool * pool);
+
+size_t          strpool_get_size(strpool * pool);
+
+void            strpool_destroy(strpool * pool);
+
+#endif
@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trigram.h"
+
+/*
+ * An index from the trigrams (substrings of three bytes) of strings to the
+ * ids of the strings that contain them
+ *
+ * It answers which strings might match a shell wildcard pattern: a string
+ * can only match if it contains all trigrams of the literal parts of the
+ * pattern, so the strings in the shortest of their lists are the only
+ * candidates. The caller checks the candidates against the pattern itself.
+ *
+ * Ids are only ever added. Whoever removes a string or gives its id to
+ * another string must check the candidates anyways and can create a new
+ * index once too many of the ids are stale.
+ *
+ * The lists are found through an open addressing hashtable with linear
+ * probing whose size is always a power of two. A trigram never contains a
+ * null byte, so zero marks an empty slot.
+ */
+
+struct trigram_list {
+    uint32_t        trigram;
+    uint32_t        num_ids;
+    uint32_t        capacity;
+    uint32_t       *ids;
+};
+
+struct trigram_index {
+    struct trigram_list *slots;
+    size_t          num_slots;
+    size_t          num_lists;
+    /* number of ids in all lists and the memory allocated for them */
+    size_t          num_ids;
+    size_t          ids_size;
+};
+
+static uint32_t trigram_from_str(const char *str)
+{
+    return ((uint32_t) (unsigned char)str[0] << 16)
+        | ((uint32_t) (unsigned char)str[1] << 8)
+        | (uint32_t) (unsigned char)str[2];
+}
+
+static size_t trigram_slot(uint32_t trigram, size_t num_slots)
+{
+    return (trigram * 2654435761U) & (num_slots - 1);
+}
+
+static struct trigram_list *trigram_index_find(trigram_index * index,
+                                               uint32_t trigram)
+{
+    size_t          i;
+
+    for (i = trigram_slot(trigram, index->num_slots);
+         index->slots[i].trigram != 0; i = (i + 1) & (index->num_slots - 1)) {
+        if (index->slots[i].trigram == trigram)
+            return &(index->slots[i]);
+    }
+
+    return NULL;
+}
+
+static int trigram_index_resize(trigram_index * index, size_t num_slots)
+{
+    struct trigram_list *slots;
+    size_t          i,
+                    j;
+
+    slots = (struct trigram_list *)calloc(num_slots,
+                                          sizeof(struct trigram_list));
+    if (slots == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return -1;
+    }
+
+    for (i = 0; i < index->num_slots; i++) {
+        if (index->slots[i].trigram == 0)
+            continue;
+        for (j = trigram_slot(index->slots[i].trigram, num_slots);
+             slots[j].trigram != 0; j = (j + 1) & (num_slots - 1)) ;
+        slots[j] = index->slots[i];
+    }
+
+    free(index->slots);
+    index->slots = slots;
+    index->num_slots = num_slots;
+
+    return 0;
+}
+
+trigram_index  *trigram_index_create(void)
+{
+    trigram_index  *index;
+
+    index = (trigram_index *) calloc(1, sizeof(trigram_index));
+    if (index == NULL) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+
+    if (trigram_index_resize(index, 1024) != 0) {
+        free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+/*
+ * add the id to the lists of all trigrams of str
+ */
+int trigram_index_add(trigram_index * index, uint32_t id, const char *str)
+{
+    struct trigram_list *list;
+    uint32_t        trigram;
+    uint32_t       *ids;
+    size_t          i;
+
+    if (str == NULL)
+        return 0;
+
+    for (; str[0] != '\0' && str[1] != '\0' && str[2] != '\0'; str++) {
+        trigram = trigram_from_str(str);
+        list = trigram_index_find(index, trigram);
+        if (list == NULL) {
+            /* keep the load factor below one half */
+            if ((index->num_lists + 1) * 2 > index->num_slots) {
+                if (trigram_index_resize(index, index->num_slots * 2) != 0)
+                    return -1;
+            }
+            for (i = trigram_slot(trigram, index->num_slots);
+                 index->slots[i].trigram != 0;
+                 i = (i + 1) & (index->num_slots - 1)) ;
+            list = &(index->slots[i]);
+            list->trigram = trigram;
+            index->num_lists++;
+        }
+        if (list->num_ids == list->capacity) {
+            ids = (uint32_t *) realloc(list->ids,
+                                       (list->capacity > 0 ?
+                                        list->capacity * 2 : 4)
+                                       * sizeof(uint32_t));
+            if (ids == NULL) {
+                fprintf(stderr, "realloc failed\n");
+                return -1;
+            }
+            index->ids_size -= list->capacity * sizeof(uint32_t);
+            list->ids = ids;
+            list->capacity = list->capacity > 0 ? list->capacity * 2 : 4;
+            index->ids_size += list->capacity * sizeof(uint32_t);
+        }
+        list->ids[list->num_ids] = id;
+        list->num_ids++;
+        index->num_ids++;
+    }
+
+    return 0;
+}
+
+/*
+ * return the position after the bracket expression starting at pattern[i]
+ * or zero if it is not terminated, in which case fnmatch() takes the
+ * bracket literally
+ */
+static size_t trigram_skip_bracket(const char *pattern, size_t i)
+{
+    char            delimiter;
+
+    i++;
+    if (pattern[i] == '!' || pattern[i] == '^')
+        i++;
+    /* a closing bracket right at the start is part of the set */
+    if (pattern[i] == ']')
+        i++;
+    while (pattern[i] != ']') {
+        if (pattern[i] == '\0')
+            return 0;
+        /* character classes like [:alpha:] contain a closing bracket */
+        if (pattern[i] == '[' && (pattern[i + 1] == ':'
+                                  || pattern[i + 1] == '.'
+                                  || pattern[i + 1] == '=')) {
+            delimiter = pattern[i + 1];
+            i += 2;
+            while (pattern[i] != '\0' && !(pattern[i] == delimiter
+                                           && pattern[i + 1] == ']')) {
+                i++;
+            }
+            if (pattern[i] == '\0')
+                return 0;
+            i += 2;
+            continue;
+        }
+        i++;
+    }
+
+    return i + 1;
+}
+
+static int ids_compare(const void *a, const void *b)
+{
+    uint32_t        id_a = *(const uint32_t *)a;
+    uint32_t        id_b = *(const uint32_t *)b;
+
+    if (id_a < id_b)
+        return -1;
+    if (id_a > id_b)
+        return 1;
+    return 0;
+}
+
+/*
+ * find the candidates for strings matching the shell wildcard pattern as
+ * understood by fnmatch() without flags
+ *
+ * On success, the ids of the candidates are returned in ascending order
+ * without duplicates in an array that has to be freed by the caller. If the
+ * literal parts of the pattern are too short to contain a trigram, every
+ * string is a candidate and 1 is returned instead without setting ids.
+ */
+int trigram_index_query(trigram_index * index, const char *pattern,
+                        uint32_t ** ids, size_t * num_ids)
+{
+    struct trigram_list *shortest;
+    struct trigram_list *list;
+    char           *literal;
+    size_t          len;
+    size_t          next;
+    size_t          i,
+                    j;
+
+    literal = (char *)malloc(strlen(pattern) + 1);
+    if (literal == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
+    }
+
+    /* go through the runs of literal characters and look up their
+     * trigrams, remembering the shortest list */
+    shortest = NULL;
+    len = 0;
+    for (i = 0;; i++) {
+        next = 0;
+        if (pattern[i] == '\\' && pattern[i + 1] != '\0') {
+            i++;
+        } else if (pattern[i] == '[') {
+            next = trigram_skip_bracket(pattern, i);
+            /* the trigrams after an unterminated bracket are not used
+             * because it is not worth matching the rules of fnmatch() */
+            if (next == 0)
+                break;
+        } else if (pattern[i] == '*' || pattern[i] == '?'
+                   || pattern[i] == '\0') {
+            next = i + 1;
+        }
+        if (next == 0) {
+            literal[len] = pattern[i];
+            len++;
+            if (len < 3)
+                continue;
+            list = trigram_index_find(index,
+                                      trigram_from_str(literal + len - 3));
+            if (list == NULL) {
+                /* no string contains this trigram */
+                free(literal);
+                *ids = NULL;
+                *num_ids = 0;
+                return 0;
+            }
+            if (shortest == NULL || list->num_ids < shortest->num_ids)
+                shortest = list;
+            continue;
+        }
+        if (pattern[i] == '\0')
+            break;
+        len = 0;
+        i = next - 1;
+    }
+    free(literal);
+
+    if (shortest == NULL)
+        return 1;
+
+    *ids = (uint32_t *) malloc((shortest->num_ids + 1) * sizeof(uint32_t));
+    if (*ids == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
+    }
+    memcpy(*ids, shortest->ids, shortest->num_ids * sizeof(uint32_t));
+    qsort(*ids, shortest->num_ids, sizeof(uint32_t), ids_compare);
+
+    j = 0;
+    for (i = 0; i < shortest->num_ids; i++) {
+        if (j == 0 || (*ids)[i] != (*ids)[j - 1]) {
+            (*ids)[j] = (*ids)[i];
+            j++;
+        }
+    }
+    *num_ids = j;
+
+    return 0;
+}
+
+/*
+ * return the number of ids that adding str to an index adds
+ */
+size_t trigram_count(const char *str)
+{
+    size_t          len;
+
+    if (str == NULL)
+        return 0;
+
+    len = strlen(str);
+
+    return len > 2 ? len - 2 : 0;
+}
+
+size_t trigram_index_get_num_ids(trigram_index * index)
+{
+    return index->num_ids;
+}
+
+/*
+ * return the number of bytes used by the hashtable and the lists
+ */
+size_t trigram_index_get_size(trigram_index * index)
+{
+    return index->num_slots * sizeof(struct trigram_list) + index->ids_size;
+}
+
+void trigram_index_destroy(trigram_index * index)
+{
+    size_t          i;
+
+    if (index == NULL)
+        return;
+
+    for (i = 0; i < index->num_slots; i++) {
+        free(index->slots[i].ids);
+    }
+    free(index->slots);
+    free(index);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2014 Johannes Schauer <j.schauer@email.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _MFUTILS_TRIGRAM_H_
+#define _MFUTILS_TRIGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct trigram_index trigram_index;
+
+trigram_index  *trigram_index_create(void);
+
+int             trigram_index_add(trigram_index * index, uint32_t id,
+                                  const char *str);
+
+int             trigram_index_query(trigram_index * index,
+                                    const char *pattern, uint32_t ** ids,
+                                    size_t * num_ids);
+
+size_t          trigram_count(const char *str);
+
+size_t          trigram_index_get_num_ids(trigram_index * index);
+
+size_t          trigram_index_get_size(trigram_index * index);
+
+void            trigram_index_destroy(trigram_index * index);
+
+#endif